@@ -53,6 +53,7 @@ class H245_MiscellaneousCommand_type;
 class H245_MiscellaneousIndication_type;
 
 class H323EndPoint;
+class H323MediaClockHandle;
 class H323Connection;
 class H323Capability;
 class H323Codec;
@@ -685,6 +686,21 @@ class H323_RTPChannel : public H323_RealTimeChannel
 
   //@}
 
+#ifdef H323_MEDIA_CLOCK
+  /**@name Overrides from class H323UnidirectionalChannel */
+  //@{
+    /**Start the channel.
+       An audio transmitter is driven by the endpoint media clock, if it is
+       enabled, instead of having its own thread.
+      */
+    virtual PBoolean Start();
+
+    /**Indicate if the channel is still transmitting or receiving.
+      */
+    virtual PBoolean IsRunning() const;
+  //@}
+#endif
+
   /**@name Overrides from class H323_RealTimeChannel */
   //@{
     /**Fill out the OpenLogicalChannel PDU for the particular channel type.
@@ -756,6 +772,25 @@ class H323_RTPChannel : public H323_RealTimeChannel
 
     unsigned rec_written;
     PBoolean rec_ok;
+
+    /**The transmit loop, split up so that each frame can be a separate step.
+      */
+    struct TransmitState;
+    PBoolean StartTransmit(TransmitState & state);
+    PBoolean TransmitFrame(TransmitState & state);
+    void EndTransmit(TransmitState & state);
+
+#ifdef H323_MEDIA_CLOCK
+    PBoolean OnClockTick();
+    void OnClockStopped();
+
+    H323MediaClockHandle * clockHandle;
+    TransmitState        * clockState;
+    PBoolean               clockRunning;
+    mutable PMutex         clockMutex;      // clockRunning is set by the clock workers
+
+    friend class H323_RTPChannelClockHandle;
+#endif
 };
 
 
@@ -443,7 +443,8 @@ class H323AudioCodec : public H323Codec
     enum SilenceDetectionMode {
       NoSilenceDetection,
       FixedSilenceDetection,
-      AdaptiveSilenceDetection
+      AdaptiveSilenceDetection,
+      AdaptiveZeroCrossingSilenceDetection  ///< Adaptive, and keeps quiet unvoiced speech
     };
 
     /**Enable/Disable silence detection.
@@ -501,6 +502,32 @@ class H323AudioCodec : public H323Codec
       */
     virtual unsigned GetAverageSignalLevel();
 
+    /**Get the number of zero crossings per 1000 samples in the audio stream.
+       This is called from within DetectSilence() after
+       GetAverageSignalLevel(), for the same frame, when the mode is
+       AdaptiveZeroCrossingSilenceDetection.
+
+       The default behaviour returns UINT_MAX which leaves only the signal
+       level for the silence detection algorithm.
+      */
+    virtual unsigned GetZeroCrossingRate();
+
+    /**Measurements of a frame of PCM samples.
+      */
+    struct FrameLevels {
+      unsigned average;         ///< Mean absolute sample value
+      unsigned peak;            ///< Largest absolute sample value
+      unsigned zeroCrossings;   ///< Sign changes between adjacent samples
+    };
+
+    /**Measure a frame of PCM samples in a single pass.
+      */
+    static void MeasureFrame(
+      const short * pcm,        ///< Linear PCM samples
+      unsigned count,           ///< Number of samples
+      FrameLevels & levels      ///< Measurements of the frame
+    );
+
    /**SetRawDataHeld is called when the call has been held and the raw
       data channel has been swapped out and released for another connection.
       */
@@ -530,6 +557,8 @@ class H323AudioCodec : public H323Codec
     unsigned silenceMaximum;        // Maximum of frames below threshold
     unsigned signalFramesReceived;  // Frames of signal received
     unsigned silenceFramesReceived; // Frames of silence received
+    unsigned silenceCrossingRate;   // Average zero crossing rate of silent frames
+    unsigned silenceCrossingFrames; // Silent frames in that average, up to adaptiveThresholdFrames
     PBoolean	 IsRawDataHeld;
 };
 
@@ -607,6 +636,11 @@ class H323FramedAudioCodec : public H323AudioCodec
       */
     virtual unsigned GetAverageSignalLevel();
 
+    /**Get the number of zero crossings per 1000 samples in the frame last
+       measured by GetAverageSignalLevel().
+      */
+    virtual unsigned GetZeroCrossingRate();
+
 
     /**Encode a sample block into the buffer specified.
        The samples have been read and are waiting in the readBuffer member
@@ -662,6 +696,8 @@ class H323FramedAudioCodec : public H323AudioCodec
     PINDEX      readBytes;
     unsigned    writeBytes;
     PINDEX      cntBytes;
+
+    FrameLevels frameLevels;
 };
 
 
@@ -720,8 +756,49 @@ class H323StreamedAudioCodec : public H323FramedAudioCodec
      */
     virtual short Decode(int sample) const = 0;
 
+    /**Encode a block of samples, one code per byte.
+       The default calls Encode() for each sample, codecs that can do the
+       whole frame at once should override this.
+     */
+    virtual void EncodeSamples(
+      const short * samples,    ///< Linear PCM samples
+      BYTE * codes,             ///< Codes for each sample, in the low bits
+      unsigned count            ///< Number of samples
+    ) const;
+
+    /**Decode a block of codes, one code per byte.
+       The default calls Decode() for each code, codecs that can do the
+       whole frame at once should override this.
+     */
+    virtual void DecodeSamples(
+      const BYTE * codes,       ///< Codes for each sample, in the low bits
+      short * samples,          ///< Linear PCM samples
+      unsigned count            ///< Number of codes
+    ) const;
+
+    /**Pack codes of the given number of bits into bytes, least significant
+       bits first. The return value is the number of bytes used.
+     */
+    static unsigned PackCodes(
+      const BYTE * codes,       ///< One code per byte
+      unsigned count,           ///< Number of codes
+      unsigned bits,            ///< Bits per code
+      BYTE * buffer             ///< Buffer for packed codes
+    );
+
+    /**Unpack codes of the given number of bits from bytes, least significant
+       bits first. The return value is the number of codes.
+     */
+    static unsigned UnpackCodes(
+      const BYTE * buffer,      ///< Packed codes
+      unsigned length,          ///< Length of packed codes
+      unsigned bits,            ///< Bits per code
+      BYTE * codes              ///< One code per byte
+    );
+
   protected:
     unsigned bitsPerSample;
+    PBYTEArray codeBuffer;
 };
 
 #endif // NO_H323_AUDIO_CODECS
@@ -1025,9 +1102,17 @@ class H323_ALawCodec : public H323StreamedAudioCodec
     virtual int   Encode(short sample) const { return EncodeSample(sample); }
     virtual short Decode(int   sample) const { return DecodeSample(sample); }
 
+    virtual void EncodeSamples(const short * samples, BYTE * codes, unsigned count) const
+    { EncodeBlock(samples, codes, count); }
+    virtual void DecodeSamples(const BYTE * codes, short * samples, unsigned count) const
+    { DecodeBlock(codes, samples, count); }
+
     static int   EncodeSample(short sample);
     static short DecodeSample(int   sample);
 
+    static void EncodeBlock(const short * samples, BYTE * codes, unsigned count);
+    static void DecodeBlock(const BYTE * codes, short * samples, unsigned count);
+
   protected:
     PBoolean sevenBit;
 };
@@ -1054,9 +1139,17 @@ class H323_muLawCodec : public H323StreamedAudioCodec
     virtual int   Encode(short sample) const { return EncodeSample(sample); }
     virtual short Decode(int   sample) const { return DecodeSample(sample); }
 
+    virtual void EncodeSamples(const short * samples, BYTE * codes, unsigned count) const
+    { EncodeBlock(samples, codes, count); }
+    virtual void DecodeSamples(const BYTE * codes, short * samples, unsigned count) const
+    { DecodeBlock(codes, samples, count); }
+
     static int   EncodeSample(short sample);
     static short DecodeSample(int   sample);
 
+    static void EncodeBlock(const short * samples, BYTE * codes, unsigned count);
+    static void DecodeBlock(const BYTE * codes, short * samples, unsigned count);
+
   protected:
     PBoolean sevenBit;
 };
@@ -47,6 +47,10 @@
 
 #include <ptlib/safecoll.h>
 
+#include <vector>
+#include <map>
+#include <set>
+
 class PASN_Sequence;
 class PASN_Choice;
 
@@ -62,6 +66,95 @@ class H323GatekeeperListener;
 class H323GatekeeperServer;
 class H323RasPDU;
 class H323PeerElement;
+class H323GatekeeperTimerWheel;
+
+
+/**This class is a timer scheduled on a H323GatekeeperTimerWheel.
+   It is a member of the object being timed, which is identified by a key
+   string so that it can be safely found again when the timer expires.
+  */
+class H323GatekeeperTimer
+{
+  public:
+    H323GatekeeperTimer();
+    H323GatekeeperTimer(const H323GatekeeperTimer &);
+    ~H323GatekeeperTimer();
+
+    H323GatekeeperTimer & operator=(const H323GatekeeperTimer &) { return *this; }
+
+    /**Indicate the timer is scheduled on a wheel.
+      */
+    PBoolean IsScheduled() const { return wheel != NULL; }
+
+  protected:
+    H323GatekeeperTimerWheel * wheel;
+    PString                    key;
+    DWORD                      due;
+    H323GatekeeperTimer     ** slot;
+    H323GatekeeperTimer      * prev;
+    H323GatekeeperTimer      * next;
+
+  friend class H323GatekeeperTimerWheel;
+};
+
+
+/**This class is a hierarchical timer wheel with a resolution of one second.
+   It is used by the gatekeeper monitor thread so it only needs to look at
+   the endpoints and calls that are due to be checked, rather than all of
+   them every second. Scheduling and cancelling a timer are O(1).
+  */
+class H323GatekeeperTimerWheel : public PObject
+{
+  PCLASSINFO(H323GatekeeperTimerWheel, PObject);
+
+  public:
+    H323GatekeeperTimerWheel();
+    ~H323GatekeeperTimerWheel();
+
+    /**Schedule the timer to expire after the number of seconds.
+       Any previous schedule for the timer is replaced.
+      */
+    void Schedule(
+      H323GatekeeperTimer & timer,  ///< Timer to schedule
+      const PString & key,          ///< Key returned by Expire()
+      unsigned seconds              ///< Time until the timer expires
+    );
+
+    /**Cancel the timer if it is scheduled.
+      */
+    void Cancel(
+      H323GatekeeperTimer & timer   ///< Timer to cancel
+    );
+
+    /**Advance the wheel to the current time.
+       The keys of all timers that have expired are returned, those timers
+       are no longer scheduled.
+      */
+    PStringList Expire();
+
+    /**Get the number of timers scheduled.
+      */
+    PINDEX GetCount() const { return count; }
+
+  protected:
+    enum {
+      Level0Bits = 8,   // 256 seconds
+      LevelBits  = 6,   // 4.5 hours, then 12 days
+      Levels     = 3
+    };
+
+    DWORD GetTick() const;
+    void Insert(H323GatekeeperTimer & timer);
+    void Unlink(H323GatekeeperTimer & timer);
+    void Cascade(unsigned level);
+
+    PTimeInterval         startTick;
+    DWORD                 currentTick;
+    PINDEX                count;
+    H323GatekeeperTimer * level0[1 << Level0Bits];
+    H323GatekeeperTimer * levelN[Levels-1][1 << LevelBits];
+    PMutex                mutex;
+};
 
 
 class H323GatekeeperRequest : public H323Transaction
@@ -126,6 +219,7 @@ class H323GatekeeperGRQ : public H323GatekeeperRequest
     virtual void SetRejectReason(
       unsigned reasonCode
     );
+    virtual PBoolean SetBusyRejectReason();
 
     H225_GatekeeperRequest & grq;
     H225_GatekeeperConfirm & gcf;
@@ -157,6 +251,7 @@ class H323GatekeeperRRQ : public H323GatekeeperRequest
     virtual void SetRejectReason(
       unsigned reasonCode
     );
+    virtual PBoolean SetBusyRejectReason();
 
     H225_RegistrationRequest & rrq;
     H225_RegistrationConfirm & rcf;
@@ -219,6 +314,7 @@ class H323GatekeeperARQ : public H323GatekeeperRequest
     virtual void SetRejectReason(
       unsigned reasonCode
     );
+    virtual PBoolean SetBusyRejectReason();
 
     H225_AdmissionRequest & arq;
     H225_AdmissionConfirm & acf;
@@ -283,6 +379,7 @@ class H323GatekeeperBRQ : public H323GatekeeperRequest
     virtual void SetRejectReason(
       unsigned reasonCode
     );
+    virtual PBoolean SetBusyRejectReason();
 
     H225_BandwidthRequest & brq;
     H225_BandwidthConfirm & bcf;
@@ -314,6 +411,7 @@ class H323GatekeeperLRQ : public H323GatekeeperRequest
     virtual void SetRejectReason(
       unsigned reasonCode
     );
+    virtual PBoolean SetBusyRejectReason();
 
     H225_LocationRequest & lrq;
     H225_LocationConfirm & lcf;
@@ -458,6 +556,11 @@ class H323GatekeeperCall : public PSafeObject
       */
     virtual PBoolean OnHeartbeat();
 
+    /**Schedule the next call to OnHeartbeat() by the gatekeeper monitor
+       thread, based on the time of the last IRR received.
+      */
+    void ScheduleHeartbeat();
+
 #ifdef H323_H248
 
     /**Get the current credit for this call.
@@ -567,6 +670,7 @@ class H323GatekeeperCall : public PSafeObject
     unsigned             bandwidthUsed;
     unsigned             infoResponseRate;
     PTime                lastInfoResponse;
+    H323GatekeeperTimer  heartbeatTimer;
 
     PBoolean                          drqReceived;
     PTime                         callStartTime;
@@ -711,6 +815,11 @@ class H323RegisteredEndPoint : public PSafeObject
       */
     virtual PBoolean OnTimeToLive();
 
+    /**Schedule the next call to OnTimeToLive() by the gatekeeper monitor
+       thread, based on the time of the last RRQ or IRR received.
+      */
+    void ScheduleTimeToLive();
+
 #ifdef H323_H248
 
     /**Get the current call credit for this endpoint.
@@ -920,6 +1029,7 @@ class H323RegisteredEndPoint : public PSafeObject
 
     PTime lastRegistration;
     PTime lastInfoResponse;
+    H323GatekeeperTimer timeToLiveTimer;
 
     PSortedList<H323GatekeeperCall> activeCalls;
 #ifdef H323_H248
@@ -1086,6 +1196,120 @@ class H323GatekeeperListener : public H225_RAS
 };
 
 
+/**This class is a hashed index from a string, for example an alias or a
+   signal address, to the identifiers of the registered endpoints using it.
+   More than one endpoint may have the same key, a search returns the one
+   added first.
+
+   The index is not thread safe, H323GatekeeperServer locks it.
+  */
+class H323GatekeeperIndex : public PObject
+{
+  PCLASSINFO(H323GatekeeperIndex, PObject);
+
+  public:
+    H323GatekeeperIndex();
+
+    /**Add a key for the endpoint.
+       Nothing is done if the endpoint already has the key.
+      */
+    void Add(
+      const PString & key,
+      const PString & identifier
+    );
+
+    /**Remove a key for the endpoint.
+      */
+    PBoolean Remove(
+      const PString & key,
+      const PString & identifier
+    );
+
+    /**Remove all the keys for the endpoint, returning the keys removed.
+      */
+    PStringList RemoveIdentifier(
+      const PString & identifier
+    );
+
+    /**Find the identifier of the first endpoint added with the key.
+      */
+    PBoolean Find(
+      const PString & key,
+      PString & identifier
+    ) const;
+
+    /**Get the number of keys in the index.
+      */
+    PINDEX GetSize() const { return count; }
+
+  protected:
+    typedef std::pair<PString, PString> Entry;
+    typedef std::vector<Entry> Bucket;
+    typedef std::vector<Bucket> Table;
+
+    static PINDEX Hash(const PString & key, PINDEX size);
+    static PBoolean Erase(Bucket & bucket, const PString & first, const PString & second);
+    void Grow();
+
+    Table  byKey;         // Entries are (key, identifier)
+    Table  byIdentifier;  // Entries are (identifier, key)
+    PINDEX count;
+};
+
+
+/**This class is a character trie of the voice prefixes of the registered
+   endpoints, so the longest prefix of a dialled number is found in one
+   pass over the number.
+
+   The tree is not thread safe, H323GatekeeperServer locks it.
+  */
+class H323GatekeeperPrefixTree : public PObject
+{
+  PCLASSINFO(H323GatekeeperPrefixTree, PObject);
+
+  public:
+    H323GatekeeperPrefixTree();
+    ~H323GatekeeperPrefixTree();
+
+    /**Add a prefix for the endpoint.
+      */
+    void Add(
+      const PString & prefix,
+      const PString & identifier
+    );
+
+    /**Remove a prefix for the endpoint.
+      */
+    PBoolean Remove(
+      const PString & prefix,
+      const PString & identifier
+    );
+
+    /**Find the identifier of the first endpoint added with the longest
+       prefix matching the start of the number.
+      */
+    PBoolean FindLongest(
+      const PString & number,
+      PString & identifier
+    ) const;
+
+    /**Indicate there are no prefixes in the tree.
+      */
+    PBoolean IsEmpty() const { return count == 0; }
+
+  protected:
+    struct Node {
+      std::map<char, Node *> children;
+      std::vector<PString>   identifiers;
+    };
+
+    static void Delete(Node * node);
+
+    Node   root;
+    PINDEX count;
+};
+
+
 /**This class implements a basic gatekeeper server functionality.
    An instance of this class contains all of the state information and
    operations for a gatekeeper. Multiple gatekeeper listeners may be using
@@ -1574,6 +1798,33 @@ class H323GatekeeperServer : public H323TransactionServer
       */
     void SetInfoResponseRate(unsigned seconds) { defaultInfoResponseRate = seconds; }
 
+    /**Get the timers scheduling OnTimeToLive() of the registered endpoints.
+      */
+    H323GatekeeperTimerWheel & GetEndPointTimers() { return endPointTimers; }
+
+    /**Get the timers scheduling OnHeartbeat() of the active calls.
+      */
+    H323GatekeeperTimerWheel & GetCallTimers() { return callTimers; }
+
+    /**Get the maximum number of threads handling requests that could not
+       be answered straight away, eg ARQ needing external authorisation.
+      */
+    unsigned GetRequestThreads() const { return workerPool.GetMaxThreads(); }
+
+    /**Set the maximum number of threads handling requests that could not
+       be answered straight away.
+      */
+    void SetRequestThreads(unsigned threads) { workerPool.SetMaxThreads(threads); }
+
+    /**Get the maximum number of requests waiting for a thread. Beyond this
+       requests are rejected with a resource unavailable reason.
+      */
+    PINDEX GetRequestQueueDepth() const { return workerPool.GetMaxQueued(); }
+
+    /**Set the maximum number of requests waiting for a thread.
+      */
+    void SetRequestQueueDepth(PINDEX depth) { workerPool.SetMaxQueued(depth); }
+
     /**Get flag for is gatekeeper routed.
       */
     PBoolean IsGatekeeperRouted() const { return isGatekeeperRouted; }
@@ -1676,18 +1927,19 @@ class H323GatekeeperServer : public H323TransactionServer
 
     H323PeerElement * peerElement;
 
+    // Must be destroyed after the endpoints and calls
+    H323GatekeeperTimerWheel endPointTimers;
+    H323GatekeeperTimerWheel callTimers;
+
     PSafeDictionary<PString, H323RegisteredEndPoint> byIdentifier;
 
-    class StringMap : public PString {
-        PCLASSINFO(StringMap, PString);
-      public:
-        StringMap(const PString & from, const PString & id)
-          : PString(from), identifier(id) { }
-        PString identifier;
-    };
-    PSortedStringList byAddress;
-    PSortedStringList byAlias;
-    PSortedStringList byVoicePrefix;
+    // Registration indexes, read for every RAS request so use a read/write lock
+    PReadWriteMutex          indexMutex;
+    H323GatekeeperIndex      byAddress;
+    H323GatekeeperIndex      byAlias;
+    H323GatekeeperIndex      byVoicePrefix;
+    H323GatekeeperPrefixTree prefixTree;
+    std::set<std::pair<PString, PString> > aliasOrder;  // For partial searches
 
     PSafeSortedList<H323GatekeeperCall> activeCalls;
 
@@ -367,6 +367,18 @@ const char * const DES_AES256 = "AES256";
 const char * const ID_AES192 = "2.16.840.1.101.3.4.1.22";
 const char * const SSL_AES192 = "DHE-RSA-AES192-SHA";
 const char * const DES_AES192 = "AES192";
+
+#ifdef H323_H235_AEAD
+const char * const ID_AES256_GCM = "2.16.840.1.101.3.4.1.46";
+const char * const SSL_AES256_GCM = "DHE-RSA-AES256-GCM-SHA384";
+const char * const DES_AES256_GCM = "AES256-GCM";
+#endif
+#endif
+
+#ifdef H323_H235_AEAD
+const char * const ID_AES128_GCM = "2.16.840.1.101.3.4.1.6";
+const char * const SSL_AES128_GCM = "DHE-RSA-AES128-GCM-SHA256";
+const char * const DES_AES128_GCM = "AES128-GCM";
 #endif
 
 const char * const ID_AES128 = "2.16.840.1.101.3.4.1.2";
@@ -379,8 +391,14 @@ const static struct {
     const char * desc;
 } H235_Encryptions[] = {
 #ifdef H323_H235_AES256
+#ifdef H323_H235_AEAD
+    { ID_AES256_GCM, SSL_AES256_GCM, DES_AES256_GCM },
+#endif
     { ID_AES256, SSL_AES256, DES_AES256 },
     { ID_AES192, SSL_AES192, DES_AES192 },
+#endif
+#ifdef H323_H235_AEAD
+    { ID_AES128_GCM, SSL_AES128_GCM, DES_AES128_GCM },
 #endif
     { ID_AES128, SSL_AES128, DES_AES128 },
     { OID_H235V3, "H235v3" , "H235v3"   }
@@ -391,12 +409,25 @@ const static struct {
     const char * algorithm;
     const char * DHparameters;
 } H235_Algorithms[] = {
+// Authenticated (GCM) variants are only offered if H235Authenticators::SetAuthenticatedMedia()
+// is enabled, they are then ahead of the standard algorithms so both sides prefer them
 #ifdef H323_H235_AES256
+#ifdef H323_H235_AEAD
+    { ID_AES256_GCM, OID_DH8192 },
+    { ID_AES256_GCM, OID_DH6144 },
+    { ID_AES256_GCM, OID_DH4096 },
+    { ID_AES256_GCM, OID_DH2048 },
+    { ID_AES256_GCM, OID_DH1536 },
+#endif
     { ID_AES256, OID_DH8192 },
     { ID_AES256, OID_DH6144 },
     { ID_AES256, OID_DH4096 },
     { ID_AES256, OID_DH2048 },
     { ID_AES256, OID_DH1536 },
+#endif
+#ifdef H323_H235_AEAD
+    { ID_AES128_GCM, OID_DH1024 },
+    { ID_AES128_GCM, OID_DH512  },
 #endif
     { ID_AES128, OID_DH1024 },
     { ID_AES128, OID_DH512  }
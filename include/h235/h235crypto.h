@@ -47,6 +47,13 @@ extern "C" {
 // H.235.6 says no more than 2^62 blocks, Bruce Schneier says no more than 2^32 blocks in CBC mode
 #define AES_KEY_LIMIT 4294967295U	// 2^32-1
 
+#ifdef H323_H235_AEAD
+// GCM nonce, session salt and authentication tag sizes for the authenticated media profile
+#define AEAD_NONCE_LEN  12
+#define AEAD_SALT_LEN   12
+#define AEAD_TAG_LEN    16
+#endif
+
 // helper routines not present in OpenSSL
 class H235CryptoHelper
 {
@@ -115,6 +122,8 @@ public:
     PBYTEArray Encrypt(const PBYTEArray & data, unsigned char * ivSequence, bool & rtpPadding);
 
     /** Encrypt In Place
+        inData and outData may be the same buffer, which must have room for
+        inLength plus one block of padding.
       */
     PINDEX EncryptInPlace(const BYTE * inData, PINDEX inLength, BYTE * outData, unsigned char * ivSequence, bool & rtpPadding);
 
@@ -123,10 +132,42 @@ public:
     PBYTEArray Decrypt(const PBYTEArray & data, unsigned char * ivSequence, bool & rtpPadding);
 
     /** Decrypt In Place
+        inData and outData may be the same buffer.
       */
     PINDEX DecryptInPlace(const BYTE * inData, PINDEX inLength, BYTE * outData, unsigned char * ivSequence, bool & rtpPadding);
 
+#ifdef H323_H235_AEAD
+    /** Encrypt and authenticate In Place (GCM algorithms only)
+        As in SRTP (RFC 7714) the nonce is the SSRC and the 48 bit packet
+        index (roll over counter and sequence number) XORed with the session
+        salt, and the whole RTP header is the additional authenticated data.
+        The tag is appended, so data must have room for length + AEAD_TAG_LEN.
+        Returns the new length or 0 on failure.
+      */
+    PINDEX EncryptAuthenticated(BYTE * data, PINDEX length, const BYTE * header, PINDEX headerSize);
+
+    /** Verify and decrypt In Place (GCM algorithms only)
+        Returns the length of the plain text or 0 if the packet is too short
+        or the tag does not verify.
+      */
+    PINDEX DecryptAuthenticated(BYTE * data, PINDEX length, const BYTE * header, PINDEX headerSize);
+
+    /** Is the algorithm OID one of the authenticated (GCM) profiles
+      */
+    static PBoolean IsAuthenticatedAlgorithm(const PString & algorithmOID);
+
+    /** Get the CBC algorithm with the same key length as the GCM algorithm,
+        used to wrap the media key. Other algorithms are returned unchanged.
+      */
+    static PString GetKeyWrapAlgorithm(const PString & algorithmOID);
+#endif
+
+    /** Does the engine authenticate the media as well as encrypt it
+      */
+    PBoolean IsAuthenticated() const { return m_authenticated; }
+
     /** Generate a random key of a size suitable for the alogorithm
+        For the GCM algorithms the session salt follows the key.
       */
     PBYTEArray GenerateRandomKey();   // Use internal Algorithm and set
 
@@ -145,13 +186,35 @@ protected:
     PString m_algorithmOID;    // eg. "2.16.840.1.101.3.4.1.2"
     PUInt64 m_operationCnt;  // 8 byte integer
     PBoolean m_initialised;
+    PBoolean m_authenticated;
 
     unsigned char m_iv[EVP_MAX_IV_LENGTH];
+    PBYTEArray m_ctsBuffer;    // input kept aside for in place ciphertext stealing
 
     int m_enc_blockSize;
     int m_enc_ivLength;
     int m_dec_blockSize;
     int m_dec_ivLength;
+
+#ifdef H323_H235_AEAD
+    // Roll over counter tracking for one direction, RFC 3711 section 3.3.1
+    struct PacketIndex {
+        PacketIndex() : valid(false), ssrc(0), roc(0), lastSeq(0) { }
+        DWORD Estimate(DWORD ssrc, WORD seq) const;
+        void Update(DWORD ssrc, DWORD roc, WORD seq);
+
+        bool valid;
+        DWORD ssrc;
+        DWORD roc;
+        WORD lastSeq;
+    };
+
+    void MakeNonce(unsigned char * nonce, DWORD ssrc, DWORD roc, WORD seq) const;
+
+    unsigned char m_salt[AEAD_SALT_LEN];
+    PacketIndex m_encIndex;
+    PacketIndex m_decIndex;
+#endif
 };
 
 
@@ -202,16 +265,29 @@ public:
     PBoolean ReadFrame(DWORD & rtpTimestamp, RTP_DataFrame & frame);
 
     /** Read Frame (Memory InPlace)
+        The payload is decrypted directly in the frame.
       */
     PBoolean ReadFrameInPlace(RTP_DataFrame & frame);
 
+    /** Read Frames (Memory InPlace)
+        Decrypt a batch of frames, returns the number of frames processed.
+      */
+    PINDEX ReadFramesInPlace(RTP_DataFrame * frames, PINDEX count);
+
     /** Write Frame
      */
     PBoolean WriteFrame(RTP_DataFrame & frame);
 
     /** Write Frame (Memory InPlace)
+        The payload is encrypted directly in the frame.
       */
     PBoolean WriteFrameInPlace(RTP_DataFrame & frame);
+
+    /** Write Frames (Memory InPlace)
+        Encrypt a batch of frames, returns the number of frames encrypted
+        before the first failure.
+      */
+    PINDEX WriteFramesInPlace(RTP_DataFrame * frames, PINDEX count);
   //@}
 
     PString GetAlgorithmOID() const { return m_context.GetAlgorithmOID(); }
@@ -231,8 +307,6 @@ private:
     int                  m_dhkeyLen;
 
     PBYTEArray           m_frameBuffer;
-    unsigned char        m_ivSequence[6];
-    PBoolean             m_padding;
 };
 
 #endif // H235CRYPTO_H
@@ -302,6 +302,12 @@ PDECLARE_LIST(H235Authenticators, H235Authenticator)
     static void SetMaxTokenLength(PINDEX len);
     static PINDEX GetMaxTokenLength();
 
+#ifdef H323_H235_AEAD
+    // offer the authenticated (GCM) media algorithms ahead of the standard ones
+    static void SetAuthenticatedMedia(PBoolean enable);
+    static PBoolean GetAuthenticatedMedia();
+#endif
+
     static PString & GetDHParameterFile();
     static void SetDHParameterFile(const PString & filePaths);
 
@@ -314,6 +320,9 @@ PDECLARE_LIST(H235Authenticators, H235Authenticator)
     static PINDEX m_encryptionPolicy;
     static PINDEX m_cipherLength;
     static PINDEX m_maxTokenLength;
+#ifdef H323_H235_AEAD
+    static PBoolean m_authenticatedMedia;
+#endif
     static PString m_dhFile;
     static DH_DataList m_dhData;
 #endif
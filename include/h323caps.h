@@ -46,6 +46,10 @@
 #include "channels.h"
 #include "mediafmt.h"
 
+#include <map>
+#include <deque>
+#include <vector>
+
 
 /* The following classes have forward references to avoid including the VERY
    large header files for H225 and H245. If an application requires access
@@ -405,7 +409,7 @@ class H323Capability : public PObject
       */
     void SetCapabilityDirection(
       CapabilityDirection dir   ///< New direction code
-    ) { capabilityDirection = dir; }
+    ) { capabilityDirection = dir; Modified(); }
 
     /// Get unique capability number.
     virtual unsigned GetCapabilityNumber() const { return assignedCapabilityNumber; }
@@ -437,9 +441,29 @@ class H323Capability : public PObject
     friend ostream & operator<<(ostream & o , CapabilityDirection d);
 #endif
 
-    void SetMediaFormatOptionInteger(const PString & name, int val) { mediaFormat.SetOptionInteger(name, val); }
+    void SetMediaFormatOptionInteger(const PString & name, int val) { mediaFormat.SetOptionInteger(name, val); Modified(); }
+
+    /**Determine if the TerminalCapabilitySet entry built by OnSendingPDU()
+       only depends on state changed through the functions of this class,
+       so it can be shared between connections by H323CapabilitySetCache.
+
+       The default behaviour returns FALSE.
+      */
+    virtual PBoolean IsPDUCacheable() const;
+
+    /**Mark the capability as changed, so a cached TerminalCapabilitySet
+       built from it is not used again. A descendant that changes state
+       used by OnSendingPDU() and returns TRUE from IsPDUCacheable() must
+       call this.
+      */
+    void Modified();
+
+    /**Get the stamp of the last change, copies share it until changed.
+      */
+    unsigned GetModificationStamp() const { return modificationStamp; }
 
   protected:
+    unsigned modificationStamp;
     unsigned assignedCapabilityNumber;  /// Unique ID assigned to capability
     CapabilityDirection capabilityDirection;
     RTP_DataFrame::PayloadTypes rtpPayloadType;
@@ -1796,6 +1820,12 @@ class H323_G711Capability : public H323AudioCapability
     /**Get the name of the media data format this class represents.
      */
     virtual PString GetFormatName() const;
+
+    /**Determine if the TerminalCapabilitySet entry can be shared.
+       Returns TRUE, the entry only depends on the mode, speed and frames
+       in a packet.
+     */
+    virtual PBoolean IsPDUCacheable() const;
   //@}
 
   /**@name Operations */
@@ -1887,6 +1917,11 @@ class H323_UserInputCapability : public H323Capability
     /**Get the name of the media data format this class represents.
      */
     virtual PString GetFormatName() const;
+
+    /**Determine if the TerminalCapabilitySet entry can be shared.
+       Returns TRUE, the entry only depends on the sub-type and payload type.
+     */
+    virtual PBoolean IsPDUCacheable() const;
   //@}
 
   /**@name Operations */
@@ -2431,8 +2466,93 @@ class H323Capabilities : public PObject
   //@}
 
   protected:
+    /**Discard the lookup indexes, for use after the table has been changed
+       other than by the functions of this class. They are rebuilt on the
+       next search.
+      */
+    void InvalidateIndex();
+
     H323CapabilitiesList table;
     H323CapabilitiesSet  set;
+
+  private:
+    typedef std::vector<H323Capability *> CapabilityVector;
+    typedef std::map<unsigned, H323Capability *> NumberIndex;
+    typedef std::map<unsigned, CapabilityVector> MainTypeIndex;
+    typedef std::map<std::pair<unsigned, unsigned>, CapabilityVector> TypeIndex;
+    typedef std::map<PCaselessString, CapabilityVector> NameIndex;
+    typedef std::map<PCaselessString, PStringArray> WildcardCache;
+
+    void UpdateIndex() const;
+    void IndexCapability(H323Capability & capability) const;
+    const PStringArray & GetWildcard(const PString & pattern) const;
+    const CapabilityVector & GetNameMatches(const PString & pattern) const;
+    unsigned GetUnusedCapabilityNumber(unsigned capabilityNumber) const;
+
+    // Built from the table on demand, all entries are in table order.
+    // The name index holds the capabilities matching each wildcard pattern.
+    mutable PMutex        indexMutex;
+    mutable PINDEX        indexedSize;
+    mutable NumberIndex   numberIndex;
+    mutable MainTypeIndex mainTypeIndex;
+    mutable TypeIndex     typeIndex;
+    mutable NameIndex     nameIndex;
+    mutable WildcardCache wildcardCache;
+};
+
+
+/**This class holds the capability table and descriptors of the
+   TerminalCapabilitySet PDUs sent by the connections of an endpoint.
+   Connections copy the capabilities of the endpoint, so unless a call
+   changes them the PDU is the same each time and is copied from here
+   instead of calling OnSendingPDU() for every capability.
+
+   The key is the capability numbers and modification stamps of the
+   usable capabilities and the layout of the descriptors. It is only used
+   when every usable capability returns TRUE from IsPDUCacheable().
+  */
+class H323CapabilitySetCache : public PObject
+{
+  PCLASSINFO(H323CapabilitySetCache, PObject);
+
+  public:
+    H323CapabilitySetCache(
+      PINDEX maxEntries   ///< Number of different PDUs kept
+    );
+    ~H323CapabilitySetCache();
+
+    /**Fill in the capability table, media packetization and descriptors of
+       the PDU from the cache. Returns FALSE if there is no entry for key.
+      */
+    PBoolean Lookup(
+      const PString & key,
+      H245_TerminalCapabilitySet & pdu
+    );
+
+    /**Keep the capability table, media packetization and descriptors of the
+       PDU. The oldest entry is dropped when the cache is full.
+      */
+    void Store(
+      const PString & key,
+      const H245_TerminalCapabilitySet & pdu
+    );
+
+    /**Remove all entries.
+      */
+    void Flush();
+
+    PINDEX GetHits() const { return hits; }
+    PINDEX GetMisses() const { return misses; }
+
+  protected:
+    typedef std::map<PString, H245_TerminalCapabilitySet *> EntryMap;
+
+    PINDEX              maxEntries;
+    EntryMap            entries;
+    std::deque<PString> order;
+    PINDEX              hits;
+    PINDEX              misses;
+    PMutex              mutex;
 };
 
 ///////////////////////////////////////////////////////////////////////////////
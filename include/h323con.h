@@ -95,6 +95,7 @@ class H323AggregatedH2x5Handle : public PAggregatedHandle
    inclusion can be avoided.
  */
 class PPER_Stream;
+class H323SignalReactorHandle;
 
 class H225_EndpointType;
 class H225_TransportAddress;
@@ -202,6 +203,8 @@ class H323Connection : public PObject
 
   friend class AggregatedH225Handle;
   friend class AggregatedH245Handle;
+  friend class ReactorH225Handle;
+  friend class ReactorH245Handle;
   public:
   /**@name Construction */
   //@{
@@ -466,6 +469,11 @@ class H323Connection : public PObject
      */
     virtual void HandleSignallingChannel();
 
+    /**Finish with the signalling channel once its PDUs stop being read.
+       This is an internal function and is unlikely to be used by applications.
+     */
+    void EndHandleSignallingChannel();
+
     /**Handle the situation where the call signalling channel fails
         return TRUE to keep the call alive / False to drop the call
       */
@@ -3575,6 +3583,20 @@ class H323Connection : public PObject
     H323AggregatedH2x5Handle * controlAggregator;
 #endif
 
+#ifdef H323_SIGNAL_REACTOR
+  public:
+    /**Have the endpoint signalling reactor read the channels of the call
+       instead of a thread per channel. These return FALSE if the reactor
+       is disabled or cannot read the transport, the caller must then read
+       it with HandleSignallingChannel() or HandleControlChannel().
+      */
+    PBoolean ReactSignalChannel(H323Transport * transport, const PTimeInterval & keepAlive);
+    PBoolean ReactControlChannel(H323Transport * transport, const PTimeInterval & keepAlive);
+  protected:
+    H323SignalReactorHandle * signalReactorHandle;
+    H323SignalReactorHandle * controlReactorHandle;
+#endif
+
 #ifdef H323_H239
     unsigned h239SessionID;
 #endif // H323_H239
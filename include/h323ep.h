@@ -71,6 +71,9 @@ class PSTUNClient;
 #endif
 
 class PHandleAggregator;
+class RTP_Reactor;
+class H323SignalReactor;
+class H323MediaClock;
 
 /* The following classes have forward references to avoid including the VERY
    large header files for H225 and H245. If an application requires access
@@ -1211,6 +1214,14 @@ class H323EndPoint : public PObject
       */
     H235MediaCipher GetH235MediaCipher();
 
+#ifdef H323_H235_AEAD
+    /** Offer the authenticated (AES-GCM) media algorithms.
+        These are not part of H.235.6, so they are off by default. When
+        enabled they are offered ahead of the standard algorithms.
+      */
+    void SetH235AuthenticatedMedia(PBoolean enable);
+#endif
+
     /** H235SetDiffieHellmanFiles Set DH prameters from File (can be multiple file paths seperated by ;)
         Data must be stored in INI format with the section being the OID of the Algorith
         Parameter names are as below and all values are base64 encoded. eg:
@@ -1864,6 +1875,100 @@ class H323EndPoint : public PObject
     PHandleAggregator * GetRTPAggregator();
 #endif
 
+#ifdef H323_RTP_REACTOR
+    /**Set the number of threads in the shared RTP reactor.
+       When non-zero the jitter buffers of all audio sessions are read by a
+       small pool of epoll threads instead of a thread per session. Must be
+       set before any calls are made. Zero (the default) disables it.
+      */
+    void SetRTPReactorThreads(
+      unsigned threads       ///< Number of reactor threads, zero disables the reactor
+    ) { rtpReactorThreads = threads; }
+
+    /**Get the number of threads in the shared RTP reactor.
+      */
+    unsigned GetRTPReactorThreads() const
+    { return rtpReactorThreads; }
+
+    /** Get the reactor used for RTP sessions, NULL if disabled
+      */
+    RTP_Reactor * GetRTPReactor();
+#endif
+
+#ifdef H323_SIGNAL_REACTOR
+    /**Set the number of worker threads of the signalling reactor.
+       When non-zero the H.225 and H.245 TCP channels of all calls are read
+       by one epoll thread, and their PDUs processed by this many workers,
+       instead of a thread per channel. Must be set before any calls are
+       made. Zero (the default) disables it.
+      */
+    void SetSignalReactorThreads(
+      unsigned threads       ///< Number of worker threads, zero disables the reactor
+    ) { signalReactorThreads = threads; }
+
+    /**Get the number of worker threads of the signalling reactor.
+      */
+    unsigned GetSignalReactorThreads() const
+    { return signalReactorThreads; }
+
+    /** Get the reactor used for signalling channels, NULL if disabled
+      */
+    H323SignalReactor * GetSignalReactor();
+#endif
+
+#ifdef H323_MEDIA_CLOCK
+    /**Set the number of worker threads of the shared media clock.
+       When non-zero the transmit side of all audio channels is driven by
+       one clock thread and this many workers, instead of a thread per
+       channel that is paced by the codec blocking. The raw data channels
+       attached to the codecs must then not delay, as for a server without
+       a sound device. Must be set before any calls are made. Zero (the
+       default) disables it.
+      */
+    void SetMediaClockThreads(
+      unsigned threads       ///< Number of worker threads, zero disables the clock
+    ) { mediaClockThreads = threads; }
+
+    /**Get the number of worker threads of the shared media clock.
+      */
+    unsigned GetMediaClockThreads() const
+    { return mediaClockThreads; }
+
+    /** Get the clock used for transmit channels, NULL if disabled
+      */
+    H323MediaClock * GetMediaClock();
+#endif
+
+#ifdef H323_RTP_BATCHIO
+    /**Set the number of RTP data packets read with one system call.
+       This is applied to each new RTP session, see
+       RTP_UDP::SetReceiveBatchSize(). A value of 1 (the default) disables
+       batching.
+      */
+    void SetRTPReceiveBatchSize(
+      PINDEX size            ///< Maximum packets per read
+    ) { rtpReceiveBatchSize = size; }
+
+    /**Get the number of RTP data packets read with one system call.
+      */
+    PINDEX GetRTPReceiveBatchSize() const
+    { return rtpReceiveBatchSize; }
+#endif
+
+#ifdef H323_RING_JITTER
+    /**Use the lock free ring jitter buffer (RTP_RingJitterBuffer) for new
+       RTP sessions rather than the default list based one. Default FALSE.
+      */
+    void SetRingJitterBuffer(
+      PBoolean enable        ///< Use the ring jitter buffer
+    ) { ringJitterBuffer = enable; }
+
+    /**Indicate new RTP sessions use the lock free ring jitter buffer.
+      */
+    PBoolean UseRingJitterBuffer() const
+    { return ringJitterBuffer; }
+#endif
+
 #ifdef H323_SIGNAL_AGGREGATE
     /**Set the signalling aggregation size
       */
@@ -2030,6 +2135,20 @@ class H323EndPoint : public PObject
      */
     const H323Capabilities & GetCapabilities() const { return capabilities; }
 
+    /**Set the number of TerminalCapabilitySet PDUs cached for connections.
+       When non-zero the capability table and descriptors built for a call
+       are kept and copied into later PDUs with the same usable, unchanged
+       capabilities, see H323CapabilitySetCache. Must be set before calls
+       are made. Zero (the default) disables the cache.
+     */
+    void SetCapabilitySetCacheSize(
+      PINDEX entries          ///< Number of PDUs kept, zero disables the cache
+    );
+
+    /**Get the cache of TerminalCapabilitySet PDUs, NULL if disabled.
+     */
+    H323CapabilitySetCache * GetCapabilitySetCache() const { return capabilitySetCache; }
+
     /**Endpoint types.
      */
     enum TerminalTypes {
@@ -3108,11 +3227,35 @@ class H323EndPoint : public PObject
     PHandleAggregator * signallingAggregator;
 #endif
 
+#ifdef H323_RTP_REACTOR
+    unsigned rtpReactorThreads;
+    RTP_Reactor * rtpReactor;
+#endif
+
+#ifdef H323_SIGNAL_REACTOR
+    unsigned signalReactorThreads;
+    H323SignalReactor * signalReactor;
+#endif
+
+#ifdef H323_MEDIA_CLOCK
+    unsigned mediaClockThreads;
+    H323MediaClock * mediaClock;
+#endif
+
+#ifdef H323_RTP_BATCHIO
+    PINDEX rtpReceiveBatchSize;
+#endif
+
+#ifdef H323_RING_JITTER
+    PBoolean ringJitterBuffer;
+#endif
+
     PThread::Priority channelThreadPriority;
 
     // Dynamic variables
     H323ListenerList listeners;
     H323Capabilities capabilities;
+    H323CapabilitySetCache * capabilitySetCache;
     H323Gatekeeper * gatekeeper;
     PString          gatekeeperPassword;
     PStringList      gkAuthenticatorOrder;
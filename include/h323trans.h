@@ -39,6 +39,10 @@
 
 #include <ptclib/asner.h>
 
+#include <map>
+#include <deque>
+#include <vector>
+
 
 class H323TransactionPDU {
   public:
@@ -50,6 +54,14 @@ class H323TransactionPDU {
     virtual PBoolean Read(H323Transport & transport);
     virtual PBoolean Write(H323Transport & transport);
 
+    /**Encode the PDU and finalise any security tokens, ready for writing.
+      */
+    virtual void EncodePDU(PPER_Stream & strm);
+
+    /**Write a PDU previously encoded by EncodePDU() to the transport.
+      */
+    virtual PBoolean WriteEncoded(H323Transport & transport, const PPER_Stream & strm);
+
     virtual PASN_Object & GetPDU() = 0;
     virtual PASN_Choice & GetChoice() = 0;
     virtual const PASN_Object & GetPDU() const = 0;
@@ -87,6 +99,85 @@ class H323TransactionPDU {
 };
 
 
+///////////////////////////////////////////////////////////
+
+class H323Transaction;
+
+/**This class is a bounded pool of threads for the transactions that could
+   not be answered straight away, eg an ARQ waiting on an external
+   authorisation. Threads are created as needed up to the maximum, after
+   which transactions wait in a queue. When the queue is full as well
+   Queue() fails and the transaction is rejected as busy.
+  */
+class H323TransactionWorkerPool : public PObject
+{
+  PCLASSINFO(H323TransactionWorkerPool, PObject);
+  public:
+    enum {
+      DefaultMaxThreads = 10,
+      DefaultMaxQueued  = 100
+    };
+
+    H323TransactionWorkerPool(
+      unsigned maxThreads = DefaultMaxThreads,  ///<  Maximum worker threads
+      PINDEX maxQueued = DefaultMaxQueued       ///<  Maximum waiting transactions
+    );
+    ~H323TransactionWorkerPool();
+
+    /**Queue the transaction for a worker thread.
+       The pool takes ownership of the transaction and deletes it when the
+       handling is complete. Returns FALSE if the pool is saturated, the
+       transaction is then still owned by the caller.
+      */
+    PBoolean Queue(
+      H323Transaction * transaction
+    );
+
+    /**Stop the worker threads, waiting for running transactions to finish.
+       Any transactions still queued are deleted.
+      */
+    void Shutdown();
+
+    /**Get the maximum number of worker threads.
+      */
+    unsigned GetMaxThreads() const { return maxThreads; }
+
+    /**Set the maximum number of worker threads.
+       Threads already running are not stopped if this is reduced.
+      */
+    void SetMaxThreads(unsigned threads) { maxThreads = PMAX(threads, 1); }
+
+    /**Get the maximum number of transactions waiting for a thread.
+      */
+    PINDEX GetMaxQueued() const { return maxQueued; }
+
+    /**Set the maximum number of transactions waiting for a thread.
+      */
+    void SetMaxQueued(PINDEX depth) { maxQueued = depth; }
+
+    /**Get the number of transactions waiting for a thread.
+      */
+    PINDEX GetQueueDepth() const;
+
+    /**Get the number of transactions refused as the pool was saturated.
+      */
+    DWORD GetOverflowCount() const { return overflows; }
+
+  protected:
+    PDECLARE_NOTIFIER(PThread, H323TransactionWorkerPool, WorkerMain);
+
+    unsigned                      maxThreads;
+    PINDEX                        maxQueued;
+    std::deque<H323Transaction *> queue;
+    std::vector<PThread *>        threads;
+    unsigned                      idleThreads;
+    PBoolean                      shuttingDown;
+    DWORD                         overflows;
+    PSemaphore                    available;
+    mutable PMutex                mutex;
+};
+
+
 ///////////////////////////////////////////////////////////
 
 class H323Transactor : public PObject
@@ -200,6 +291,30 @@ class H323Transactor : public PObject
     /**Get flag to check all crypto tokens on responses.
       */
     PBoolean GetCheckResponseCryptoTokens() { return checkResponseCryptoTokens; }
+
+    /**Get the number of retries answered from the response cache.
+      */
+    DWORD GetResponseCacheHits() const { return responseCacheHits; }
+
+    /**Get the number of responses removed from the cache after they aged.
+      */
+    DWORD GetResponseCacheEvictions() const { return responseCacheEvictions; }
+
+    /**Get the number of responses currently in the cache.
+      */
+    PINDEX GetResponseCacheSize() const { return responses.GetSize(); }
+
+    /**Set the pool of threads used for transactions that are not answered
+       straight away. If NULL a new thread is created for each of them.
+      */
+    void SetWorkerPool(
+      H323TransactionWorkerPool * pool  ///<  Pool to use, not deleted.
+    ) { workerPool = pool; }
+
+    /**Get the pool of threads used for transactions that are not answered
+       straight away.
+      */
+    H323TransactionWorkerPool * GetWorkerPool() const { return workerPool; }
   //@}
 	
     class Request : public PObject
@@ -283,6 +398,9 @@ class H323Transactor : public PObject
       const H323TransactionPDU & pdu
     );
 
+    class Response;
+    typedef std::multimap<PInt64, Response *> ResponseExpiryQueue;
+
     class Response : public PString
     {
         PCLASSINFO(Response, PString);
@@ -290,20 +408,29 @@ class H323Transactor : public PObject
         Response(const H323TransportAddress & addr, unsigned seqNum);
         ~Response();
 
-        void SetPDU(const H323TransactionPDU & pdu);
+        void SetPDU(const H323TransactionPDU & pdu, const PPER_Stream & encoded);
         PBoolean SendCachedResponse(H323Transport & transport);
 
         PTime                lastUsedTime;
         PTimeInterval        retirementAge;
-        H323TransactionPDU * replyPDU;
+        PPER_Stream          replyPDU;    // As sent, empty until the reply is written
+
+        // Position in the expiry queue, if queued
+        PBoolean                      queued;
+        ResponseExpiryQueue::iterator expiry;
     };
 
+    void QueueResponse(
+      Response & response
+    );
+
     // Configuration variables
     H323EndPoint  & endpoint;
     WORD            defaultLocalPort;
     WORD            defaultRemotePort;
     H323Transport * transport;
     PBoolean            checkResponseCryptoTokens;
+    H323TransactionWorkerPool * workerPool;
 
     unsigned  nextSequenceNumber;
     PMutex    nextSequenceNumberMutex;
@@ -312,8 +439,11 @@ class H323Transactor : public PObject
     PMutex                            requestsMutex;
     Request                         * lastRequest;
 
-    PMutex                pduWriteMutex;
-    PSortedList<Response> responses;
+    PMutex                           pduWriteMutex;
+    PDictionary<PString, Response>   responses;
+    ResponseExpiryQueue              responseExpiry;
+    DWORD                            responseCacheHits;
+    DWORD                            responseCacheEvictions;
 };
 
 
@@ -350,6 +480,11 @@ class H323Transaction : public PObject
 
     PBoolean HandlePDU();
 
+    /**Continue handling a transaction that returned InProgress, until it
+       is complete. The transaction is deleted on return.
+      */
+    void HandleSlowPDU();
+
     virtual PBoolean WritePDU(
       H323TransactionPDU & pdu
     );
@@ -366,6 +501,12 @@ class H323Transaction : public PObject
       unsigned reasonCode
     ) = 0;
 
+    /**Set the reject reason used when no worker thread is available.
+       The default returns FALSE, the request is then ignored and the remote
+       retries.
+      */
+    virtual PBoolean SetBusyRejectReason() { return FALSE; }
+
     PBoolean IsFastResponseRequired() const { return fastResponseRequired && canSendRIP; }
     PBoolean CanSendRIP() const { return canSendRIP; }
     H323TransportAddress GetReplyAddress() const { return replyAddresses[0]; }
@@ -492,6 +633,10 @@ class H323TransactionServer : public PObject
     PSyncPoint     monitorExit;
 
     PMutex         mutex;
+
+    // Must be destroyed after the listeners that use it
+    H323TransactionWorkerPool workerPool;
+
     H323LIST(ListenerList, H323Transactor);
     ListenerList listeners;
     PBoolean usingAllInterfaces;
@@ -54,6 +54,7 @@
 #include <ptlib/pluginmgr.h>
 #include <ptclib/url.h>
 #include <map>
+#include <vector>
 #include "ptlib_extras.h"
 
 
@@ -1169,6 +1170,76 @@ class H460_FeatureSet : public PObject
 
 };
 
+//////////////////////////////////////////////////////////////////////////////
+// Process wide catalog of the feature plugins
+
+/**This class holds, for each feature instance type, the features the plugin
+   manager provides for it with their identifiers and plugin service
+   descriptors. A type is enumerated the first time a feature set of that
+   type is loaded, after which the feature sets of each call and RAS
+   transaction create their features from the catalog directly.
+  */
+class H460_FeatureCatalog : public PObject
+{
+    PCLASSINFO(H460_FeatureCatalog, PObject);
+  public:
+
+    struct Entry {
+      Entry(const PString & _name, const H460_FeatureID & _id, PDevicePluginServiceDescriptor * _descriptor)
+        : name(_name), id(_id), descriptor(_descriptor) { }
+
+      PString                          name;
+      H460_FeatureID                   id;
+      PDevicePluginServiceDescriptor * descriptor;
+    };
+    typedef std::vector<Entry> Entries;
+
+    /** Deconstructor
+      */
+    ~H460_FeatureCatalog();
+
+    /** Get the catalog of the default plugin manager
+      */
+    static H460_FeatureCatalog & GetCatalog();
+
+    /** Get the features for the instance type, in the same order as
+        H460_Feature::FeatureList(). The entries remain valid for the life
+        of the catalog.
+      */
+    const Entries & GetFeatures(int inst);
+
+    /** Create a new instance of the feature for the instance type
+      */
+    static H460_Feature * CreateFeature(const Entry & entry, int inst);
+
+    /** Enumerate the plugins again on next use. H460_FeaturePluginManager
+        calls this when a plugin library is loaded or unloaded.
+      */
+    void Refresh();
+
+  protected:
+    typedef std::map<int, Entries *> EntryMap;
+
+    EntryMap               types;
+    std::vector<Entries *> retired;
+    PMutex                 mutex;
+};
+
+#if defined(P_HAS_PLUGINS)
+/**This class refreshes the feature catalog when the plugin manager loads
+   or unloads a plugin library, so features in plugins loaded after the
+   first feature set was created are used.
+  */
+class H460_FeaturePluginManager : public PPluginModuleManager
+{
+    PCLASSINFO(H460_FeaturePluginManager, PPluginModuleManager);
+  public:
+    H460_FeaturePluginManager(PPluginManager * pluginMgr = NULL);
+
+    void OnLoadPlugin(PDynaLink & dll, INT code);
+};
+#endif
+
 /////////////////////////////////////////////////////////////////////
 
 #if PTLIB_VER >= 2130
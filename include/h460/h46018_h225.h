@@ -50,6 +50,13 @@
 
 #include "h323pdu.h"
 
+#ifdef H323_H46019M
+#include <vector>
+#ifdef H323_STD_ATOMIC
+#include <atomic>
+#endif
+#endif
+
 class H46018SignalPDU  : public H323SignalPDU
 {
   public:
@@ -223,10 +230,79 @@ class H46018Handler : public PObject
 
 
 #ifdef H323_H46019M
-typedef std::map<unsigned, PUDPSocket*> muxSocketMap;
-typedef std::map<PString, unsigned> muxPortMap;
-
+class H46019UDPSocket;
 class H46019MultiplexSocket;
+
+#define H46019_MUX_ROUTE_SHARDS  32
+
+/**Routing table from the receive multiplex ID to the media socket.
+   The table is split into shards by multiplex ID, each with its own read
+   write lock, so the demultiplexing thread does not contend with call
+   threads registering sockets for other IDs. Packets are delivered while
+   the shard is read locked, so once Remove() returns the socket no longer
+   receives packets and may be deleted.
+
+   Packets sent without a multiplex header are matched on their source
+   address, the result being kept in a second index.
+  */
+class H46019MultiplexRoutes
+{
+  public:
+    H46019MultiplexRoutes();
+
+    /**Register the socket for the multiplex ID.
+      */
+    void Add(unsigned id, H46019UDPSocket * socket);
+
+    /**Unregister the multiplex ID.
+       Returns the number of IDs still registered.
+      */
+    PINDEX Remove(unsigned id);
+
+    /**Remove all IDs.
+      */
+    void RemoveAll();
+
+    /**Pass a packet to the socket registered for the multiplex ID.
+       Returns FALSE if no socket is registered for the ID.
+      */
+    PBoolean Deliver(
+      unsigned id,
+      const void * buf,
+      PINDEX len,
+      const PIPSocket::Address & addr,
+      WORD port
+    );
+
+    /**Find the multiplex ID of an unmultiplexed packet from its source
+       address, looking at the remote address of each socket the first
+       time a source is seen.
+      */
+    unsigned FindBySource(const PIPSocket::Address & addr, WORD port);
+
+    /**Find the multiplex ID of the socket whose remote address is the
+       source address.
+      */
+    unsigned FindByPeer(const PIPSocket::Address & addr, WORD port);
+
+    /**Find the receive multiplex ID of the socket that sends with the ID.
+      */
+    unsigned FindBySendID(unsigned sendID, H46019UDPSocket * & socket);
+
+    PINDEX GetSize() const;
+
+  protected:
+    struct Shard {
+      mutable PReadWriteMutex               mutex;
+      std::map<unsigned, H46019UDPSocket *> sockets;
+    };
+
+    Shard & GetShard(unsigned id) { return shards[id % H46019_MUX_ROUTE_SHARDS]; }
+
+    Shard                          shards[H46019_MUX_ROUTE_SHARDS];
+    mutable PReadWriteMutex        sourceMutex;
+    std::map<PString, unsigned>    sources;
+};
 #endif
 
 class PNatMethod_H46019  : public H323NatMethod
@@ -424,9 +500,8 @@ protected:
     PortInfo                             muxPortInfo;
     static H323Connection::NAT_Sockets   muxSockets;
 
-    static muxSocketMap                  rtpSocketMap;
-    static muxPortMap                    rtpPortMap;
-    static muxSocketMap                  rtcpSocketMap;
+    static H46019MultiplexRoutes         rtpRoutes;
+    static H46019MultiplexRoutes         rtcpRoutes;
     static PMutex                        muxMutex;
     PThread *                            m_readThread;
     PDECLARE_NOTIFIER(PThread, PNatMethod_H46019, ReadThread);
@@ -447,10 +522,58 @@ protected:
 struct  H46019MultiPacket {
   PIPSocket::Address fromAddr;
   WORD               fromPort;
+  PINDEX             length;
   PBYTEArray         frame;
 };
 
-typedef std::queue<H46019MultiPacket> H46019MultiQueue;
+/**Queue of demultiplexed packets waiting to be read by a media session.
+   This is a fixed size ring written only by the multiplex read thread.
+   The slot buffers are kept between packets, so queueing a packet is a
+   single copy without any allocation or locking. Readers must be
+   serialised by the caller.
+  */
+class H46019MultiQueue
+{
+  public:
+    H46019MultiQueue();
+
+    /**Copy a packet into the next free slot.
+       Returns FALSE if the queue is full.
+      */
+    PBoolean Push(
+      const void * buf,
+      PINDEX len,
+      const PIPSocket::Address & addr,
+      WORD port
+    );
+
+    /**Copy the oldest packet out of the queue.
+       Returns FALSE if the queue is empty.
+      */
+    PBoolean Pop(
+      void * buf,
+      PINDEX & len,
+      PIPSocket::Address & addr,
+      WORD & port
+    );
+
+    /**Discard all queued packets.
+      */
+    void Clear();
+
+    PBoolean IsEmpty() const;
+
+  protected:
+    std::vector<H46019MultiPacket> slots;
+#ifdef H323_STD_ATOMIC
+    std::atomic<unsigned> head;
+    std::atomic<unsigned> tail;
+#else
+    unsigned head;
+    unsigned tail;
+    mutable PMutex indexMutex;
+#endif
+};
 
 class H46019MultiplexSocket : public H323UDPSocket
 {
@@ -758,8 +881,8 @@ private:
     unsigned         m_recvMultiplexID;             ///< Multiplex ID
     unsigned         m_sendMultiplexID;             ///< Multiplex ID
     H46019MultiQueue m_multQueue;                   ///< Incoming frame Queue
-    unsigned         m_multiBuffer;                 ///< Multiplex BufferSize
-    PMutex           m_multiMutex;                  ///< MultiQueue mutex
+    PSyncPoint       m_multiReady;                  ///< Signalled when a frame is queued
+    PMutex           m_multiMutex;                  ///< MultiQueue read mutex
     PBoolean         m_shutDown;                    ///< Shutdown
 #endif
 
@@ -787,7 +910,6 @@ private:
     PBoolean    m_h46024b;
 #endif
 
-	PAdaptiveDelay selectBlock;
     bool rtpSocket;
 
 };
@@ -39,7 +39,7 @@
 #define H_H460_Featurestd26
 
 #include <h460/h46026.h>
-#include <queue>
+#include <deque>
 #include <vector>
 #include <map>
 
@@ -70,7 +70,8 @@ public:
         Priority_Critical=1,    // Audio RTP
         Priority_Discretion,    // Video RTP
         Priority_High,          // Signaling   
-        Priority_Low            // RTCP
+        Priority_Low,           // RTCP
+        Priority_Count = Priority_Low
      };
 
      struct MessageHeader {
@@ -78,21 +79,52 @@ public:
         unsigned crv;
         int sessionId;
         int priority;
-        int delay;
+        PINDEX size;
         PInt64 packTime;
      };
 
-     int operator() ( const std::pair<PBYTEArray, MessageHeader>& p1,
-                      const std::pair<PBYTEArray, MessageHeader>& p2 ) {
-           return ((p1.second.priority >= p2.second.priority) && 
-                     (p1.second.packTime > p2.second.packTime));
-     }
-
      PString PriorityAsString();
 };
 
-typedef std::priority_queue< std::pair<PBYTEArray, socketOrder::MessageHeader >, 
-        std::vector< std::pair<PBYTEArray, socketOrder::MessageHeader> >, socketOrder > H46026SocketQueue;
+/* An encoded message waiting to be written to the socket */
+struct H46026QueuedPacket {
+    PBYTEArray data;
+    socketOrder::MessageHeader header;
+};
+
+/* The queue of one priority of one call. Flows take turns on the
+   socket by deficit round robin.
+ */
+class H46026SocketFlow {
+public:
+    H46026SocketFlow();
+
+    std::deque<H46026QueuedPacket> packets;
+    PINDEX bytes;
+    PINDEX deficit;
+    PBoolean active;
+    PBoolean newRound;
+};
+
+typedef std::pair<int, unsigned> H46026FlowKey;     // priority, crv
+typedef std::map<H46026FlowKey, H46026SocketFlow> H46026FlowMap;
+typedef std::deque<H46026FlowKey> H46026FlowList;
+
+/* Queue statistics of one priority */
+class H46026QueueStatistics {
+public:
+    H46026QueueStatistics();
+
+    unsigned GetAverageDelay() const;   // milliseconds
+
+    unsigned packetsSent;
+    PInt64   bytesSent;
+    unsigned packetsDropped;
+    PInt64   totalDelay;                // milliseconds
+    unsigned maximumDelay;              // milliseconds
+    unsigned packetsQueued;
+    PINDEX   bytesQueued;
+};
 
 typedef std::map<int,H46026UDPBuffer*> H46026CallMap;
 typedef std::map<unsigned, H46026CallMap >  H46026RTPBuffer;
@@ -128,7 +160,7 @@ public:
       e_extVideo /// extended video
     };
 
-    /* Set the pipe bandwidth Default is 384k */
+    /* Set the pipe bandwidth in bits/s. Default is 1536k */
     void SetPipeBandwidth(unsigned bps);
 
     /** Clear Buffers */
@@ -174,6 +206,22 @@ public:
     PBoolean SocketOut(BYTE * data, PINDEX & len);
     PBoolean SocketOut(PBYTEArray & data, PINDEX & len);
 
+    /* Report that len bytes handed out by SocketOut have been written to the socket.
+       This measures the actual send rate of the TCP connection and lets the pacing
+       follow it when the connection is slower than the pipe bandwidth.
+     */
+    void SocketWritten(PINDEX len);
+
+    /** Statistics */
+    /* Get the queue statistics for the priority (socketOrder::priority) */
+    H46026QueueStatistics GetQueueStatistics(int priority);
+
+    /* Get the measured socket send rate in bits/s. Zero if SocketWritten is not used */
+    unsigned GetSendRate();
+
+    /* Get the current pacing rate in bits/s */
+    unsigned GetPacingRate();
+
     /* Receiving from the socket */
     /* Process an incoming message from the socket.
         Returns false if message could not be handled or decoded into Q931.
@@ -182,28 +230,68 @@ public:
     PBoolean SocketIn(const PBYTEArray & data);
     PBoolean SocketIn(const Q931 & q931);
 
+    /* Process an incoming message from the socket only if it is a media frame in the
+       envelope this manager sends. Nothing is decoded into Q931 or H225 objects.
+        Returns false, without doing anything, if the message is anything else.
+     */
+    PBoolean SocketMediaIn(const BYTE * data, PINDEX len);
+
 protected:
-    PBoolean WriteQueue(const Q931 & msg, const socketOrder::MessageHeader & prior);
+    PBoolean WriteQueue(const Q931 & msg, socketOrder::MessageHeader & prior);
     PBoolean WriteQueue(const PBYTEArray & data, const socketOrder::MessageHeader & prior);
 
     PBoolean PackageFrame(PBoolean rtp, unsigned crv, PacketTypes id, PINDEX sessionId, H46026_UDPFrame & data);
+    void MediaFrameIn(unsigned crv, H46026_UDPFrame & frameData);
+
+    void BuildEnvelope();
+    PBoolean EncodeEnvelope(unsigned crv, const H46026_UDPFrame & data, PBYTEArray & output);
     H46026UDPBuffer * GetRTPBuffer(unsigned crv, int sessionId);
 
     PBoolean ProcessQueue();
 
     unsigned NextPacketCounter();
 
+    PBoolean NextPacket(H46026FlowList & active, H46026QueuedPacket & packet);
+    void GetFreeBuffer(PBYTEArray & data);
+    void RecycleBuffer(const PBYTEArray & data);
+    void RefillTokens(PInt64 now);
+    void UpdateSendRate(PInt64 now);
+
 private:
     double                     m_mbps;
     PBoolean                   m_socketPacketReady;
-    PInt64                     m_currentPacketTime;
     unsigned                   m_pktCounter;
 
     H225_H323_UserInformation  m_uuie;
     H46026RTPBuffer            m_rtpBuffer;
     PMutex                     m_writeMutex;
-    H46026SocketQueue          m_socketQueue;
+
+    // Pre-encoded media envelope, only the call reference and lengths change per packet
+    PBoolean                   m_envelopeValid;
+    PBYTEArray                 m_envelopeHeader;  // Q.931 header and IEs before the User-User IE
+    PBYTEArray                 m_envelopePrefix;  // PER before the genericData open type length
+    PBYTEArray                 m_envelopeInner;   // PER between the open type length and the payload length
+
+    // Scheduler, all protected by m_queueMutex
+    H46026FlowMap              m_flows;
+    H46026FlowList             m_criticalFlows;
+    H46026FlowList             m_sharedFlows;
+    std::vector<PBYTEArray>    m_freeBuffers;
+    H46026QueueStatistics      m_statistics[socketOrder::Priority_Count];
     PMutex                     m_queueMutex;
+
+    // Token bucket pacing
+    double                     m_pacingRate;
+    double                     m_tokens;
+    PInt64                     m_lastRefill;
+
+    // Socket send rate measurement
+    double                     m_sendRate;
+    PInt64                     m_sentBytes;
+    PInt64                     m_rateWindowStart;
+    PInt64                     m_lastHandout;
+    PBoolean                   m_backlogged;      // Data waited for the socket or the tokens this window
+    PBoolean                   m_congested;
 };
 
 
@@ -40,8 +40,13 @@
 
 #include "rtp.h"
 
+#ifdef H323_RING_JITTER
+#include <atomic>
+#endif
+
 class RTP_JitterBufferAnalyser;
 class RTP_AggregatedHandle;
+class RTP_JitterReactorHandle;
 
 ///////////////////////////////////////////////////////////////////////////////
 
@@ -51,6 +56,7 @@ class RTP_JitterBuffer : public PObject
 
   public:
     friend class RTP_AggregatedHandle;
+    friend class RTP_JitterReactorHandle;
 
     RTP_JitterBuffer(
       RTP_Session & session,   ///<  Associated RTP session tor ead data from
@@ -63,7 +69,7 @@ class RTP_JitterBuffer : public PObject
 //    PINDEX GetSize() const { return bufferSize; }
     /**Set the maximum delay the jitter buffer will operate to.
       */
-    void SetDelay(
+    virtual void SetDelay(
       unsigned minJitterDelay, ///<  Minimum delay in RTP timestamp units
       unsigned maxJitterDelay  ///<  Maximum delay in RTP timestamp units
     );
@@ -115,6 +121,13 @@ class RTP_JitterBuffer : public PObject
 
     PDECLARE_NOTIFIER(PThread, RTP_JitterBuffer, JitterThreadMain);
 
+#ifdef H323_RTP_REACTOR
+    /**Remove the buffer from the session's RTP reactor.
+       This must be done before the session sockets are closed.
+      */
+    void DetachReactor();
+#endif
+
   protected:
     //virtual void Main();
 
@@ -166,12 +179,109 @@ class RTP_JitterBuffer : public PObject
     RTP_AggregatedHandle * aggregratedHandle;
 #endif
 
-    PBoolean Init(Entry * & currentReadFrame, PBoolean & markerWarning);
-    PBoolean PreRead(Entry * & currentReadFrame, PBoolean & markerWarning);
-    PBoolean OnRead(Entry * & currentReadFrame, PBoolean & markerWarning, PBoolean loop);
-    void DeInit(Entry * & currentReadFrame, PBoolean & markerWarning);
+#ifdef H323_RTP_REACTOR
+    RTP_JitterReactorHandle * reactorHandle;
+    PBoolean reactorMarkerWarning;
+    virtual PBoolean OnReactorData();
+#endif
+
+    virtual PBoolean Init(Entry * & currentReadFrame, PBoolean & markerWarning);
+    virtual PBoolean PreRead(Entry * & currentReadFrame, PBoolean & markerWarning);
+    virtual PBoolean OnRead(Entry * & currentReadFrame, PBoolean & markerWarning, PBoolean loop);
+    virtual void DeInit(Entry * & currentReadFrame, PBoolean & markerWarning);
+    void PrepareReadFrame(Entry * currentReadFrame, PBoolean & markerWarning);
+    void QueueReadFrame(Entry * currentReadFrame, PBoolean & markerWarning);
+    void AnalyseWriteFrame();
+    void CheckTargetJitter();
+    void StopReading();
 };
 
+
+#ifdef H323_RING_JITTER
+
+/**A jitter buffer that keeps the frames in a fixed size ring indexed by
+   the RTP sequence number instead of a list.
+   The thread reading the RTP session and the thread calling ReadData() pass
+   frames to each other through atomic slots, so neither takes bufferMutex
+   per packet. All frames are allocated when the buffer is created. The
+   adaptive delay (minJitterTime, maxJitterTime and targetJitterTime)
+   behaves as for RTP_JitterBuffer.
+  */
+class RTP_RingJitterBuffer : public RTP_JitterBuffer
+{
+  PCLASSINFO(RTP_RingJitterBuffer, RTP_JitterBuffer);
+
+  public:
+    RTP_RingJitterBuffer(
+      RTP_Session & session,   ///<  Associated RTP session tor ead data from
+      unsigned minJitterDelay, ///<  Minimum delay in RTP timestamp units
+      unsigned maxJitterDelay, ///<  Maximum delay in RTP timestamp units
+      PINDEX stackSize = 30000 ///<  Stack size for jitter thread
+    );
+    ~RTP_RingJitterBuffer();
+
+    /**Set the maximum delay the jitter buffer will operate to.
+       The ring is not resized, a larger maximum only causes more overruns.
+      */
+    virtual void SetDelay(
+      unsigned minJitterDelay, ///<  Minimum delay in RTP timestamp units
+      unsigned maxJitterDelay  ///<  Maximum delay in RTP timestamp units
+    );
+
+    /**Read a data frame from the jitter buffer.
+       Must only be called from one thread at a time.
+      */
+    virtual PBoolean ReadData(
+      DWORD timestamp,        ///<  Timestamp to read from buffer.
+      RTP_DataFrame & frame   ///<  Frame read from the RTP session
+    );
+
+    /**Get the number of frames the ring can hold.
+      */
+    PINDEX GetRingSize() const { return ringSize; }
+
+  protected:
+    // Reading side, called from the jitter thread or the RTP reactor
+    virtual PBoolean Init(Entry * & currentReadFrame, PBoolean & markerWarning);
+    virtual PBoolean PreRead(Entry * & currentReadFrame, PBoolean & markerWarning);
+    virtual PBoolean OnRead(Entry * & currentReadFrame, PBoolean & markerWarning, PBoolean loop);
+    virtual void DeInit(Entry * & currentReadFrame, PBoolean & markerWarning);
+#ifdef H323_RTP_REACTOR
+    virtual PBoolean OnReactorData();
+#endif
+    Entry * TakeFreeFrame();
+    void PublishFrame(Entry * & currentReadFrame, PBoolean & markerWarning);
+
+    // Playing side, called from ReadData()
+    Entry * TakeSlot(WORD sequence);
+    void ReturnSlot(Entry * frame);
+    void ReleaseFrame(Entry * frame);
+    PBoolean FindOldest(DWORD & newestTimestamp);
+    PBoolean NextWriteFrame(DWORD & newestTimestamp);
+    void Flush();
+
+    PINDEX ringSize;
+    PINDEX ringMask;
+    std::atomic<Entry *> * ring;
+
+    // Frames given back by the playing side, in order of release
+    PINDEX freeSize;
+    Entry ** freeQueue;
+    std::atomic<unsigned> freeHead;
+    std::atomic<unsigned> freeTail;
+
+    // Sequence number (bits 32-47) and timestamp of the newest frame
+    std::atomic<PUInt64> newestInfo;
+    // Next sequence number to be played, above 0xffff if not yet playing
+    std::atomic<unsigned> playSequence;
+    std::atomic<bool> resyncRequested;
+
+    Entry * spareFrame;   // Owned by the reading side
+    Entry * headFrame;    // Owned by the playing side, next frame to play
+};
+
+#endif // H323_RING_JITTER
+
 #endif // __OPAL_JITTER_H
 
 
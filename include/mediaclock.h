@@ -0,0 +1,199 @@
+/*
+ * mediaclock.h
+ *
+ * Shared media clock for transmit channels
+ *
+ * H323Plus Library
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is H323Plus Library.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Id$
+ *
+ */
+
+#ifndef __OPAL_MEDIACLOCK_H
+#define __OPAL_MEDIACLOCK_H
+
+#ifdef P_USE_PRAGMA
+#pragma interface
+#endif
+
+#include "openh323buildopts.h"
+
+#ifdef H323_MEDIA_CLOCK
+
+#include <map>
+#include <deque>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+
+/**A periodic task driven by the media clock.
+   OnTick() is called from one of the worker threads of the clock once per
+   period. The deadlines are kept relative to when the handle was added, so
+   late wake ups do not accumulate into drift. A handle that falls behind
+   has its missed ticks run back to back, up to a limit, after which the
+   oldest ones are skipped.
+  */
+class H323MediaClockHandle : public PObject
+{
+  PCLASSINFO(H323MediaClockHandle, PObject);
+
+  public:
+    H323MediaClockHandle(
+      unsigned period             ///< Period in microseconds
+    );
+
+    /**Do the work for one period, eg read, encode and send a frame.
+       Returning FALSE stops the handle, there are no more call backs apart
+       from OnStopped().
+      */
+    virtual PBoolean OnTick() = 0;
+
+    /**Called from the worker thread after OnTick() returned FALSE.
+       This is not called when the handle is taken out of the clock with
+       H323MediaClock::RemoveHandle().
+      */
+    virtual void OnStopped() { }
+
+    /**Get the period in microseconds.
+      */
+    unsigned GetPeriod() const { return period; }
+
+    /**Get the number of times OnTick() was called.
+      */
+    DWORD GetTickCount() const { return tickCount; }
+
+    /**Get the number of ticks skipped because the handle fell too far behind.
+      */
+    DWORD GetSkippedTicks() const { return skippedTicks; }
+
+    /**Get the average time in microseconds between a deadline and the
+       OnTick() call for it.
+      */
+    unsigned GetAverageLateness() const
+    { return tickCount > 0 ? (unsigned)(totalLateness/tickCount) : 0; }
+
+    /**Get the largest time in microseconds between a deadline and the
+       OnTick() call for it.
+      */
+    unsigned GetMaximumLateness() const { return maximumLateness; }
+
+  private:
+    unsigned     period;
+    unsigned     id;
+    PInt64       nextDeadline;    // Nanoseconds on the monotonic clock
+    unsigned     pendingTicks;
+    PBoolean     scheduled;
+    PBoolean     stopped;
+    PBoolean     removed;
+    PThread    * runningThread;
+    PSyncPoint   finished;
+
+    DWORD        tickCount;
+    DWORD        skippedTicks;
+    PInt64       totalLateness;
+    unsigned     maximumLateness;
+
+    friend class H323MediaClock;
+};
+
+
+/**This class is an endpoint wide clock that drives the transmit side of
+   many media channels from a small pool of threads. It replaces the
+   transmit thread per channel that relies on the codec blocking to keep
+   real time, which for server applications without a sound device means
+   a sleep per frame in every call.
+
+   One thread waits on a timer for the earliest deadline and hands the
+   handles that are due to the worker threads. A handle is only run by one
+   worker at a time.
+  */
+class H323MediaClock : public PObject
+{
+  PCLASSINFO(H323MediaClock, PObject);
+
+  public:
+  /**@name Construction */
+  //@{
+    /**Create the clock and start its threads.
+      */
+    H323MediaClock(
+      unsigned workerCount,           ///< Number of threads running the handles
+      PINDEX stackSize = 30000        ///< Stack size for each thread
+    );
+
+    /**Stop the threads.
+       All handles must have been removed before this is called.
+      */
+    ~H323MediaClock();
+  //@}
+
+  /**@name Operations */
+  //@{
+    /**Start calling the handle, the first tick is one period from now.
+      */
+    PBoolean AddHandle(
+      H323MediaClockHandle * handle
+    );
+
+    /**Remove the handle from the clock.
+       When this returns the handle is not in use by any worker thread and
+       may be deleted, unless it was called from the call back of the
+       handle itself.
+      */
+    PBoolean RemoveHandle(
+      H323MediaClockHandle * handle
+    );
+
+    /**Get the number of worker threads.
+      */
+    unsigned GetWorkerCount() const { return (unsigned)workers.size(); }
+
+    /**Get the number of handles currently registered.
+      */
+    PINDEX GetHandleCount() const;
+  //@}
+
+  protected:
+    typedef std::map<unsigned, H323MediaClockHandle *> HandleMap;
+    typedef std::multimap<PInt64, unsigned> Schedule;
+
+    PDECLARE_NOTIFIER(PThread, H323MediaClock, ClockMain);
+    PDECLARE_NOTIFIER(PThread, H323MediaClock, WorkerMain);
+
+    void Wake();
+    void OnDeadline(H323MediaClockHandle & handle, PInt64 now);
+    void RunHandle(H323MediaClockHandle & handle);
+
+    int                    timerFd;
+    int                    wakeFd;
+    PBoolean               running;
+    PThread              * clockThread;
+    std::vector<PThread *> workers;
+    HandleMap              handles;
+    Schedule               schedule;
+    std::deque<unsigned>   runQueue;
+    PSemaphore             available;
+    unsigned               nextId;
+    mutable PMutex         mutex;
+};
+
+#endif // H323_MEDIA_CLOCK
+
+#endif // __OPAL_MEDIACLOCK_H
+
+
+/////////////////////////////////////////////////////////////////////////////
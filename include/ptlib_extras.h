@@ -69,6 +69,7 @@
 #else
 
 #include <map>
+#include <vector>
 
 template <class PAIR>
 class deleteDictionaryEntry {
@@ -91,6 +92,38 @@ struct PSTLSortOrder {
      }
 };
 
+
+/**Hash of a dictionary key for the PSTLDictionary key index.
+   Keys only need to implement <code>PObject::HashFunction()</code>. PString
+   and POrdinalKey are specialised as their own hash functions only spread
+   over a few buckets.
+  */
+template <class K>
+struct PSTLKeyHash {
+     unsigned operator() ( const K & key ) const {
+           return (unsigned)key.HashFunction();
+     }
+};
+
+template <>
+struct PSTLKeyHash<PString> {
+     unsigned operator() ( const PString & key ) const {
+           // FNV-1a
+           unsigned hash = 2166136261U;
+           const char * ptr = key;
+           for (PINDEX i = key.GetLength(); i > 0; --i)
+               hash = (hash ^ (BYTE)*ptr++) * 16777619U;
+           return hash;
+     }
+};
+
+template <>
+struct PSTLKeyHash<POrdinalKey> {
+     unsigned operator() ( const POrdinalKey & key ) const {
+           return (unsigned)(PINDEX)key;
+     }
+};
+
 template <class K, class D> class PSTLDictionary : public PObject, 
                                                   public std::map< unsigned, std::pair<K, D*>, PSTLSortOrder >
 {
@@ -159,6 +192,9 @@ template <class K, class D> class PSTLDictionary : public PObject,
        present in the dictionary. If the dictionary is set to delete objects
        upon removal, the value -1 is returned if the key existed prior to removal
        rather than returning an illegal pointer
+
+       The last entry in the dictionary takes over the ordinal position of
+       the removed one, other entries keep their positions.
      */
     virtual D * RemoveAt(
       const K & key   ///< Key for position in dictionary to get object.
@@ -166,9 +202,11 @@ template <class K, class D> class PSTLDictionary : public PObject,
         return InternalRemoveKey(key);
       }
 
-    /**Add a new object to the collection. If the objects value is already in
-       the dictionary then the object is overrides the previous value. If the
-       <code>AllowDeleteObjects</code> option is set then the old object is also deleted.
+    /**Add a new object to the collection. If the key is already in the
+       dictionary then the object overrides the previous value, keeping the
+       ordinal position of the key, so there is only ever one entry per key.
+       If the <code>AllowDeleteObjects</code> option is set then the old
+       object is also deleted.
 
        The object is placed in the an ordinal position dependent on the keys
        hash function. Subsequent searches use the hash function to speed access
@@ -239,6 +277,7 @@ template <class K, class D> class PSTLDictionary : public PObject,
           if (!disallowDeleteObjects)
                 deleteDictionaryEntries(*this);  
           this->clear();
+          keyIndex.clear();
       }
 
     PINLINE void AllowDeleteObjects(
@@ -255,19 +294,89 @@ template <class K, class D> class PSTLDictionary : public PObject,
 
   protected:
 
+      /* The ordinal map is indexed by a hash table of the keys, so finding a
+         key does not scan every entry. */
+      struct IndexEntry {
+          IndexEntry(const K & k, unsigned p, D * d) : key(k), pos(p), data(d) { }
+          K        key;
+          unsigned pos;
+          D *      data;
+      };
+      typedef std::vector<IndexEntry> IndexBucket;
+
       PBoolean  disallowDeleteObjects;
       PMutex    dictMutex;
+      std::vector<IndexBucket> keyIndex;
+
+       IndexBucket & IndexBucketOf(
+          const K & key
+          ) const
+      {
+          return PRemoveConst(PSTLDictionary, this)->keyIndex[PSTLKeyHash<K>()(key) % keyIndex.size()];
+      }
+
+       void IndexAdd(
+          const K & key,
+          unsigned pos,
+          D * obj
+          )
+      {
+          if (this->size() > keyIndex.size()) {
+              // Rebuild with twice the buckets, the new entry is already in the map
+              size_t buckets = keyIndex.size() < 16 ? 16 : keyIndex.size()*2;
+              keyIndex.clear();
+              keyIndex.resize(buckets);
+              typename std::map< unsigned, std::pair<K, D*>,PSTLSortOrder>::const_iterator i;
+              for (i = this->begin(); i != this->end(); ++i)
+                  IndexBucketOf(i->second.first).push_back(IndexEntry(i->second.first, i->first, i->second.second));
+              return;
+          }
+          IndexBucketOf(key).push_back(IndexEntry(key, pos, obj));
+      }
+
+       void IndexMove(
+          const K & key,
+          unsigned from,
+          unsigned to
+          )
+      {
+          IndexBucket & bucket = IndexBucketOf(key);
+          for (typename IndexBucket::iterator i = bucket.begin(); i != bucket.end(); ++i) {
+              if (i->pos == from) {
+                  i->pos = to;
+                  return;
+              }
+          }
+      }
+
+       void IndexRemove(
+          const K & key,
+          unsigned pos
+          )
+      {
+          IndexBucket & bucket = IndexBucketOf(key);
+          for (typename IndexBucket::iterator i = bucket.begin(); i != bucket.end(); ++i) {
+              if (i->pos == pos) {
+                  bucket.erase(i);
+                  return;
+              }
+          }
+      }
 
        D * InternalFindKey(
           const K & key,   ///< Key to look for in the dictionary.
           unsigned & ref        ///< Returned index
           ) const
       {
-          typename std::map< unsigned, std::pair<K, D*>,PSTLSortOrder>::const_iterator i;
-          for (i = this->begin(); i != this->end(); ++i) {
-            if (i->second.first == key) {
-               ref = i->first;
-               return i->second.second;
+          if (keyIndex.empty())
+              return NULL;
+
+          // Keys are unique, SetAt() replaces the object of an existing key
+          const IndexBucket & bucket = IndexBucketOf(key);
+          for (typename IndexBucket::const_iterator i = bucket.begin(); i != bucket.end(); ++i) {
+            if (i->key == key) {
+               ref = i->pos;
+               return i->data;
             }
         }
         return NULL;
@@ -298,24 +407,25 @@ template <class K, class D> class PSTLDictionary : public PObject,
       }
 
       D * InternalRemoveResort(unsigned pos) {
-          unsigned newpos = pos;
-          unsigned sz = (unsigned)this->size();
+          unsigned last = (unsigned)this->size() - 1;
           D * dataPtr = NULL;
           typename std::map< unsigned, std::pair<K, D*>, PSTLSortOrder >::iterator it = this->find(pos);
           if (it == this->end()) return NULL;
+          IndexRemove(it->second.first, pos);
           if (disallowDeleteObjects)
             dataPtr = it->second.second;
           else
             delete it->second.second;  
           this->erase(it);
-          
-          for (unsigned i = pos+1; i < sz; ++i) {
-             typename std::map< unsigned, std::pair<K, D*>, PSTLSortOrder >::iterator j = this->find(i);
+
+          // Fill the gap with the last entry rather than renumbering the rest
+          if (pos != last) {
+             typename std::map< unsigned, std::pair<K, D*>, PSTLSortOrder >::iterator j = this->find(last);
              if (j != this->end()) {
                  DictionaryEntry entry =  make_pair(j->second.first,j->second.second) ;
-                 this->insert(pair<unsigned, std::pair<K, D*> >(newpos,entry));
-                 newpos++;
                  this->erase(j);
+                 this->insert(pair<unsigned, std::pair<K, D*> >(pos,entry));
+                 IndexMove(entry.first, last, pos);
              }
           }
 
@@ -329,7 +439,8 @@ template <class K, class D> class PSTLDictionary : public PObject,
           PWaitAndSignal m(dictMutex);
 
           unsigned pos = 0;
-          InternalFindKey(key,pos);
+          if (InternalFindKey(key,pos) == NULL)
+              return NULL;
           return InternalRemoveResort(pos);
       }
 
@@ -340,9 +451,28 @@ template <class K, class D> class PSTLDictionary : public PObject,
       { 
           PWaitAndSignal m(dictMutex);
 
+          // Replace in place so a key only ever has the one entry
+          if (!keyIndex.empty()) {
+              IndexBucket & bucket = IndexBucketOf(key);
+              for (typename IndexBucket::iterator i = bucket.begin(); i != bucket.end(); ++i) {
+                  if (i->key == key) {
+                      typename std::map< unsigned, std::pair<K, D*>, PSTLSortOrder >::iterator it = this->find(i->pos);
+                      if (it == this->end())
+                          return false;
+                      D * old = it->second.second;
+                      it->second.second = obj;
+                      i->data = obj;
+                      if (!disallowDeleteObjects && old != obj)
+                          delete old;
+                      return true;
+                  }
+              }
+          }
+
           unsigned pos = (unsigned)this->size();
           DictionaryEntry entry = make_pair(key,obj);
           this->insert(pair<unsigned, std::pair<K, D*> >(pos,entry));
+          IndexAdd(key, pos, obj);
           return true;
       }
 
@@ -756,23 +886,35 @@ public:
         PBoolean  m_marker;
         PInt64    m_receiveTime;
      };
-
-     int operator() ( const std::pair<H323FRAME::Info, PBYTEArray>& p1,
-                      const std::pair<H323FRAME::Info, PBYTEArray>& p2 ) {
-           return (p1.first.m_sequence > p2.first.m_sequence);
-     }
 };
 
-typedef std::priority_queue< std::pair<H323FRAME::Info, PBYTEArray >, 
-        std::vector< std::pair<H323FRAME::Info, PBYTEArray> >,H323FRAME > RTP_Sortedframes;
+#define H323_FRAMEBUFFER_SLOTS  1024    // Packets held, power of two
 
 
+/**Video reassembly buffer.
+   Packets are copied once into a ring of slots indexed by RTP sequence
+   number. The slot buffers are allocated on first use and kept for the
+   life of the stream, and are handed to FrameOut() by reference. The output
+   thread sleeps on a sync point until a complete frame is buffered.
+  */
 class H323_FrameBuffer : public PThread
 {
     PCLASSINFO(H323_FrameBuffer, PThread);
 
 protected:
-    RTP_Sortedframes  m_buffer;
+    struct Slot {
+        Slot() : m_used(false), m_busy(false), m_length(0), m_frame(NULL) {}
+        H323FRAME::Info m_info;
+        PBoolean        m_used;           // Waiting for output
+        PBoolean        m_busy;           // Being passed to FrameOut()
+        PINDEX          m_length;
+        PBYTEArray *    m_frame;
+    };
+
+    std::vector<Slot> m_slots;
+    unsigned m_count;                 // Number of slots waiting for output
+    WORD     m_nextSequence;          // Next sequence number to output
+    PBoolean m_sequenceValid;         // m_nextSequence has been set
     PBoolean m_threadRunning;
 
     unsigned m_frameMarker;           // Number of complete frames;
@@ -791,12 +933,15 @@ protected:
     PInt64   m_RenderTimeStamp;       // local realTime to render.
 
     PMutex bufferMutex;
+    PSyncPoint m_frameReady;          // Signalled when a frame is complete
     PAdaptiveDelay m_outputDelay;
     PBoolean  m_exit;
 
 public:
     H323_FrameBuffer()
-    : PThread(10000, NoAutoDeleteThread, HighestPriority, "FrameBuffer"), m_threadRunning(false),
+    : PThread(10000, NoAutoDeleteThread, HighestPriority, "FrameBuffer"),
+      m_slots(H323_FRAMEBUFFER_SLOTS), m_count(0), m_nextSequence(0), m_sequenceValid(false),
+      m_threadRunning(false),
       m_frameMarker(0), m_frameOutput(false), m_frameStartTime(0), 
       m_StartTimeStamp(0), m_calcClockRate(90),
       m_packetReceived(0), m_oddTimeCount(0), m_lateThreshold(5.0), m_increaseBuffer(false),
@@ -806,8 +951,12 @@ public:
 
     ~H323_FrameBuffer()
     { 
-        if (m_threadRunning)
+        if (m_threadRunning) {
             m_exit = true;  
+            m_frameReady.Signal();
+        }
+        for (std::vector<Slot>::iterator i = m_slots.begin(); i != m_slots.end(); ++i)
+            delete i->m_frame;
     }
 
     void Start()
@@ -821,89 +970,100 @@ public:
 		return m_threadRunning;
 	}
 
-    virtual void FrameOut(PBYTEArray & /*frame*/, PInt64 /*receiveTime*/, unsigned /*clock*/, PBoolean /*fup*/, PBoolean /*flow*/) {};
+    /**Create the buffer for a slot. A descendant may create a descendant
+       of PBYTEArray, which is then passed back to FrameOut().
+      */
+    virtual PBYTEArray * CreateFrame() { return new PBYTEArray(); }
+
+    /**Output a packet. The first length bytes of frame hold the packet,
+       the frame remains owned by the buffer.
+      */
+    virtual void FrameOut(PBYTEArray & /*frame*/, PINDEX /*length*/, PInt64 /*receiveTime*/, unsigned /*clock*/, PBoolean /*fup*/, PBoolean /*flow*/) {};
 
     void Main() {
 
-        PBYTEArray frame;
-        PTimeInterval lastMarker;
         int delay=0;
         PBoolean fup=false;
 
         while (!m_exit) {
-            while (m_frameOutput && m_frameMarker > 0) {
-                if (m_buffer.empty()) {
+            if (!m_frameOutput || m_frameMarker == 0) {
+                m_frameReady.Wait();
+                continue;
+            }
+
+            // fixed local render clock
+            if (m_RenderTimeStamp == 0)
+                m_RenderTimeStamp = PTimer::Tick().GetMilliSeconds();
+
+            PBoolean flow = false;
+
+            H323FRAME::Info info;
+              bufferMutex.Wait();
+                Slot * slot = TakeNextSlot();
+                if (slot == NULL) {
                     if (m_frameMarker > 0)
                         m_frameMarker--;
-                    break;
+                    bufferMutex.Signal();
+                    continue;
                 }
+                info = slot->m_info;
+                unsigned lastTimeStamp = info.m_timeStamp;
+                const Slot * next = info.m_marker ? PeekNextSlot() : NULL;
+                if (next != NULL) { // Peek ahead for next timestamp
+                    delay = (next->m_info.m_timeStamp - lastTimeStamp)/(unsigned)m_calcClockRate;
+                    if (delay <= 0 || delay > 200 || (lastTimeStamp > next->m_info.m_timeStamp)) {
+                       delay = 0;
+                       m_RenderTimeStamp = PTimer::Tick().GetMilliSeconds();
+                       fup = true;
+                    } 
+                }
+              bufferMutex.Signal();
+
+              if (m_exit)
+                  break;
+
+              m_frameCount++;
+              if (m_lastSequence) {
+                 unsigned diff = info.m_sequence - m_lastSequence - 1;
+                 if (diff > 0) {
+                     PTRACE(5,"RTPBUF\tDetected loss of " << diff << " packets."); 
+                     m_lossCount = m_lossCount + diff;
+                 }
+              }
+              m_lastSequence = info.m_sequence;
 
-                // fixed local render clock
-                if (m_RenderTimeStamp == 0)
-                    m_RenderTimeStamp = PTimer::Tick().GetMilliSeconds();
-
-                PBoolean flow = false;
-
-                H323FRAME::Info info;
-                  bufferMutex.Wait();
-                    info = m_buffer.top().first;
-                    frame.SetSize(m_buffer.top().second.GetSize());
-                    memcpy(frame.GetPointer(), m_buffer.top().second, m_buffer.top().second.GetSize());
-                    unsigned lastTimeStamp = info.m_timeStamp;
-                    m_buffer.pop();
-                    if (info.m_marker && !m_buffer.empty()) { // Peek ahead for next timestamp
-                        delay = (m_buffer.top().first.m_timeStamp - lastTimeStamp)/(unsigned)m_calcClockRate;
-                        if (delay <= 0 || delay > 200 || (lastTimeStamp > m_buffer.top().first.m_timeStamp)) {
-                           delay = 0;
-                           m_RenderTimeStamp = PTimer::Tick().GetMilliSeconds();
-                           fup = true;
-                        } 
-                    }
-                  bufferMutex.Signal();
-
-                  if (m_exit)
-                      break;
+              if (!fup && m_frameCount > 0) 
+                  fup = ((m_lossCount/m_frameCount)*100.0 > m_lossThreshold);
 
-                  m_frameCount++;
-                  if (m_lastSequence) {
-                     unsigned diff = info.m_sequence - m_lastSequence - 1;
-                     if (diff > 0) {
-                         PTRACE(5,"RTPBUF\tDetected loss of " << diff << " packets."); 
-                         m_lossCount = m_lossCount + diff;
-                     }
-                  }
-                  m_lastSequence = info.m_sequence;
+              FrameOut(*slot->m_frame, slot->m_length, info.m_receiveTime, (unsigned)m_calcClockRate, fup, flow);
 
-                  if (!fup && m_frameCount > 0) 
-                      fup = ((m_lossCount/m_frameCount)*100.0 > m_lossThreshold);
+              bufferMutex.Wait();
+                slot->m_busy = false;
+              bufferMutex.Signal();
 
-                  FrameOut(frame, info.m_receiveTime, (unsigned)m_calcClockRate, fup, flow);
-                  frame.SetSize(0);
-                  if (fup) {
-                     m_lossCount = m_frameCount = 0;
-                     fup = false;
-                  }
+              if (fup) {
+                 m_lossCount = m_frameCount = 0;
+                 fup = false;
+              }
 
-                  if (info.m_marker && m_frameMarker > 0) {
-                        if (m_increaseBuffer) {
-                            delay = delay*2;
-                            m_increaseBuffer=false;
-                        }
-                      m_RenderTimeStamp+=delay;
-                      PInt64 nowTime = PTimer::Tick().GetMilliSeconds();
-                      unsigned ldelay = (unsigned)((m_RenderTimeStamp > nowTime)? m_RenderTimeStamp - nowTime : 0);
-                      if (ldelay > 200 || m_frameMarker > 5) ldelay = 0;
-                      if (!ldelay)  m_RenderTimeStamp = nowTime;
-                      m_frameMarker--;
-                      m_outputDelay.Delay(ldelay);
-                  } else 
-                      PThread::Sleep(2);
-            }
-            PThread::Sleep(5);
+              if (info.m_marker && m_frameMarker > 0) {
+                    if (m_increaseBuffer) {
+                        delay = delay*2;
+                        m_increaseBuffer=false;
+                    }
+                  m_RenderTimeStamp+=delay;
+                  PInt64 nowTime = PTimer::Tick().GetMilliSeconds();
+                  unsigned ldelay = (unsigned)((m_RenderTimeStamp > nowTime)? m_RenderTimeStamp - nowTime : 0);
+                  if (ldelay > 200 || m_frameMarker > 5) ldelay = 0;
+                  if (!ldelay)  m_RenderTimeStamp = nowTime;
+                  m_frameMarker--;
+                  m_outputDelay.Delay(ldelay);
+              }
         }
         bufferMutex.Wait();
-        while (!m_buffer.empty()) 
-           m_buffer.pop();
+        for (std::vector<Slot>::iterator i = m_slots.begin(); i != m_slots.end(); ++i)
+            i->m_used = i->m_busy = false;
+        m_count = 0;
         bufferMutex.Signal();
 
         m_threadRunning = false;
@@ -934,41 +1094,110 @@ public:
                 m_StartTimeStamp = PTimer::Tick().GetMilliSeconds();
             }
         }
-            
-        H323FRAME::Info info;
-           info.m_sequence = seq;
-           info.m_marker = marker;
-           info.m_timeStamp = time;
-           info.m_receiveTime = now;
 
-        PBYTEArray * m_frame = new PBYTEArray(payload+12);
-        memcpy(m_frame->GetPointer(),(PRemoveConst(PBYTEArray,&frame))->GetPointer(),payload+12);
+        PWaitAndSignal m(bufferMutex);
 
-        bufferMutex.Wait();
         m_packetReceived++;
-        if (m_frameOutput && !m_buffer.empty() && info.m_sequence < m_buffer.top().first.m_sequence) {
-            m_oddTimeCount++;
-            PTRACE(6,"RTPBUF\tLate Packet Received " << (m_oddTimeCount/m_packetReceived)*100.0 << "%");
-            if ((m_oddTimeCount/m_packetReceived)*100.0 > m_lateThreshold) {
-                PTRACE(4,"RTPBUF\tLate Packet threshold reached increasing buffer.");
-                m_increaseBuffer = true;
-                m_packetReceived=0;
-                m_oddTimeCount=0;
+        if (!m_sequenceValid) {
+            m_nextSequence = (WORD)seq;
+            m_sequenceValid = true;
+        }
+
+        short position = (short)(WORD)(seq - m_nextSequence);
+        if (position >= H323_FRAMEBUFFER_SLOTS || position <= -H323_FRAMEBUFFER_SLOTS) {
+            // Sequence jump (source restarted or long outage), what is held is stale
+            PTRACE(4,"RTPBUF\tSequence jump from " << m_nextSequence << " to " << seq << ", resynchronising.");
+            for (std::vector<Slot>::iterator i = m_slots.begin(); i != m_slots.end(); ++i)
+                i->m_used = false;
+            m_count = 0;
+            m_nextSequence = (WORD)seq;
+            position = 0;
+        }
+
+        if (position < 0) {
+            if (!m_frameOutput && -position < H323_FRAMEBUFFER_SLOTS) {
+                // Reordered before output started, move the start back
+                m_nextSequence = (WORD)seq;
+            } else {
+                m_oddTimeCount++;
+                PTRACE(6,"RTPBUF\tLate Packet Received " << (m_oddTimeCount/m_packetReceived)*100.0 << "%");
+                if ((m_oddTimeCount/m_packetReceived)*100.0 > m_lateThreshold) {
+                    PTRACE(4,"RTPBUF\tLate Packet threshold reached increasing buffer.");
+                    m_increaseBuffer = true;
+                    m_packetReceived=0;
+                    m_oddTimeCount=0;
+                }
+                return true;   // already played out past it
             }
         }
-        m_buffer.push(pair<H323FRAME::Info, PBYTEArray>(info,*m_frame));
-        delete m_frame;
-        bufferMutex.Signal();
+
+        Slot & slot = m_slots[seq & (H323_FRAMEBUFFER_SLOTS-1)];
+        if (slot.m_used || slot.m_busy) {
+            PTRACE(4,"RTPBUF\tBuffer full, packet " << seq << " dropped.");
+            return true;
+        }
+
+        if (slot.m_frame == NULL)
+            slot.m_frame = CreateFrame();
+        if (!slot.m_frame->SetMinSize(payload+12))
+            return false;
+        memcpy(slot.m_frame->GetPointer(),(PRemoveConst(PBYTEArray,&frame))->GetPointer(),payload+12);
+
+        slot.m_length = payload+12;
+        slot.m_info.m_sequence = seq;
+        slot.m_info.m_marker = marker;
+        slot.m_info.m_timeStamp = time;
+        slot.m_info.m_receiveTime = now;
+        slot.m_used = true;
+        m_count++;
 
         if (marker) {
            m_frameMarker++;
            // Make sure we have a min of 3 frames in buffer to start
            if (!m_frameOutput && m_frameMarker > 2)
               m_frameOutput = true;
+           if (m_frameOutput)
+              m_frameReady.Signal();
         }
 
         return true;
     }
+
+protected:
+    // Take the waiting slot with the lowest sequence number, skipping lost packets
+    Slot * TakeNextSlot()
+    {
+        if (m_count == 0)
+            return NULL;
+
+        WORD sequence = m_nextSequence;
+        for (unsigned i = 0; i < H323_FRAMEBUFFER_SLOTS; ++i, ++sequence) {
+            Slot & slot = m_slots[sequence & (H323_FRAMEBUFFER_SLOTS-1)];
+            if (slot.m_used && (WORD)slot.m_info.m_sequence == sequence) {
+                slot.m_used = false;
+                slot.m_busy = true;
+                m_count--;
+                m_nextSequence = (WORD)(sequence+1);
+                return &slot;
+            }
+        }
+        return NULL;
+    }
+
+    // Get the slot that TakeNextSlot() would return next
+    const Slot * PeekNextSlot() const
+    {
+        if (m_count == 0)
+            return NULL;
+
+        WORD sequence = m_nextSequence;
+        for (unsigned i = 0; i < H323_FRAMEBUFFER_SLOTS; ++i, ++sequence) {
+            const Slot & slot = m_slots[sequence & (H323_FRAMEBUFFER_SLOTS-1)];
+            if (slot.m_used && (WORD)slot.m_info.m_sequence == sequence)
+                return &slot;
+        }
+        return NULL;
+    }
 };
 
 #endif  // H323_FRAMEBUFFER
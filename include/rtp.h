@@ -44,6 +44,8 @@
 
 class RTP_JitterBuffer;
 class PHandleAggregator;
+class RTP_Reactor;
+class RTP_BatchMessages;
 
 #ifdef P_STUN
 class PNatMethod;
@@ -400,6 +402,20 @@ class RTP_Session : public PObject
       */
     unsigned GetJitterBufferSize() const;
 
+#ifdef H323_RING_JITTER
+    /**Use the lock free RTP_RingJitterBuffer rather than RTP_JitterBuffer.
+       This must be set before the jitter buffer is created by
+       SetJitterBufferSize().
+      */
+    void SetRingJitterBuffer(
+      PBoolean enable         ///< Use the ring jitter buffer
+    ) { ringJitterBuffer = enable; }
+
+    /**Indicate the lock free ring jitter buffer is used.
+      */
+    PBoolean UseRingJitterBuffer() const { return ringJitterBuffer; }
+#endif
+
     /**Modifies the QOS specifications for this RTP session*/
     virtual PBoolean ModifyQOS(RTP_QOS * )
     { return FALSE; }
@@ -738,6 +754,44 @@ class RTP_Session : public PObject
     { return PINDEX(-1); }
   //@}
 
+#ifdef H323_RTP_REACTOR
+  /**@name Functions added to RTP reactor */
+  //@{
+    /**Set the endpoint wide reactor used to read this session.
+       If NULL (the default) a jitter buffer uses its own thread.
+      */
+    void SetReactor(RTP_Reactor * r) { reactor = r; }
+
+    /**Get the endpoint wide reactor used to read this session.
+      */
+    RTP_Reactor * GetReactor() const { return reactor; }
+
+    /**Indicate the sockets of the session can be monitored by the reactor.
+       Sessions that receive packets other than by their own sockets, for
+       example multiplexed or tunneled media, must return FALSE.
+      */
+    virtual PBoolean IsReactorCapable() const
+    { return FALSE; }
+
+    /**Read a single data packet the reactor has indicated is waiting.
+      */
+    virtual SendReceiveStatus ReadReadyData(
+      RTP_DataFrame & /*frame*/   ///<  Frame read from the RTP session
+    ) { return e_AbortTransport; }
+
+    /**Read a single control packet the reactor has indicated is waiting.
+      */
+    virtual SendReceiveStatus ReadReadyControl()
+    { return e_AbortTransport; }
+
+    /**Indicate data packets have already been read from the socket and are
+       waiting to be collected by ReadReadyData(), eg by a batched read.
+      */
+    virtual PBoolean HasReadyData() const
+    { return FALSE; }
+  //@}
+#endif
+
   protected:
     void AddReceiverReport(RTP_ControlFrame::ReceiverReport & receiver);
 
@@ -811,6 +865,14 @@ class RTP_Session : public PObject
 #ifdef H323_RTP_AGGREGATE
     PHandleAggregator * aggregator;
 #endif
+
+#ifdef H323_RTP_REACTOR
+    RTP_Reactor * reactor;
+#endif
+
+#ifdef H323_RING_JITTER
+    PBoolean ringJitterBuffer;
+#endif
 };
 
 
@@ -1152,6 +1214,76 @@ class RTP_UDP : public RTP_Session
     PINDEX GetControlSocketHandle() const
     { return controlSocket != NULL ? controlSocket->GetHandle() : -1; }
 
+#ifdef H323_RTP_REACTOR
+    virtual PBoolean IsReactorCapable() const;
+    virtual SendReceiveStatus ReadReadyData(RTP_DataFrame & frame);
+    virtual SendReceiveStatus ReadReadyControl();
+    virtual PBoolean HasReadyData() const;
+#endif
+
+#ifdef H323_RTP_BATCHIO
+  /**@name Batched I/O */
+  //@{
+    /**Set the number of data packets read from the socket with a single
+       recvmmsg() call. The packets are held in a ring of pre-allocated
+       frames and handed out one at a time by ReadData(). A size of 1 (the
+       default) reads each packet with its own system call.
+      */
+    void SetReceiveBatchSize(
+      PINDEX size             ///< Maximum number of packets per read
+    );
+
+    /**Get the number of data packets read with a single call.
+      */
+    PINDEX GetReceiveBatchSize() const { return rxBatchSize; }
+
+    /**Set the number of data packets queued by WriteData() before they are
+       sent with a single sendmmsg() call. The queue is also sent when a
+       frame with the marker bit set is written, or FlushData() is called,
+       so this is only suitable for media with a marker at the end of each
+       burst such as video, or for relays that call FlushData() themselves.
+       A size of 1 (the default) sends each packet immediately.
+      */
+    void SetSendBatchSize(
+      PINDEX size             ///< Maximum number of packets per write
+    );
+
+    /**Get the number of data packets sent with a single call.
+      */
+    PINDEX GetSendBatchSize() const { return txBatchSize; }
+
+    /**Send all data packets queued by WriteData().
+      */
+    PBoolean FlushData();
+
+    /**Get the number of batched read system calls that returned data.
+      */
+    DWORD GetReceiveBatchCalls() const { return rxBatchCalls; }
+
+    /**Get the number of packets received by batched reads.
+       Divide by GetReceiveBatchCalls() for the average batch size achieved.
+      */
+    DWORD GetReceiveBatchPackets() const { return rxBatchPackets; }
+
+    /**Get the largest number of packets received by one batched read.
+      */
+    DWORD GetReceiveBatchMaximum() const { return rxBatchMaximum; }
+
+    /**Get the number of batched write system calls.
+      */
+    DWORD GetSendBatchCalls() const { return txBatchCalls; }
+
+    /**Get the number of packets sent by batched writes.
+       Divide by GetSendBatchCalls() for the average batch size achieved.
+      */
+    DWORD GetSendBatchPackets() const { return txBatchPackets; }
+
+    /**Get the largest number of packets sent by one batched write.
+      */
+    DWORD GetSendBatchMaximum() const { return txBatchMaximum; }
+  //@}
+#endif
+
   protected:
     SendReceiveStatus ReadDataPDU(RTP_DataFrame & frame);
     SendReceiveStatus ReadControlPDU();
@@ -1160,6 +1292,43 @@ class RTP_UDP : public RTP_Session
       PBYTEArray & frame,
       PBoolean fromDataChannel
     );
+    SendReceiveStatus OnReadDataOrControlPDU(
+      PUDPSocket & socket,
+      PBYTEArray & frame,
+      PBoolean fromDataChannel,
+      const PIPSocket::Address & addr,
+      WORD port
+    );
+    SendReceiveStatus OnReadError(
+      int errorNumber,
+      PBoolean fromDataChannel,
+      const PString & errorText
+    );
+    PBoolean UsesPlainSockets() const;
+
+#ifdef H323_RTP_BATCHIO
+    SendReceiveStatus ReadBatchedDataPDU(RTP_DataFrame & frame, PINDEX & pduSize);
+    PBoolean WriteBatchedData(RTP_DataFrame & frame);
+    void AllocateBatchBuffers();
+
+    PINDEX          rxBatchSize;
+    RTP_DataFrame * rxFrames;
+    RTP_BatchMessages * rxMessages;
+    PINDEX          rxCount;
+    PINDEX          rxNext;
+    DWORD           rxBatchCalls;
+    DWORD           rxBatchPackets;
+    DWORD           rxBatchMaximum;
+
+    PMutex          txBatchMutex;
+    PINDEX          txBatchSize;
+    RTP_DataFrame * txFrames;
+    RTP_BatchMessages * txMessages;
+    PINDEX          txCount;
+    DWORD           txBatchCalls;
+    DWORD           txBatchPackets;
+    DWORD           txBatchMaximum;
+#endif
 
     PIPSocket::Address localAddress;
     WORD               localDataPort;
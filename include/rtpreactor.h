@@ -0,0 +1,161 @@
+/*
+ * rtpreactor.h
+ *
+ * Shared RTP socket reactor
+ *
+ * H323Plus Library
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is H323Plus Library.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Id$
+ *
+ */
+
+#ifndef __OPAL_RTPREACTOR_H
+#define __OPAL_RTPREACTOR_H
+
+#ifdef P_USE_PRAGMA
+#pragma interface
+#endif
+
+#include "rtp.h"
+
+#ifdef H323_RTP_REACTOR
+
+#include <map>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+
+/**A handle registered with the RTP reactor.
+   The reactor calls OnDataReady() or OnControlReady() from one of its
+   worker threads whenever the corresponding socket of the session has a
+   datagram waiting, so a single read will not block. OnTimeout() is called
+   periodically so the session can send its RTCP reports.
+
+   Returning FALSE from any of the call backs removes the handle from the
+   reactor, the handle is not deleted. The call backs are made without any
+   reactor lock held, so handles can be added and removed while they run.
+  */
+class RTP_ReactorHandle : public PObject
+{
+  PCLASSINFO(RTP_ReactorHandle, PObject);
+
+  public:
+    RTP_ReactorHandle(
+      RTP_Session & session   ///< Session whose sockets are to be monitored
+    );
+
+    /**A data packet is waiting on the data socket.
+      */
+    virtual PBoolean OnDataReady() = 0;
+
+    /**A control packet is waiting on the control socket.
+       The default behaviour reads the packet and passes it to
+       RTP_Session::OnReceiveControl().
+      */
+    virtual PBoolean OnControlReady();
+
+    /**Called periodically by the reactor.
+       The default behaviour sends the RTCP report if it is due.
+      */
+    virtual PBoolean OnTimeout();
+
+    /**Called when the handle has been removed from the reactor, either
+       by RTP_Reactor::RemoveHandle() or because the session was closed or a
+       read failed.
+      */
+    virtual void OnRemoved() { }
+
+    RTP_Session & GetSession() const { return session; }
+
+    /**Get the key assigned by the reactor when the handle was added.
+      */
+    unsigned GetId() const { return id; }
+
+  protected:
+    RTP_Session & session;
+
+  private:
+    unsigned id;
+    friend class RTP_Reactor;
+};
+
+
+/**This class is an endpoint wide pool of epoll threads that owns the RTP
+   and RTCP sockets of many sessions. It replaces the thread per session
+   that blocks in PSocket::Select() in RTP_UDP::ReadData().
+  */
+class RTP_Reactor : public PObject
+{
+  PCLASSINFO(RTP_Reactor, PObject);
+
+  public:
+  /**@name Construction */
+  //@{
+    /**Create the reactor and start the worker threads.
+      */
+    RTP_Reactor(
+      unsigned threadCount,           ///< Number of epoll threads
+      PINDEX stackSize = 30000        ///< Stack size for each thread
+    );
+
+    /**Stop the worker threads.
+       All handles must have been removed before this is called.
+      */
+    ~RTP_Reactor();
+  //@}
+
+  /**@name Operations */
+  //@{
+    /**Add the sockets of the handle to the least loaded worker thread.
+       Returns FALSE if the session has no valid sockets.
+      */
+    PBoolean AddHandle(
+      RTP_ReactorHandle * handle
+    );
+
+    /**Remove the handle from the reactor.
+       When this returns the handle is not in use by any worker thread and
+       may be deleted, unless it was called from a call back of the handle
+       itself, in which case the handle is free once the call back returns.
+      */
+    PBoolean RemoveHandle(
+      RTP_ReactorHandle * handle
+    );
+
+    /**Get the number of worker threads.
+      */
+    unsigned GetThreadCount() const { return (unsigned)workers.size(); }
+
+    /**Get the number of handles currently registered.
+      */
+    PINDEX GetHandleCount() const;
+  //@}
+
+  protected:
+    class Worker;
+
+    std::vector<Worker *> workers;
+    PMutex   workersMutex;
+    unsigned nextId;
+};
+
+#endif // H323_RTP_REACTOR
+
+#endif // __OPAL_RTPREACTOR_H
+
+
+/////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,211 @@
+/*
+ * signalreactor.h
+ *
+ * Shared H.225/H.245 signalling reactor
+ *
+ * H323Plus Library
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is H323Plus Library.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Id$
+ *
+ */
+
+#ifndef __OPAL_SIGNALREACTOR_H
+#define __OPAL_SIGNALREACTOR_H
+
+#ifdef P_USE_PRAGMA
+#pragma interface
+#endif
+
+#include "transports.h"
+
+#ifdef H323_SIGNAL_REACTOR
+
+#include <map>
+#include <deque>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+
+/**A signalling channel registered with the signalling reactor.
+   The reactor reads complete TPKT frames from the transport on its I/O
+   thread and calls OnReceivedPDU() for each of them from one of its worker
+   threads. A handle is only ever run by one worker at a time, so the PDUs
+   of a channel are processed in the order they arrived.
+  */
+class H323SignalReactorHandle : public PObject
+{
+  PCLASSINFO(H323SignalReactorHandle, PObject);
+
+  public:
+    H323SignalReactorHandle(
+      H323TransportTCP & transport,             ///< Transport to be read
+      const PTimeInterval & keepAlive = 0       ///< Interval of empty TPKT keep alives, zero for none
+    );
+
+    /**A PDU has been read from the transport, or the read failed.
+       If ok is FALSE the error code of the transport gives the reason, it
+       is PChannel::Timeout when nothing arrived within the read timeout of
+       the transport.
+
+       Returning FALSE stops the handle, there are no more call backs apart
+       from OnStopped().
+      */
+    virtual PBoolean OnReceivedPDU(
+      PBoolean ok,              ///< PDU was read successfully
+      PBYTEArray & pdu          ///< PDU read from the transport
+    ) = 0;
+
+    /**Called from the worker thread after OnReceivedPDU() returned FALSE.
+       This is not called when the handle is taken out of the reactor with
+       H323SignalReactor::RemoveHandle().
+      */
+    virtual void OnStopped() { }
+
+    H323TransportTCP & GetTransport() const { return transport; }
+
+    /**Get the key assigned by the reactor when the handle was added.
+      */
+    unsigned GetId() const { return id; }
+
+  protected:
+    H323TransportTCP & transport;
+    PTimeInterval      keepAliveInterval;
+
+  private:
+    struct Event {
+      enum Kinds {
+        ReceivedPDU,
+        ReadFailed,
+        SendKeepAlive
+      } kind;
+      PBYTEArray pdu;
+      PChannel::Errors error;
+      int osError;
+    };
+
+    unsigned          id;
+    int               fd;       // Our own duplicate of the socket handle
+    std::deque<Event> events;
+    PBoolean          scheduled;
+    PBoolean          paused;
+    PBoolean          stopped;
+    PBoolean          removed;
+    PThread         * runningThread;
+    PSyncPoint        finished;
+    PTimeInterval     lastRead;
+    PTimeInterval     lastKeepAlive;
+
+    friend class H323SignalReactor;
+};
+
+
+/**This class is an endpoint wide epoll loop that reads the H.225 and H.245
+   TCP channels of many calls, with a fixed pool of worker threads that
+   process the PDUs. It replaces the H225TransportThread, H245TransportThread
+   and H225CallThread that otherwise block in H323Transport::ReadPDU() for
+   the whole call, and the keep alive timers that go with them.
+  */
+class H323SignalReactor : public PObject
+{
+  PCLASSINFO(H323SignalReactor, PObject);
+
+  public:
+  /**@name Construction */
+  //@{
+    /**Create the reactor and start the I/O and worker threads.
+      */
+    H323SignalReactor(
+      unsigned workerCount,           ///< Number of threads processing PDUs
+      PINDEX stackSize = 30000        ///< Stack size for each thread
+    );
+
+    /**Stop the threads.
+       All handles must have been removed before this is called.
+      */
+    ~H323SignalReactor();
+  //@}
+
+  /**@name Operations */
+  //@{
+    /**Start reading the transport of the handle.
+       Any PDUs already buffered by the transport are queued at once.
+       Returns FALSE if the transport has no open socket.
+      */
+    PBoolean AddHandle(
+      H323SignalReactorHandle * handle
+    );
+
+    /**Remove the handle from the reactor.
+       Events not yet processed are discarded. When this returns the handle
+       is not in use by any worker thread and may be deleted, unless it was
+       called from the call back of the handle itself.
+      */
+    PBoolean RemoveHandle(
+      H323SignalReactorHandle * handle
+    );
+
+    /**Determine if the transport can be read by the reactor.
+       Only plain TCP transports qualify, not TLS or the tunnelling and NAT
+       traversal transports that override H323Transport::ReadPDU().
+      */
+    static PBoolean IsSupportedTransport(
+      H323Transport & transport
+    );
+
+    /**Get the number of worker threads.
+      */
+    unsigned GetWorkerCount() const { return (unsigned)workers.size(); }
+
+    /**Get the number of handles currently registered.
+      */
+    PINDEX GetHandleCount() const;
+  //@}
+
+  protected:
+    typedef H323SignalReactorHandle::Event Event;
+    typedef std::map<unsigned, H323SignalReactorHandle *> HandleMap;
+
+    PDECLARE_NOTIFIER(PThread, H323SignalReactor, IOMain);
+    PDECLARE_NOTIFIER(PThread, H323SignalReactor, WorkerMain);
+
+    PBoolean Attach(H323SignalReactorHandle & handle);
+    void Detach(H323SignalReactorHandle & handle);
+    void SetReading(H323SignalReactorHandle & handle, PBoolean enable);
+    void ReadHandle(H323SignalReactorHandle & handle);
+    void CheckTimers(H323SignalReactorHandle & handle, const PTimeInterval & now);
+    void QueueEvent(H323SignalReactorHandle & handle, const Event & event);
+    void RunHandle(H323SignalReactorHandle & handle);
+    PBoolean Dispatch(H323SignalReactorHandle & handle, Event & event);
+
+    int                    epollFd;
+    int                    wakeFd;
+    PBoolean               running;
+    PThread              * ioThread;
+    std::vector<PThread *> workers;
+    HandleMap              handles;
+    std::deque<unsigned>   runQueue;
+    PSemaphore             available;
+    unsigned               nextId;
+    mutable PMutex         mutex;
+};
+
+#endif // H323_SIGNAL_REACTOR
+
+#endif // __OPAL_SIGNALREACTOR_H
+
+
+/////////////////////////////////////////////////////////////////////////////
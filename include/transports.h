@@ -931,11 +931,26 @@ class H323TransportTCP : public H323TransportIP
        This will read using the transports mechanism for PDU boundaries, for
        example UDP is a single Read() call, while for TCP there is a TPKT
        header that indicates the size of the PDU.
+
+       The TCP transport reads as much as is available into an internal
+       buffer, so several PDUs arriving together only need one Read().
       */
     PBoolean ReadPDU(
       PBYTEArray & pdu   ///<  PDU read from transport
     );
 
+#ifdef H323_SIGNAL_REACTOR
+    /**Read a protocol data unit without blocking.
+       This takes whatever the socket has waiting into the internal buffer
+       and sets complete if a whole PDU is then available. It returns FALSE
+       if the transport was closed or the read failed.
+      */
+    PBoolean PollPDU(
+      PBYTEArray & pdu,     ///<  PDU read from transport
+      PBoolean & complete   ///<  Set if a whole PDU was read
+    );
+#endif
+
     /**Extract a protocol data unit from the transport
       */
     PBoolean ExtractPDU(
@@ -1012,8 +1027,32 @@ class H323TransportTCP : public H323TransportIP
      */
     virtual PBoolean OnOpen();
 
+    /**Write the TPKT header and the PDU with a single gather write if the
+       socket allows it.
+      */
+    PBoolean WriteTPKT(
+      const BYTE * header,
+      const PBYTEArray & pdu
+    );
+
+    /**Take the next complete PDU out of the read buffer, if there is one.
+       Sets ok to FALSE if the buffered data is not a valid TPKT.
+      */
+    PBoolean TakeBufferedPDU(
+      PBYTEArray & pdu,
+      PBoolean & ok
+    );
+
+    /**Make room in the read buffer for the rest of the current PDU.
+      */
+    void PrepareReadBuffer();
+
 
     PTCPSocket * h245listener;
+
+    PBYTEArray readBuffer;
+    PINDEX     readBufferStart;
+    PINDEX     readBufferEnd;
 };
 
 
@@ -0,0 +1,211 @@
+/*
+ * clocktest.cxx
+ *
+ * Benchmark of the shared media clock against a thread per channel.
+ *
+ * H323Plus Library
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is H323Plus Library.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Id$
+ *
+ */
+
+#include <ptlib.h>
+
+#include "main.h"
+
+#ifdef H323_MEDIA_CLOCK
+
+#include "mediaclock.h"
+
+#include <time.h>
+
+#define DEFAULT_CHANNELS  200
+#define CLOCK_WORKERS     4
+#define FRAME_PERIOD      20000     // Microseconds, 20ms audio frames
+#define FRAME_SAMPLES     160
+#define RUN_SECONDS       5
+
+
+static PInt64 MicrosecondsNow()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (PInt64)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+
+// About the work of reading and encoding one frame of audio
+static unsigned SimulateFrame(unsigned seed)
+{
+  short samples[FRAME_SAMPLES];
+  unsigned sum = seed;
+  for (PINDEX i = 0; i < FRAME_SAMPLES; i++) {
+    samples[i] = (short)(sum*1103515245 + 12345);
+    sum += samples[i] < 0 ? -samples[i] : samples[i];
+  }
+  return sum;
+}
+
+
+class ClockChannel : public H323MediaClockHandle
+{
+  PCLASSINFO(ClockChannel, H323MediaClockHandle);
+
+  public:
+    ClockChannel()
+      : H323MediaClockHandle(FRAME_PERIOD), work(0) { }
+
+    virtual PBoolean OnTick()
+    {
+      work = SimulateFrame(work);
+      return TRUE;
+    }
+
+  protected:
+    unsigned work;
+};
+
+
+/* The way a transmit thread without a sound device keeps real time, a
+   sleep per frame in every channel.
+ */
+class ThreadChannel : public PThread
+{
+  PCLASSINFO(ThreadChannel, PThread);
+
+  public:
+    ThreadChannel(PInt64 stop)
+      : PThread(30000, NoAutoDeleteThread, HighPriority, "Bench TX"),
+        stopTime(stop), work(0), ticks(0), totalLateness(0), maximumLateness(0)
+    {
+      Resume();
+    }
+
+    virtual void Main()
+    {
+      PAdaptiveDelay delay;
+      delay.Delay(FRAME_PERIOD/1000);   // Sets the reference time
+      PInt64 start = MicrosecondsNow();
+
+      for (PInt64 k = 1; ; k++) {
+        delay.Delay(FRAME_PERIOD/1000);
+        PInt64 now = MicrosecondsNow();
+        if (now >= stopTime)
+          break;
+
+        PInt64 lateness = now - (start + k*FRAME_PERIOD);
+        if (lateness < 0)
+          lateness = 0;
+        totalLateness += lateness;
+        if (lateness > maximumLateness)
+          maximumLateness = (unsigned)lateness;
+        ticks++;
+
+        work = SimulateFrame(work);
+      }
+    }
+
+    unsigned GetAverageLateness() const
+    { return ticks > 0 ? (unsigned)(totalLateness/ticks) : 0; }
+
+    PInt64   stopTime;
+    unsigned work;
+    DWORD    ticks;
+    PInt64   totalLateness;
+    unsigned maximumLateness;
+};
+
+
+static void Report(const char * name, unsigned channels, PInt64 ticks, PInt64 totalLateness,
+                   unsigned maximumLateness, PInt64 skipped, unsigned threads)
+{
+  cout << "        " << setw(16) << left << name << right
+       << channels << " channels on " << threads << " threads: "
+       << ticks << " ticks, lateness avg=" << (ticks > 0 ? (unsigned)(totalLateness/ticks) : 0)
+       << "us max=" << maximumLateness << "us, skipped=" << skipped << endl;
+}
+
+
+PBoolean TestMediaClock(unsigned count)
+{
+  unsigned channels = count > 0 ? count : DEFAULT_CHANNELS;
+  PInt64 expected = (PInt64)channels*RUN_SECONDS*1000000/FRAME_PERIOD;
+
+  cout << "        " << channels << " channels of " << FRAME_PERIOD/1000 << "ms frames for "
+       << RUN_SECONDS << " seconds, about " << expected << " ticks each run" << endl;
+
+  // Shared clock
+  PInt64 clockTicks = 0;
+  PInt64 clockLateness = 0;
+  unsigned clockMaximum = 0;
+  PInt64 clockSkipped = 0;
+  {
+    H323MediaClock clock(CLOCK_WORKERS);
+    std::vector<ClockChannel *> handles;
+    unsigned i;
+    for (i = 0; i < channels; i++) {
+      handles.push_back(new ClockChannel);
+      clock.AddHandle(handles.back());
+    }
+
+    PThread::Sleep(RUN_SECONDS*1000);
+
+    for (i = 0; i < channels; i++) {
+      ClockChannel * handle = handles[i];
+      clock.RemoveHandle(handle);
+      clockTicks += handle->GetTickCount();
+      clockLateness += (PInt64)handle->GetAverageLateness()*handle->GetTickCount();
+      if (handle->GetMaximumLateness() > clockMaximum)
+        clockMaximum = handle->GetMaximumLateness();
+      clockSkipped += handle->GetSkippedTicks();
+      delete handle;
+    }
+  }
+  Report("media clock", channels, clockTicks, clockLateness, clockMaximum, clockSkipped, CLOCK_WORKERS);
+
+  // Thread per channel
+  PInt64 threadTicks = 0;
+  PInt64 threadLateness = 0;
+  unsigned threadMaximum = 0;
+  {
+    PInt64 stop = MicrosecondsNow() + (PInt64)RUN_SECONDS*1000000;
+    std::vector<ThreadChannel *> threads;
+    unsigned i;
+    for (i = 0; i < channels; i++)
+      threads.push_back(new ThreadChannel(stop));
+
+    for (i = 0; i < channels; i++) {
+      ThreadChannel * thread = threads[i];
+      thread->WaitForTermination();
+      threadTicks += thread->ticks;
+      threadLateness += thread->totalLateness;
+      if (thread->maximumLateness > threadMaximum)
+        threadMaximum = thread->maximumLateness;
+      delete thread;
+    }
+  }
+  Report("thread/channel", channels, threadTicks, threadLateness, threadMaximum, 0, channels);
+
+  // Allow for the start and stop, the clock should not lose ticks at this load
+  return Check(clockTicks + clockSkipped >= expected*9/10,
+               psprintf("media clock ran %u%% of the expected ticks", (unsigned)(clockTicks*100/expected)));
+}
+
+#endif // H323_MEDIA_CLOCK
+
+
+// End of File ///////////////////////////////////////////////////////////////
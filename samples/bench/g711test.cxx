@@ -0,0 +1,240 @@
+/*
+ * g711test.cxx
+ *
+ * Self test and benchmark of the whole frame G.711 kernels.
+ *
+ * H323Plus Library
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is H323Plus Library.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Id$
+ *
+ */
+
+#include <ptlib.h>
+
+#include "main.h"
+
+#ifndef NO_H323_AUDIO_CODECS
+
+#include "codecs.h"
+
+#define DEFAULT_FRAMES    100000
+#define FRAME_SAMPLES     160
+
+static volatile unsigned Sink;
+
+
+/* EncodeSample() and DecodeSample() call linear2alaw() and friends from
+   g711.h for each sample, they are the reference for the block kernels.
+ */
+struct G711Law {
+  const char * name;
+  int   (*encodeSample)(short sample);
+  short (*decodeSample)(int code);
+  void  (*encodeBlock)(const short * samples, BYTE * codes, unsigned count);
+  void  (*decodeBlock)(const BYTE * codes, short * samples, unsigned count);
+};
+
+static const G711Law Laws[] = {
+  { "A-law", H323_ALawCodec::EncodeSample, H323_ALawCodec::DecodeSample, H323_ALawCodec::EncodeBlock, H323_ALawCodec::DecodeBlock },
+  { "uLaw", H323_muLawCodec::EncodeSample, H323_muLawCodec::DecodeSample, H323_muLawCodec::EncodeBlock, H323_muLawCodec::DecodeBlock }
+};
+
+
+static PBoolean TestExact(const G711Law & law)
+{
+  PShortArray input(65536);
+  PBYTEArray codes(65536);
+  unsigned i;
+  for (i = 0; i < 65536; i++)
+    input[i] = (short)(i - 32768);
+
+  // All inputs in one block, the vector loops with no tail
+  law.encodeBlock(input, codes.GetPointer(), 65536);
+  unsigned vectorErrors = 0;
+  for (i = 0; i < 65536; i++) {
+    if (codes[i] != (BYTE)law.encodeSample(input[i]))
+      vectorErrors++;
+  }
+
+  // One sample at a time, only the scalar table tail
+  unsigned tableErrors = 0;
+  for (i = 0; i < 65536; i++) {
+    BYTE code;
+    law.encodeBlock(&input[i], &code, 1);
+    if (code != (BYTE)law.encodeSample(input[i]))
+      tableErrors++;
+  }
+
+  // Unaligned and an odd length, so every path meets every input
+  law.encodeBlock(&input[3], codes.GetPointer(), 65533);
+  unsigned offsetErrors = 0;
+  for (i = 0; i < 65533; i++) {
+    if (codes[i] != (BYTE)law.encodeSample(input[i+3]))
+      offsetErrors++;
+  }
+
+  BYTE allCodes[256];
+  short decoded[256];
+  for (i = 0; i < 256; i++)
+    allCodes[i] = (BYTE)i;
+  law.decodeBlock(allCodes, decoded, 256);
+  unsigned decodeErrors = 0;
+  for (i = 0; i < 256; i++) {
+    if (decoded[i] != law.decodeSample(i))
+      decodeErrors++;
+  }
+
+  PString name = law.name;
+  PBoolean ok = Check(vectorErrors == 0, name + psprintf(" block encode of all 65536 inputs matches g711.h (%u differ)", vectorErrors));
+  ok = Check(tableErrors == 0, name + psprintf(" table encode of all 65536 inputs matches g711.h (%u differ)", tableErrors)) && ok;
+  ok = Check(offsetErrors == 0, name + psprintf(" unaligned odd length encode matches g711.h (%u differ)", offsetErrors)) && ok;
+  ok = Check(decodeErrors == 0, name + psprintf(" decode of all 256 codes matches g711.h (%u differ)", decodeErrors)) && ok;
+  return ok;
+}
+
+
+static PBoolean TestPacking()
+{
+  BYTE codes[FRAME_SAMPLES];
+  BYTE packed[FRAME_SAMPLES];
+  BYTE unpacked[FRAME_SAMPLES];
+
+  PBoolean ok = TRUE;
+  for (unsigned bits = 2; bits <= 5; bits++) {
+    unsigned i;
+    for (i = 0; i < FRAME_SAMPLES; i++)
+      codes[i] = (BYTE)((i*37 + bits) & ((1 << bits) - 1));
+
+    unsigned bytes = H323StreamedAudioCodec::PackCodes(codes, FRAME_SAMPLES, bits, packed);
+    unsigned count = H323StreamedAudioCodec::UnpackCodes(packed, bytes, bits, unpacked);
+
+    ok = Check(bytes == FRAME_SAMPLES*bits/8 && count == FRAME_SAMPLES && memcmp(codes, unpacked, FRAME_SAMPLES) == 0,
+               psprintf("G.726 %u bit codes pack into %u bytes and unpack again", bits, bytes)) && ok;
+
+    // Least significant bits first, as the per position switches did
+    if (bits == 4) {
+      unsigned errors = 0;
+      for (i = 0; i < FRAME_SAMPLES/2; i++) {
+        if (packed[i] != (BYTE)(codes[2*i] | (codes[2*i+1] << 4)))
+          errors++;
+      }
+      ok = Check(errors == 0, "G.726 4 bit codes keep the low nibble first layout") && ok;
+    }
+  }
+
+  return ok;
+}
+
+
+static PInt64 Microseconds()
+{
+  PTime now;
+  return (PInt64)now.GetTimeInSeconds()*1000000 + now.GetMicrosecond();
+}
+
+
+static void ReportRate(const char * what, unsigned frames, PInt64 elapsed, PInt64 reference)
+{
+  if (elapsed <= 0)
+    elapsed = 1;
+  cout << "        " << setw(26) << left << what << right
+       << setw(7) << (unsigned)(elapsed*1000/frames) << " ns/frame, "
+       << setw(5) << (unsigned)((PInt64)frames*FRAME_SAMPLES/elapsed) << " Msamples/s";
+  if (reference > 0)
+    cout << ", " << setprecision(2) << fixed << (double)reference/elapsed << "x the reference";
+  cout << endl;
+}
+
+
+static void TestThroughput(const G711Law & law, unsigned frames)
+{
+  // A tone with some noise, so every segment of the companding is used
+  short samples[FRAME_SAMPLES];
+  unsigned seed = 1;
+  unsigned i;
+  for (i = 0; i < FRAME_SAMPLES; i++) {
+    seed = seed*1103515245 + 12345;
+    samples[i] = (short)((i*4099 % 32768) - 16384 + (int)((seed >> 16) & 0x3ff) - 512);
+  }
+
+  BYTE codes[FRAME_SAMPLES];
+  short decoded[FRAME_SAMPLES];
+  unsigned check = 0;
+
+  PInt64 start = Microseconds();
+  unsigned f;
+  for (f = 0; f < frames; f++) {
+    for (i = 0; i < FRAME_SAMPLES; i++)
+      codes[i] = (BYTE)law.encodeSample(samples[i]);
+    check += codes[f % FRAME_SAMPLES];
+  }
+  PInt64 encodeReference = Microseconds() - start;
+
+  start = Microseconds();
+  for (f = 0; f < frames; f++) {
+    law.encodeBlock(samples, codes, FRAME_SAMPLES);
+    check += codes[f % FRAME_SAMPLES];
+  }
+  PInt64 encodeBlock = Microseconds() - start;
+
+  start = Microseconds();
+  for (f = 0; f < frames; f++) {
+    for (i = 0; i < FRAME_SAMPLES; i++)
+      decoded[i] = law.decodeSample(codes[i]);
+    check += decoded[f % FRAME_SAMPLES];
+  }
+  PInt64 decodeReference = Microseconds() - start;
+
+  start = Microseconds();
+  for (f = 0; f < frames; f++) {
+    law.decodeBlock(codes, decoded, FRAME_SAMPLES);
+    check += decoded[f % FRAME_SAMPLES];
+  }
+  PInt64 decodeBlock = Microseconds() - start;
+
+  PString name = law.name;
+  ReportRate(name + " encode per sample", frames, encodeReference, 0);
+  ReportRate(name + " encode block", frames, encodeBlock, encodeReference);
+  ReportRate(name + " decode per sample", frames, decodeReference, 0);
+  ReportRate(name + " decode block", frames, decodeBlock, decodeReference);
+
+  // Keeps the loops from being optimised away
+  Sink = check;
+}
+
+
+PBoolean TestG711(unsigned count)
+{
+  unsigned frames = count > 0 ? count : DEFAULT_FRAMES;
+
+  PBoolean ok = TRUE;
+  PINDEX l;
+  for (l = 0; l < PARRAYSIZE(Laws); l++)
+    ok = TestExact(Laws[l]) && ok;
+  ok = TestPacking() && ok;
+
+  cout << "        " << frames << " frames of " << FRAME_SAMPLES << " samples" << endl;
+  for (l = 0; l < PARRAYSIZE(Laws); l++)
+    TestThroughput(Laws[l], frames);
+
+  return ok;
+}
+
+#endif // NO_H323_AUDIO_CODECS
+
+
+// End of File ///////////////////////////////////////////////////////////////
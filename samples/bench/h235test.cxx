@@ -0,0 +1,303 @@
+/*
+ * h235test.cxx
+ *
+ * Self test and benchmark of the H.235 AES-GCM media profile.
+ *
+ * H323Plus Library
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is H323Plus Library.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Id$
+ *
+ */
+
+#include <ptlib.h>
+
+#include "main.h"
+
+#ifdef H323_H235_AEAD
+
+#include "h235/h2351.h"
+#include "h235/h235crypto.h"
+#include "rtp.h"
+
+extern "C" {
+#include <openssl/evp.h>
+}
+
+#define TEST_SSRC         0x11223344
+#define TEST_KEY_LENGTH   16
+#define DEFAULT_PACKETS   100000
+
+
+static void MakePacket(RTP_DataFrame & frame, WORD seq, DWORD timestamp, PINDEX size)
+{
+  frame.SetPayloadSize(size);
+  frame.SetPayloadType(RTP_DataFrame::PCMU);
+  frame.SetMarker(FALSE);
+  frame.SetSequenceNumber(seq);
+  frame.SetTimestamp(timestamp);
+  frame.SetSyncSource(TEST_SSRC);
+
+  BYTE * payload = frame.GetPayloadPtr();
+  for (PINDEX i = 0; i < size; i++)
+    payload[i] = (BYTE)(i*7 + seq);
+}
+
+
+static PBoolean Encrypt(H235CryptoEngine & engine, RTP_DataFrame & frame)
+{
+  PINDEX length = frame.GetPayloadSize();
+  if (!frame.SetPayloadSize(length + AEAD_TAG_LEN))
+    return FALSE;
+  const BYTE * header = frame.GetPointer();
+  frame.SetPayloadSize(engine.EncryptAuthenticated(frame.GetPayloadPtr(), length, header, frame.GetHeaderSize()));
+  return frame.GetPayloadSize() > 0;
+}
+
+
+static PBoolean Decrypt(H235CryptoEngine & engine, RTP_DataFrame & frame)
+{
+  const BYTE * header = frame.GetPointer();
+  frame.SetPayloadSize(engine.DecryptAuthenticated(frame.GetPayloadPtr(), frame.GetPayloadSize(), header, frame.GetHeaderSize()));
+  return frame.GetPayloadSize() > 0;
+}
+
+
+/* SRTP AES-GCM (RFC 7714) done directly with OpenSSL, independently of
+   H235CryptoEngine, to show the packets are laid out the same way.
+ */
+static PINDEX ReferenceEncrypt(const PBYTEArray & material, DWORD roc,
+                               const BYTE * header, PINDEX headerSize,
+                               const BYTE * plain, PINDEX length, BYTE * out)
+{
+  BYTE iv[AEAD_NONCE_LEN];
+  iv[0] = iv[1] = 0;
+  memcpy(iv+2, header+8, 4);
+  iv[6] = (BYTE)(roc >> 24);
+  iv[7] = (BYTE)(roc >> 16);
+  iv[8] = (BYTE)(roc >> 8);
+  iv[9] = (BYTE)roc;
+  memcpy(iv+10, header+2, 2);
+  for (PINDEX i = 0; i < AEAD_NONCE_LEN; i++)
+    iv[i] ^= material[TEST_KEY_LENGTH + i];
+
+  EVP_CIPHER_CTX * ctx = EVP_CIPHER_CTX_new();
+  int len = 0;
+  int final = 0;
+  PBoolean ok = EVP_EncryptInit_ex(ctx, EVP_aes_128_gcm(), NULL, NULL, NULL)
+             && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, AEAD_NONCE_LEN, NULL)
+             && EVP_EncryptInit_ex(ctx, NULL, NULL, (const BYTE *)material, iv)
+             && EVP_EncryptUpdate(ctx, NULL, &len, header, headerSize)
+             && EVP_EncryptUpdate(ctx, out, &len, plain, length)
+             && EVP_EncryptFinal_ex(ctx, out + len, &final)
+             && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, AEAD_TAG_LEN, out + len + final);
+  EVP_CIPHER_CTX_free(ctx);
+
+  return ok ? len + final + AEAD_TAG_LEN : 0;
+}
+
+
+static PBoolean TestRoundTrip(const PBYTEArray & material, H235CryptoEngine & sender, H235CryptoEngine & receiver, unsigned count)
+{
+  // Start just before the sequence number wraps, so the roll over counter is used
+  WORD seq = (WORD)(0x10000 - count/2);
+  DWORD roc = 0;
+  DWORD timestamp = 1000;
+
+  unsigned mismatched = 0;
+  unsigned failed = 0;
+  unsigned corrupted = 0;
+
+  RTP_DataFrame frame(0);
+  RTP_DataFrame original(0);
+  PBYTEArray expected(2048);
+
+  for (unsigned i = 0; i < count; i++, seq++, timestamp += 160) {
+    if (seq == 0 && i > 0)
+      roc++;
+
+    MakePacket(frame, seq, timestamp, 160);
+    MakePacket(original, seq, timestamp, 160);
+
+    PINDEX expectedSize = ReferenceEncrypt(material, roc, frame.GetPointer(), frame.GetHeaderSize(),
+                                           frame.GetPayloadPtr(), 160, expected.GetPointer());
+
+    if (!Encrypt(sender, frame)) {
+      failed++;
+      continue;
+    }
+
+    if (frame.GetPayloadSize() != expectedSize || memcmp(frame.GetPayloadPtr(), (const BYTE *)expected, expectedSize) != 0)
+      mismatched++;
+
+    if (!Decrypt(receiver, frame))
+      failed++;
+    else if (frame.GetPayloadSize() != 160 || memcmp(frame.GetPayloadPtr(), original.GetPayloadPtr(), 160) != 0)
+      corrupted++;
+  }
+
+  PBoolean ok = Check(failed == 0, psprintf("%u packets across a sequence number wrap encrypt and verify (%u failed)", count, failed));
+  ok = Check(corrupted == 0, psprintf("decrypted payloads match the originals (%u differ)", corrupted)) && ok;
+  ok = Check(mismatched == 0, psprintf("packets match an independent RFC 7714 encoder (%u differ)", mismatched)) && ok;
+  return ok;
+}
+
+
+static PBoolean TestTamper(H235CryptoEngine & sender, H235CryptoEngine & receiver)
+{
+  static const char * const Changes[] = {
+    "marker bit", "payload type", "timestamp", "added CSRC", "header extension", "payload byte", "tag byte"
+  };
+
+  RTP_DataFrame good(0);
+  MakePacket(good, 100, 5000, 160);
+  if (!Encrypt(sender, good))
+    return Check(FALSE, "encrypt packet to tamper with");
+
+  PBoolean ok = TRUE;
+  for (PINDEX c = 0; c < PARRAYSIZE(Changes); c++) {
+    RTP_DataFrame frame = good;
+    frame.MakeUnique();
+
+    switch (c) {
+      case 0 :
+        frame.SetMarker(TRUE);
+        break;
+      case 1 :
+        frame.SetPayloadType(RTP_DataFrame::PCMA);
+        break;
+      case 2 :
+        frame.SetTimestamp(frame.GetTimestamp() + 1);
+        break;
+      case 3 :
+        frame.SetContribSource(0, 0x55667788);
+        break;
+      case 4 :
+        frame.SetExtensionType(0xBEDE);
+        break;
+      case 5 :
+        frame.GetPayloadPtr()[10] ^= 1;
+        break;
+      default :
+        frame.GetPayloadPtr()[frame.GetPayloadSize()-1] ^= 1;
+    }
+
+    ok = Check(!Decrypt(receiver, frame), PString("changed ") + Changes[c] + " is rejected") && ok;
+  }
+
+  RTP_DataFrame frame = good;
+  frame.MakeUnique();
+  ok = Check(Decrypt(receiver, frame), "unchanged packet still verifies after the rejects") && ok;
+  return ok;
+}
+
+
+static PBoolean TestNonceReuse(const PBYTEArray & material)
+{
+  /* A static stream, every packet the same apart from the sequence number.
+     A whole cycle later the same sequence number must not give the same
+     cipher text, or the GCM nonce was used twice under the one key.
+   */
+  H235CryptoEngine sender(ID_AES128_GCM, material);
+
+  RTP_DataFrame first(0);
+  RTP_DataFrame frame(0);
+  for (unsigned i = 0; i <= 0x10000; i++) {
+    MakePacket(frame, (WORD)i, 1000, 160);
+    memset(frame.GetPayloadPtr(), 0, 160);
+    if (!Encrypt(sender, frame))
+      return Check(FALSE, "encrypt static stream");
+    if (i == 0) {
+      first = frame;
+      first.MakeUnique();
+    }
+  }
+
+  return Check(memcmp(first.GetPayloadPtr(), frame.GetPayloadPtr(), frame.GetPayloadSize()) != 0,
+               "same sequence number and timestamp after a wrap give different cipher text");
+}
+
+
+static PBoolean TestThroughput(H235CryptoEngine & sender, H235CryptoEngine & receiver, unsigned count, PINDEX size)
+{
+  RTP_DataFrame frame(0);
+  unsigned failed = 0;
+  WORD seq = 0;
+
+  PTimeInterval start = PTimer::Tick();
+  for (unsigned i = 0; i < count; i++, seq++) {
+    MakePacket(frame, seq, i*160, size);
+    if (!Encrypt(sender, frame) || !Decrypt(receiver, frame))
+      failed++;
+  }
+  PTimeInterval elapsed = PTimer::Tick() - start;
+
+  double seconds = elapsed.GetMilliSeconds() / 1000.0;
+  if (seconds <= 0)
+    seconds = 0.001;
+  cout << "        " << size << " byte payloads: " << count << " packets encrypted and verified in "
+       << elapsed.GetMilliSeconds() << " ms, " << (unsigned)(count / seconds) << " packets/s, "
+       << (unsigned)(count * size * 8.0 / seconds / 1000000.0) << " Mbit/s" << endl;
+
+  return Check(failed == 0, psprintf("throughput run at %u bytes had no failures", (unsigned)size));
+}
+
+
+PBoolean TestH235Authenticated(unsigned count)
+{
+  if (count == 0)
+    count = DEFAULT_PACKETS;
+
+  // The sender makes the key material, the session salt follows the key
+  H235CryptoEngine sender(ID_AES128_GCM);
+  PBYTEArray material = sender.GenerateRandomKey();
+  PBoolean ok = Check(material.GetSize() == TEST_KEY_LENGTH + AEAD_SALT_LEN, "key material is key and session salt");
+
+  // Carry it to the receiver wrapped with the CBC algorithm, as H235Session does
+  H235CryptoEngine wrapper(ID_AES128);
+  PBYTEArray sessionKey = wrapper.GenerateRandomKey();
+  H235CryptoEngine unwrapper(ID_AES128, sessionKey);
+  bool padding = false;
+  PBYTEArray wrapped = wrapper.Encrypt(material, NULL, padding);
+  padding = false;
+  PBYTEArray unwrapped = unwrapper.Decrypt(wrapped, NULL, padding);
+  ok = Check(unwrapped.GetSize() >= material.GetSize() && memcmp(unwrapped, material, material.GetSize()) == 0,
+             "key material survives the media key wrap") && ok;
+
+  H235CryptoEngine receiver(ID_AES128_GCM, unwrapped);
+  ok = Check(sender.IsAuthenticated() && receiver.IsAuthenticated(), "engines are authenticated") && ok;
+
+  H235CryptoEngine shortKey(ID_AES128_GCM, sessionKey);
+  RTP_DataFrame frame(0);
+  MakePacket(frame, 1, 1, 160);
+  ok = Check(!Encrypt(shortKey, frame), "key without a session salt is refused") && ok;
+
+  ok = TestRoundTrip(material, sender, receiver, count < 0x20000 ? count : 0x20000) && ok;
+  ok = TestTamper(sender, receiver) && ok;
+  ok = TestNonceReuse(material) && ok;
+
+  H235CryptoEngine benchSender(ID_AES128_GCM, material);
+  H235CryptoEngine benchReceiver(ID_AES128_GCM, material);
+  ok = TestThroughput(benchSender, benchReceiver, count, 160) && ok;
+  ok = TestThroughput(benchSender, benchReceiver, count, 1200) && ok;
+
+  return ok;
+}
+
+#endif // H323_H235_AEAD
+
+
+// End of File ///////////////////////////////////////////////////////////////
@@ -0,0 +1,133 @@
+/*
+ * h460test.cxx
+ *
+ * Benchmark of loading the H.460 feature sets for RRQ and Setup.
+ *
+ * H323Plus Library
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is H323Plus Library.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Id$
+ *
+ */
+
+#include <ptlib.h>
+
+#include "main.h"
+
+#ifdef H323_H460
+
+#include "h460/h4601.h"
+
+#define DEFAULT_LOADS     10000
+
+
+class BenchFeatureSet : public H460_FeatureSet
+{
+  PCLASSINFO(BenchFeatureSet, H460_FeatureSet);
+
+  public:
+    PINDEX GetFeatureCount() const { return Features.GetSize(); }
+
+    // How LoadFeatureSet() found the features before the catalog
+    PBoolean LoadFromPlugins(int inst)
+    {
+      H460FeatureList featurelist;
+      H460_Feature::FeatureList(inst, featurelist, NULL);
+      for (H460FeatureList::const_iterator it = featurelist.begin(); it != featurelist.end(); ++it) {
+        H460_Feature * feat = H460_Feature::CreateFeature(it->first, inst);
+        if (feat != NULL)
+          AddFeature(feat);
+      }
+      DeleteFeatureList(featurelist);
+      return TRUE;
+    }
+};
+
+
+static PInt64 Microseconds()
+{
+  PTime now;
+  return (PInt64)now.GetTimeInSeconds()*1000000 + now.GetMicrosecond();
+}
+
+
+static PBoolean TestLoad(const char * name, int inst, unsigned loads)
+{
+  PINDEX catalogFeatures = 0;
+  PINDEX pluginFeatures = 0;
+
+  PInt64 start = Microseconds();
+  unsigned i;
+  for (i = 0; i < loads; i++) {
+    BenchFeatureSet features;
+    features.LoadFromPlugins(inst);
+    pluginFeatures = features.GetFeatureCount();
+  }
+  PInt64 plugins = Microseconds() - start;
+
+  // The first load after a refresh builds the catalog entry
+  H460_FeatureCatalog::GetCatalog().Refresh();
+  start = Microseconds();
+  {
+    BenchFeatureSet features;
+    features.LoadFeatureSet(inst);
+  }
+  PInt64 first = Microseconds() - start;
+
+  start = Microseconds();
+  for (i = 0; i < loads; i++) {
+    BenchFeatureSet features;
+    features.LoadFeatureSet(inst);
+    catalogFeatures = features.GetFeatureCount();
+  }
+  PInt64 catalog = Microseconds() - start;
+
+  if (catalog <= 0)
+    catalog = 1;
+  cout << "        " << setw(6) << left << name << right << pluginFeatures << " features, plugin scan "
+       << (unsigned)(plugins*1000/loads) << " ns/load, catalog " << (unsigned)(catalog*1000/loads)
+       << " ns/load (" << setprecision(1) << fixed << (double)plugins/catalog << "x), first catalog load "
+       << (unsigned)first << " us" << endl;
+
+  return Check(catalogFeatures == pluginFeatures,
+               psprintf("%s feature set from the catalog has the %u features of a plugin scan", name, (unsigned)pluginFeatures));
+}
+
+
+PBoolean TestH460Features(unsigned count)
+{
+  unsigned loads = count > 0 ? count : DEFAULT_LOADS;
+
+  cout << "        " << loads << " feature set loads, no endpoint filtering" << endl;
+
+  PBoolean ok = TestLoad("RRQ", H460_Feature::FeatureRas, loads);
+  ok = TestLoad("Setup", H460_Feature::FeatureSignal, loads) && ok;
+
+  // The plugin manager notifier does this when a library is loaded
+  const H460_FeatureCatalog::Entries & before = H460_FeatureCatalog::GetCatalog().GetFeatures(H460_Feature::FeatureRas);
+  size_t beforeSize = before.size();
+  H460_FeatureCatalog::GetCatalog().Refresh();
+  ok = Check(before.size() == beforeSize &&
+             H460_FeatureCatalog::GetCatalog().GetFeatures(H460_Feature::FeatureRas).size() == beforeSize,
+             "entries in use stay valid over a refresh and the catalog is rebuilt the same") && ok;
+
+  return ok;
+}
+
+#endif // H323_H460
+
+
+// End of File ///////////////////////////////////////////////////////////////
@@ -0,0 +1,137 @@
+/*
+ * main.cxx
+ *
+ * Benchmarks and self tests for the H323Plus library.
+ *
+ * H323Plus Library
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is H323Plus Library.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Id$
+ *
+ */
+
+#include <ptlib.h>
+
+#ifdef __GNUC__
+#define H323_STATIC_LIB
+#endif
+
+#include "main.h"
+#include "../../version.h"
+
+#define new PNEW
+
+PCREATE_PROCESS(H323BenchProcess);
+
+
+///////////////////////////////////////////////////////////////
+
+H323BenchProcess::H323BenchProcess()
+  : PProcess("H323Plus", "h323bench", MAJOR_VERSION, MINOR_VERSION, BUILD_TYPE, BUILD_NUMBER)
+{
+}
+
+
+PBoolean Check(PBoolean condition, const PString & what)
+{
+  cout << (condition ? "  pass  " : "  FAIL  ") << what << endl;
+  return condition;
+}
+
+
+static const struct {
+  const char * name;
+  const char * description;
+  PBoolean (*run)(unsigned count);
+} Tests[] = {
+#ifdef H323_H235_AEAD
+  { "h235", "H.235 AES-GCM media round trip, tamper, roll over and interop checks", TestH235Authenticated },
+#endif
+#ifdef H323_MEDIA_CLOCK
+  { "clock", "Media clock lateness against a thread per channel, the count is the channels", TestMediaClock },
+#endif
+#ifndef NO_H323_AUDIO_CODECS
+  { "g711", "G.711 block kernels against g711.h over every input, and throughput", TestG711 },
+  { "silence", "Silence detection cost per frame, MeasureFrame against the old level loop", TestSilence },
+#endif
+#ifdef H323_H460
+  { "h460", "H.460 feature set loads for RRQ and Setup, catalog against a plugin scan", TestH460Features },
+#endif
+  { NULL, NULL, NULL }
+};
+
+
+void H323BenchProcess::Main()
+{
+  PString spec = "a-all.n-count:h-help.";
+#if PTRACING
+  spec += "t-trace.o-output:";
+#endif
+  PINDEX t;
+  for (t = 0; Tests[t].name != NULL; t++)
+    spec += PString("-") + Tests[t].name + '.';
+
+  PArgList & args = GetArguments();
+  args.Parse(spec, FALSE);
+
+  if (args.HasOption('h')) {
+    cout << "Usage : " << GetName() << " [options]\n"
+            "Options:\n"
+            "  -a --all                : Run every test, the default if none is selected.\n";
+    for (t = 0; Tests[t].name != NULL; t++)
+      cout << "     --" << setw(18) << left << Tests[t].name << ": " << Tests[t].description << ".\n";
+    cout << "  -n --count n            : Packets or frames per test, instead of the test default.\n"
+#if PTRACING
+            "  -t --trace              : Enable trace, use multiple times for more detail.\n"
+            "  -o --output             : File for trace output, default is stderr.\n"
+#endif
+            "  -h --help               : This help message.\n"
+            << endl;
+    return;
+  }
+
+#if PTRACING
+  PTrace::Initialise(args.GetOptionCount('t'),
+                     args.HasOption('o') ? (const char *)args.GetOptionString('o') : NULL,
+                     PTrace::DateAndTime | PTrace::TraceLevel | PTrace::FileAndLine);
+#endif
+
+  // Run everything unless particular tests were asked for
+  PBoolean all = args.HasOption('a');
+  if (!all) {
+    all = TRUE;
+    for (t = 0; Tests[t].name != NULL; t++) {
+      if (args.HasOption(Tests[t].name))
+        all = FALSE;
+    }
+  }
+
+  unsigned count = args.GetOptionString('n').AsUnsigned();
+  PBoolean ok = TRUE;
+  for (t = 0; Tests[t].name != NULL; t++) {
+    if (all || args.HasOption(Tests[t].name)) {
+      cout << "\n=== " << Tests[t].name << " ===" << endl;
+      if (!Tests[t].run(count))
+        ok = FALSE;
+    }
+  }
+
+  cout << '\n' << (ok ? "All checks passed" : "CHECKS FAILED") << endl;
+  SetTerminationValue(ok ? 0 : 1);
+}
+
+
+// End of File ///////////////////////////////////////////////////////////////
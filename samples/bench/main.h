@@ -0,0 +1,68 @@
+/*
+ * main.h
+ *
+ * Benchmarks and self tests for the H323Plus library.
+ *
+ * H323Plus Library
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is H323Plus Library.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Id$
+ *
+ */
+
+#ifndef _H323Bench_MAIN_H
+#define _H323Bench_MAIN_H
+
+#include <h323.h>
+
+
+class H323BenchProcess : public PProcess
+{
+  PCLASSINFO(H323BenchProcess, PProcess)
+
+  public:
+    H323BenchProcess();
+
+    void Main();
+};
+
+
+/* Each test prints its results to cout and returns FALSE if a check
+   failed. The count is the number of packets or frames to run through,
+   zero for the default of the test.
+ */
+#ifdef H323_H235_AEAD
+PBoolean TestH235Authenticated(unsigned count);
+#endif
+#ifdef H323_MEDIA_CLOCK
+PBoolean TestMediaClock(unsigned count);
+#endif
+#ifndef NO_H323_AUDIO_CODECS
+PBoolean TestG711(unsigned count);
+PBoolean TestSilence(unsigned count);
+#endif
+#ifdef H323_H460
+PBoolean TestH460Features(unsigned count);
+#endif
+
+// Print a pass or fail line for the check and return the condition
+PBoolean Check(PBoolean condition, const PString & what);
+
+
+#endif  // _H323Bench_MAIN_H
+
+
+// End of File ///////////////////////////////////////////////////////////////
@@ -0,0 +1,225 @@
+/*
+ * silencetest.cxx
+ *
+ * Self test and benchmark of the frame measurement for silence detection.
+ *
+ * H323Plus Library
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is H323Plus Library.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Id$
+ *
+ */
+
+#include <ptlib.h>
+
+#include "main.h"
+
+#ifndef NO_H323_AUDIO_CODECS
+
+#include "codecs.h"
+
+#define DEFAULT_FRAMES    100000
+#define FRAME_SAMPLES     160
+#define TEST_FRAMES       50        // One second of 20ms frames, cycled
+
+static volatile unsigned Sink;
+
+
+// The per frame level loop DetectSilence() used before MeasureFrame()
+static unsigned OldAverageLevel(const short * pcm, unsigned count)
+{
+  int sum = 0;
+  const short * end = pcm + count;
+  while (pcm != end) {
+    if (*pcm < 0)
+      sum -= *pcm++;
+    else
+      sum += *pcm++;
+  }
+  return sum/count;
+}
+
+
+static void ReferenceMeasure(const short * pcm, unsigned count, H323AudioCodec::FrameLevels & levels)
+{
+  unsigned sum = 0;
+  levels.peak = levels.zeroCrossings = 0;
+  for (unsigned i = 0; i < count; i++) {
+    unsigned mag = pcm[i] < 0 ? -pcm[i] : pcm[i];
+    sum += mag;
+    if (mag > levels.peak)
+      levels.peak = mag;
+    if (i > 0 && (pcm[i] ^ pcm[i-1]) < 0)
+      levels.zeroCrossings++;
+  }
+  levels.average = sum/count;
+}
+
+
+// Gives DetectSilence() a frame without a sound channel
+class BenchCodec : public H323_muLawCodec
+{
+  PCLASSINFO(BenchCodec, H323_muLawCodec);
+
+  public:
+    BenchCodec()
+      : H323_muLawCodec(Encoder, FALSE, FRAME_SAMPLES) { }
+
+    void SetFrame(const short * pcm)
+    { memcpy(sampleBuffer.GetPointer(), pcm, FRAME_SAMPLES*sizeof(short)); }
+};
+
+
+/* Background noise with talk bursts of voiced (low frequency, loud) and
+   unvoiced (high frequency, quiet) speech, so every branch is taken.
+ */
+static void MakeFrames(PShortArray & frames)
+{
+  frames.SetSize(TEST_FRAMES*FRAME_SAMPLES);
+  unsigned seed = 1;
+  for (unsigned f = 0; f < TEST_FRAMES; f++) {
+    for (unsigned i = 0; i < FRAME_SAMPLES; i++) {
+      seed = seed*1103515245 + 12345;
+      int noise = (int)((seed >> 16) & 0x3f) - 32;
+      int sample;
+      if (f % 10 < 4)
+        sample = noise;
+      else if (f % 10 < 8)
+        sample = ((i*2) % 40 < 20 ? 8000 : -8000) + noise*16;
+      else
+        sample = (i & 1 ? 600 : -600) + noise;
+      frames[f*FRAME_SAMPLES + i] = (short)sample;
+    }
+  }
+}
+
+
+static PBoolean TestMeasure()
+{
+  // Every length up to a frame, so each vector loop and tail is covered.
+  // The vector loop may give a peak of 32767 for -32768, so that is left out.
+  short pcm[FRAME_SAMPLES];
+  unsigned seed = 7;
+  unsigned errors = 0;
+  unsigned frames = 0;
+  for (unsigned pass = 0; pass < 20; pass++) {
+    for (unsigned count = 1; count <= FRAME_SAMPLES; count++) {
+      for (unsigned i = 0; i < count; i++) {
+        seed = seed*1103515245 + 12345;
+        int range = pass < 10 ? 0x7fff : 0x3ff;
+        pcm[i] = (short)((int)((seed >> 8) % (2*range + 1)) - range);
+      }
+
+      H323AudioCodec::FrameLevels levels, expected;
+      H323AudioCodec::MeasureFrame(pcm, count, levels);
+      ReferenceMeasure(pcm, count, expected);
+      if (levels.average != expected.average || levels.peak != expected.peak ||
+          levels.zeroCrossings != expected.zeroCrossings || levels.average != OldAverageLevel(pcm, count))
+        errors++;
+      frames++;
+    }
+  }
+
+  return Check(errors == 0, psprintf("MeasureFrame matches a scalar reference for %u frames of 1 to %u samples (%u differ)",
+                                     frames, FRAME_SAMPLES, errors));
+}
+
+
+static PInt64 Microseconds()
+{
+  PTime now;
+  return (PInt64)now.GetTimeInSeconds()*1000000 + now.GetMicrosecond();
+}
+
+
+static void ReportCost(const char * what, unsigned frames, PInt64 elapsed, PInt64 reference)
+{
+  if (elapsed <= 0)
+    elapsed = 1;
+  cout << "        " << setw(34) << left << what << right
+       << setw(7) << (unsigned)(elapsed*1000/frames) << " ns/frame";
+  if (reference > 0)
+    cout << ", " << setprecision(2) << fixed << (double)reference/elapsed << "x the old loop";
+  cout << endl;
+}
+
+
+PBoolean TestSilence(unsigned count)
+{
+  unsigned frames = count > 0 ? count : DEFAULT_FRAMES;
+
+  PBoolean ok = TestMeasure();
+
+  PShortArray test;
+  MakeFrames(test);
+  const short * pcm = test;
+  unsigned check = 0;
+
+  cout << "        " << frames << " frames of " << FRAME_SAMPLES << " samples" << endl;
+
+  PInt64 start = Microseconds();
+  unsigned f;
+  for (f = 0; f < frames; f++)
+    check += OldAverageLevel(pcm + (f % TEST_FRAMES)*FRAME_SAMPLES, FRAME_SAMPLES);
+  PInt64 oldLoop = Microseconds() - start;
+
+  start = Microseconds();
+  for (f = 0; f < frames; f++) {
+    H323AudioCodec::FrameLevels levels;
+    H323AudioCodec::MeasureFrame(pcm + (f % TEST_FRAMES)*FRAME_SAMPLES, FRAME_SAMPLES, levels);
+    check += levels.average + levels.zeroCrossings;
+  }
+  PInt64 measure = Microseconds() - start;
+
+  ReportCost("level loop before MeasureFrame", frames, oldLoop, 0);
+  ReportCost("MeasureFrame", frames, measure, oldLoop);
+
+  static const struct {
+    const char * name;
+    H323AudioCodec::SilenceDetectionMode mode;
+  } Modes[] = {
+    { "DetectSilence adaptive", H323AudioCodec::AdaptiveSilenceDetection },
+    { "DetectSilence zero crossing", H323AudioCodec::AdaptiveZeroCrossingSilenceDetection }
+  };
+
+  for (PINDEX m = 0; m < PARRAYSIZE(Modes); m++) {
+    BenchCodec codec;
+    codec.SetSilenceDetectionMode(Modes[m].mode);
+
+    unsigned silent = 0;
+    start = Microseconds();
+    for (f = 0; f < frames; f++) {
+      codec.SetFrame(pcm + (f % TEST_FRAMES)*FRAME_SAMPLES);
+      if (codec.DetectSilence())
+        silent++;
+    }
+    PInt64 elapsed = Microseconds() - start;
+
+    ReportCost(Modes[m].name, frames, elapsed, 0);
+    cout << "          " << silent*100/frames << "% of frames silent" << endl;
+    check += silent;
+  }
+
+  // Keeps the loops from being optimised away
+  Sink = check;
+
+  return ok;
+}
+
+#endif // NO_H323_AUDIO_CODECS
+
+
+// End of File ///////////////////////////////////////////////////////////////
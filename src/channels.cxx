@@ -44,6 +44,10 @@
 #include <ptclib/random.h>
 #include <ptclib/delaychan.h>
 
+#ifdef H323_MEDIA_CLOCK
+#include "mediaclock.h"
+#endif
+
 #ifdef H323_H235
 #include <h235/h235chan.h>
 #endif
@@ -671,6 +675,12 @@ H323_RTPChannel::H323_RTPChannel(H323Connection & conn,
     rtpCallbacks(*(H323_RTP_Session *)r.GetUserData()), silenceStartTick(0),
     rec_written(0), rec_ok(false)
 {
+#ifdef H323_MEDIA_CLOCK
+  clockHandle = NULL;
+  clockState = NULL;
+  clockRunning = FALSE;
+#endif
+
   PTRACE(3, "H323RTP\t" << (receiver ? "Receiver" : "Transmitter")
          << " created using session " << GetSessionID());
 }
@@ -678,6 +688,14 @@ H323_RTPChannel::H323_RTPChannel(H323Connection & conn,
 
 H323_RTPChannel::~H323_RTPChannel()
 {
+#ifdef H323_MEDIA_CLOCK
+  if (clockHandle != NULL) {
+    endpoint.GetMediaClock()->RemoveHandle(clockHandle);
+    delete clockHandle;
+  }
+  delete clockState;
+#endif
+
   // Finished with the RTP session, this will delete the session if it is no
   // longer referenced by any logical channels.
   connection.ReleaseSession(GetSessionID());
@@ -691,6 +709,29 @@ void H323_RTPChannel::CleanUpOnTermination()
 
   PTRACE(3, "H323RTP\tCleaning up RTP " << number);
 
+#ifdef H323_MEDIA_CLOCK
+  if (clockHandle != NULL) {
+    if (!opened)
+      return;
+
+    // As for the transmit thread, closing the codec breaks a tick that is
+    // blocked reading it, and it then sees it is terminating. Only then can
+    // waiting for the tick to finish be sure to return.
+    terminating = TRUE;
+    codec->Close();
+
+    endpoint.GetMediaClock()->RemoveHandle(clockHandle);
+    clockMutex.Wait();
+    clockRunning = FALSE;
+    clockMutex.Signal();
+
+    connection.OnClosedLogicalChannel(*this);
+
+    PTRACE(3, "LogChan\tCleaned up " << number);
+    return;
+  }
+#endif
+
   // Break any I/O blocks and wait for the thread that uses this object to
   // terminate before we allow it to be deleted.
   if ((receiver ? receiveThread : transmitThread) != NULL)
@@ -836,210 +877,356 @@ class CodecReadAnalyser
 #endif
 
 
+struct H323_RTPChannel::TransmitState
+{
+  TransmitState()
+    : isAudio(FALSE), framesInPacket(1), maxFrameSize(0),
+      silent(TRUE), length(0), frameOffset(0), frameCount(0),
+      rtpTimestamp(0), nextTimestamp(0)
+#ifndef H323_FIXED_VIDEOCLOCK
+      , lastFrameTime(0)
+#endif
+#if PTRACING
+      , lastDisplayedTimestamp(0), codecReadAnalysis(NULL)
+#endif
+  { }
+
+  ~TransmitState()
+  {
+#if PTRACING
+    delete codecReadAnalysis;
+#endif
+  }
+
+  PBoolean      isAudio;
+  unsigned      framesInPacket;
+  unsigned      maxFrameSize;
+  RTP_DataFrame frame;
+  PBoolean      silent;
+  unsigned      length;
+  unsigned      frameOffset;
+  unsigned      frameCount;
+  DWORD         rtpTimestamp;
+  DWORD         nextTimestamp;
+#ifndef H323_FIXED_VIDEOCLOCK
+  PInt64        lastFrameTime;
+#endif
+#if PTRACING
+  DWORD lastDisplayedTimestamp;
+  CodecReadAnalyser * codecReadAnalysis;
+#endif
+};
+
+
 void H323_RTPChannel::Transmit()
+{
+  TransmitState state;
+  if (!StartTransmit(state))
+    return;
+
+  /* Now keep getting encoded frames from the codec, it is expected that the
+     Read() function will maintain the Real Time aspects of the transmission.
+     That is for GSM codec say with a single frame, this function will take
+     20 milliseconds to complete.
+   */
+  while (TransmitFrame(state))
+    ;
+
+  EndTransmit(state);
+}
+
+
+PBoolean H323_RTPChannel::StartTransmit(TransmitState & state)
 {
   if (terminating) {
     PTRACE(3, "H323RTP\tTransmit thread terminated on start up");
-    return;
+    return FALSE;
   }
 
   if (!codec) {
     PTRACE(3, "H323RTP\tTransmit thread terminated No Codec!");
-    return;
+    return FALSE;
   }
 
   const OpalMediaFormat & mediaFormat = codec->GetMediaFormat();
 
   // Get parameters from the codec on time and data sizes
-  PBoolean isAudio = mediaFormat.NeedsJitterBuffer();
-  unsigned framesInPacket = capability->GetTxFramesInPacket();
-  if (framesInPacket > 8) framesInPacket = 1;  // TODO: Resolve issue with G.711 20ms
+  state.isAudio = mediaFormat.NeedsJitterBuffer();
+  state.framesInPacket = capability->GetTxFramesInPacket();
+  if (state.framesInPacket > 8) state.framesInPacket = 1;  // TODO: Resolve issue with G.711 20ms
   unsigned maxSampleSize = mediaFormat.GetFrameSize();
   unsigned maxSampleTime = mediaFormat.GetFrameTime();
 
-  unsigned maxFrameSize = isAudio ? maxSampleSize*maxSampleTime : 2000;
-  RTP_DataFrame frame(framesInPacket*maxFrameSize);
+  state.maxFrameSize = state.isAudio ? maxSampleSize*maxSampleTime : 2000;
+  state.frame.SetPayloadSize(state.framesInPacket*state.maxFrameSize);
 
   rtpPayloadType = GetRTPPayloadType();
   if (rtpPayloadType == RTP_DataFrame::IllegalPayloadType) {
      PTRACE(1, "H323RTP\tReceive " << mediaFormat << " thread ended (illegal payload type)");
-     return;
+     return FALSE;
   }
-  frame.SetPayloadType(rtpPayloadType);
+  state.frame.SetPayloadType(rtpPayloadType);
 
   PTRACE(2, "H323RTP\tTransmit " << mediaFormat << " thread started:"
             " rate=" << codec->GetFrameRate() <<
             " time=" << (codec->GetFrameRate()/(mediaFormat.GetTimeUnits() > 0 ? mediaFormat.GetTimeUnits() : 1)) << "ms" <<
-            " size=" << framesInPacket << '*' << maxFrameSize << '='
-                    << (framesInPacket*maxFrameSize) );
+            " size=" << state.framesInPacket << '*' << state.maxFrameSize << '='
+                    << (state.framesInPacket*state.maxFrameSize) );
 
   // This is real time so need to keep track of elapsed milliseconds
-  PBoolean silent = TRUE;
-  unsigned length;
-  unsigned frameOffset = 0;
-  unsigned frameCount = 0;
-  DWORD rtpTimestamp = PRandom();
-  DWORD nextTimestamp = 0;
-#ifndef H323_FIXED_VIDEOCLOCK
-  PInt64 lastFrameTime = 0;
-#endif
+  state.rtpTimestamp = PRandom();
 
 #if PTRACING
-  DWORD lastDisplayedTimestamp = 0;
-  CodecReadAnalyser * codecReadAnalysis = NULL;
   if (PTrace::GetLevel() >= 5)
-    codecReadAnalysis = new CodecReadAnalyser;
+    state.codecReadAnalysis = new CodecReadAnalyser;
 #endif
 
+  return TRUE;
+}
+
 
-  /* Now keep getting encoded frames from the codec, it is expected that the
-     Read() function will maintain the Real Time aspects of the transmission.
-     That is for GSM codec say with a single frame, this function will take
-     20 milliseconds to complete.
-   */
-  while (codec->Read(frame.GetPayloadPtr()+frameOffset, length, frame)) {
-    // Calculate the timestamp and real time to take in processing
-    if(isAudio)
-    {
-        rtpTimestamp += codec->GetFrameRate();
-    }
-    else
-    {
-       if(frame.GetMarker()) {
-          // Video uses a 90khz clock. Note that framerate should really be a float.
+PBoolean H323_RTPChannel::TransmitFrame(TransmitState & state)
+{
+  RTP_DataFrame & frame = state.frame;
+  unsigned & length = state.length;
+
+  if (!codec->Read(frame.GetPayloadPtr()+state.frameOffset, length, frame))
+    return FALSE;
+
+  // Calculate the timestamp and real time to take in processing
+  if(state.isAudio)
+  {
+      state.rtpTimestamp += codec->GetFrameRate();
+  }
+  else
+  {
+     if(frame.GetMarker()) {
+        // Video uses a 90khz clock. Note that framerate should really be a float.
 #ifdef H323_FIXED_VIDEOCLOCK
-           nextTimestamp = rtpTimestamp + 90000/codec->GetFrameRate();
+         state.nextTimestamp = state.rtpTimestamp + 90000/codec->GetFrameRate();
 #else
-           PInt64 nowTime = PTimer::Tick().GetMilliSeconds();
-           if (lastFrameTime == 0) {
-              nextTimestamp = rtpTimestamp + 90000/codec->GetFrameRate();
-           } else {
-              nextTimestamp = rtpTimestamp + (DWORD)(90000.0*((float)(nowTime-lastFrameTime))/1000.0);
-           }
-           lastFrameTime = nowTime;
+         PInt64 nowTime = PTimer::Tick().GetMilliSeconds();
+         if (state.lastFrameTime == 0) {
+            state.nextTimestamp = state.rtpTimestamp + 90000/codec->GetFrameRate();
+         } else {
+            state.nextTimestamp = state.rtpTimestamp + (DWORD)(90000.0*((float)(nowTime-state.lastFrameTime))/1000.0);
+         }
+         state.lastFrameTime = nowTime;
 #endif
-       }
-    }
+     }
+  }
 
 #if PTRACING
-    if (rtpTimestamp - lastDisplayedTimestamp > RTP_TRACE_DISPLAY_RATE) {
-      PTRACE(3, "H323RTP\tTransmitter sent timestamp " << rtpTimestamp);
-      lastDisplayedTimestamp = rtpTimestamp;
-    }
+  if (state.rtpTimestamp - state.lastDisplayedTimestamp > RTP_TRACE_DISPLAY_RATE) {
+    PTRACE(3, "H323RTP\tTransmitter sent timestamp " << state.rtpTimestamp);
+    state.lastDisplayedTimestamp = state.rtpTimestamp;
+  }
 
-    if (codecReadAnalysis != NULL)
-      codecReadAnalysis->AddSample(rtpTimestamp);
+  if (state.codecReadAnalysis != NULL)
+    state.codecReadAnalysis->AddSample(state.rtpTimestamp);
 #endif
 
-    if (paused)
-      length = 0; // Act as though silent/no video
+  if (paused)
+    length = 0; // Act as though silent/no video
 
-    // Handle marker bit for audio codec
-    if (isAudio) {
-      // If switching from silence to signal
-      if (silent && length > 0) {
-        silent = FALSE;
-        frame.SetMarker(TRUE);  // Set flag for start of sound
-        PTRACE(3, "H323RTP\tTransmit start of talk burst: " << rtpTimestamp);
-      }
-      // If switching from signal to silence
-      else if (!silent && length == 0) {
-        silent = TRUE;
-        // If had some data waiting to go out
-        if (frameOffset > 0)
-          frameCount = framesInPacket;  // Force the RTP write
-        PTRACE(3, "H323RTP\tTransmit  end  of talk burst: " << rtpTimestamp);
-      }
+  // Handle marker bit for audio codec
+  if (state.isAudio) {
+    // If switching from silence to signal
+    if (state.silent && length > 0) {
+      state.silent = FALSE;
+      frame.SetMarker(TRUE);  // Set flag for start of sound
+      PTRACE(3, "H323RTP\tTransmit start of talk burst: " << state.rtpTimestamp);
+    }
+    // If switching from signal to silence
+    else if (!state.silent && length == 0) {
+      state.silent = TRUE;
+      // If had some data waiting to go out
+      if (state.frameOffset > 0)
+        state.frameCount = state.framesInPacket;  // Force the RTP write
+      PTRACE(3, "H323RTP\tTransmit  end  of talk burst: " << state.rtpTimestamp);
     }
+  }
 
-    // See if is silence or have some audio data to stuff in the RTP packet
-    if (length == 0)
-      frame.SetTimestamp(rtpTimestamp);
+  // See if is silence or have some audio data to stuff in the RTP packet
+  if (length == 0)
+    frame.SetTimestamp(state.rtpTimestamp);
+  else {
+    silenceStartTick = PTimer::Tick().GetMilliSeconds();
+
+    // If first read frame in packet, set timestamp for it
+    if (state.frameOffset == 0)
+      frame.SetTimestamp(state.rtpTimestamp);
+    state.frameOffset += length;
+
+    // Look for special cases
+    if (rtpPayloadType == RTP_DataFrame::G729 && length == 2) {
+      /* If we have a G729 sid frame (ie 2 bytes instead of 10) then we must
+         not send any more frames in the RTP packet.
+       */
+      state.frameCount = state.framesInPacket;
+    }
     else {
-      silenceStartTick = PTimer::Tick().GetMilliSeconds();
-
-      // If first read frame in packet, set timestamp for it
-      if (frameOffset == 0)
-        frame.SetTimestamp(rtpTimestamp);
-      frameOffset += length;
-
-      // Look for special cases
-      if (rtpPayloadType == RTP_DataFrame::G729 && length == 2) {
-        /* If we have a G729 sid frame (ie 2 bytes instead of 10) then we must
-           not send any more frames in the RTP packet.
-         */
-        frameCount = framesInPacket;
-      }
-      else {
-        /* Increment by number of frames that were read in one hit Note a
-           codec that does variable length frames should never return more
-           than one frame per Read() call or confusion will result.
-         */
-        frameCount += (length + maxFrameSize - 1)/maxFrameSize;
-      }
+      /* Increment by number of frames that were read in one hit Note a
+         codec that does variable length frames should never return more
+         than one frame per Read() call or confusion will result.
+       */
+      state.frameCount += (length + state.maxFrameSize - 1)/state.maxFrameSize;
     }
+  }
 
-    PBoolean sendPacket = FALSE;
+  PBoolean sendPacket = FALSE;
 
-    // Have read number of frames for packet (or just went silent)
-    if (frameCount >= framesInPacket) {
-      // Set payload size to frame offset, now length of frame.
-      frame.SetPayloadSize(frameOffset);
-      frame.SetPayloadType(rtpPayloadType);
+  // Have read number of frames for packet (or just went silent)
+  if (state.frameCount >= state.framesInPacket) {
+    // Set payload size to frame offset, now length of frame.
+    frame.SetPayloadSize(state.frameOffset);
+    frame.SetPayloadType(rtpPayloadType);
 
-      frameOffset = 0;
-      frameCount = 0;
+    state.frameOffset = 0;
+    state.frameCount = 0;
 
-      sendPacket = TRUE;
-    }
+    sendPacket = TRUE;
+  }
 
-    if (isAudio) {
-        filterMutex.Wait();
-        for (PINDEX i = 0; i < filters.GetSize(); i++)
-          filters[i](frame, (H323_INT)&sendPacket);
-        filterMutex.Signal();
+  if (state.isAudio) {
+      filterMutex.Wait();
+      for (PINDEX i = 0; i < filters.GetSize(); i++)
+        filters[i](frame, (H323_INT)&sendPacket);
+      filterMutex.Signal();
+  }
+
+  if (sendPacket || (state.silent && frame.GetPayloadSize() > 0)) {
+    // Send the frame of coded data we have so far to RTP transport
+    if (!WriteFrame(frame))
+       return FALSE;
+
+    // video frames produce many packets per frame especially at
+    // higher resolutions and can easily overload the link if sent
+    // without delay
+    if (!state.isAudio) {
+       PThread::Sleep(5);
+       if (frame.GetMarker())
+           state.rtpTimestamp = state.nextTimestamp;
     }
 
-    if (sendPacket || (silent && frame.GetPayloadSize() > 0)) {
-      // Send the frame of coded data we have so far to RTP transport
-      if (!WriteFrame(frame))
-         break;
-
-      // video frames produce many packets per frame especially at
-      // higher resolutions and can easily overload the link if sent
-      // without delay
-      if (!isAudio) {
-         PThread::Sleep(5);
-         if (frame.GetMarker())
-             rtpTimestamp = nextTimestamp;
-      }
+    // Reset flag for in talk burst
+    if (state.isAudio)
+      frame.SetMarker(FALSE);
 
-      // Reset flag for in talk burst
-      if (isAudio)
-        frame.SetMarker(FALSE);
+    frame.SetPayloadSize(state.maxFrameSize);
+    state.frameOffset = 0;
+    state.frameCount = 0;
+  }
 
-      frame.SetPayloadSize(maxFrameSize);
-      frameOffset = 0;
-      frameCount = 0;
-    }
+  return !terminating;
+}
 
-    if (terminating)
-      break;
-  }
 
+void H323_RTPChannel::EndTransmit(TransmitState & state)
+{
 #if PTRACING
   if (PTrace::GetLevel() >= 5) {
-      PTRACE_IF(5, codecReadAnalysis != NULL, "Codec read timing:\n" << *codecReadAnalysis);
-      delete codecReadAnalysis;
+      PTRACE_IF(5, state.codecReadAnalysis != NULL, "Codec read timing:\n" << *state.codecReadAnalysis);
   }
+  delete state.codecReadAnalysis;
+  state.codecReadAnalysis = NULL;
 #endif
 
   if (!terminating)
     connection.CloseLogicalChannelNumber(number);
 
-  PTRACE(2, "H323RTP\tTransmit " << mediaFormat << " thread ended");
+  PTRACE(2, "H323RTP\tTransmit " << codec->GetMediaFormat() << " thread ended");
 }
 
+#ifdef H323_MEDIA_CLOCK
+
+class H323_RTPChannelClockHandle : public H323MediaClockHandle
+{
+  PCLASSINFO(H323_RTPChannelClockHandle, H323MediaClockHandle);
+  public:
+    H323_RTPChannelClockHandle(H323_RTPChannel & _channel, unsigned period)
+      : H323MediaClockHandle(period), channel(_channel) { }
+
+    PBoolean OnTick()
+    { return channel.OnClockTick(); }
+
+    void OnStopped()
+    { channel.OnClockStopped(); }
+
+  protected:
+    H323_RTPChannel & channel;
+};
+
+
+PBoolean H323_RTPChannel::Start()
+{
+  H323MediaClock * clock = endpoint.GetMediaClock();
+  if (receiver || clock == NULL)
+    return H323_RealTimeChannel::Start();
+
+  if (!Open())
+    return FALSE;
+
+  // Only audio has a fixed frame time, video keeps its thread
+  const OpalMediaFormat & mediaFormat = codec->GetMediaFormat();
+  if (!mediaFormat.NeedsJitterBuffer() || mediaFormat.GetTimeUnits() == 0)
+    return H323_RealTimeChannel::Start();
+
+  clockState = new TransmitState;
+  if (!StartTransmit(*clockState))
+    return TRUE;
+
+  unsigned period = codec->GetFrameRate()*1000/mediaFormat.GetTimeUnits();
+  clockHandle = new H323_RTPChannelClockHandle(*this, period);
+  clockMutex.Wait();
+  clockRunning = TRUE;
+  clockMutex.Signal();
+  if (!clock->AddHandle(clockHandle)) {
+    PTRACE(2, "H323RTP\tMedia clock could not take channel, using a thread");
+    clockMutex.Wait();
+    clockRunning = FALSE;
+    clockMutex.Signal();
+    delete clockHandle;
+    clockHandle = NULL;
+    delete clockState;
+    clockState = NULL;
+    return H323_RealTimeChannel::Start();
+  }
+
+  PTRACE(3, "H323RTP\tTransmit " << mediaFormat << " driven by media clock every " << period << "us");
+  return TRUE;
+}
+
+
+PBoolean H323_RTPChannel::IsRunning() const
+{
+  {
+    PWaitAndSignal m(clockMutex);
+    if (clockRunning)
+      return TRUE;
+  }
+
+  return H323_RealTimeChannel::IsRunning();
+}
+
+
+PBoolean H323_RTPChannel::OnClockTick()
+{
+  return TransmitFrame(*clockState);
+}
+
+
+void H323_RTPChannel::OnClockStopped()
+{
+  clockMutex.Wait();
+  clockRunning = FALSE;
+  clockMutex.Signal();
+  EndTransmit(*clockState);
+}
+
+#endif // H323_MEDIA_CLOCK
+
+
 void H323_RTPChannel::SendUniChannelBackProbe()
 {
   // When we are receiving media on a unidirectional Channel
@@ -54,8 +54,21 @@ extern "C" {
 #include "g711.h"
 };
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
 #define new PNEW
 
+// Zero crossing silence detection, in complemented uLaw steps and crossings
+// per 1000 samples. Quiet frames this close to the threshold that cross zero
+// this often, and twice as often as the silence, are unvoiced speech.
+#define ZERO_CROSSING_LEVEL_MARGIN  16
+#define ZERO_CROSSING_MINIMUM_RATE  250
+
 /////////////////////////////////////////////////////////////////////////////
 
 H323Codec::H323Codec(const OpalMediaFormat & fmt, Direction dir)
@@ -583,7 +596,7 @@ void H323AudioCodec::SetSilenceDetectionMode(SilenceDetectionMode mode,
   // This is the period over which the adaptive algorithm operates
   adaptiveThresholdFrames = (adaptivePeriod+samplesPerFrame-1)/samplesPerFrame;
 
-  if (mode != AdaptiveSilenceDetection) {
+  if (mode != AdaptiveSilenceDetection && mode != AdaptiveZeroCrossingSilenceDetection) {
     levelThreshold = threshold;
     return;
   }
@@ -596,6 +609,8 @@ void H323AudioCodec::SetSilenceDetectionMode(SilenceDetectionMode mode,
   silenceMaximum = 0;
   signalFramesReceived = 0;
   silenceFramesReceived = 0;
+  silenceCrossingRate = 0;
+  silenceCrossingFrames = 0;
 
   // Restart in silent mode
   inTalkBurst = FALSE;
@@ -618,7 +633,30 @@ PBoolean H323AudioCodec::DetectSilence()
   level = linear2ulaw(level) ^ 0xff;
 
   // Now if signal level above threshold we are "talking"
-  PBoolean haveSignal = level > levelThreshold;
+  PBoolean haveEnergy = level > levelThreshold;
+  PBoolean haveSignal = haveEnergy;
+
+  /* Unvoiced speech, eg "s" or "f", can be just under the threshold but
+     crosses zero much more often than the background noise. Every frame
+     that is silent on energy alone outside of a talk burst goes into the
+     average for the noise, and nothing is promoted until that average has
+     had an adaptive period to settle, else steady hiss that sits within the
+     margin of the threshold would hold the talk burst open for ever.
+   */
+  if (silenceDetectMode == AdaptiveZeroCrossingSilenceDetection && levelThreshold > 0) {
+    unsigned rate = GetZeroCrossingRate();
+    if (rate != UINT_MAX && !haveEnergy) {
+      if (!inTalkBurst) {
+        silenceCrossingRate = (silenceCrossingRate*7 + rate)/8;
+        if (silenceCrossingFrames < adaptiveThresholdFrames)
+          silenceCrossingFrames++;
+      }
+      if (silenceCrossingFrames >= adaptiveThresholdFrames &&
+          level + ZERO_CROSSING_LEVEL_MARGIN > levelThreshold &&
+          rate > ZERO_CROSSING_MINIMUM_RATE && rate > silenceCrossingRate*2)
+        haveSignal = TRUE;
+    }
+  }
 
   // If no change ie still talking or still silent, resent frame counter
   if (inTalkBurst == haveSignal)
@@ -653,7 +691,7 @@ PBoolean H323AudioCodec::DetectSilence()
   }
 
   // Count the number of silent and signal frames and calculate min/max
-  if (haveSignal) {
+  if (haveEnergy) {
     if (level < signalMinimum)
       signalMinimum = level;
     signalFramesReceived++;
@@ -721,6 +759,91 @@ unsigned H323AudioCodec::GetAverageSignalLevel()
   return UINT_MAX;
 }
 
+
+unsigned H323AudioCodec::GetZeroCrossingRate()
+{
+  return UINT_MAX;
+}
+
+
+void H323AudioCodec::MeasureFrame(const short * pcm, unsigned count, FrameLevels & levels)
+{
+  levels.average = levels.peak = levels.zeroCrossings = 0;
+  if (count == 0)
+    return;
+
+  unsigned sum = 0;
+  unsigned peak = 0;
+  unsigned crossings = 0;
+  unsigned i = 0;
+
+#if defined(__SSE2__)
+  if (count > 8) {
+    /* Absolute values are summed in 32 bit lanes. The peak uses a saturated
+       negate so -32768 counts as 32767. A crossing is where the sign of a
+       sample differs from the one before, the first sample has no previous
+       one so starts the vector loop at one.
+     */
+    __m128i sum32 = _mm_setzero_si128();
+    __m128i peak16 = _mm_setzero_si128();
+    __m128i cross16 = _mm_setzero_si128();
+    __m128i zero = _mm_setzero_si128();
+
+    for (i = 1; i + 8 <= count; i += 8) {
+      __m128i x = _mm_loadu_si128((const __m128i *)(pcm+i));
+      __m128i prev = _mm_loadu_si128((const __m128i *)(pcm+i-1));
+
+      __m128i sign = _mm_srai_epi16(x, 15);
+      __m128i mag = _mm_sub_epi16(_mm_xor_si128(x, sign), sign);
+      sum32 = _mm_add_epi32(sum32, _mm_unpacklo_epi16(mag, zero));
+      sum32 = _mm_add_epi32(sum32, _mm_unpackhi_epi16(mag, zero));
+
+      peak16 = _mm_max_epi16(peak16, _mm_max_epi16(x, _mm_subs_epi16(zero, x)));
+
+      cross16 = _mm_sub_epi16(cross16, _mm_srai_epi16(_mm_xor_si128(x, prev), 15));
+    }
+
+    PINT32 sums[4];
+    short peaks[8];
+    unsigned short crosses[8];
+    _mm_storeu_si128((__m128i *)sums, sum32);
+    _mm_storeu_si128((__m128i *)peaks, peak16);
+    _mm_storeu_si128((__m128i *)crosses, cross16);
+
+    sum = (unsigned)sums[0] + (unsigned)sums[1] + (unsigned)sums[2] + (unsigned)sums[3];
+    for (int j = 0; j < 8; j++) {
+      if ((unsigned)peaks[j] > peak)
+        peak = peaks[j];
+      crossings += crosses[j];
+    }
+  }
+#endif
+
+  // Whatever the vector loop did not cover, including the first sample
+  unsigned first = i;
+  for (; i < count; i++) {
+    int sample = pcm[i];
+    unsigned mag = sample < 0 ? -sample : sample;
+    sum += mag;
+    if (mag > peak)
+      peak = mag;
+    if (i > 0 && (sample ^ pcm[i-1]) < 0)
+      crossings++;
+  }
+
+  if (first > 0) {
+    int sample = pcm[0];
+    unsigned mag = sample < 0 ? -sample : sample;
+    sum += mag;
+    if (mag > peak)
+      peak = mag;
+  }
+
+  levels.average = sum/count;
+  levels.peak = peak;
+  levels.zeroCrossings = crossings;
+}
+
 PBoolean H323AudioCodec::SetRawDataHeld(PBoolean hold) {
 
   PTimedMutex m;
@@ -740,7 +863,7 @@ H323FramedAudioCodec::H323FramedAudioCodec(const OpalMediaFormat & fmt, Directio
     sampleBuffer(samplesPerFrame), bytesPerFrame(mediaFormat.GetFrameSize()),
     readBytes(samplesPerFrame*2), writeBytes(samplesPerFrame*2), cntBytes(0)
 {
-
+  frameLevels.average = frameLevels.peak = frameLevels.zeroCrossings = 0;
 }
 
 
@@ -874,18 +997,17 @@ unsigned H323FramedAudioCodec::GetAverageSignalLevel()
       return 0;
 
   // Calculate the average signal level of this frame
-  int sum = 0;
-
-  const short * pcm = sampleBuffer;
-  const short * end = pcm + samplesPerFrame;
-  while (pcm != end) {
-    if (*pcm < 0)
-      sum -= *pcm++;
-    else
-      sum += *pcm++;
-  }
+  MeasureFrame(sampleBuffer, samplesPerFrame, frameLevels);
+  return frameLevels.average;
+}
+
+
+unsigned H323FramedAudioCodec::GetZeroCrossingRate()
+{
+  if (!samplesPerFrame)
+      return UINT_MAX;
 
-  return sum/samplesPerFrame;
+  return frameLevels.zeroCrossings*1000/samplesPerFrame;
 }
 
 
@@ -936,146 +1058,35 @@ H323StreamedAudioCodec::H323StreamedAudioCodec(const OpalMediaFormat & fmt,
 }
 
 
-PBoolean H323StreamedAudioCodec::EncodeFrame(BYTE * buffer, unsigned &)
+static PBoolean IsSupportedBitsPerSample(unsigned bits)
 {
-  PINDEX i;
-  unsigned short position = 0;
-  BYTE encoded;
-  switch (bitsPerSample) {
-    case 8 :
-      for (i = 0; i < (PINDEX)samplesPerFrame; i++)
-        *buffer++ = (BYTE)Encode(sampleBuffer[i]);
-      break;
-    case 5 : // g.726-40 payload encoding....
-      for (i = 0; i < (PINDEX)samplesPerFrame;i++)
-      {
-        // based on a 40 bits encoding, we have 8 words of 5 bits each
-        encoded = (BYTE)Encode(sampleBuffer[i]);
-        switch(position)
-        {
-          case 0: // 0 bits overflow
-            *buffer = encoded;
-            position++;
-            break;
-          case 1: // 2 bits overflow
-            *buffer++ |= (encoded << 5);
-            *buffer = (BYTE)(encoded >> 3);
-            position++;
-            break;
-          case 2:
-            *buffer |= (encoded << 2);
-            position++;
-            break;
-          case 3: // one bit left for word 4
-            *buffer++ |= (encoded << 7);
-            *buffer = (BYTE)(encoded >> 1);
-            position++;
-            break;
-          case 4:
-            *buffer++ |= (encoded << 4);
-            *buffer = (BYTE)(encoded >> 4);
-            position++;
-            break;
-          case 5:
-            *buffer |= (encoded << 1);
-            position++;
-            break;
-          case 6: //two bits left for the new encoded word
-            *buffer++ |= (encoded << 6);
-            *buffer =  (BYTE)(encoded >> 2);
-            position++;
-            break;
-          case 7: // now five bits left for the last word
-            *buffer++ |= (encoded << 3);
-            position = 0;
-            break;
-        }
-      }
-      break;
-
+  switch (bits) {
+    case 2 :
+    case 3 :
     case 4 :
-      for (i = 0; i < (PINDEX)samplesPerFrame; i++) {
-        if ((i&1) == 0)
-          *buffer = (BYTE)Encode(sampleBuffer[i]);
-        else
-          *buffer++ |= (BYTE)(Encode(sampleBuffer[i]) << 4);
-      }
-      break;
+    case 5 : // G.726
+    case 8 : // G.711
+      return TRUE;
+  }
 
-    case 3 :
-      for (i = 0;i < (PINDEX)samplesPerFrame;i++)
-      {
-        encoded = (BYTE)Encode(sampleBuffer[i]);
-        switch(position)
-        {
-          case 0: // 0 bits overflow
-            *buffer = encoded;
-            position++;
-            break;
-          case 1: // 2 bits overflow
-            *buffer |= (encoded << 3);
-            position++;
-            break;
-          case 2:
-            *buffer++ |= (encoded << 6);
-            *buffer = (BYTE)(encoded >> 2);
-            position++;
-            break;
-          case 3: // one bit left for word 4
-            *buffer |= (encoded << 1);
-            position++;
-            break;
-          case 4:
-            *buffer |= (encoded << 4);
-            position++;
-            break;
-          case 5:
-            *buffer++ |= (encoded << 7);
-            *buffer = (BYTE)(encoded >> 1);
-            position++;
-            break;
-          case 6: //two bits left for the new encoded word
-            *buffer |= (encoded << 2);
-            position++;
-            break;
-          case 7: // now five bits left for the last word
-            *buffer++ |= (encoded << 5);
-            position = 0;
-            break;
-        }
-      }
-      break;
+  PTRACE(1, "Codec\tUnsupported bit size");
+  return FALSE;
+}
 
-    case 2:
-      for (i = 0; i < (PINDEX)samplesPerFrame; i++)
-      {
-        switch(position)
-        {
-          case 0:
-            *buffer = (BYTE)Encode(sampleBuffer[i]);
-            position++;
-            break;
-          case 1:
-            *buffer |= (BYTE)(Encode(sampleBuffer[i]) << 2);
-            position++;
-            break;
-          case 2:
-            *buffer |= (BYTE)(Encode(sampleBuffer[i]) << 4);
-            position++;
-            break;
-          case 3:
-            *buffer++ |= (BYTE)(Encode(sampleBuffer[i]) << 6);
-            position = 0;
-            break;
-        }
-      }
-      break;
 
-    default :
-      PTRACE(1, "Codec\tUnsupported bit size");
-      return FALSE;
+PBoolean H323StreamedAudioCodec::EncodeFrame(BYTE * buffer, unsigned &)
+{
+  if (!IsSupportedBitsPerSample(bitsPerSample))
+    return FALSE;
+
+  if (bitsPerSample == 8) {
+    EncodeSamples(sampleBuffer, buffer, samplesPerFrame);
+    return TRUE;
   }
 
+  BYTE * codes = codeBuffer.GetPointer(samplesPerFrame);
+  EncodeSamples(sampleBuffer, codes, samplesPerFrame);
+  PackCodes(codes, samplesPerFrame, bitsPerSample, buffer);
   return TRUE;
 }
 
@@ -1085,122 +1096,293 @@ PBoolean H323StreamedAudioCodec::DecodeFrame(const BYTE * buffer,
                                          unsigned & written,
                                          unsigned & decodedBytes)
 {
-  unsigned i;
+  if (!IsSupportedBitsPerSample(bitsPerSample))
+    return FALSE;
 
-  short * sampleBufferPtr = sampleBuffer.GetPointer(samplesPerFrame);
-  short * out = sampleBufferPtr;
-  unsigned short position = 0;
-  unsigned remaining = 0;
+  unsigned count = length*8/bitsPerSample;
+  short * out = sampleBuffer.GetPointer(PMAX(samplesPerFrame, count));
 
-  switch (bitsPerSample) {
-    case 8 :
-      for (i = 0; i < length; i++)
-        *out++ = Decode(*buffer++);
-      break;
+  if (bitsPerSample == 8)
+    DecodeSamples(buffer, out, count);
+  else {
+    BYTE * codes = codeBuffer.GetPointer(count);
+    count = UnpackCodes(buffer, length, bitsPerSample, codes);
+    DecodeSamples(codes, out, count);
+  }
+
+  written = length;
+  decodedBytes = count*2;
+
+  return TRUE;
+}
+
+
+void H323StreamedAudioCodec::EncodeSamples(const short * samples, BYTE * codes, unsigned count) const
+{
+  while (count-- > 0)
+    *codes++ = (BYTE)Encode(*samples++);
+}
+
+
+void H323StreamedAudioCodec::DecodeSamples(const BYTE * codes, short * samples, unsigned count) const
+{
+  while (count-- > 0)
+    *samples++ = Decode(*codes++);
+}
 
-    // those case are for ADPCM G.726
-    case 5 :
-      for (i = 0; i < length; i++) {
-        switch(position)
-        {
-          case 0:
-            *out++ = Decode(*buffer & 31);
-            remaining = *buffer >> 5; // get the three remaining bytes for the next word
-            buffer++;
-            position++;
-            break;
-          case 1: // we can decode more than one word in second buffer
-            *out++ = Decode (((*buffer&3) << 3) | remaining);
-            *out++ = Decode( (*buffer >> 2) & 31);
-            remaining = *buffer >> 7;
-            buffer++;
-            position++;
-            break;
-          case 2:
-            *out++ = Decode( remaining | ((*buffer&15) << 1));
-            remaining = *buffer >> 4;
-            buffer++;
-            position++;
-            break;
-          case 3:
-            *out++ = Decode( remaining | ((*buffer&1) << 4));
-            *out++ = Decode( (*buffer >> 1) & 31);
-            remaining = *buffer >> 6;
-            buffer++;
-            position++;
-            break;
-          case 4 :
-            *out++ = Decode( remaining | ((*buffer&7) << 2));
-            *out++ = Decode(*buffer >> 3);
-            buffer++;
-            position = 0;
-            break;
-        }
-      }
-      break;
+
+unsigned H323StreamedAudioCodec::PackCodes(const BYTE * codes, unsigned count, unsigned bits, BYTE * buffer)
+{
+  BYTE * out = buffer;
+  unsigned i = 0;
+
+  switch (bits) {
+    case 8 :
+      memcpy(buffer, codes, count);
+      return count;
 
     case 4 :
-      for (i = 0; i < length; i++) {
-        *out++ = Decode(*buffer & 15);
-        *out++ = Decode(*buffer >> 4);
-        buffer++;
+#if defined(__SSE2__)
+      for (; i + 32 <= count; i += 32) {
+        // Each 16 bit word holds an even and an odd code, fold the odd one
+        // down next to the even one then narrow the words to bytes.
+        __m128i a = _mm_loadu_si128((const __m128i *)(codes+i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(codes+i+16));
+        a = _mm_and_si128(_mm_or_si128(a, _mm_srli_epi16(a, 4)), _mm_set1_epi16(0xff));
+        b = _mm_and_si128(_mm_or_si128(b, _mm_srli_epi16(b, 4)), _mm_set1_epi16(0xff));
+        _mm_storeu_si128((__m128i *)out, _mm_packus_epi16(a, b));
+        out += 16;
       }
+#endif
+      for (; i + 2 <= count; i += 2)
+        *out++ = (BYTE)(codes[i] | (codes[i+1] << 4));
       break;
 
-    case 3:
-      for (i = 0; i < length; i++) {
-        switch(position)
-        {
-        case 0:
-          *out++ = Decode(*buffer & 7);
-          *out++ = Decode((*buffer>>3)&7);
-          remaining = *buffer >> 6;
-          buffer++;
-          position++;
-          break;
-        case 1:
-          *out++ = Decode(remaining | ((*buffer&1) << 2));
-          *out++ = Decode((*buffer >> 1) & 7);
-          *out++ = Decode((*buffer >> 4)&7);
-          remaining = *buffer >> 7;
-          buffer++;
-          position++;
-          break;
-        case 2:
-          *out++ = Decode(remaining | ((*buffer&3) << 1));
-          *out++ = Decode((*buffer >> 2) & 7);
-          *out++ = Decode((*buffer >> 5) & 7);
-          buffer++;
-          position = 0;
-          break;
-        }
-      }
+    case 2 :
+      for (; i + 4 <= count; i += 4)
+        *out++ = (BYTE)(codes[i] | (codes[i+1] << 2) | (codes[i+2] << 4) | (codes[i+3] << 6));
       break;
+  }
 
-    case 2:
-      for (i = 0; i < length; i++)
-      {
-        *out++ = Decode(*buffer & 3);
-        *out++ = Decode((*buffer >> 2) & 3);
-        *out++ = Decode((*buffer >> 4) & 3);
-        *out++ = Decode((*buffer >> 6) & 3);
-        buffer++;
+  // Codes that straddle bytes, and anything left over from above
+  unsigned bitBuffer = 0;
+  unsigned bitCount = 0;
+  for (; i < count; i++) {
+    bitBuffer |= codes[i] << bitCount;
+    bitCount += bits;
+    if (bitCount >= 8) {
+      *out++ = (BYTE)bitBuffer;
+      bitBuffer >>= 8;
+      bitCount -= 8;
+    }
+  }
+  if (bitCount > 0)
+    *out++ = (BYTE)bitBuffer;
+
+  return out - buffer;
+}
+
+
+unsigned H323StreamedAudioCodec::UnpackCodes(const BYTE * buffer, unsigned length, unsigned bits, BYTE * codes)
+{
+  BYTE * out = codes;
+  unsigned i = 0;
 
+  switch (bits) {
+    case 8 :
+      memcpy(codes, buffer, length);
+      return length;
+
+    case 4 :
+#if defined(__SSE2__)
+      for (; i + 16 <= length; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(buffer+i));
+        __m128i lo = _mm_and_si128(v, _mm_set1_epi8(0x0f));
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), _mm_set1_epi8(0x0f));
+        _mm_storeu_si128((__m128i *)out, _mm_unpacklo_epi8(lo, hi));
+        _mm_storeu_si128((__m128i *)(out+16), _mm_unpackhi_epi8(lo, hi));
+        out += 32;
       }
-      break;
+#endif
+      for (; i < length; i++) {
+        *out++ = (BYTE)(buffer[i] & 15);
+        *out++ = (BYTE)(buffer[i] >> 4);
+      }
+      return out - codes;
+
+    case 2 :
+      for (; i < length; i++) {
+        *out++ = (BYTE)(buffer[i] & 3);
+        *out++ = (BYTE)((buffer[i] >> 2) & 3);
+        *out++ = (BYTE)((buffer[i] >> 4) & 3);
+        *out++ = (BYTE)(buffer[i] >> 6);
+      }
+      return out - codes;
+  }
 
-    default :
-      PTRACE(1, "Codec\tUnsupported bit size");
-      return FALSE;
+  unsigned mask = (1 << bits) - 1;
+  unsigned bitBuffer = 0;
+  unsigned bitCount = 0;
+  for (; i < length; i++) {
+    bitBuffer |= buffer[i] << bitCount;
+    bitCount += 8;
+    while (bitCount >= bits) {
+      *out++ = (BYTE)(bitBuffer & mask);
+      bitBuffer >>= bits;
+      bitCount -= bits;
+    }
   }
 
-  written = length;
-  decodedBytes = (out - sampleBufferPtr)*2;
+  return out - codes;
+}
 
-  return TRUE;
+
+/////////////////////////////////////////////////////////////////////////////
+
+// G.711 only looks at the top 13 (A-law) or 14 (uLaw) bits of a sample, so
+// both directions fit in tables small enough to stay in the cache.
+static struct G711Tables
+{
+  G711Tables()
+  {
+    int i;
+    for (i = 0; i < 256; i++) {
+      alawDecode[i] = (short)alaw2linear((unsigned char)i);
+      ulawDecode[i] = (short)ulaw2linear((unsigned char)i);
+    }
+    for (i = 0; i < 8192; i++)
+      alawEncode[i] = (BYTE)linear2alaw((short)(i << 3));
+    for (i = 0; i < 16384; i++)
+      ulawEncode[i] = (BYTE)linear2ulaw((short)(i << 2));
+  }
+
+  short alawDecode[256];
+  short ulawDecode[256];
+  BYTE  alawEncode[8192];
+  BYTE  ulawEncode[16384];
+} g711Tables;
+
+
+#if defined(__SSE2__)
+
+/* The vector encoders follow linear2alaw() and linear2ulaw() eight samples
+   at a time. The segment is the number of segment ends the magnitude is
+   above, and the variable right shift of the magnitude is done as an
+   unsigned high multiply by a power of two that halves with each segment.
+ */
+static const short G711ALawSegEnd[7] = { 0x1F, 0x3F, 0x7F, 0xFF, 0x1FF, 0x3FF, 0x7FF };
+static const short G711uLawSegEnd[7] = { 0x3F, 0x7F, 0xFF, 0x1FF, 0x3FF, 0x7FF, 0xFFF };
+
+static inline __m128i G711ALawEncode8(__m128i pcm)
+{
+  __m128i val  = _mm_srai_epi16(pcm, 3);
+  __m128i neg  = _mm_srai_epi16(val, 15);
+  __m128i mag  = _mm_xor_si128(val, neg);              // -val-1 when negative
+  __m128i seg  = _mm_setzero_si128();
+  __m128i mult = _mm_set1_epi16((short)0x8000);        // segments 0 and 1 shift by one
+
+  for (int i = 0; i < 7; i++) {
+    __m128i above = _mm_cmpgt_epi16(mag, _mm_set1_epi16(G711ALawSegEnd[i]));
+    seg = _mm_sub_epi16(seg, above);
+    if (i > 0)
+      mult = _mm_sub_epi16(mult, _mm_and_si128(_mm_srli_epi16(mult, 1), above));
+  }
+
+  __m128i quant = _mm_and_si128(_mm_mulhi_epu16(mag, mult), _mm_set1_epi16(0x0F));
+  __m128i aval  = _mm_or_si128(_mm_slli_epi16(seg, 4), quant);
+  __m128i mask  = _mm_xor_si128(_mm_set1_epi16(0xD5), _mm_and_si128(neg, _mm_set1_epi16(0x80)));
+  return _mm_xor_si128(aval, mask);
+}
+
+
+static inline __m128i G711uLawEncode8(__m128i pcm)
+{
+  __m128i val  = _mm_srai_epi16(pcm, 2);
+  __m128i neg  = _mm_srai_epi16(val, 15);
+  __m128i mag  = _mm_sub_epi16(_mm_xor_si128(val, neg), neg);
+  mag = _mm_add_epi16(_mm_min_epi16(mag, _mm_set1_epi16(CLIP)), _mm_set1_epi16(BIAS >> 2));
+
+  __m128i seg  = _mm_setzero_si128();
+  __m128i mult = _mm_set1_epi16((short)0x8000);
+
+  for (int i = 0; i < 7; i++) {
+    __m128i above = _mm_cmpgt_epi16(mag, _mm_set1_epi16(G711uLawSegEnd[i]));
+    seg  = _mm_sub_epi16(seg, above);
+    mult = _mm_sub_epi16(mult, _mm_and_si128(_mm_srli_epi16(mult, 1), above));
+  }
+
+  __m128i quant = _mm_and_si128(_mm_mulhi_epu16(mag, mult), _mm_set1_epi16(0x0F));
+  __m128i uval  = _mm_or_si128(_mm_slli_epi16(seg, 4), quant);
+
+  // Only full scale negative samples reach past the last segment
+  uval = _mm_or_si128(uval, _mm_and_si128(_mm_cmpgt_epi16(mag, _mm_set1_epi16(0x1FFF)), _mm_set1_epi16(0x7F)));
+
+  __m128i mask  = _mm_xor_si128(_mm_set1_epi16(0xFF), _mm_and_si128(neg, _mm_set1_epi16(0x80)));
+  return _mm_xor_si128(uval, mask);
+}
+
+#endif // __SSE2__
+
+
+#if defined(__AVX2__)
+
+static inline __m256i G711ALawEncode16(__m256i pcm)
+{
+  __m256i val  = _mm256_srai_epi16(pcm, 3);
+  __m256i neg  = _mm256_srai_epi16(val, 15);
+  __m256i mag  = _mm256_xor_si256(val, neg);
+  __m256i seg  = _mm256_setzero_si256();
+  __m256i mult = _mm256_set1_epi16((short)0x8000);
+
+  for (int i = 0; i < 7; i++) {
+    __m256i above = _mm256_cmpgt_epi16(mag, _mm256_set1_epi16(G711ALawSegEnd[i]));
+    seg = _mm256_sub_epi16(seg, above);
+    if (i > 0)
+      mult = _mm256_sub_epi16(mult, _mm256_and_si256(_mm256_srli_epi16(mult, 1), above));
+  }
+
+  __m256i quant = _mm256_and_si256(_mm256_mulhi_epu16(mag, mult), _mm256_set1_epi16(0x0F));
+  __m256i aval  = _mm256_or_si256(_mm256_slli_epi16(seg, 4), quant);
+  __m256i mask  = _mm256_xor_si256(_mm256_set1_epi16(0xD5), _mm256_and_si256(neg, _mm256_set1_epi16(0x80)));
+  return _mm256_xor_si256(aval, mask);
 }
 
 
+static inline __m256i G711uLawEncode16(__m256i pcm)
+{
+  __m256i val  = _mm256_srai_epi16(pcm, 2);
+  __m256i neg  = _mm256_srai_epi16(val, 15);
+  __m256i mag  = _mm256_sub_epi16(_mm256_xor_si256(val, neg), neg);
+  mag = _mm256_add_epi16(_mm256_min_epi16(mag, _mm256_set1_epi16(CLIP)), _mm256_set1_epi16(BIAS >> 2));
+
+  __m256i seg  = _mm256_setzero_si256();
+  __m256i mult = _mm256_set1_epi16((short)0x8000);
+
+  for (int i = 0; i < 7; i++) {
+    __m256i above = _mm256_cmpgt_epi16(mag, _mm256_set1_epi16(G711uLawSegEnd[i]));
+    seg  = _mm256_sub_epi16(seg, above);
+    mult = _mm256_sub_epi16(mult, _mm256_and_si256(_mm256_srli_epi16(mult, 1), above));
+  }
+
+  __m256i quant = _mm256_and_si256(_mm256_mulhi_epu16(mag, mult), _mm256_set1_epi16(0x0F));
+  __m256i uval  = _mm256_or_si256(_mm256_slli_epi16(seg, 4), quant);
+  uval = _mm256_or_si256(uval, _mm256_and_si256(_mm256_cmpgt_epi16(mag, _mm256_set1_epi16(0x1FFF)), _mm256_set1_epi16(0x7F)));
+
+  __m256i mask  = _mm256_xor_si256(_mm256_set1_epi16(0xFF), _mm256_and_si256(neg, _mm256_set1_epi16(0x80)));
+  return _mm256_xor_si256(uval, mask);
+}
+
+
+// Narrow two vectors of 16 bit codes to 32 bytes in order
+static inline void G711Store32(BYTE * codes, __m256i lo, __m256i hi)
+{
+  __m256i packed = _mm256_packus_epi16(lo, hi);
+  _mm256_storeu_si256((__m256i *)codes, _mm256_permute4x64_epi64(packed, 0xD8));
+}
+
+#endif // __AVX2__
+
+
 /////////////////////////////////////////////////////////////////////////////
 
 H323_ALawCodec::H323_ALawCodec(Direction dir,
@@ -1229,6 +1411,36 @@ short H323_ALawCodec::DecodeSample(int sample)
 }
 
 
+void H323_ALawCodec::EncodeBlock(const short * samples, BYTE * codes, unsigned count)
+{
+  unsigned i = 0;
+
+#if defined(__AVX2__)
+  for (; i + 32 <= count; i += 32)
+    G711Store32(codes+i, G711ALawEncode16(_mm256_loadu_si256((const __m256i *)(samples+i))),
+                         G711ALawEncode16(_mm256_loadu_si256((const __m256i *)(samples+i+16))));
+#endif
+
+#if defined(__SSE2__)
+  for (; i + 16 <= count; i += 16)
+    _mm_storeu_si128((__m128i *)(codes+i),
+                     _mm_packus_epi16(G711ALawEncode8(_mm_loadu_si128((const __m128i *)(samples+i))),
+                                      G711ALawEncode8(_mm_loadu_si128((const __m128i *)(samples+i+8)))));
+#endif
+
+  for (; i < count; i++)
+    codes[i] = g711Tables.alawEncode[(unsigned short)samples[i] >> 3];
+}
+
+
+void H323_ALawCodec::DecodeBlock(const BYTE * codes, short * samples, unsigned count)
+{
+  const short * table = g711Tables.alawDecode;
+  while (count-- > 0)
+    *samples++ = table[*codes++];
+}
+
+
 /////////////////////////////////////////////////////////////////////////////
 
 H323_muLawCodec::H323_muLawCodec(Direction dir,
@@ -1256,6 +1468,36 @@ short H323_muLawCodec::DecodeSample(int sample)
 }
 
 
+void H323_muLawCodec::EncodeBlock(const short * samples, BYTE * codes, unsigned count)
+{
+  unsigned i = 0;
+
+#if defined(__AVX2__)
+  for (; i + 32 <= count; i += 32)
+    G711Store32(codes+i, G711uLawEncode16(_mm256_loadu_si256((const __m256i *)(samples+i))),
+                         G711uLawEncode16(_mm256_loadu_si256((const __m256i *)(samples+i+16))));
+#endif
+
+#if defined(__SSE2__)
+  for (; i + 16 <= count; i += 16)
+    _mm_storeu_si128((__m128i *)(codes+i),
+                     _mm_packus_epi16(G711uLawEncode8(_mm_loadu_si128((const __m128i *)(samples+i))),
+                                      G711uLawEncode8(_mm_loadu_si128((const __m128i *)(samples+i+8)))));
+#endif
+
+  for (; i < count; i++)
+    codes[i] = g711Tables.ulawEncode[(unsigned short)samples[i] >> 2];
+}
+
+
+void H323_muLawCodec::DecodeBlock(const BYTE * codes, short * samples, unsigned count)
+{
+  const short * table = g711Tables.ulawDecode;
+  while (count-- > 0)
+    *samples++ = table[*codes++];
+}
+
+
 /////////////////////////////////////////////////////////////////////////////
 
 #endif // NO_H323_AUDIO_CODECS
@@ -213,6 +213,13 @@ void H323GatekeeperGRQ::SetRejectReason(unsigned reasonCode)
 }
 
 
+PBoolean H323GatekeeperGRQ::SetBusyRejectReason()
+{
+  SetRejectReason(H225_GatekeeperRejectReason::e_resourceUnavailable);
+  return TRUE;
+}
+
+
 H323GatekeeperRequest::Response H323GatekeeperGRQ::OnHandlePDU()
 {
   return rasChannel.OnDiscovery(*this);
@@ -319,6 +326,13 @@ void H323GatekeeperRRQ::SetRejectReason(unsigned reasonCode)
 }
 
 
+PBoolean H323GatekeeperRRQ::SetBusyRejectReason()
+{
+  SetRejectReason(H225_RegistrationRejectReason::e_resourceUnavailable);
+  return TRUE;
+}
+
+
 H323GatekeeperRequest::Response H323GatekeeperRRQ::OnHandlePDU()
 {
   H323GatekeeperRequest::Response response = rasChannel.OnRegistration(*this);
@@ -468,6 +482,13 @@ void H323GatekeeperARQ::SetRejectReason(unsigned reasonCode)
 }
 
 
+PBoolean H323GatekeeperARQ::SetBusyRejectReason()
+{
+  SetRejectReason(H225_AdmissionRejectReason::e_resourceUnavailable);
+  return TRUE;
+}
+
+
 H323GatekeeperRequest::Response H323GatekeeperARQ::OnHandlePDU()
 {
   H323GatekeeperRequest::Response response = rasChannel.OnAdmission(*this);
@@ -621,6 +642,13 @@ void H323GatekeeperBRQ::SetRejectReason(unsigned reasonCode)
 }
 
 
+PBoolean H323GatekeeperBRQ::SetBusyRejectReason()
+{
+  SetRejectReason(H225_BandRejectReason::e_insufficientResources);
+  return TRUE;
+}
+
+
 H323GatekeeperRequest::Response H323GatekeeperBRQ::OnHandlePDU()
 {
   return rasChannel.OnBandwidth(*this);
@@ -693,6 +721,13 @@ void H323GatekeeperLRQ::SetRejectReason(unsigned reasonCode)
 }
 
 
+PBoolean H323GatekeeperLRQ::SetBusyRejectReason()
+{
+  SetRejectReason(H225_LocationRejectReason::e_resourceUnavailable);
+  return TRUE;
+}
+
+
 H323GatekeeperRequest::Response H323GatekeeperLRQ::OnHandlePDU()
 {
   return rasChannel.OnLocation(*this);
@@ -1215,6 +1250,8 @@ H323GatekeeperRequest::Response H323GatekeeperCall::OnInfoResponse(H323Gatekeepe
 
   UnlockReadWrite();
 
+  ScheduleHeartbeat();
+
   return H323GatekeeperRequest::Confirm;
 }
 
@@ -1240,6 +1277,16 @@ static PBoolean CheckTimeSince(PTime & lastTime, unsigned threshold)
 }
 
 
+static unsigned GetTimeUntil(const PTime & lastTime, unsigned threshold)
+{
+  // Same limit as CheckTimeSince(), so the check passes until then
+  PTime now;
+  PTimeInterval delta = now - lastTime;
+  int remaining = (int)(threshold+10) - (int)delta.GetSeconds();
+  return remaining > 0 ? remaining : 0;
+}
+
+
 PBoolean H323GatekeeperCall::OnHeartbeat()
 {
   if (!LockReadOnly()) {
@@ -1281,6 +1328,28 @@ PBoolean H323GatekeeperCall::OnHeartbeat()
   return response;
 }
 
+
+void H323GatekeeperCall::ScheduleHeartbeat()
+{
+  if (!LockReadOnly()) {
+    PTRACE(1, "RAS\tScheduleHeartbeat lock failed on call " << *this);
+    return;
+  }
+
+  unsigned rate = infoResponseRate;
+  unsigned seconds = GetTimeUntil(lastInfoResponse, rate);
+
+  UnlockReadOnly();
+
+  if (rate == 0)
+    gatekeeper.GetCallTimers().Cancel(heartbeatTimer);
+  else {
+    PStringStream key;
+    key << *this;
+    gatekeeper.GetCallTimers().Schedule(heartbeatTimer, key, seconds);
+  }
+}
+
 #ifdef H323_H248
 
 PString H323GatekeeperCall::GetCallCreditAmount() const
@@ -1555,7 +1624,13 @@ void H323RegisteredEndPoint::RemoveAlias(const PString & alias)
   // remove the aliases from the list in the gatekeeper
   gatekeeper.RemoveAlias(*this, alias);
 
+  PBoolean noAliases = aliases.IsEmpty();
+
   UnlockReadWrite();
+
+  // Have the monitor remove it when the last alias goes
+  if (noAliases)
+    ScheduleTimeToLive();
 }
 
 static PBoolean IsTransportAddressSuperset(const H225_ArrayOf_TransportAddress & pdu,
@@ -1627,6 +1702,8 @@ H323GatekeeperRequest::Response H323RegisteredEndPoint::OnRegistration(H323Gatek
 
   UnlockReadWrite();
 
+  ScheduleTimeToLive();
+
   if (info.rrq.m_keepAlive)
     return info.CheckCryptoTokens() ? H323GatekeeperRequest::Confirm
                                     : H323GatekeeperRequest::Reject;
@@ -1899,6 +1976,8 @@ H323GatekeeperRequest::Response H323RegisteredEndPoint::OnInfoResponse(H323Gatek
   lastInfoResponse = PTime();
   UnlockReadWrite();
 
+  ScheduleTimeToLive();
+
   if (info.irr.HasOptionalField(H225_InfoRequestResponse::e_irrStatus) &&
       info.irr.m_irrStatus.GetTag() == H225_InfoRequestResponseStatus::e_invalidCall) {
     PTRACE(2, "RAS\tIRR for call-id endpoint does not know about");
@@ -2009,6 +2088,29 @@ PBoolean H323RegisteredEndPoint::OnTimeToLive()
   return response;
 }
 
+
+void H323RegisteredEndPoint::ScheduleTimeToLive()
+{
+  if (!LockReadOnly()) {
+    PTRACE(1, "RAS\tScheduleTimeToLive lock failed on endpoint " << *this);
+    return;
+  }
+
+  // Endpoints without aliases are removed at the next check
+  PBoolean expires = aliases.GetSize() == 0 || timeToLive > 0;
+  unsigned seconds = 0;
+  if (aliases.GetSize() > 0)
+    seconds = PMAX(GetTimeUntil(lastRegistration, timeToLive),
+                   GetTimeUntil(lastInfoResponse, timeToLive));
+
+  UnlockReadOnly();
+
+  if (expires)
+    gatekeeper.GetEndPointTimers().Schedule(timeToLiveTimer, identifier, seconds);
+  else
+    gatekeeper.GetEndPointTimers().Cancel(timeToLiveTimer);
+}
+
 #ifdef H323_H248
 
 PString H323RegisteredEndPoint::GetCallCreditAmount() const
@@ -2635,6 +2737,409 @@ void H323GatekeeperListener::OnReceiveFeatureSet(unsigned pduType, const H225_Fe
 
 /////////////////////////////////////////////////////////////////////////////
 
+H323GatekeeperTimer::H323GatekeeperTimer()
+  : wheel(NULL), due(0), slot(NULL), prev(NULL), next(NULL)
+{
+}
+
+
+H323GatekeeperTimer::H323GatekeeperTimer(const H323GatekeeperTimer &)
+  : wheel(NULL), due(0), slot(NULL), prev(NULL), next(NULL)
+{
+}
+
+
+H323GatekeeperTimer::~H323GatekeeperTimer()
+{
+  if (wheel != NULL)
+    wheel->Cancel(*this);
+}
+
+
+H323GatekeeperTimerWheel::H323GatekeeperTimerWheel()
+  : startTick(PTimer::Tick()),
+    currentTick(0),
+    count(0)
+{
+  memset(level0, 0, sizeof(level0));
+  memset(levelN, 0, sizeof(levelN));
+}
+
+
+H323GatekeeperTimerWheel::~H323GatekeeperTimerWheel()
+{
+  PWaitAndSignal wait(mutex);
+
+  for (PINDEX i = 0; i < (1 << Level0Bits); i++) {
+    while (level0[i] != NULL)
+      Unlink(*level0[i]);
+  }
+
+  for (PINDEX level = 0; level < Levels-1; level++) {
+    for (PINDEX i = 0; i < (1 << LevelBits); i++) {
+      while (levelN[level][i] != NULL)
+        Unlink(*levelN[level][i]);
+    }
+  }
+}
+
+
+DWORD H323GatekeeperTimerWheel::GetTick() const
+{
+  return (DWORD)(PTimer::Tick() - startTick).GetSeconds();
+}
+
+
+void H323GatekeeperTimerWheel::Schedule(H323GatekeeperTimer & timer,
+                                        const PString & key,
+                                        unsigned seconds)
+{
+  PWaitAndSignal wait(mutex);
+
+  if (timer.wheel == this)
+    Unlink(timer);
+
+  // Never put it in a slot Expire() has already passed
+  timer.due = GetTick() + seconds;
+  if ((int)(timer.due - currentTick) <= 0)
+    timer.due = currentTick + 1;
+
+  timer.key = key;
+  timer.wheel = this;
+  count++;
+  Insert(timer);
+}
+
+
+void H323GatekeeperTimerWheel::Cancel(H323GatekeeperTimer & timer)
+{
+  PWaitAndSignal wait(mutex);
+
+  if (timer.wheel == this)
+    Unlink(timer);
+}
+
+
+void H323GatekeeperTimerWheel::Insert(H323GatekeeperTimer & timer)
+{
+  DWORD delta = timer.due - currentTick;
+  if ((int)delta < 0) {
+    timer.due = currentTick;
+    delta = 0;
+  }
+
+  H323GatekeeperTimer ** slot;
+  if (delta < (1 << Level0Bits))
+    slot = &level0[timer.due & ((1 << Level0Bits)-1)];
+  else if (delta < (1 << (Level0Bits+LevelBits)))
+    slot = &levelN[0][(timer.due >> Level0Bits) & ((1 << LevelBits)-1)];
+  else {
+    // Anything beyond the range of the last level goes round it again when
+    // its slot is cascaded, until it is close enough to drop a level.
+    slot = &levelN[1][(timer.due >> (Level0Bits+LevelBits)) & ((1 << LevelBits)-1)];
+  }
+
+  timer.slot = slot;
+  timer.prev = NULL;
+  timer.next = *slot;
+  if (*slot != NULL)
+    (*slot)->prev = &timer;
+  *slot = &timer;
+}
+
+
+void H323GatekeeperTimerWheel::Unlink(H323GatekeeperTimer & timer)
+{
+  if (timer.prev != NULL)
+    timer.prev->next = timer.next;
+  else
+    *timer.slot = timer.next;
+
+  if (timer.next != NULL)
+    timer.next->prev = timer.prev;
+
+  timer.slot = NULL;
+  timer.prev = timer.next = NULL;
+  timer.wheel = NULL;
+  count--;
+}
+
+
+void H323GatekeeperTimerWheel::Cascade(unsigned level)
+{
+  unsigned shift = Level0Bits + (level-1)*LevelBits;
+  unsigned index = (currentTick >> shift) & ((1 << LevelBits)-1);
+
+  // The level above refills this one when it wraps around
+  if (index == 0 && level < Levels-1)
+    Cascade(level+1);
+
+  H323GatekeeperTimer * timer = levelN[level-1][index];
+  levelN[level-1][index] = NULL;
+
+  while (timer != NULL) {
+    H323GatekeeperTimer * next = timer->next;
+    Insert(*timer);
+    timer = next;
+  }
+}
+
+
+PStringList H323GatekeeperTimerWheel::Expire()
+{
+  PStringList keys;
+
+  PWaitAndSignal wait(mutex);
+
+  DWORD now = GetTick();
+  while ((int)(now - currentTick) > 0) {
+    currentTick++;
+
+    unsigned index = currentTick & ((1 << Level0Bits)-1);
+    if (index == 0)
+      Cascade(1);
+
+    while (level0[index] != NULL) {
+      H323GatekeeperTimer & timer = *level0[index];
+      Unlink(timer);
+
+      if ((int)(timer.due - currentTick) > 0) {
+        // Never fire early, should the cascade ever bring one down too soon
+        timer.wheel = this;
+        count++;
+        Insert(timer);
+      }
+      else
+        keys.AppendString(timer.key);
+    }
+  }
+
+  return keys;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+/* Initial number of buckets in a H323GatekeeperIndex, must be a power of two */
+#define INDEX_INITIAL_BUCKETS 64
+
+H323GatekeeperIndex::H323GatekeeperIndex()
+  : byKey(INDEX_INITIAL_BUCKETS),
+    byIdentifier(INDEX_INITIAL_BUCKETS),
+    count(0)
+{
+}
+
+
+PINDEX H323GatekeeperIndex::Hash(const PString & key, PINDEX size)
+{
+  // FNV-1a, the table size is always a power of two
+  DWORD hash = 2166136261U;
+  for (const char * ptr = key; *ptr != '\0'; ptr++) {
+    hash ^= (BYTE)*ptr;
+    hash *= 16777619U;
+  }
+  return hash & (size-1);
+}
+
+
+PBoolean H323GatekeeperIndex::Erase(Bucket & bucket, const PString & first, const PString & second)
+{
+  for (Bucket::iterator it = bucket.begin(); it != bucket.end(); ++it) {
+    if (it->first == first && it->second == second) {
+      bucket.erase(it);
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+
+void H323GatekeeperIndex::Grow()
+{
+  PINDEX size = byKey.size()*2;
+
+  Table newByKey(size);
+  for (Table::iterator b = byKey.begin(); b != byKey.end(); ++b) {
+    for (Bucket::iterator it = b->begin(); it != b->end(); ++it)
+      newByKey[Hash(it->first, size)].push_back(*it);
+  }
+  byKey.swap(newByKey);
+
+  Table newByIdentifier(size);
+  for (Table::iterator b = byIdentifier.begin(); b != byIdentifier.end(); ++b) {
+    for (Bucket::iterator it = b->begin(); it != b->end(); ++it)
+      newByIdentifier[Hash(it->first, size)].push_back(*it);
+  }
+  byIdentifier.swap(newByIdentifier);
+}
+
+
+void H323GatekeeperIndex::Add(const PString & key, const PString & identifier)
+{
+  Bucket & bucket = byKey[Hash(key, byKey.size())];
+  for (Bucket::iterator it = bucket.begin(); it != bucket.end(); ++it) {
+    if (it->first == key && it->second == identifier)
+      return;
+  }
+
+  bucket.push_back(Entry(key, identifier));
+  byIdentifier[Hash(identifier, byIdentifier.size())].push_back(Entry(identifier, key));
+
+  if (++count > (PINDEX)byKey.size())
+    Grow();
+}
+
+
+PBoolean H323GatekeeperIndex::Remove(const PString & key, const PString & identifier)
+{
+  if (!Erase(byKey[Hash(key, byKey.size())], key, identifier))
+    return FALSE;
+
+  Erase(byIdentifier[Hash(identifier, byIdentifier.size())], identifier, key);
+  count--;
+  return TRUE;
+}
+
+
+PStringList H323GatekeeperIndex::RemoveIdentifier(const PString & identifier)
+{
+  PStringList keys;
+
+  Bucket & bucket = byIdentifier[Hash(identifier, byIdentifier.size())];
+  Bucket::iterator it = bucket.begin();
+  while (it != bucket.end()) {
+    if (it->first != identifier)
+      ++it;
+    else {
+      keys.AppendString(it->second);
+      Erase(byKey[Hash(it->second, byKey.size())], it->second, identifier);
+      count--;
+      it = bucket.erase(it);
+    }
+  }
+
+  return keys;
+}
+
+
+PBoolean H323GatekeeperIndex::Find(const PString & key, PString & identifier) const
+{
+  const Bucket & bucket = byKey[Hash(key, byKey.size())];
+  for (Bucket::const_iterator it = bucket.begin(); it != bucket.end(); ++it) {
+    if (it->first == key) {
+      identifier = it->second;
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+H323GatekeeperPrefixTree::H323GatekeeperPrefixTree()
+  : count(0)
+{
+}
+
+
+H323GatekeeperPrefixTree::~H323GatekeeperPrefixTree()
+{
+  for (std::map<char, Node *>::iterator it = root.children.begin(); it != root.children.end(); ++it)
+    Delete(it->second);
+}
+
+
+void H323GatekeeperPrefixTree::Delete(Node * node)
+{
+  for (std::map<char, Node *>::iterator it = node->children.begin(); it != node->children.end(); ++it)
+    Delete(it->second);
+  delete node;
+}
+
+
+void H323GatekeeperPrefixTree::Add(const PString & prefix, const PString & identifier)
+{
+  if (prefix.IsEmpty())
+    return;
+
+  Node * node = &root;
+  for (const char * ptr = prefix; *ptr != '\0'; ptr++) {
+    Node * & child = node->children[*ptr];
+    if (child == NULL)
+      child = new Node;
+    node = child;
+  }
+
+  for (std::vector<PString>::iterator it = node->identifiers.begin(); it != node->identifiers.end(); ++it) {
+    if (*it == identifier)
+      return;
+  }
+
+  node->identifiers.push_back(identifier);
+  count++;
+}
+
+
+PBoolean H323GatekeeperPrefixTree::Remove(const PString & prefix, const PString & identifier)
+{
+  if (prefix.IsEmpty())
+    return FALSE;
+
+  std::vector<Node *> path;
+  path.push_back(&root);
+  for (const char * ptr = prefix; *ptr != '\0'; ptr++) {
+    std::map<char, Node *>::iterator child = path.back()->children.find(*ptr);
+    if (child == path.back()->children.end())
+      return FALSE;
+    path.push_back(child->second);
+  }
+
+  std::vector<PString> & identifiers = path.back()->identifiers;
+  std::vector<PString>::iterator it = identifiers.begin();
+  while (it != identifiers.end() && *it != identifier)
+    ++it;
+  if (it == identifiers.end())
+    return FALSE;
+
+  identifiers.erase(it);
+  count--;
+
+  // Prune the nodes no longer leading to any prefix
+  for (PINDEX depth = prefix.GetLength(); depth > 0; depth--) {
+    Node * node = path[depth];
+    if (!node->identifiers.empty() || !node->children.empty())
+      break;
+    path[depth-1]->children.erase(prefix[depth-1]);
+    delete node;
+  }
+
+  return TRUE;
+}
+
+
+PBoolean H323GatekeeperPrefixTree::FindLongest(const PString & number, PString & identifier) const
+{
+  const Node * node = &root;
+  const Node * longest = NULL;
+
+  for (const char * ptr = number; *ptr != '\0'; ptr++) {
+    std::map<char, Node *>::const_iterator child = node->children.find(*ptr);
+    if (child == node->children.end())
+      break;
+    node = child->second;
+    if (!node->identifiers.empty())
+      longest = node;
+  }
+
+  if (longest == NULL)
+    return FALSE;
+
+  identifier = longest->identifiers.front();
+  return TRUE;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
 H323GatekeeperServer::H323GatekeeperServer(H323EndPoint & ep)
   : H323TransactionServer(ep)
 {
@@ -2683,6 +3188,9 @@ H323GatekeeperServer::~H323GatekeeperServer()
   PAssert(monitorThread->WaitForTermination(10000), "Gatekeeper monitor thread did not terminate!");
   delete monitorThread;
 
+  // Let requests in progress finish while the endpoints and calls exist
+  workerPool.Shutdown();
+
 #ifdef H323_H501
   delete peerElement;
 #endif
@@ -2922,18 +3430,28 @@ void H323GatekeeperServer::AddEndPoint(H323RegisteredEndPoint * ep)
     totalRegistrations++;
   }
 
+  mutex.Signal();
+
+  ep->ScheduleTimeToLive();
+
+  PWriteWaitAndSignal lock(indexMutex);
+
+  const PString & identifier = ep->GetIdentifier();
+
   for (i = 0; i < ep->GetSignalAddressCount(); i++)
-    byAddress.Append(new StringMap(ep->GetSignalAddress(i), ep->GetIdentifier()));
+    byAddress.Add(ep->GetSignalAddress(i), identifier);
 
   for (i = 0; i < ep->GetAliasCount(); i++) {
     PString alias = ep->GetAlias(i);
-    byAlias.Append(new StringMap(ep->GetAlias(i), ep->GetIdentifier()));
+    byAlias.Add(alias, identifier);
+    aliasOrder.insert(std::pair<PString, PString>(alias, identifier));
   }
 
-  for (i = 0; i < ep->GetPrefixCount(); i++)
-    byVoicePrefix.Append(new StringMap(ep->GetPrefix(i), ep->GetIdentifier()));
-
-  mutex.Signal();
+  for (i = 0; i < ep->GetPrefixCount(); i++) {
+    PString prefix = ep->GetPrefix(i);
+    byVoicePrefix.Add(prefix, identifier);
+    prefixTree.Add(prefix, identifier);
+  }
 }
 
 
@@ -2951,27 +3469,24 @@ PBoolean H323GatekeeperServer::RemoveEndPoint(H323RegisteredEndPoint * ep)
 
   PWaitAndSignal wait(mutex);
 
-  PINDEX i;
+  {
+    PWriteWaitAndSignal lock(indexMutex);
 
-  // remove prefixes belonging to this endpoint
-  for (i = 0; i < byVoicePrefix.GetSize(); i++) {
-    StringMap & prefixMap = (StringMap &)*byVoicePrefix.GetAt(i);
-    if (prefixMap.identifier == ep->GetIdentifier())
-      byVoicePrefix.RemoveAt(i);
-  }
+    const PString & identifier = ep->GetIdentifier();
+    PINDEX i;
 
-  // remove aliases belonging to this endpoint
-  for (i = 0; i < byAlias.GetSize(); i++) {
-    StringMap & aliasMap = (StringMap &)*byAlias.GetAt(i);
-    if (aliasMap.identifier == ep->GetIdentifier())
-      byAlias.RemoveAt(i);
-  }
+    // remove prefixes belonging to this endpoint
+    PStringList prefixes = byVoicePrefix.RemoveIdentifier(identifier);
+    for (i = 0; i < prefixes.GetSize(); i++)
+      prefixTree.Remove(prefixes[i], identifier);
 
-  // remove call signalling addresses
-  for (i = 0; i < byAddress.GetSize(); i++) {
-    StringMap & aliasMap = (StringMap &)*byAddress.GetAt(i);
-    if (aliasMap.identifier == ep->GetIdentifier())
-      byAddress.RemoveAt(i);
+    // remove aliases belonging to this endpoint
+    PStringList aliases = byAlias.RemoveIdentifier(identifier);
+    for (i = 0; i < aliases.GetSize(); i++)
+      aliasOrder.erase(std::pair<PString, PString>(aliases[i], identifier));
+
+    // remove call signalling addresses
+    byAddress.RemoveIdentifier(identifier);
   }
 
   // remove the descriptor
@@ -2991,27 +3506,14 @@ void H323GatekeeperServer::RemoveAlias(H323RegisteredEndPoint & ep,
 {
   PTRACE(3, "RAS\tRemoving registered endpoint alias: " << alias);
 
-  mutex.Wait();
-
-  PINDEX pos = byAlias.GetValuesIndex(alias);
-  if (pos != P_MAX_INDEX) {
-    // Allow for possible multiple aliases
-    while (pos < byAlias.GetSize()) {
-      StringMap & aliasMap = (StringMap &)byAlias[pos];
-      if (aliasMap != alias)
-        break;
-
-      if (aliasMap.identifier == ep.GetIdentifier())
-        byAlias.RemoveAt(pos);
-      else
-        pos++;
-    }
+  {
+    PWriteWaitAndSignal lock(indexMutex);
+    byAlias.Remove(alias, ep.GetIdentifier());
+    aliasOrder.erase(std::pair<PString, PString>(alias, ep.GetIdentifier()));
   }
 
   if (ep.ContainsAlias(alias))
     ep.RemoveAlias(alias);
-
-  mutex.Signal();
 }
 
 
@@ -3040,28 +3542,37 @@ PSafePtr<H323RegisteredEndPoint> H323GatekeeperServer::FindEndPointByIdentifier(
 PSafePtr<H323RegisteredEndPoint> H323GatekeeperServer::FindEndPointBySignalAddresses(
                             const H225_ArrayOf_TransportAddress & addresses, PSafetyMode mode)
 {
-  PWaitAndSignal wait(mutex);
+  PString identifier;
+
+  {
+    PReadWaitAndSignal lock(indexMutex);
 
-  for (PINDEX i = 0; i < addresses.GetSize(); i++) {
-    PINDEX pos = byAddress.GetValuesIndex(H323TransportAddress(addresses[i]));
-    if (pos != P_MAX_INDEX)
-      return FindEndPointByIdentifier(((StringMap &)byAddress[pos]).identifier, mode);
+    PINDEX i;
+    for (i = 0; i < addresses.GetSize(); i++) {
+      if (byAddress.Find(H323TransportAddress(addresses[i]), identifier))
+        break;
+    }
+
+    if (i >= addresses.GetSize())
+      return (H323RegisteredEndPoint *)NULL;
   }
 
-  return (H323RegisteredEndPoint *)NULL;
+  return FindEndPointByIdentifier(identifier, mode);
 }
 
 
 PSafePtr<H323RegisteredEndPoint> H323GatekeeperServer::FindEndPointBySignalAddress(
                                      const H323TransportAddress & address, PSafetyMode mode)
 {
-  PWaitAndSignal wait(mutex);
+  PString identifier;
 
-  PINDEX pos = byAddress.GetValuesIndex(address);
-  if (pos != P_MAX_INDEX)
-    return FindEndPointByIdentifier(((StringMap &)byAddress[pos]).identifier, mode);
+  {
+    PReadWaitAndSignal lock(indexMutex);
+    if (!byAddress.Find(address, identifier))
+      return (H323RegisteredEndPoint *)NULL;
+  }
 
-  return (H323RegisteredEndPoint *)NULL;
+  return FindEndPointByIdentifier(identifier, mode);
 }
 
 
@@ -3075,14 +3586,17 @@ PSafePtr<H323RegisteredEndPoint> H323GatekeeperServer::FindEndPointByAliasAddres
 PSafePtr<H323RegisteredEndPoint> H323GatekeeperServer::FindEndPointByAliasString(
                                                   const PString & alias, PSafetyMode mode)
 {
-  {
-    PWaitAndSignal wait(mutex);
-    PINDEX pos = byAlias.GetValuesIndex(alias);
+  PString identifier;
+  PBoolean found;
 
-    if (pos != P_MAX_INDEX)
-      return FindEndPointByIdentifier(((StringMap &)byAlias[pos]).identifier, mode);
+  {
+    PReadWaitAndSignal lock(indexMutex);
+    found = byAlias.Find(alias, identifier);
   }
 
+  if (found)
+    return FindEndPointByIdentifier(identifier, mode);
+
   return FindEndPointByPrefixString(alias, mode);
 }
 
@@ -3090,18 +3604,24 @@ PSafePtr<H323RegisteredEndPoint> H323GatekeeperServer::FindEndPointByAliasString
 PSafePtr<H323RegisteredEndPoint> H323GatekeeperServer::FindEndPointByPartialAlias(
                                                   const PString & alias, PSafetyMode mode)
 {
-  PWaitAndSignal wait(mutex);
-  PINDEX pos = byAlias.GetNextStringsIndex(alias);
-
-  if (pos != P_MAX_INDEX) {
-    StringMap & possible = (StringMap &)byAlias[pos];
-    if (possible.NumCompare(alias) == EqualTo) {
-      PTRACE(4, "RAS\tPartial endpoint search for "
-                "\"" << alias << "\" found \"" << possible << '"');
-      return FindEndPointByIdentifier(possible.identifier, mode);
+  PString possible, identifier;
+
+  {
+    PReadWaitAndSignal lock(indexMutex);
+    std::set<std::pair<PString, PString> >::const_iterator it =
+                      aliasOrder.lower_bound(std::pair<PString, PString>(alias, PString::Empty()));
+    if (it != aliasOrder.end()) {
+      possible = it->first;
+      identifier = it->second;
     }
   }
 
+  if (!possible.IsEmpty() && possible.NumCompare(alias) == EqualTo) {
+    PTRACE(4, "RAS\tPartial endpoint search for "
+              "\"" << alias << "\" found \"" << possible << '"');
+    return FindEndPointByIdentifier(identifier, mode);
+  }
+
   PTRACE(4, "RAS\tPartial endpoint search for \"" << alias << "\" failed");
   return (H323RegisteredEndPoint *)NULL;
 }
@@ -3110,18 +3630,15 @@ PSafePtr<H323RegisteredEndPoint> H323GatekeeperServer::FindEndPointByPartialAlia
 PSafePtr<H323RegisteredEndPoint> H323GatekeeperServer::FindEndPointByPrefixString(
                                                   const PString & prefix, PSafetyMode mode)
 {
-  PWaitAndSignal wait(mutex);
+  PString identifier;
 
-  if (byVoicePrefix.IsEmpty())
-    return (H323RegisteredEndPoint *)NULL;
-
-  for (PINDEX len = prefix.GetLength(); len > 0; len--) {
-    PINDEX pos = byVoicePrefix.GetValuesIndex(prefix.Left(len));
-    if (pos != P_MAX_INDEX)
-      return FindEndPointByIdentifier(((StringMap &)byVoicePrefix[pos]).identifier, mode);
+  {
+    PReadWaitAndSignal lock(indexMutex);
+    if (!prefixTree.FindLongest(prefix, identifier))
+      return (H323RegisteredEndPoint *)NULL;
   }
 
-  return (H323RegisteredEndPoint *)NULL;
+  return FindEndPointByIdentifier(identifier, mode);
 }
 
 
@@ -3191,6 +3708,8 @@ H323GatekeeperRequest::Response H323GatekeeperServer::OnAdmission(H323Gatekeeper
       PTRACE(2, "RAS\tAdded new call (total=" << activeCalls.GetSize() << ") " << *newCall);
       mutex.Signal();
 
+      newCall->ScheduleHeartbeat();
+
       AddCall(oldCall);
     } else {
       delete newCall;
@@ -3569,24 +4088,38 @@ void H323GatekeeperServer::MonitorMain(PThread &, H323_INT)
   while (!monitorExit.Wait(1000)) {
     PTRACE(6, "RAS\tAging registered endpoints");
 
-    for (PSafePtr<H323RegisteredEndPoint> ep = GetFirstEndPoint(PSafeReference); ep != NULL; ep++) {
-      if (!ep->OnTimeToLive()) {
-        PTRACE(2, "RAS\tRemoving expired endpoint " << *ep);
-        RemoveEndPoint(ep);
-      }
+    // Only the endpoints and calls whose timers are due are checked
+    PStringList expired = endPointTimers.Expire();
+    PINDEX i;
+    for (i = 0; i < expired.GetSize(); i++) {
+      PSafePtr<H323RegisteredEndPoint> ep = FindEndPointByIdentifier(expired[i], PSafeReference);
+      if (ep == NULL)
+        continue;
+
       if (ep->GetAliasCount() == 0) {
         PTRACE(2, "RAS\tRemoving endpoint " << *ep << " with no aliases");
         RemoveEndPoint(ep);
       }
+      else if (!ep->OnTimeToLive()) {
+        PTRACE(2, "RAS\tRemoving expired endpoint " << *ep);
+        RemoveEndPoint(ep);
+      }
+      else
+        ep->ScheduleTimeToLive();
     }
 
     byIdentifier.DeleteObjectsToBeRemoved();
 
-    for (PSafePtr<H323GatekeeperCall> call = GetFirstCall(PSafeReference); call != NULL; call++) {
-      if (!call->OnHeartbeat()) {
-        if (disengageOnHearbeatFail)
-          call->Disengage();
-      }
+    expired = callTimers.Expire();
+    for (i = 0; i < expired.GetSize(); i++) {
+      PSafePtr<H323GatekeeperCall> call = FindCall(expired[i], PSafeReference);
+      if (call == NULL)
+        continue;
+
+      if (!call->OnHeartbeat() && disengageOnHearbeatFail)
+        call->Disengage();
+      else
+        call->ScheduleHeartbeat();
     }
 
     activeCalls.DeleteObjectsToBeRemoved();
@@ -48,6 +48,7 @@
 #include <h235auth.h>
 #include "h235/h2356.h"
 #include "h235/h235support.h"
+#include "h235/h235crypto.h"
 #include "h323con.h"
 #include <algorithm>
 
@@ -443,8 +444,13 @@ void H2356_Authenticator::InitialiseSecurity()
 
   m_algOIDs.SetSize(0);
   for (PINDEX i=0; i<PARRAYSIZE(H235_Algorithms); ++i) {
-      if (PString(H235_Algorithms[i].DHparameters) == dhOID)
-           m_algOIDs.AppendString(H235_Algorithms[i].algorithm);
+      if (PString(H235_Algorithms[i].DHparameters) != dhOID)
+          continue;
+#ifdef H323_H235_AEAD
+      if (!H235Authenticators::GetAuthenticatedMedia() && H235CryptoEngine::IsAuthenticatedAlgorithm(H235_Algorithms[i].algorithm))
+          continue;
+#endif
+      m_algOIDs.AppendString(H235_Algorithms[i].algorithm);
   }
 
   H235_DHMap::iterator l = m_dhLocalMap.find(dhOID);
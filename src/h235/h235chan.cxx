@@ -52,6 +52,12 @@ const char * STR_AES256 = "AES256";
 #endif
 const char * STR_AES192 = "AES192";
 const char * STR_AES128 = "AES128";
+#ifdef H323_H235_AEAD
+#ifdef H323_H235_AES256
+const char * STR_AES256_GCM = "AES256-GCM";
+#endif
+const char * STR_AES128_GCM = "AES128-GCM";
+#endif
 
 PString CipherString(const PString & m_algorithmOID)
 {
@@ -62,6 +68,14 @@ PString CipherString(const PString & m_algorithmOID)
 #ifdef H323_H235_AES256
     } else if (m_algorithmOID == "2.16.840.1.101.3.4.1.42") {
         return STR_AES256;
+#endif
+#ifdef H323_H235_AEAD
+    } else if (m_algorithmOID == "2.16.840.1.101.3.4.1.6") {
+        return STR_AES128_GCM;
+#ifdef H323_H235_AES256
+    } else if (m_algorithmOID == "2.16.840.1.101.3.4.1.46") {
+        return STR_AES256_GCM;
+#endif
 #endif
     }
     return "Unknown";
@@ -460,16 +460,22 @@ int H235CryptoHelper::DecryptFinalRelaxed(EVP_CIPHER_CTX *ctx, unsigned char *ou
 
 H235CryptoEngine::H235CryptoEngine(const PString & algorithmOID)
 :  m_encryptCtx(NULL), m_decryptCtx(NULL),
-   m_algorithmOID(algorithmOID), m_operationCnt(0), m_initialised(false),
+   m_algorithmOID(algorithmOID), m_operationCnt(0), m_initialised(false), m_authenticated(false),
    m_enc_blockSize(0), m_enc_ivLength(0), m_dec_blockSize(0), m_dec_ivLength(0)
 {
+#ifdef H323_H235_AEAD
+    memset(m_salt, 0, sizeof(m_salt));
+#endif
 }
 
 H235CryptoEngine::H235CryptoEngine(const PString & algorithmOID, const PBYTEArray & key)
 :  m_encryptCtx(NULL), m_decryptCtx(NULL),
-   m_algorithmOID(algorithmOID), m_operationCnt(0), m_initialised(false),
+   m_algorithmOID(algorithmOID), m_operationCnt(0), m_initialised(false), m_authenticated(false),
    m_enc_blockSize(0), m_enc_ivLength(0), m_dec_blockSize(0), m_dec_ivLength(0)
 {
+#ifdef H323_H235_AEAD
+    memset(m_salt, 0, sizeof(m_salt));
+#endif
     SetKey(key);
 }
 
@@ -484,6 +490,7 @@ H235CryptoEngine::~H235CryptoEngine()
 void H235CryptoEngine::SetKey(PBYTEArray key)
 {
     const EVP_CIPHER * cipher = NULL;
+    m_authenticated = false;
 
     if (m_algorithmOID == ID_AES128) {
         cipher = EVP_aes_128_cbc();
@@ -492,6 +499,16 @@ void H235CryptoEngine::SetKey(PBYTEArray key)
         cipher = EVP_aes_192_cbc();
     } else if (m_algorithmOID == ID_AES256) {
         cipher = EVP_aes_256_cbc();
+#endif
+#ifdef H323_H235_AEAD
+    } else if (m_algorithmOID == ID_AES128_GCM) {
+        cipher = EVP_aes_128_gcm();
+        m_authenticated = true;
+#ifdef H323_H235_AES256
+    } else if (m_algorithmOID == ID_AES256_GCM) {
+        cipher = EVP_aes_256_gcm();
+        m_authenticated = true;
+#endif
 #endif
     } else {
         PTRACE(1, "H235\tUnsupported algorithm " << m_algorithmOID);
@@ -500,6 +517,20 @@ void H235CryptoEngine::SetKey(PBYTEArray key)
 
     m_initialised = false;
 
+#ifdef H323_H235_AEAD
+    if (m_authenticated) {
+        // The session salt follows the key in the media key material
+        PINDEX keyLength = EVP_CIPHER_key_length(cipher);
+        if (key.GetSize() < keyLength + AEAD_SALT_LEN) {
+            PTRACE(1, "H235\tKey material too short for " << m_algorithmOID << ", size=" << key.GetSize());
+            return;
+        }
+        memcpy(m_salt, key.GetPointer() + keyLength, AEAD_SALT_LEN);
+        m_encIndex = PacketIndex();
+        m_decIndex = PacketIndex();
+    }
+#endif
+
     if (m_encryptCtx == NULL) {
       m_encryptCtx = EVP_CIPHER_CTX_new();
       if (m_encryptCtx == NULL) {
@@ -629,6 +660,12 @@ PINDEX H235CryptoEngine::EncryptInPlace(const BYTE * inData, PINDEX inLength, BY
     EVP_CIPHER_CTX_set_padding(m_encryptCtx, rtpPadding ? 1 : 0);
 
     if (!rtpPadding && (inLength % m_enc_blockSize > 0)) {
+        // ciphertext stealing can't work in place, keep the input aside
+        if (inData == outData) {
+            m_ctsBuffer.SetMinSize(inLength);
+            memcpy(m_ctsBuffer.GetPointer(), inData, inLength);
+            inData = m_ctsBuffer;
+        }
         // use cyphertext stealing
         if (!m_encryptHelper.EncryptUpdateCTS(m_encryptCtx, outData, &inSize, inData, inLength)) {
             PTRACE(1, "H235\tEVP_EncryptUpdate_cts() failed");
@@ -695,6 +732,10 @@ PBYTEArray H235CryptoEngine::Decrypt(const PBYTEArray & _data, unsigned char * i
 
 PINDEX H235CryptoEngine::DecryptInPlace(const BYTE * inData, PINDEX inLength, BYTE * outData, unsigned char * ivSequence, bool & rtpPadding)
 {
+    if (!m_initialised) {
+        PTRACE(1, "H235\tERROR: Decryption not initialised!!");
+        return 0;
+    }
 
     /* plaintext will always be equal to or lesser than length of ciphertext*/
     int outSize = 0;
@@ -707,6 +748,12 @@ PINDEX H235CryptoEngine::DecryptInPlace(const BYTE * inData, PINDEX inLength, BY
     EVP_CIPHER_CTX_set_padding(m_decryptCtx, rtpPadding ? 1 : 0);
 
     if (!rtpPadding && inLength % m_dec_blockSize > 0) {
+        // ciphertext stealing can't work in place, keep the input aside
+        if (inData == outData) {
+            m_ctsBuffer.SetMinSize(inLength);
+            memcpy(m_ctsBuffer.GetPointer(), inData, inLength);
+            inData = m_ctsBuffer;
+        }
         // use cyphertext stealing
         if (!m_decryptHelper.DecryptUpdateCTS(m_decryptCtx, outData, &inSize, inData, inLength)) {
             PTRACE(1, "H235\tDecryptUpdateCTS() failed");
@@ -730,6 +777,152 @@ PINDEX H235CryptoEngine::DecryptInPlace(const BYTE * inData, PINDEX inLength, BY
     return inSize + outSize;
 }
 
+#ifdef H323_H235_AEAD
+DWORD H235CryptoEngine::PacketIndex::Estimate(DWORD packetSsrc, WORD seq) const
+{
+    // A new source starts its own count
+    if (!valid || packetSsrc != ssrc)
+        return 0;
+
+    if (lastSeq < 0x8000) {
+        if (seq > lastSeq && seq - lastSeq > 0x8000)
+            return roc - 1;
+    } else {
+        if (lastSeq - 0x8000 > seq)
+            return roc + 1;
+    }
+    return roc;
+}
+
+void H235CryptoEngine::PacketIndex::Update(DWORD packetSsrc, DWORD packetRoc, WORD seq)
+{
+    if (!valid || packetSsrc != ssrc) {
+        valid = true;
+        ssrc = packetSsrc;
+        roc = packetRoc;
+        lastSeq = seq;
+    } else if (packetRoc == roc + 1 || (packetRoc == roc && seq > lastSeq)) {
+        roc = packetRoc;
+        lastSeq = seq;
+    }
+}
+
+void H235CryptoEngine::MakeNonce(unsigned char * nonce, DWORD ssrc, DWORD roc, WORD seq) const
+{
+    // 00 00 || SSRC || ROC || SEQ, XORed with the session salt
+    nonce[0] = 0;
+    nonce[1] = 0;
+    nonce[2] = (BYTE)(ssrc >> 24);
+    nonce[3] = (BYTE)(ssrc >> 16);
+    nonce[4] = (BYTE)(ssrc >> 8);
+    nonce[5] = (BYTE)ssrc;
+    nonce[6] = (BYTE)(roc >> 24);
+    nonce[7] = (BYTE)(roc >> 16);
+    nonce[8] = (BYTE)(roc >> 8);
+    nonce[9] = (BYTE)roc;
+    nonce[10] = (BYTE)(seq >> 8);
+    nonce[11] = (BYTE)seq;
+
+    for (PINDEX i = 0; i < AEAD_NONCE_LEN; i++)
+        nonce[i] ^= m_salt[i];
+}
+
+PINDEX H235CryptoEngine::EncryptAuthenticated(BYTE * data, PINDEX length, const BYTE * header, PINDEX headerSize)
+{
+    if (!m_initialised || !m_authenticated) {
+        PTRACE(1, "H235\tERROR: Authenticated encryption not initialised!!");
+        return 0;
+    }
+
+    if (headerSize < 12) {
+        PTRACE(2, "H235\tRTP header too short, size=" << headerSize);
+        return 0;
+    }
+
+    WORD seq = (WORD)((header[2] << 8) | header[3]);
+    DWORD ssrc = ((DWORD)header[8] << 24) | ((DWORD)header[9] << 16) | ((DWORD)header[10] << 8) | header[11];
+    DWORD roc = m_encIndex.Estimate(ssrc, seq);
+
+    unsigned char nonce[AEAD_NONCE_LEN];
+    MakeNonce(nonce, ssrc, roc, seq);
+
+    int outSize = 0;
+    int finalSize = 0;
+    if (!EVP_EncryptInit_ex(m_encryptCtx, NULL, NULL, NULL, nonce)
+     || !EVP_EncryptUpdate(m_encryptCtx, NULL, &outSize, header, headerSize)
+     || !EVP_EncryptUpdate(m_encryptCtx, data, &outSize, data, length)
+     || !EVP_EncryptFinal_ex(m_encryptCtx, data + outSize, &finalSize)
+     || !EVP_CIPHER_CTX_ctrl(m_encryptCtx, EVP_CTRL_GCM_GET_TAG, AEAD_TAG_LEN, data + outSize + finalSize)) {
+        PTRACE(1, "H235\tGCM encryption failed");
+        return 0;
+    }
+
+    m_encIndex.Update(ssrc, roc, seq);
+    m_operationCnt++;
+    return outSize + finalSize + AEAD_TAG_LEN;
+}
+
+PINDEX H235CryptoEngine::DecryptAuthenticated(BYTE * data, PINDEX length, const BYTE * header, PINDEX headerSize)
+{
+    if (!m_initialised || !m_authenticated) {
+        PTRACE(1, "H235\tERROR: Authenticated decryption not initialised!!");
+        return 0;
+    }
+
+    if (length < AEAD_TAG_LEN || headerSize < 12) {
+        PTRACE(2, "H235\tGCM packet too short, size=" << length);
+        return 0;
+    }
+
+    WORD seq = (WORD)((header[2] << 8) | header[3]);
+    DWORD ssrc = ((DWORD)header[8] << 24) | ((DWORD)header[9] << 16) | ((DWORD)header[10] << 8) | header[11];
+    DWORD roc = m_decIndex.Estimate(ssrc, seq);
+
+    unsigned char nonce[AEAD_NONCE_LEN];
+    MakeNonce(nonce, ssrc, roc, seq);
+
+    PINDEX cipherSize = length - AEAD_TAG_LEN;
+    int outSize = 0;
+    int finalSize = 0;
+    if (!EVP_DecryptInit_ex(m_decryptCtx, NULL, NULL, NULL, nonce)
+     || !EVP_DecryptUpdate(m_decryptCtx, NULL, &outSize, header, headerSize)
+     || !EVP_DecryptUpdate(m_decryptCtx, data, &outSize, data, cipherSize)
+     || !EVP_CIPHER_CTX_ctrl(m_decryptCtx, EVP_CTRL_GCM_SET_TAG, AEAD_TAG_LEN, data + cipherSize)) {
+        PTRACE(1, "H235\tGCM decryption failed");
+        return 0;
+    }
+
+    if (EVP_DecryptFinal_ex(m_decryptCtx, data + outSize, &finalSize) <= 0) {
+        PTRACE(2, "H235\tGCM tag mismatch, packet discarded");
+        return 0;	// no usable payload
+    }
+
+    // Only an authentic packet may move the roll over counter on
+    m_decIndex.Update(ssrc, roc, seq);
+    return outSize + finalSize;
+}
+
+PBoolean H235CryptoEngine::IsAuthenticatedAlgorithm(const PString & algorithmOID)
+{
+#ifdef H323_H235_AES256
+    if (algorithmOID == ID_AES256_GCM)
+        return true;
+#endif
+    return (algorithmOID == ID_AES128_GCM);
+}
+
+PString H235CryptoEngine::GetKeyWrapAlgorithm(const PString & algorithmOID)
+{
+#ifdef H323_H235_AES256
+    if (algorithmOID == ID_AES256_GCM)
+        return ID_AES256;
+#endif
+    if (algorithmOID == ID_AES128_GCM)
+        return ID_AES128;
+    return algorithmOID;
+}
+#endif
+
 PBYTEArray H235CryptoEngine::GenerateRandomKey()
 {
     PBYTEArray result = GenerateRandomKey(m_algorithmOID);
@@ -748,6 +941,14 @@ PBYTEArray H235CryptoEngine::GenerateRandomKey(const PString & algorithmOID)
         key.SetSize(24);
     } else if (m_algorithmOID == ID_AES256) {
         key.SetSize(32);
+#endif
+#ifdef H323_H235_AEAD
+    } else if (algorithmOID == ID_AES128_GCM) {
+        key.SetSize(16 + AEAD_SALT_LEN);
+#ifdef H323_H235_AES256
+    } else if (algorithmOID == ID_AES256_GCM) {
+        key.SetSize(32 + AEAD_SALT_LEN);
+#endif
 #endif
     } else {
         PTRACE(1, "Unsupported algorithm " << algorithmOID);
@@ -761,9 +962,14 @@ PBYTEArray H235CryptoEngine::GenerateRandomKey(const PString & algorithmOID)
 ///////////////////////////////////////////////////////////////////////////////////
 
 H235Session::H235Session(H235Capabilities * caps, const PString & oidAlgorithm)
-: m_dh(*caps->GetDiffieHellMan()), m_context(oidAlgorithm), m_dhcontext(oidAlgorithm),
+: m_dh(*caps->GetDiffieHellMan()), m_context(oidAlgorithm),
+#ifdef H323_H235_AEAD
+  m_dhcontext(H235CryptoEngine::GetKeyWrapAlgorithm(oidAlgorithm)),
+#else
+  m_dhcontext(oidAlgorithm),
+#endif
   m_isInitialised(false), m_isMaster(false), m_crytoMasterKey(0),
-  m_frameBuffer(1500), m_padding(false)
+  m_frameBuffer(1500)
 {
     if (oidAlgorithm == ID_AES128) {
         m_dhkeyLen = 16;
@@ -772,6 +978,14 @@ H235Session::H235Session(H235Capabilities * caps, const PString & oidAlgorithm)
         m_dhkeyLen = 24;
     } else if (oidAlgorithm == ID_AES256) {
         m_dhkeyLen = 32;
+#endif
+#ifdef H323_H235_AEAD
+    } else if (oidAlgorithm == ID_AES128_GCM) {
+        m_dhkeyLen = 16;
+#ifdef H323_H235_AES256
+    } else if (oidAlgorithm == ID_AES256_GCM) {
+        m_dhkeyLen = 32;
+#endif
 #endif
     } else {
         PTRACE(1, "Unsupported algorithm " << oidAlgorithm);
@@ -844,6 +1058,9 @@ PBoolean H235Session::CreateSession(PBoolean isMaster)
 
 PBoolean H235Session::ReadFrame(DWORD & /*rtpTimestamp*/, RTP_DataFrame & frame)
 {
+    if (m_context.IsAuthenticated())
+        return ReadFrameInPlace(frame);
+
     unsigned char ivSequence[6];
     memcpy(ivSequence, frame.GetSequenceNumberPtr(), 6);
     PBoolean padding = frame.GetPadding();
@@ -859,16 +1076,37 @@ PBoolean H235Session::ReadFrame(DWORD & /*rtpTimestamp*/, RTP_DataFrame & frame)
 
 PBoolean H235Session::ReadFrameInPlace(RTP_DataFrame & frame)
 {
-    memcpy(m_ivSequence, frame.GetSequenceNumberPtr(), 6);
-    m_padding = frame.GetPadding();
-    frame.SetPayloadSize(m_context.DecryptInPlace(frame.GetPayloadPtr(), frame.GetPayloadSize(), m_frameBuffer.GetPointer(), m_ivSequence, m_padding));
-    memmove(frame.GetPayloadPtr(), m_frameBuffer.GetPointer(), frame.GetPayloadSize());
-    frame.SetPadding(m_padding);
+#ifdef H323_H235_AEAD
+    if (m_context.IsAuthenticated()) {
+        // GCM needs no RTP padding, a forged or damaged packet leaves an empty payload
+        const BYTE * header = frame.GetPointer();
+        BYTE * payload = frame.GetPayloadPtr();
+        frame.SetPayloadSize(m_context.DecryptAuthenticated(payload, frame.GetPayloadSize(), header, frame.GetHeaderSize()));
+        frame.SetPadding(false);
+        return true;
+    }
+#endif
+
+    // The IV comes from the header, which is not touched by decrypting the payload
+    bool padding = frame.GetPadding();
+    BYTE * payload = frame.GetPayloadPtr();
+    frame.SetPayloadSize(m_context.DecryptInPlace(payload, frame.GetPayloadSize(), payload, frame.GetSequenceNumberPtr(), padding));
+    frame.SetPadding(padding);
     return true;	// don't stop on decoding errors
 }
 
+PINDEX H235Session::ReadFramesInPlace(RTP_DataFrame * frames, PINDEX count)
+{
+    for (PINDEX i = 0; i < count; i++)
+        ReadFrameInPlace(frames[i]);
+    return count;
+}
+
 PBoolean H235Session::WriteFrame(RTP_DataFrame & frame)
 {
+    if (m_context.IsAuthenticated())
+        return WriteFrameInPlace(frame);
+
     unsigned char ivSequence[6];
     memcpy(ivSequence, frame.GetSequenceNumberPtr(), 6);
     PBoolean padding = frame.GetPadding();
@@ -884,13 +1122,41 @@ PBoolean H235Session::WriteFrame(RTP_DataFrame & frame)
 
 PBoolean H235Session::WriteFrameInPlace(RTP_DataFrame & frame)
 {
-    memcpy(m_ivSequence, frame.GetSequenceNumberPtr(), 6);
-    m_padding = frame.GetPadding();
-    frame.SetPayloadSize(m_context.EncryptInPlace(frame.GetPayloadPtr(), frame.GetPayloadSize(), m_frameBuffer.GetPointer(), m_ivSequence, m_padding));
-    memmove(frame.GetPayloadPtr(), m_frameBuffer.GetPointer(), frame.GetPayloadSize());
-    frame.SetPadding(m_padding);
+    PINDEX length = frame.GetPayloadSize();
+
+#ifdef H323_H235_AEAD
+    if (m_context.IsAuthenticated()) {
+        // Make room for the tag first, so the payload pointer stays valid
+        if (!frame.SetPayloadSize(length + AEAD_TAG_LEN))
+            return false;
+        // The header is authenticated, so it must be final before encrypting
+        frame.SetPadding(false);
+        const BYTE * header = frame.GetPointer();
+        BYTE * payload = frame.GetPayloadPtr();
+        frame.SetPayloadSize(m_context.EncryptAuthenticated(payload, length, header, frame.GetHeaderSize()));
+        return (frame.GetPayloadSize() > 0);
+    }
+#endif
+
+    // Make room for the padding block first, so the payload pointer stays valid
+    if (!frame.SetPayloadSize(length + EVP_MAX_BLOCK_LENGTH))
+        return false;
+
+    bool padding = frame.GetPadding();
+    BYTE * payload = frame.GetPayloadPtr();
+    frame.SetPayloadSize(m_context.EncryptInPlace(payload, length, payload, frame.GetSequenceNumberPtr(), padding));
+    frame.SetPadding(padding);
     return (frame.GetPayloadSize() > 0);
 }
 
+PINDEX H235Session::WriteFramesInPlace(RTP_DataFrame * frames, PINDEX count)
+{
+    for (PINDEX i = 0; i < count; i++) {
+        if (!WriteFrameInPlace(frames[i]))
+            return i;
+    }
+    return count;
+}
+
 #endif
 
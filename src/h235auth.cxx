@@ -343,6 +343,9 @@ PBoolean H235Authenticator::GetAlgorithmDetails(const PString & /*algorithm*/,
 PINDEX   H235Authenticators::m_encryptionPolicy = 0;   // Default Encryption is disabled must be one of the H235MediaPolicy values
 PINDEX   H235Authenticators::m_cipherLength = 128;     // Ciphers above 128 must be expressly enabled.
 PINDEX   H235Authenticators::m_maxTokenLength = 1024;  // Tokens longer than 1024 bits must be expressly enabled.
+#ifdef H323_H235_AEAD
+PBoolean H235Authenticators::m_authenticatedMedia = FALSE; // The GCM algorithms are not part of H.235.6 so must be expressly enabled.
+#endif
 PString  H235Authenticators::m_dhFile=PString();
 H235Authenticators::DH_DataList H235Authenticators::m_dhData;
 #endif
@@ -710,6 +713,18 @@ PINDEX H235Authenticators::GetEncryptionPolicy()
     return m_encryptionPolicy;
 }
 
+#ifdef H323_H235_AEAD
+void H235Authenticators::SetAuthenticatedMedia(PBoolean enable)
+{
+    m_authenticatedMedia = enable;
+}
+
+PBoolean H235Authenticators::GetAuthenticatedMedia()
+{
+    return m_authenticatedMedia;
+}
+#endif
+
 #endif
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -92,6 +92,10 @@
 
 #include "h235auth.h"
 
+#ifdef H323_SIGNAL_REACTOR
+#include "signalreactor.h"
+#endif
+
 const PTimeInterval MonitorCallStatusTime(0, 10); // Seconds
 
 #define new PNEW
@@ -178,6 +182,67 @@ class AggregatedH245Handle : public H323AggregatedH2x5Handle
 
 #endif
 
+#ifdef H323_SIGNAL_REACTOR
+
+class ReactorH225Handle : public H323SignalReactorHandle
+{
+  PCLASSINFO(ReactorH225Handle, H323SignalReactorHandle)
+  public:
+    ReactorH225Handle(H323TransportTCP & _transport, H323Connection & _connection, const PTimeInterval & keepAlive)
+      : H323SignalReactorHandle(_transport, keepAlive),
+        connection(_connection)
+    {
+    }
+
+    PBoolean OnReceivedPDU(PBoolean ok, PBYTEArray & dataPDU)
+    {
+      H323SignalPDU pdu;
+      if (ok)
+        ok = pdu.ProcessReadData(transport, dataPDU);
+      // skip keep-alives
+      if (ok && pdu.GetQ931().GetMessageType() == 0)
+        return TRUE;
+      return connection.HandleReceivedSignalPDU(ok, pdu);
+    }
+
+    void OnStopped()
+    {
+      connection.EndHandleSignallingChannel();
+    }
+
+  protected:
+    H323Connection & connection;
+};
+
+class ReactorH245Handle : public H323SignalReactorHandle
+{
+  PCLASSINFO(ReactorH245Handle, H323SignalReactorHandle)
+  public:
+    ReactorH245Handle(H323TransportTCP & _transport, H323Connection & _connection, const PTimeInterval & keepAlive)
+      : H323SignalReactorHandle(_transport, keepAlive),
+        connection(_connection)
+    {
+    }
+
+    PBoolean OnReceivedPDU(PBoolean ok, PBYTEArray & pdu)
+    {
+      connection.MonitorCallStatus();
+      PPER_Stream strm(pdu);
+      return connection.HandleReceivedControlPDU(ok, strm);
+    }
+
+    void OnStopped()
+    {
+      connection.EndHandleControlChannel();
+      PTRACE(2, "H245\tControl channel closed.");
+    }
+
+  protected:
+    H323Connection & connection;
+};
+
+#endif
+
 /////////////////////////////////////////////////////////////////////////////
 
 #if PTRACING
@@ -598,6 +663,10 @@ H323Connection::H323Connection(H323EndPoint & ep,
   controlAggregator = NULL;
   useSignallingAggregation = (options & SignallingAggregationMask) != SignallingAggregationDisable;
 #endif
+#ifdef H323_SIGNAL_REACTOR
+  signalReactorHandle = NULL;
+  controlReactorHandle = NULL;
+#endif
 
 #ifdef H323_AEC
     aec = NULL;
@@ -859,6 +928,20 @@ void H323Connection::CleanUpOnCallEnd()
     }
   }
 
+#ifdef H323_SIGNAL_REACTOR
+  // Take the channels out of the reactor before they are closed
+  if (controlReactorHandle != NULL) {
+    endpoint.GetSignalReactor()->RemoveHandle(controlReactorHandle);
+    delete controlReactorHandle;
+    controlReactorHandle = NULL;
+  }
+  if (signalReactorHandle != NULL) {
+    endpoint.GetSignalReactor()->RemoveHandle(signalReactorHandle);
+    delete signalReactorHandle;
+    signalReactorHandle = NULL;
+  }
+#endif
+
   // Wait for control channel to be cleaned up (thread ended).
   if (controlChannel != NULL)
     controlChannel->CleanUpOnTermination();
@@ -990,6 +1073,11 @@ void H323Connection::HandleSignallingChannel()
       break;
   }
 
+  EndHandleSignallingChannel();
+}
+
+void H323Connection::EndHandleSignallingChannel()
+{
   // If we are the only link to the far end then indicate that we have
   // received endSession even if we hadn't, because we are now never going
   // to get one so there is no point in having CleanUpOnCallEnd wait.
@@ -5667,6 +5755,16 @@ RTP_Session * H323Connection::UseSession(unsigned sessionID,
 #endif
                   );
 
+#ifdef H323_RTP_REACTOR
+  udp_session->SetReactor(endpoint.GetRTPReactor());
+#endif
+#ifdef H323_RTP_BATCHIO
+  udp_session->SetReceiveBatchSize(endpoint.GetRTPReceiveBatchSize());
+#endif
+#ifdef H323_RING_JITTER
+  udp_session->SetRingJitterBuffer(endpoint.UseRingJitterBuffer());
+#endif
+
   udp_session->SetUserData(new H323_RTP_UDP(*this, *udp_session, rtpqos));
   rtpSessions.AddSession(udp_session);
   return udp_session;
@@ -7260,6 +7358,49 @@ const H323TransportSecurity & H323Connection::GetTransportSecurity() const
     return m_transportSecurity;
 }
 
+#ifdef H323_SIGNAL_REACTOR
+
+PBoolean H323Connection::ReactSignalChannel(H323Transport * transport, const PTimeInterval & keepAlive)
+{
+  H323SignalReactor * reactor = endpoint.GetSignalReactor();
+  if (reactor == NULL || transport == NULL || !H323SignalReactor::IsSupportedTransport(*transport))
+    return FALSE;
+
+  signalReactorHandle = new ReactorH225Handle(*(H323TransportTCP *)transport, *this, keepAlive);
+  if (!reactor->AddHandle(signalReactorHandle)) {
+    PTRACE(2, "H225\tSignalling reactor could not take channel, using a thread");
+    delete signalReactorHandle;
+    signalReactorHandle = NULL;
+    return FALSE;
+  }
+
+  PTRACE(2, "H225\tReading PDUs with signalling reactor: callRef=" << callReference);
+  return TRUE;
+}
+
+PBoolean H323Connection::ReactControlChannel(H323Transport * transport, const PTimeInterval & keepAlive)
+{
+  H323SignalReactor * reactor = endpoint.GetSignalReactor();
+  if (reactor == NULL || transport == NULL || !H323SignalReactor::IsSupportedTransport(*transport))
+    return FALSE;
+
+  if (!OnStartHandleControlChannel())
+    return TRUE;
+
+  controlReactorHandle = new ReactorH245Handle(*(H323TransportTCP *)transport, *this, keepAlive);
+  if (!reactor->AddHandle(controlReactorHandle)) {
+    PTRACE(1, "H245\tSignalling reactor could not take control channel");
+    delete controlReactorHandle;
+    controlReactorHandle = NULL;
+    EndHandleControlChannel();
+    ClearCall(EndedByTransportFail);
+  }
+
+  return TRUE;
+}
+
+#endif
+
 #ifdef H323_SIGNAL_AGGREGATE
 
 void H323Connection::AggregateSignalChannel(H323Transport * transport)
@@ -62,6 +62,9 @@ DEFINE_G711_CAPABILITY(H323_G711uLaw64Capability, H323_G711Capability::muLaw, "G
 
 #define new PNEW
 
+/* Wildcard patterns kept before the caches of them are started again */
+#define MAX_CACHED_PATTERNS 256
+
 
 #if PTRACING
 ostream & operator<<(ostream & o , H323Capability::MainTypes t)
@@ -84,8 +87,21 @@ ostream & operator<<(ostream & o , H323Capability::CapabilityDirection d)
 
 /////////////////////////////////////////////////////////////////////////////
 
+static unsigned NextModificationStamp()
+{
+  static PMutex mutex;
+  static unsigned stamp = 0;
+
+  PWaitAndSignal m(mutex);
+  if (++stamp == 0)
+    ++stamp;
+  return stamp;
+}
+
+
 H323Capability::H323Capability()
 {
+  modificationStamp = NextModificationStamp();
   assignedCapabilityNumber = 0; // Unassigned
   capabilityDirection = e_Unknown;
   rtpPayloadType = RTP_DataFrame::IllegalPayloadType;
@@ -205,6 +221,8 @@ PBoolean H323Capability::IsMatch(const PASN_Choice & subTypePDU) const
 
 PBoolean H323Capability::OnReceivedPDU(const H245_Capability & cap)
 {
+  Modified();
+
   switch (cap.GetTag()) {
     case H245_Capability::e_receiveVideoCapability:
     case H245_Capability::e_receiveAudioCapability:
@@ -254,6 +272,9 @@ const OpalMediaFormat & H323Capability::GetMediaFormat() const
 
 OpalMediaFormat & H323Capability::GetWritableMediaFormat()
 {
+  // The caller may change it
+  Modified();
+
   if (mediaFormat.IsEmpty()) {
     PString name = GetFormatName();
     name.Delete(name.FindLast('{'), 4);
@@ -263,6 +284,18 @@ OpalMediaFormat & H323Capability::GetWritableMediaFormat()
 }
 
 
+PBoolean H323Capability::IsPDUCacheable() const
+{
+  return FALSE;
+}
+
+
+void H323Capability::Modified()
+{
+  modificationStamp = NextModificationStamp();
+}
+
+
 /////////////////////////////////////////////////////////////////////////////
 
 H323RealTimeCapability::H323RealTimeCapability()
@@ -921,6 +954,7 @@ void H323AudioCapability::SetTxFramesInPacket(unsigned frames)
     txFramesInPacket = 256;
   else
     txFramesInPacket = frames;
+  Modified();
 }
 
 
@@ -2864,6 +2898,12 @@ PString H323_G711Capability::GetFormatName() const
 }
 
 
+PBoolean H323_G711Capability::IsPDUCacheable() const
+{
+  return TRUE;
+}
+
+
 H323Codec * H323_G711Capability::CreateCodec(H323Codec::Direction direction) const
 {
   unsigned packetSize = 8*(direction == H323Codec::Encoder ? txFramesInPacket : rxFramesInPacket);
@@ -2985,6 +3025,12 @@ PString H323_UserInputCapability::GetFormatName() const
 }
 
 
+PBoolean H323_UserInputCapability::IsPDUCacheable() const
+{
+  return TRUE;
+}
+
+
 H323Channel * H323_UserInputCapability::CreateChannel(H323Connection &,
                                                       H323Channel::Directions,
                                                       unsigned,
@@ -3209,12 +3255,14 @@ PBoolean H323CapabilitiesSet::SetSize(PINDEX newSize)
 
 
 H323Capabilities::H323Capabilities()
+  : indexedSize(P_MAX_INDEX)
 {
 }
 
 
 H323Capabilities::H323Capabilities(const H323Connection & connection,
                                    const H245_TerminalCapabilitySet & pdu)
+  : indexedSize(P_MAX_INDEX)
 {
   const H323Capabilities & localCapabilities = connection.GetLocalCapabilities();
 
@@ -3236,6 +3284,9 @@ H323Capabilities::H323Capabilities(const H323Connection & connection,
     }
   }
 
+  PWaitAndSignal m(indexMutex);
+  UpdateIndex();
+
   PINDEX outerSize = pdu.m_capabilityDescriptors.GetSize();
   set.SetSize(outerSize);
   for (PINDEX outer = 0; outer < outerSize; outer++) {
@@ -3246,12 +3297,9 @@ H323Capabilities::H323Capabilities(const H323Connection & connection,
       for (PINDEX middle = 0; middle < middleSize; middle++) {
         H245_AlternativeCapabilitySet & alt = desc.m_simultaneousCapabilities[middle];
         for (PINDEX inner = 0; inner < alt.GetSize(); inner++) {
-          for (PINDEX cap = 0; cap < table.GetSize(); cap++) {
-            if (table[cap].GetCapabilityNumber() == alt[inner]) {
-              set[outer][middle].Append(&table[cap]);
-              break;
-            }
-          }
+          NumberIndex::const_iterator cap = numberIndex.find(alt[inner]);
+          if (cap != numberIndex.end())
+            set[outer][middle].Append(cap->second);
         }
       }
     }
@@ -3260,6 +3308,7 @@ H323Capabilities::H323Capabilities(const H323Connection & connection,
 
 
 H323Capabilities::H323Capabilities(const H323Capabilities & original)
+  : indexedSize(P_MAX_INDEX)
 {
   operator=(original);
 }
@@ -3400,26 +3449,91 @@ PINDEX H323Capabilities::AddAllCapabilities(PINDEX descriptorNum,
 }
 
 
-static unsigned MergeCapabilityNumber(const H323CapabilitiesList & table,
-                                      unsigned newCapabilityNumber)
+void H323Capabilities::InvalidateIndex()
+{
+  PWaitAndSignal m(indexMutex);
+  indexedSize = P_MAX_INDEX;
+}
+
+
+void H323Capabilities::UpdateIndex() const
+{
+  // Anything changing the table through this class keeps the index up to
+  // date or invalidates it, the size catches derived classes appending.
+  if (indexedSize == table.GetSize())
+    return;
+
+  numberIndex.clear();
+  mainTypeIndex.clear();
+  typeIndex.clear();
+  nameIndex.clear();
+  indexedSize = 0;
+
+  for (PINDEX i = 0; i < table.GetSize(); i++)
+    IndexCapability(table[i]);
+}
+
+
+void H323Capabilities::IndexCapability(H323Capability & capability) const
+{
+  // Numbers should be unique, if not the first in the table wins
+  numberIndex.insert(NumberIndex::value_type(capability.GetCapabilityNumber(), &capability));
+
+  unsigned mainType = capability.GetMainType();
+  mainTypeIndex[mainType].push_back(&capability);
+  typeIndex[std::make_pair(mainType, capability.GetSubType())].push_back(&capability);
+
+  nameIndex.clear();
+  indexedSize++;
+}
+
+
+const PStringArray & H323Capabilities::GetWildcard(const PString & pattern) const
+{
+  WildcardCache::const_iterator it = wildcardCache.find(pattern);
+  if (it != wildcardCache.end())
+    return it->second;
+
+  if (wildcardCache.size() >= MAX_CACHED_PATTERNS) {
+    PTRACE(4, "H323\tCapability pattern cache full, flushing");
+    wildcardCache.clear();
+    nameIndex.clear();
+  }
+
+  return wildcardCache.insert(WildcardCache::value_type(pattern, pattern.Tokenise('*', FALSE))).first->second;
+}
+
+
+const H323Capabilities::CapabilityVector & H323Capabilities::GetNameMatches(const PString & pattern) const
+{
+  NameIndex::const_iterator it = nameIndex.find(pattern);
+  if (it != nameIndex.end())
+    return it->second;
+
+  const PStringArray & wildcard = GetWildcard(pattern);
+
+  CapabilityVector & matches = nameIndex[pattern];
+  for (PINDEX i = 0; i < table.GetSize(); i++) {
+    if (MatchWildcard(table[i].GetFormatName(), wildcard))
+      matches.push_back(&table[i]);
+  }
+
+  return matches;
+}
+
+
+unsigned H323Capabilities::GetUnusedCapabilityNumber(unsigned capabilityNumber) const
 {
   // Assign a unique number to the codec, check if the user wants a specific
   // value and start with that.
-  if (newCapabilityNumber == 0)
-    newCapabilityNumber = 1;
+  if (capabilityNumber == 0)
+    capabilityNumber = 1;
 
-  PINDEX i = 0;
-  while (i < table.GetSize()) {
-    if (table[i].GetCapabilityNumber() != newCapabilityNumber)
-      i++;
-    else {
-      // If it already in use, increment it
-      newCapabilityNumber++;
-      i = 0;
-    }
-  }
+  // If it already in use, increment it
+  while (numberIndex.find(capabilityNumber) != numberIndex.end())
+    capabilityNumber++;
 
-  return newCapabilityNumber;
+  return capabilityNumber;
 }
 
 
@@ -3428,12 +3542,19 @@ void H323Capabilities::Add(H323Capability * capability)
   if (capability == NULL)
     return;
 
-  // See if already added, confuses things if you add the same instance twice
-  if (table.GetObjectsIndex(capability) != P_MAX_INDEX)
-    return;
+  {
+    PWaitAndSignal m(indexMutex);
+    UpdateIndex();
 
-  capability->SetCapabilityNumber(MergeCapabilityNumber(table, capability->GetCapabilityNumber()));
-  table.Append(capability);
+    // See if already added, confuses things if you add the same instance twice
+    NumberIndex::const_iterator it = numberIndex.find(capability->GetCapabilityNumber());
+    if (it != numberIndex.end() && it->second == capability)
+      return;
+
+    capability->SetCapabilityNumber(GetUnusedCapabilityNumber(capability->GetCapabilityNumber()));
+    table.Append(capability);
+    IndexCapability(*capability);
+  }
 
   OpalMediaFormat::DebugOptionList(capability->GetMediaFormat());
 }
@@ -3442,8 +3563,15 @@ void H323Capabilities::Add(H323Capability * capability)
 H323Capability * H323Capabilities::Copy(const H323Capability & capability)
 {
   H323Capability * newCapability = (H323Capability *)capability.Clone();
-  newCapability->SetCapabilityNumber(MergeCapabilityNumber(table, capability.GetCapabilityNumber()));
-  table.Append(newCapability);
+
+  {
+    PWaitAndSignal m(indexMutex);
+    UpdateIndex();
+
+    newCapability->SetCapabilityNumber(GetUnusedCapabilityNumber(capability.GetCapabilityNumber()));
+    table.Append(newCapability);
+    IndexCapability(*newCapability);
+  }
 
   PTRACE(3, "H323\tAdded capability: " << *newCapability);
   return newCapability;
@@ -3453,12 +3581,14 @@ H323Capability * H323Capabilities::Copy(const H323Capability & capability)
 void H323Capabilities::RemoveSecure(unsigned capabilityNumber)
 {
   H323Capability * capability = NULL;
-  for (PINDEX i = 0; i < table.GetSize(); i++) {
-      if (table[i].GetMainType() == H323Capability::e_Security &&
-          table[i].GetSubType() == capabilityNumber) {
-            capability = &table[i];
-            break;
-      }
+  {
+    PWaitAndSignal m(indexMutex);
+    UpdateIndex();
+
+    // The sub type of a security capability is the number of its media capability
+    TypeIndex::const_iterator it = typeIndex.find(std::make_pair((unsigned)H323Capability::e_Security, capabilityNumber));
+    if (it != typeIndex.end())
+      capability = it->second.front();
   }
 
   if (capability != NULL) {
@@ -3503,6 +3633,7 @@ void H323Capabilities::Remove(H323Capability * capability)
      RemoveSecure(capabilityNumber);
 #endif
   table.Remove(capability);
+  InvalidateIndex();
 }
 
 
@@ -3531,6 +3662,7 @@ void H323Capabilities::RemoveAll()
 {
   table.RemoveAll();
   set.RemoveAll();
+  InvalidateIndex();
 }
 
 
@@ -3538,14 +3670,15 @@ H323Capability * H323Capabilities::FindCapability(unsigned capabilityNumber) con
 {
   PTRACE(4, "H323\tFindCapability: " << capabilityNumber);
 
-  for (PINDEX i = 0; i < table.GetSize(); i++) {
-    if (table[i].GetCapabilityNumber() == capabilityNumber) {
-      PTRACE(3, "H323\tFound capability: " << table[i]);
-      return &table[i];
-    }
-  }
+  PWaitAndSignal m(indexMutex);
+  UpdateIndex();
 
-  return NULL;
+  NumberIndex::const_iterator it = numberIndex.find(capabilityNumber);
+  if (it == numberIndex.end())
+    return NULL;
+
+  PTRACE(3, "H323\tFound capability: " << *it->second);
+  return it->second;
 }
 
 
@@ -3554,15 +3687,16 @@ H323Capability * H323Capabilities::FindCapability(const PString & formatName,
 {
   PTRACE(4, "H323\tFindCapability: \"" << formatName << '"');
 
-  PStringArray wildcard = formatName.Tokenise('*', FALSE);
+  PWaitAndSignal m(indexMutex);
+  UpdateIndex();
 
-  for (PINDEX i = 0; i < table.GetSize(); i++) {
-    PCaselessString str = table[i].GetFormatName();
-    if (MatchWildcard(str, wildcard) &&
-          (direction == H323Capability::e_Unknown ||
-           table[i].GetCapabilityDirection() == direction)) {
-      PTRACE(3, "H323\tFound capability: " << table[i]);
-      return &table[i];
+  // The direction can change after the capability is added, so is not indexed
+  const CapabilityVector & matches = GetNameMatches(formatName);
+  for (CapabilityVector::const_iterator it = matches.begin(); it != matches.end(); ++it) {
+    if (direction == H323Capability::e_Unknown ||
+        (*it)->GetCapabilityDirection() == direction) {
+      PTRACE(3, "H323\tFound capability: " << **it);
+      return *it;
     }
   }
 
@@ -3590,10 +3724,18 @@ H323Capability * H323Capabilities::FindCapability(const H323Capability & capabil
 {
   PTRACE(4, "H323\tFindCapability: " << capability);
 
-  for (PINDEX i = 0; i < table.GetSize(); i++) {
-    if (table[i] == capability) {
-      PTRACE(3, "H323\tFound capability: " << table[i]);
-      return &table[i];
+  PWaitAndSignal m(indexMutex);
+  UpdateIndex();
+
+  // Capabilities only compare equal when their main and sub types match
+  TypeIndex::const_iterator bucket = typeIndex.find(std::make_pair((unsigned)capability.GetMainType(), capability.GetSubType()));
+  if (bucket == typeIndex.end())
+    return NULL;
+
+  for (CapabilityVector::const_iterator it = bucket->second.begin(); it != bucket->second.end(); ++it) {
+    if (**it == capability) {
+      PTRACE(3, "H323\tFound capability: " << **it);
+      return *it;
     }
   }
 
@@ -3681,44 +3823,73 @@ H323Capability * H323Capabilities::FindCapability(const H245_DataType & dataType
 {
   PTRACE(4, "H323\tFindCapability: " << dataType.GetTagName());
 
-  for (PINDEX i = 0; i < table.GetSize(); i++) {
-    H323Capability & capability = table[i];
+  // Only the capabilities of the main type in the data type need checking
+  CapabilityVector candidates;
+  {
+    PWaitAndSignal m(indexMutex);
+    UpdateIndex();
+
+    MainTypeIndex::const_iterator bucket = mainTypeIndex.end();
+    switch (dataType.GetTag()) {
+      case H245_DataType::e_audioData :
+        bucket = mainTypeIndex.find(H323Capability::e_Audio);
+        break;
+
+      case H245_DataType::e_videoData :
+        bucket = mainTypeIndex.find(H323Capability::e_Video);
+        break;
+
+      case H245_DataType::e_data :
+        bucket = mainTypeIndex.find(H323Capability::e_Data);
+        break;
+
+#ifdef H323_H235
+      case H245_DataType::e_h235Media :
+        for (PINDEX i = 0; i < table.GetSize(); i++) {
+          if (table[i].GetMainType() != H323Capability::e_Security)
+            candidates.push_back(&table[i]);
+        }
+        break;
+#endif
+
+      default :
+        return NULL;
+    }
+
+    if (bucket != mainTypeIndex.end())
+      candidates = bucket->second;
+  }
+
+  for (CapabilityVector::const_iterator it = candidates.begin(); it != candidates.end(); ++it) {
+    H323Capability & capability = **it;
     PBoolean checkExact=false;
     switch (dataType.GetTag()) {
       case H245_DataType::e_audioData :
       {
-         if (capability.GetMainType() == H323Capability::e_Audio) {
         const H245_AudioCapability & audio = dataType;
         checkExact = capability.IsMatch(audio);
-       }
         break;
       }
 
       case H245_DataType::e_videoData :
       {
-       if (capability.GetMainType() == H323Capability::e_Video) {
         const H245_VideoCapability & video = dataType;
         checkExact = capability.IsMatch(video);
-       }
         break;
       }
 
       case H245_DataType::e_data :
       {
-       if (capability.GetMainType() == H323Capability::e_Data) {
         const H245_DataApplicationCapability & data = dataType;
         checkExact = capability.IsMatch(data.m_application);
-       }
         break;
       }
 
 #ifdef H323_H235
       case H245_DataType::e_h235Media :
       {
-       if (capability.GetMainType() != H323Capability::e_Security) {
         const H245_H235Media & data = dataType;
         checkExact = capability.IsMatch(data.m_mediaType);
-       }
         break;
       }
 #endif
@@ -3836,12 +4007,28 @@ H323Capability * H323Capabilities::FindCapability(H323Capability::MainTypes main
 
     PTRACE(4, "H323\tFindCapability: " << mainType << " Generic " << oid);
 
+    PWaitAndSignal m(indexMutex);
+    UpdateIndex();
+
+    const CapabilityVector * candidates = NULL;
     unsigned int subType = subTypePDU.GetTag();
-    for (PINDEX i = 0; i < table.GetSize(); i++) {
-        H323Capability & capability = table[i];
-        if (capability.GetMainType() == mainType &&
-            (subType == UINT_MAX || capability.GetSubType() == subType) &&
-            (capability.GetIdentifier() == oid)) {
+    if (subType == UINT_MAX) {
+        MainTypeIndex::const_iterator bucket = mainTypeIndex.find(mainType);
+        if (bucket != mainTypeIndex.end())
+            candidates = &bucket->second;
+    }
+    else {
+        TypeIndex::const_iterator bucket = typeIndex.find(std::make_pair((unsigned)mainType, subType));
+        if (bucket != typeIndex.end())
+            candidates = &bucket->second;
+    }
+
+    if (candidates == NULL)
+        return NULL;
+
+    for (CapabilityVector::const_iterator it = candidates->begin(); it != candidates->end(); ++it) {
+        H323Capability & capability = **it;
+        if (capability.GetIdentifier() == oid) {
                 PTRACE(3, "H323\tFound capability: " << capability);
                 return &capability;
         }
@@ -3878,21 +4065,30 @@ H323Capability * H323Capabilities::FindCapability(H323Capability::MainTypes main
 H323Capability * H323Capabilities::FindCapability(bool, const H245_ExtendedVideoCapability & gen) const
 {
 #ifdef H323_H239
+  CapabilityVector candidates;
+  {
+    PWaitAndSignal m(indexMutex);
+    UpdateIndex();
+
+    TypeIndex::const_iterator bucket = typeIndex.find(std::make_pair((unsigned)H323Capability::e_Video,
+                                                      (unsigned)H245_VideoCapability::e_extendedVideoCapability));
+    if (bucket == typeIndex.end())
+      return NULL;
+    candidates = bucket->second;
+  }
+
   H323Capability * newCap = NULL;
   for (PINDEX j=0; j < gen.m_videoCapability.GetSize(); ++j) {
     const H245_VideoCapability & vidCap = gen.m_videoCapability[j];
-    for (PINDEX i = 0; i < table.GetSize(); i++) {
-        H323Capability & capability = table[i];
-        if (capability.GetMainType() == H323Capability::e_Video &&
-            capability.GetSubType() == H245_VideoCapability::e_extendedVideoCapability) {
-            if (vidCap.GetTag() == H245_VideoCapability::e_genericVideoCapability)
-               newCap = ((H323ExtendedVideoCapability &)capability).GetCapabilities().FindCapability(H323Capability::e_Video, vidCap, vidCap);
-            else
-               newCap = ((H323ExtendedVideoCapability &)capability).GetCapabilities().FindCapability(H323Capability::e_Video, vidCap, NULL, 0);
-
-            if (newCap)
-                return &capability;
-        }
+    for (CapabilityVector::const_iterator it = candidates.begin(); it != candidates.end(); ++it) {
+        H323Capability & capability = **it;
+        if (vidCap.GetTag() == H245_VideoCapability::e_genericVideoCapability)
+           newCap = ((H323ExtendedVideoCapability &)capability).GetCapabilities().FindCapability(H323Capability::e_Video, vidCap, vidCap);
+        else
+           newCap = ((H323ExtendedVideoCapability &)capability).GetCapabilities().FindCapability(H323Capability::e_Video, vidCap, NULL, 0);
+
+        if (newCap)
+            return &capability;
     }
   }
 #endif
@@ -3932,16 +4128,25 @@ H323Capability * H323Capabilities::FindCapability(H323Capability::MainTypes main
      PTRACE(4, "H323\tFindCapability: " << mainType << " subtype=" << subType);
   }
 
-  for (PINDEX i = 0; i < table.GetSize(); i++) {
-    H323Capability & capability = table[i];
-    if (capability.GetMainType() == mainType &&
-                        (subType == UINT_MAX || capability.GetSubType() == subType)) {
-      PTRACE(3, "H323\tFound capability: " << capability);
-      return &capability;
-    }
+  PWaitAndSignal m(indexMutex);
+  UpdateIndex();
+
+  H323Capability * capability = NULL;
+  if (subType == UINT_MAX) {
+    MainTypeIndex::const_iterator it = mainTypeIndex.find(mainType);
+    if (it != mainTypeIndex.end())
+      capability = it->second.front();
+  }
+  else {
+    TypeIndex::const_iterator it = typeIndex.find(std::make_pair((unsigned)mainType, subType));
+    if (it != typeIndex.end())
+      capability = it->second.front();
   }
 
-  return NULL;
+  if (capability != NULL) {
+    PTRACE(3, "H323\tFound capability: " << *capability);
+  }
+  return capability;
 }
 
 PBoolean H323Capabilities::RemoveCapability(H323Capability::MainTypes capabilityType)
@@ -4036,29 +4241,70 @@ void H323Capabilities::BuildPDU(const H323Connection & connection,
   if (tableSize == 0 || setSize == 0)
     return;
 
+  // Ask each capability once, the descriptors refer to the same objects
+  std::map<const H323Capability *, bool> usable;
+  PBoolean cacheable = TRUE;
+  PStringStream key;
+
+  PINDEX usableCount = 0;
+  PINDEX i;
+  for (i = 0; i < tableSize; i++) {
+    const H323Capability & capability = table[i];
+    bool isUsable = capability.IsUsable(connection) != FALSE;
+    usable[&capability] = isUsable;
+    if (isUsable) {
+      usableCount++;
+      if (!capability.IsPDUCacheable())
+        cacheable = FALSE;
+      key << capability.GetCapabilityNumber() << ':' << capability.GetModificationStamp() << ',';
+    }
+  }
+
+  H323CapabilitySetCache * cache = connection.GetEndPoint().GetCapabilitySetCache();
+  if (cache != NULL && cacheable) {
+    key << '/';
+    for (PINDEX outer = 0; outer < setSize; outer++) {
+      for (PINDEX middle = 0; middle < set[outer].GetSize(); middle++) {
+        for (PINDEX inner = 0; inner < set[outer][middle].GetSize(); inner++) {
+          const H323Capability & capability = set[outer][middle][inner];
+          std::map<const H323Capability *, bool>::iterator it = usable.find(&capability);
+          if (it != usable.end() ? it->second : capability.IsUsable(connection) != FALSE)
+            key << capability.GetCapabilityNumber() << ',';
+        }
+        key << ';';
+      }
+      key << '|';
+    }
+
+    if (cache->Lookup(key, pdu))
+      return;
+  }
+
   // Set the table of capabilities
   pdu.IncludeOptionalField(H245_TerminalCapabilitySet::e_capabilityTable);
 
   H245_H2250Capability & h225_0 = pdu.m_multiplexCapability;
+  H245_ArrayOf_RTPPayloadType & rtpPayloadTypes = h225_0.m_mediaPacketizationCapability.m_rtpPayloadType;
   PINDEX rtpPacketizationCount = 0;
 
+  pdu.m_capabilityTable.SetSize(usableCount);
+  rtpPayloadTypes.SetSize(usableCount+1);
+
   PINDEX count = 0;
-  for (PINDEX i = 0; i < tableSize; i++) {
+  for (i = 0; i < tableSize; i++) {
     H323Capability & capability = table[i];
-    if (capability.IsUsable(connection)) {
-      pdu.m_capabilityTable.SetSize(count+1);
+    if (usable[&capability]) {
       H245_CapabilityTableEntry & entry = pdu.m_capabilityTable[count++];
       entry.m_capabilityTableEntryNumber = capability.GetCapabilityNumber();
       entry.IncludeOptionalField(H245_CapabilityTableEntry::e_capability);
       capability.OnSendingPDU(entry.m_capability);
 
-      h225_0.m_mediaPacketizationCapability.m_rtpPayloadType.SetSize(rtpPacketizationCount+1);
-      if (H323SetRTPPacketization(h225_0.m_mediaPacketizationCapability.m_rtpPayloadType[rtpPacketizationCount],
-                                                    capability.GetMediaFormat(), RTP_DataFrame::MaxPayloadType)) {
+      if (H323SetRTPPacketization(rtpPayloadTypes[rtpPacketizationCount],
+                                  capability.GetMediaFormat(), RTP_DataFrame::MaxPayloadType)) {
         // Check if already in list
         PINDEX test;
         for (test = 0; test < rtpPacketizationCount; test++) {
-          if (h225_0.m_mediaPacketizationCapability.m_rtpPayloadType[test] == h225_0.m_mediaPacketizationCapability.m_rtpPayloadType[rtpPacketizationCount])
+          if (rtpPayloadTypes[test] == rtpPayloadTypes[rtpPacketizationCount])
             break;
         }
         if (test == rtpPacketizationCount)
@@ -4069,9 +4315,11 @@ void H323Capabilities::BuildPDU(const H323Connection & connection,
 
   // Have some mediaPacketizations to include.
   if (rtpPacketizationCount > 0) {
-    h225_0.m_mediaPacketizationCapability.m_rtpPayloadType.SetSize(rtpPacketizationCount);
+    rtpPayloadTypes.SetSize(rtpPacketizationCount);
     h225_0.m_mediaPacketizationCapability.IncludeOptionalField(H245_MediaPacketizationCapability::e_rtpPayloadType);
   }
+  else
+    rtpPayloadTypes.SetSize(0);
 
   // Set the sets of compatible capabilities
   pdu.IncludeOptionalField(H245_TerminalCapabilitySet::e_capabilityDescriptors);
@@ -4090,13 +4338,94 @@ void H323Capabilities::BuildPDU(const H323Connection & connection,
       count = 0;
       for (PINDEX inner = 0; inner < innerSize; inner++) {
         H323Capability & capability = set[outer][middle][inner];
-        if (capability.IsUsable(connection)) {
-          alt.SetSize(count+1);
+        std::map<const H323Capability *, bool>::iterator it = usable.find(&capability);
+        if (it != usable.end() ? it->second : capability.IsUsable(connection) != FALSE)
           alt[count++] = capability.GetCapabilityNumber();
-        }
       }
+      alt.SetSize(count);
+    }
+  }
+
+  if (cache != NULL && cacheable)
+    cache->Store(key, pdu);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+H323CapabilitySetCache::H323CapabilitySetCache(PINDEX max)
+  : maxEntries(max > 0 ? max : 1),
+    hits(0),
+    misses(0)
+{
+}
+
+
+H323CapabilitySetCache::~H323CapabilitySetCache()
+{
+  Flush();
+}
+
+
+PBoolean H323CapabilitySetCache::Lookup(const PString & key, H245_TerminalCapabilitySet & pdu)
+{
+  PWaitAndSignal m(mutex);
+
+  EntryMap::iterator it = entries.find(key);
+  if (it == entries.end()) {
+    misses++;
+    return FALSE;
+  }
+
+  hits++;
+
+  const H245_TerminalCapabilitySet & cached = *it->second;
+
+  pdu.IncludeOptionalField(H245_TerminalCapabilitySet::e_capabilityTable);
+  pdu.m_capabilityTable = cached.m_capabilityTable;
+
+  H245_H2250Capability & h225_0 = pdu.m_multiplexCapability;
+  const H245_H2250Capability & cachedH225_0 = cached.m_multiplexCapability;
+  h225_0.m_mediaPacketizationCapability = cachedH225_0.m_mediaPacketizationCapability;
+
+  pdu.IncludeOptionalField(H245_TerminalCapabilitySet::e_capabilityDescriptors);
+  pdu.m_capabilityDescriptors = cached.m_capabilityDescriptors;
+
+  return TRUE;
+}
+
+
+void H323CapabilitySetCache::Store(const PString & key, const H245_TerminalCapabilitySet & pdu)
+{
+  PWaitAndSignal m(mutex);
+
+  if (entries.find(key) != entries.end())
+    return;
+
+  while (entries.size() >= (size_t)maxEntries && !order.empty()) {
+    EntryMap::iterator it = entries.find(order.front());
+    if (it != entries.end()) {
+      delete it->second;
+      entries.erase(it);
     }
+    order.pop_front();
   }
+
+  entries[key] = (H245_TerminalCapabilitySet *)pdu.Clone();
+  order.push_back(key);
+
+  PTRACE(4, "H245\tCached TerminalCapabilitySet, " << entries.size() << " entries");
+}
+
+
+void H323CapabilitySetCache::Flush()
+{
+  PWaitAndSignal m(mutex);
+
+  for (EntryMap::iterator it = entries.begin(); it != entries.end(); ++it)
+    delete it->second;
+  entries.clear();
+  order.clear();
 }
 
 
@@ -4140,44 +4469,73 @@ const H323CapabilitiesSet & H323Capabilities::GetCapabilitySet()
     return set;
 }
 
+typedef std::pair<PINDEX, H323Capability *> CapabilityPosition;
+
+static bool ComparePosition(const CapabilityPosition & a, const CapabilityPosition & b)
+{
+  return a.first < b.first;
+}
+
+
 void H323Capabilities::Reorder(const PStringArray & preferenceOrder)
 {
   if (preferenceOrder.IsEmpty())
     return;
 
-  table.DisallowDeleteObjects();
+  PWaitAndSignal m(indexMutex);
+  UpdateIndex();
 
-  PINDEX preference = 0;
-  PINDEX base = 0;
-
-  for (preference = 0; preference < preferenceOrder.GetSize(); preference++) {
-    PStringArray wildcard = preferenceOrder[preference].Tokenise('*', FALSE);
-    for (PINDEX idx = base; idx < table.GetSize(); idx++) {
-       PCaselessString str = table[idx].GetFormatName();
-      if (MatchWildcard(str, wildcard)) {
-          if (idx != base)
-             table.InsertAt(base, table.RemoveAt(idx));
-          base++;
-          idx = base-1;  // start from last allocated
-      }
+  // Each capability goes with the first preference it matches, in table
+  // order, and the ones matching none stay at the end.
+  PINDEX preferenceCount = preferenceOrder.GetSize();
+  std::vector<CapabilityVector> preferred(preferenceCount+1);
+  std::map<const H323Capability *, PINDEX> position;
+
+  for (PINDEX preference = 0; preference < preferenceCount; preference++) {
+    const CapabilityVector & matches = GetNameMatches(preferenceOrder[preference]);
+    for (CapabilityVector::const_iterator it = matches.begin(); it != matches.end(); ++it) {
+      if (position.insert(std::make_pair(*it, preference)).second)
+        preferred[preference].push_back(*it);
     }
   }
 
+  for (PINDEX i = 0; i < table.GetSize(); i++) {
+    if (position.find(&table[i]) == position.end())
+      preferred[preferenceCount].push_back(&table[i]);
+  }
+
+  table.DisallowDeleteObjects();
+  table.RemoveAll();
+  for (PINDEX preference = 0; preference <= preferenceCount; preference++) {
+    for (CapabilityVector::const_iterator it = preferred[preference].begin(); it != preferred[preference].end(); ++it) {
+      position[*it] = table.GetSize()+1;
+      table.Append(*it);
+    }
+  }
+  table.AllowDeleteObjects();
+
+  // Put the alternatives in the same order as the table, anything not in
+  // the table stays at the front.
   for (PINDEX outer = 0; outer < set.GetSize(); outer++) {
     for (PINDEX middle = 0; middle < set[outer].GetSize(); middle++) {
       H323CapabilitiesList & list = set[outer][middle];
-      for (PINDEX idx = 0; idx < table.GetSize(); idx++) {
-        for (PINDEX inner = 0; inner < list.GetSize(); inner++) {
-          if (&table[idx] == &list[inner]) {
-            list.Append(list.RemoveAt(inner));
-            break;
-          }
-        }
+
+      std::vector<CapabilityPosition> sorted;
+      sorted.reserve(list.GetSize());
+      for (PINDEX inner = 0; inner < list.GetSize(); inner++) {
+        std::map<const H323Capability *, PINDEX>::const_iterator it = position.find(&list[inner]);
+        sorted.push_back(CapabilityPosition(it != position.end() ? it->second : 0, &list[inner]));
       }
+      std::stable_sort(sorted.begin(), sorted.end(), ComparePosition);
+
+      list.DisallowDeleteObjects();
+      list.RemoveAll();
+      for (std::vector<CapabilityPosition>::const_iterator it = sorted.begin(); it != sorted.end(); ++it)
+        list.Append(it->second);
     }
   }
 
-  table.AllowDeleteObjects();
+  indexedSize = P_MAX_INDEX;
 }
 
 
@@ -134,6 +134,18 @@
 #include <ptclib/sockagg.h>
 #endif
 
+#ifdef H323_RTP_REACTOR
+#include "rtpreactor.h"
+#endif
+
+#ifdef H323_SIGNAL_REACTOR
+#include "signalreactor.h"
+#endif
+
+#ifdef H323_MEDIA_CLOCK
+#include "mediaclock.h"
+#endif
+
 #ifndef IPTOS_PREC_CRITIC_ECP
 #define IPTOS_PREC_CRITIC_ECP (5 << 5)
 #endif
@@ -624,6 +636,11 @@ void H225CallThread::Main()
         SetAutoDelete(AutoDeleteThread);
         return;
       }
+#endif
+#ifdef H323_SIGNAL_REACTOR
+      // Still attached to the transport, so cleaned up with it
+      if (connection.ReactSignalChannel(&transport, 0))
+        return;
 #endif
       connection.HandleSignallingChannel();
     }
@@ -842,8 +859,32 @@ H323EndPoint::H323EndPoint()
   rtpAggregator = NULL;
 #endif
 
+#ifdef H323_RTP_REACTOR
+  rtpReactorThreads = 0;
+  rtpReactor = NULL;
+#endif
+
+#ifdef H323_SIGNAL_REACTOR
+  signalReactorThreads = 0;
+  signalReactor = NULL;
+#endif
+
+#ifdef H323_MEDIA_CLOCK
+  mediaClockThreads = 0;
+  mediaClock = NULL;
+#endif
+
+#ifdef H323_RTP_BATCHIO
+  rtpReceiveBatchSize = 1;
+#endif
+
+#ifdef H323_RING_JITTER
+  ringJitterBuffer = FALSE;
+#endif
+
   channelThreadPriority     = PThread::HighestPriority;
 
+  capabilitySetCache = NULL;
   gatekeeper = NULL;
   RegThread = NULL;
 
@@ -967,6 +1008,14 @@ H323EndPoint::~H323EndPoint()
   }
 #endif
 
+#ifdef H323_RTP_REACTOR
+  {
+    PWaitAndSignal m(connectionsMutex);
+    delete rtpReactor;
+    rtpReactor = NULL;
+  }
+#endif
+
   // And shut down the gatekeeper (if there was one)
   RemoveGatekeeper();
 
@@ -986,6 +1035,24 @@ H323EndPoint::~H323EndPoint()
   // Clean up any connections that the cleaner thread missed
   CleanUpConnections();
 
+#ifdef H323_SIGNAL_REACTOR
+  {
+    PWaitAndSignal m(connectionsMutex);
+    delete signalReactor;
+    signalReactor = NULL;
+  }
+#endif
+
+#ifdef H323_MEDIA_CLOCK
+  {
+    PWaitAndSignal m(connectionsMutex);
+    delete mediaClock;
+    mediaClock = NULL;
+  }
+#endif
+
+  delete capabilitySetCache;
+
 #ifdef H323_TLS
   if (m_transportContext) {
     delete m_transportContext;
@@ -1252,6 +1319,13 @@ void H323EndPoint::ReorderCapabilities(const PStringArray & preferenceOrder)
 }
 
 
+void H323EndPoint::SetCapabilitySetCacheSize(PINDEX entries)
+{
+  delete capabilitySetCache;
+  capabilitySetCache = entries > 0 ? new H323CapabilitySetCache(entries) : NULL;
+}
+
+
 PBoolean H323EndPoint::UseGatekeeper(const PString & address,
                                  const PString & identifier,
                                  const PString & localAddress)
@@ -1691,6 +1765,13 @@ H323EndPoint::H235MediaCipher H323EndPoint::GetH235MediaCipher()
     return static_cast<H235MediaCipher>(H235Authenticators::GetMaxCipherLength());
 }
 
+#ifdef H323_H235_AEAD
+void H323EndPoint::SetH235AuthenticatedMedia(PBoolean enable)
+{
+    H235Authenticators::SetAuthenticatedMedia(enable);
+}
+#endif
+
 void H323EndPoint::H235SetDiffieHellmanFiles(const PString & file)
 {
     SetEncryptionCacheFiles(file);
@@ -4800,6 +4881,48 @@ PHandleAggregator * H323EndPoint::GetRTPAggregator()
 }
 #endif
 
+#ifdef H323_RTP_REACTOR
+RTP_Reactor * H323EndPoint::GetRTPReactor()
+{
+  PWaitAndSignal m(connectionsMutex);
+  if (rtpReactorThreads == 0)
+    return NULL;
+
+  if (rtpReactor == NULL)
+    rtpReactor = new RTP_Reactor(rtpReactorThreads, jitterThreadStackSize);
+
+  return rtpReactor;
+}
+#endif
+
+#ifdef H323_MEDIA_CLOCK
+H323MediaClock * H323EndPoint::GetMediaClock()
+{
+  PWaitAndSignal m(connectionsMutex);
+  if (mediaClockThreads == 0)
+    return NULL;
+
+  if (mediaClock == NULL)
+    mediaClock = new H323MediaClock(mediaClockThreads, GetChannelThreadStackSize());
+
+  return mediaClock;
+}
+#endif
+
+#ifdef H323_SIGNAL_REACTOR
+H323SignalReactor * H323EndPoint::GetSignalReactor()
+{
+  PWaitAndSignal m(connectionsMutex);
+  if (signalReactorThreads == 0)
+    return NULL;
+
+  if (signalReactor == NULL)
+    signalReactor = new H323SignalReactor(signalReactorThreads, signallingThreadStackSize);
+
+  return signalReactor;
+}
+#endif
+
 #ifdef H323_SIGNAL_AGGREGATE
 PHandleAggregator * H323EndPoint::GetSignallingAggregator()
 {
@@ -197,13 +197,6 @@ class OpalPluginCodec : public OpalFactoryCodec {
 
 #ifdef H323_AUDIO_CODECS
 
-extern "C" {
-  unsigned char linear2ulaw(int pcm_val);
-  int ulaw2linear(unsigned char u_val);
-  unsigned char linear2alaw(int pcm_val);
-  int alaw2linear(unsigned char u_val);
-};
-
 #define DECLARE_FIXED_CODEC(name, format, bps, frameTime, samples, bytes, fpp, maxfpp, payload, sdp) \
 class name##_Base : public OpalFactoryCodec { \
   PCLASSINFO(name##_Base, OpalFactoryCodec) \
@@ -260,8 +253,7 @@ int OpalG711ALaw64k_Encoder::Encode(const void * _from, unsigned * fromLen, void
   unsigned count = *fromLen / 2;
   *toLen         = count;
 
-  while (count-- > 0)
-    *to++ = linear2alaw(*from++);
+  H323_ALawCodec::EncodeBlock(from, to, count);
 
   return 1;
 }
@@ -277,8 +269,7 @@ int OpalG711ALaw64k_Decoder::Encode(const void * _from, unsigned * fromLen, void
   unsigned count = *fromLen;
   *toLen         = count * 2;
 
-  while (count-- > 0)
-    *to++ = (short)alaw2linear(*from++);
+  H323_ALawCodec::DecodeBlock(from, to, count);
 
   return 1;
 }
@@ -296,8 +287,7 @@ int OpalG711ALaw64k20_Encoder::Encode(const void * _from, unsigned * fromLen, vo
   unsigned count = *fromLen / 2;
   *toLen         = count;
 
-  while (count-- > 0)
-    *to++ = linear2alaw(*from++);
+  H323_ALawCodec::EncodeBlock(from, to, count);
 
   return 1;
 }
@@ -313,8 +303,7 @@ int OpalG711ALaw64k20_Decoder::Encode(const void * _from, unsigned * fromLen, vo
   unsigned count = *fromLen;
   *toLen         = count * 2;
 
-  while (count-- > 0)
-    *to++ = (short)alaw2linear(*from++);
+  H323_ALawCodec::DecodeBlock(from, to, count);
 
   return 1;
 }
@@ -332,8 +321,7 @@ int OpalG711uLaw64k_Encoder::Encode(const void * _from, unsigned * fromLen, void
   unsigned count = *fromLen / 2;
   *toLen         = count;
 
-  while (count-- > 0)
-    *to++ = linear2ulaw(*from++);
+  H323_muLawCodec::EncodeBlock(from, to, count);
 
   return 1;
 }
@@ -349,8 +337,7 @@ int OpalG711uLaw64k_Decoder::Encode(const void * _from, unsigned * fromLen, void
   unsigned count = *fromLen;
   *toLen         = count * 2;
 
-  while (count-- > 0)
-    *to++ = (short)ulaw2linear(*from++);
+  H323_muLawCodec::DecodeBlock(from, to, count);
 
   return 1;
 }
@@ -368,8 +355,7 @@ int OpalG711uLaw64k20_Encoder::Encode(const void * _from, unsigned * fromLen, vo
   unsigned count = *fromLen / 2;
   *toLen         = count;
 
-  while (count-- > 0)
-    *to++ = linear2ulaw(*from++);
+  H323_muLawCodec::EncodeBlock(from, to, count);
 
   return 1;
 }
@@ -385,8 +371,7 @@ int OpalG711uLaw64k20_Decoder::Encode(const void * _from, unsigned * fromLen, vo
   unsigned count = *fromLen;
   *toLen         = count * 2;
 
-  while (count-- > 0)
-    *to++ = (short)ulaw2linear(*from++);
+  H323_muLawCodec::DecodeBlock(from, to, count);
 
   return 1;
 }
@@ -1290,10 +1275,15 @@ public:
         Start();
     }
 
-    virtual void FrameOut(PBYTEArray & frame, PInt64 receiveTime, unsigned clock , PBoolean fup, PBoolean flow)  {
+    virtual PBYTEArray * CreateFrame() {
+        return new RTP_DataFrame();
+    }
+
+    virtual void FrameOut(PBYTEArray & frame, PINDEX length, PInt64 receiveTime, unsigned clock , PBoolean fup, PBoolean flow)  {
         m_flowControl = flow;
-        frameData.SetPayloadSize(frame.GetSize()-12);
-        memmove(frameData.GetPointer(), frame.GetPointer(), frame.GetSize());
+        // Decode straight from the buffer slot, created by CreateFrame()
+        RTP_DataFrame & frameData = (RTP_DataFrame &)frame;
+        frameData.SetPayloadSize(length-12);
         unsigned written = 0;
         H323Codec::H323_RTPInformation  rtpInformation;
           rtpInformation.m_recvTime = receiveTime;
@@ -1318,8 +1308,6 @@ public:
     }
 
 protected:
-    RTP_DataFrame frameData;
-
     H323Codec * codec;
     PBoolean m_noError;
     PBoolean m_flowControl;
@@ -2194,6 +2182,10 @@ class H323AudioPluginCapability : public H323AudioCapability,
     virtual unsigned GetSubType() const
     { return pluginSubType; }
 
+    // The entry only depends on the sub-type, the frames in a packet and the media format
+    virtual PBoolean IsPDUCacheable() const
+    { return TRUE; }
+
   protected:
     unsigned pluginSubType;
     unsigned h323subType;   // only set if using capability without codec
@@ -2317,6 +2309,10 @@ class H323PluginG7231Capability : public H323AudioPluginCapability
       return TRUE;
     }
 
+    // Annex A is not held in the media format
+    virtual PBoolean IsPDUCacheable() const
+    { return FALSE; }
+
   protected:
     PBoolean annexA;
 };
@@ -2353,6 +2349,11 @@ class H323GSMPluginCapability : public H323AudioPluginCapability
       const H245_AudioCapability & pdu,  /// PDU to get information from
       unsigned & packetSize              /// Packet size to use in capability
     );
+
+    // Comfort noise and scrambling are not held in the media format
+    virtual PBoolean IsPDUCacheable() const
+    { return FALSE; }
+
   protected:
     int comfortNoise;
     int scrambled;
@@ -95,13 +95,24 @@ PBoolean H323TransactionPDU::Read(H323Transport & transport)
 PBoolean H323TransactionPDU::Write(H323Transport & transport)
 {
   PPER_Stream strm;
+  EncodePDU(strm);
+  return WriteEncoded(transport, strm);
+}
+
+
+void H323TransactionPDU::EncodePDU(PPER_Stream & strm)
+{
   GetPDU().Encode(strm);
   strm.CompleteEncoding();
 
   // Finalise the security if present
   for (PINDEX i = 0; i < authenticators.GetSize(); i++)
     authenticators[i].Finalise(strm);
+}
 
+
+PBoolean H323TransactionPDU::WriteEncoded(H323Transport & transport, const PPER_Stream & strm)
+{
   H323TraceDumpPDU("Trans", TRUE, strm, GetPDU(), GetChoice(), GetSequenceNumber(),
                    transport.GetLocalAddress(), transport.GetRemoteAddress());
 
@@ -158,7 +169,10 @@ void H323Transactor::Construct()
 {
   nextSequenceNumber = PRandom::Number()%65536;
   checkResponseCryptoTokens = TRUE;
+  workerPool = NULL;
   lastRequest = NULL;
+  responseCacheHits = 0;
+  responseCacheEvictions = 0;
 
   requests.DisallowDeleteObjects();
 }
@@ -341,18 +355,32 @@ unsigned H323Transactor::GetNextSequenceNumber()
 }
 
 
+void H323Transactor::QueueResponse(Response & response)
+{
+  // Must have pduWriteMutex
+  if (response.queued)
+    responseExpiry.erase(response.expiry);
+
+  PInt64 expires = (PTimer::Tick() + response.retirementAge).GetMilliSeconds();
+  response.expiry = responseExpiry.insert(ResponseExpiryQueue::value_type(expires, &response));
+  response.queued = TRUE;
+}
+
+
 void H323Transactor::AgeResponses()
 {
-  PTime now;
+  PInt64 now = PTimer::Tick().GetMilliSeconds();
 
   PWaitAndSignal mutex(pduWriteMutex);
 
-  for (PINDEX i = 0; i < responses.GetSize(); i++) {
-    const Response & response = responses[i];
-    if ((now - response.lastUsedTime) > response.retirementAge) {
-      PTRACE(4, "Trans\tRemoving cached response: " << response);
-      responses.RemoveAt(i--);
-    }
+  // Queue is in order of expiry, so stop at the first one still in use
+  while (!responseExpiry.empty() && responseExpiry.begin()->first < now) {
+    Response * response = responseExpiry.begin()->second;
+    responseExpiry.erase(responseExpiry.begin());
+    PTRACE(4, "Trans\tRemoving cached response: " << *response);
+    PString key = *response;
+    responses.RemoveAt(key);
+    responseCacheEvictions++;
   }
 }
 
@@ -366,11 +394,17 @@ PBoolean H323Transactor::SendCachedResponse(const H323TransactionPDU & pdu)
 
   PWaitAndSignal mutex(pduWriteMutex);
 
-  PINDEX idx = responses.GetValuesIndex(key);
-  if (idx != P_MAX_INDEX)
-    return responses[idx].SendCachedResponse(*transport);
+  Response * response = responses.GetAt(key);
+  if (response != NULL) {
+    responseCacheHits++;
+    PBoolean ok = response->SendCachedResponse(*transport);
+    QueueResponse(*response);
+    return ok;
+  }
 
-  responses.Append(new Response(key));
+  response = new Response(key);
+  responses.SetAt(key, response);
+  QueueResponse(*response);
   return FALSE;
 }
 
@@ -384,12 +418,18 @@ PBoolean H323Transactor::WritePDU(H323TransactionPDU & pdu)
 
   PWaitAndSignal mutex(pduWriteMutex);
 
+  // Encode once, the cached response keeps the bytes actually sent
+  PPER_Stream strm;
+  pdu.EncodePDU(strm);
+
   Response key(transport->GetLastReceivedAddress(), pdu.GetSequenceNumber());
-  PINDEX idx = responses.GetValuesIndex(key);
-  if (idx != P_MAX_INDEX)
-    responses[idx].SetPDU(pdu);
+  Response * response = responses.GetAt(key);
+  if (response != NULL) {
+    response->SetPDU(pdu, strm);
+    QueueResponse(*response);
+  }
 
-  return pdu.Write(*transport);
+  return pdu.WriteEncoded(*transport, strm);
 }
 
 
@@ -672,24 +712,20 @@ H323Transactor::Response::Response(const H323TransportAddress & addr, unsigned s
     retirementAge(ResponseRetirementAge)
 {
   sprintf("#%u", seqNum);
-  replyPDU = NULL;
+  queued = FALSE;
 }
 
 
 H323Transactor::Response::~Response()
 {
-  if (replyPDU != NULL)
-    replyPDU->DeletePDU();
 }
 
 
-void H323Transactor::Response::SetPDU(const H323TransactionPDU & pdu)
+void H323Transactor::Response::SetPDU(const H323TransactionPDU & pdu, const PPER_Stream & encoded)
 {
   PTRACE(4, "Trans\tAdding cached response: " << *this);
 
-  if (replyPDU != NULL)
-    replyPDU->DeletePDU();
-  replyPDU = pdu.ClonePDU();
+  replyPDU = encoded;
   lastUsedTime = PTime();
 
   unsigned delay = pdu.GetRequestInProgressDelay();
@@ -702,10 +738,10 @@ PBoolean H323Transactor::Response::SendCachedResponse(H323Transport & transport)
 {
   PTRACE(3, "Trans\tSending cached response: " << *this);
 
-  if (replyPDU != NULL) {
+  if (!replyPDU.IsEmpty()) {
     H323TransportAddress oldAddress = transport.GetRemoteAddress();
     transport.ConnectTo(Left(FindLast('#')));
-    replyPDU->Write(transport);
+    transport.WritePDU(replyPDU);
     transport.ConnectTo(oldAddress);
   }
   else {
@@ -771,29 +807,45 @@ PBoolean H323Transaction::HandlePDU()
 
   if (fastResponseRequired) {
     fastResponseRequired = FALSE;
-    PThread::Create(PCREATE_NOTIFIER(SlowHandler), 0,
-                                     PThread::AutoDeleteThread,
-                                     PThread::NormalPriority,
-                                     "Transaction:%x");
+
+    H323TransactionWorkerPool * pool = transactor.GetWorkerPool();
+    if (pool == NULL)
+      PThread::Create(PCREATE_NOTIFIER(SlowHandler), 0,
+                                       PThread::AutoDeleteThread,
+                                       PThread::NormalPriority,
+                                       "Transaction:%x");
+    else if (!pool->Queue(this)) {
+      // Already sent the RIP, so follow it with the final answer
+      PTRACE(2, "Trans\t" << GetName() << " rejected, no worker thread available.");
+      if (reject != NULL && SetBusyRejectReason())
+        WritePDU(*reject);
+      return FALSE;
+    }
   }
 
   return TRUE;
 }
 
 
-void H323Transaction::SlowHandler(PThread &, H323_INT)
+void H323Transaction::HandleSlowPDU()
 {
-  PTRACE(3, "Trans\tStarted slow PDU handler thread.");
+  PTRACE(3, "Trans\tStarted slow PDU handler.");
 
   while (HandlePDU())
     ;
 
-  PTRACE(3, "Trans\tEnded slow PDU handler thread.");
+  PTRACE(3, "Trans\tEnded slow PDU handler.");
 
   delete this;
 }
 
 
+void H323Transaction::SlowHandler(PThread &, H323_INT)
+{
+  HandleSlowPDU();
+}
+
+
 PBoolean H323Transaction::WritePDU(H323TransactionPDU & pdu)
 {
   pdu.SetAuthenticators(authenticators);
@@ -817,6 +869,117 @@ PBoolean H323Transaction::CheckCryptoTokens(const H235Authenticators & auth)
 }
 
 
+/////////////////////////////////////////////////////////////////////////////////
+
+H323TransactionWorkerPool::H323TransactionWorkerPool(unsigned threads, PINDEX queued)
+  : maxThreads(PMAX(threads, 1)),
+    maxQueued(queued),
+    idleThreads(0),
+    shuttingDown(FALSE),
+    overflows(0),
+    available(0, P_MAX_INDEX)
+{
+}
+
+
+H323TransactionWorkerPool::~H323TransactionWorkerPool()
+{
+  Shutdown();
+}
+
+
+PBoolean H323TransactionWorkerPool::Queue(H323Transaction * transaction)
+{
+  PWaitAndSignal wait(mutex);
+
+  if (shuttingDown)
+    return FALSE;
+
+  // Need another thread if all the idle ones already have work waiting
+  if (queue.size() >= idleThreads) {
+    if (threads.size() < maxThreads) {
+      threads.push_back(PThread::Create(PCREATE_NOTIFIER(WorkerMain), 0,
+                                        PThread::NoAutoDeleteThread,
+                                        PThread::NormalPriority,
+                                        "Transaction:%x"));
+      idleThreads++;
+    }
+    else if ((PINDEX)queue.size() >= maxQueued) {
+      overflows++;
+      return FALSE;
+    }
+  }
+
+  queue.push_back(transaction);
+  available.Signal();
+  return TRUE;
+}
+
+
+void H323TransactionWorkerPool::Shutdown()
+{
+  std::vector<PThread *> stopping;
+
+  mutex.Wait();
+  shuttingDown = TRUE;
+  stopping.swap(threads);
+  mutex.Signal();
+
+  std::vector<PThread *>::iterator it;
+  for (it = stopping.begin(); it != stopping.end(); ++it)
+    available.Signal();
+
+  for (it = stopping.begin(); it != stopping.end(); ++it) {
+    (*it)->WaitForTermination();
+    delete *it;
+  }
+
+  PWaitAndSignal wait(mutex);
+
+  PTRACE_IF(2, !queue.empty(), "Trans\tDiscarding " << queue.size() << " queued transactions");
+  while (!queue.empty()) {
+    delete queue.front();
+    queue.pop_front();
+  }
+}
+
+
+PINDEX H323TransactionWorkerPool::GetQueueDepth() const
+{
+  PWaitAndSignal wait(mutex);
+  return (PINDEX)queue.size();
+}
+
+
+void H323TransactionWorkerPool::WorkerMain(PThread &, H323_INT)
+{
+  PTRACE(3, "Trans\tStarted transaction worker thread.");
+
+  for (;;) {
+    available.Wait();
+
+    H323Transaction * transaction;
+    {
+      PWaitAndSignal wait(mutex);
+      if (shuttingDown)
+        break;
+      if (queue.empty())
+        continue;
+      transaction = queue.front();
+      queue.pop_front();
+      idleThreads--;
+    }
+
+    transaction->HandleSlowPDU();
+
+    PWaitAndSignal wait(mutex);
+    idleThreads++;
+  }
+
+  PTRACE(3, "Trans\tEnded transaction worker thread.");
+}
+
+
 /////////////////////////////////////////////////////////////////////////////////
 
 H323TransactionServer::H323TransactionServer(H323EndPoint & ep)
@@ -829,6 +992,7 @@ H323TransactionServer::H323TransactionServer(H323EndPoint & ep)
 
 H323TransactionServer::~H323TransactionServer()
 {
+  workerPool.Shutdown();
 }
 
 
@@ -919,6 +1083,8 @@ PBoolean H323TransactionServer::AddListener(H323Transactor * listener)
 
   PTRACE(3, "Trans\tStarted listener " << *listener);
 
+  listener->SetWorkerPool(&workerPool);
+
   mutex.Wait();
   listeners.Append(listener);
   mutex.Signal();
@@ -938,6 +938,89 @@ PBoolean H460_Feature::FeatureList(int type, H460FeatureList & plist, H323EndPoi
 
 /////////////////////////////////////////////////////////////////////
 
+H460_FeatureCatalog::~H460_FeatureCatalog()
+{
+  for (EntryMap::iterator it = types.begin(); it != types.end(); ++it)
+    delete it->second;
+  for (std::vector<Entries *>::iterator it = retired.begin(); it != retired.end(); ++it)
+    delete *it;
+}
+
+H460_FeatureCatalog & H460_FeatureCatalog::GetCatalog()
+{
+  static H460_FeatureCatalog catalog;
+  return catalog;
+}
+
+const H460_FeatureCatalog::Entries & H460_FeatureCatalog::GetFeatures(int inst)
+{
+  PWaitAndSignal m(mutex);
+
+  EntryMap::const_iterator it = types.find(inst);
+  if (it != types.end())
+    return *it->second;
+
+  PTimeInterval start = PTimer::Tick();
+
+  PPluginManager & pluginMgr = PPluginManager::GetPluginManager();
+  H460FeatureList featurelist;
+  H460_Feature::FeatureList(inst, featurelist, NULL, &pluginMgr);
+
+  Entries * entries = new Entries;
+  for (H460FeatureList::const_iterator f = featurelist.begin(); f != featurelist.end(); ++f) {
+    PDevicePluginServiceDescriptor * desc =
+            (PDevicePluginServiceDescriptor *)pluginMgr.GetServiceDescriptor(f->first, H460FeaturePluginBaseClass);
+    if (desc != NULL)
+      entries->push_back(Entry(f->first, *f->second, desc));
+  }
+  DeleteFeatureList(featurelist);
+
+  types.insert(EntryMap::value_type(inst, entries));
+
+  PTRACE(4, "H460\tCatalogued " << entries->size() << " features for type " << inst
+         << " in " << (PTimer::Tick() - start).GetMilliSeconds() << "ms");
+  return *entries;
+}
+
+H460_Feature * H460_FeatureCatalog::CreateFeature(const Entry & entry, int inst)
+{
+  return (H460_Feature *)entry.descriptor->CreateInstance(inst);
+}
+
+void H460_FeatureCatalog::Refresh()
+{
+  PWaitAndSignal m(mutex);
+
+  // Feature sets may still be iterating over the old entries
+  for (EntryMap::iterator it = types.begin(); it != types.end(); ++it)
+    retired.push_back(it->second);
+  types.clear();
+}
+
+#if defined(P_HAS_PLUGINS)
+
+// Exported by every PTLib plugin library, feature plugins included
+#define H460_PLUGIN_SIGNATURE  "PWLibPlugin_TriggerRegister"
+
+H460_FeaturePluginManager::H460_FeaturePluginManager(PPluginManager * _pluginMgr)
+ : PPluginModuleManager(H460_PLUGIN_SIGNATURE, _pluginMgr)
+{
+  // Libraries loaded already are picked up when the catalog is first built
+  pluginMgr->AddNotifier(PCREATE_NOTIFIER(OnLoadModule), FALSE);
+}
+
+void H460_FeaturePluginManager::OnLoadPlugin(PDynaLink & dll, INT code)
+{
+  PTRACE(4, "H460	Plugin library " << dll.GetName() << (code == 0 ? " loaded" : " unloaded") << ", refreshing feature catalog");
+  H460_FeatureCatalog::GetCatalog().Refresh();
+}
+
+static PFactory<PPluginModuleManager>::Worker<H460_FeaturePluginManager> h460FeaturePluginManagerFactory("H460_FeaturePluginManager", true);
+
+#endif
+
+/////////////////////////////////////////////////////////////////////
+
 H460_FeatureStd::H460_FeatureStd(unsigned Identifier)
     : H460_Feature(Identifier)
 {
@@ -1212,21 +1295,25 @@ PBoolean H460_FeatureSet::LoadFeatureSet(int inst, H323Connection * con)
   if ((ep) && (ep->FeatureSetDisabled()))
      return FALSE;
 
-  H460FeatureList featurelist;
-  H460_Feature::FeatureList(inst,featurelist,ep);
+  const H460_FeatureCatalog::Entries & featurelist = H460_FeatureCatalog::GetCatalog().GetFeatures(inst);
 
-  	 H460FeatureList::const_iterator it = featurelist.begin();
+  	 H460_FeatureCatalog::Entries::const_iterator it = featurelist.begin();
 	 while (it != featurelist.end()) {
+        if (ep && !ep->OnFeatureInstance(inst,it->name)) {
+            ++it;
+            continue;
+        }
+
         H460_Feature * feat = NULL;
-        if (baseSet && baseSet->HasFeature(*it->second)) {
-            H460_Feature * tempfeat = baseSet->GetFeature(*it->second);
+        if (baseSet && baseSet->HasFeature(it->id)) {
+            H460_Feature * tempfeat = baseSet->GetFeature(it->id);
             if (tempfeat->GetFeaturePurpose() == H460_Feature::FeatureBaseAll)
                 feat = tempfeat;
             else {
                 feat = (H460_Feature*)(tempfeat->Clone());
             }
         } else {
-            feat = H460_Feature::CreateFeature(it->first,inst);
+            feat = H460_FeatureCatalog::CreateFeature(*it,inst);
             if ((feat) && (ep))
                 feat->AttachEndPoint(ep);
         }
@@ -1236,12 +1323,11 @@ PBoolean H460_FeatureSet::LoadFeatureSet(int inst, H323Connection * con)
                 feat->AttachConnection(con);
 
            AddFeature(feat);
-           PTRACE(4, "H460\tLoaded Feature " << it->first);
+           PTRACE(4, "H460\tLoaded Feature " << it->name);
         }
         ++it;
       }
 
-  DeleteFeatureList(featurelist);
   return TRUE;
 }
 
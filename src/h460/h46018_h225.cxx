@@ -481,9 +481,8 @@ void H46018Handler::H46024ADirect(bool reply, const PString & token)
 #ifdef H323_H46019M
 H323Connection::NAT_Sockets   PNatMethod_H46019::muxSockets;
 PBoolean                      PNatMethod_H46019::multiplex=false;
-muxSocketMap                  PNatMethod_H46019::rtpSocketMap;
-muxPortMap                    PNatMethod_H46019::rtpPortMap;
-muxSocketMap                  PNatMethod_H46019::rtcpSocketMap;
+H46019MultiplexRoutes         PNatMethod_H46019::rtpRoutes;
+H46019MultiplexRoutes         PNatMethod_H46019::rtcpRoutes;
 PBoolean                      PNatMethod_H46019::muxShutdown;
 PMutex                        PNatMethod_H46019::muxMutex;
 #endif
@@ -507,9 +506,8 @@ PNatMethod_H46019::~PNatMethod_H46019()
 
         m_readThread = NULL;
 
-        rtpSocketMap.clear();
-        rtpPortMap.clear();
-        rtcpSocketMap.clear();
+        rtpRoutes.RemoveAll();
+        rtcpRoutes.RemoveAll();
 
         if (muxSockets.rtp) {
             muxSockets.rtp->Close();
@@ -735,69 +733,20 @@ PUDPSocket * & PNatMethod_H46019::GetMultiplexSocket(bool rtp)
       return (PUDPSocket * &)muxSockets.rtcp;
 }
 
-unsigned DetectSourceAddress(const muxSocketMap & socMap, const PIPSocket::Address & addr, WORD port)
-{
-    PIPSocketAddressAndPort daddr;
-    daddr.SetAddress(addr, port);
-
-    for (std::map<unsigned, PUDPSocket*>::const_iterator i = socMap.begin(); i != socMap.end(); ++i) {
-        PIPSocketAddressAndPort raddr;
-        if (i->second)
-            i->second->GetPeerAddress(raddr);
-        if (raddr.AsString() == daddr.AsString())
-            return i->first;
-    }
-    return 0;
-}
-
-unsigned ResolveMuxIDFromSourceAddress(const muxSocketMap & socMap, muxPortMap & portMap, const PIPSocket::Address & addr, WORD port)
-{
-    PIPSocketAddressAndPort daddr;
-    daddr.SetAddress(addr, port);
-
-    std::map<PString, unsigned>::const_iterator it = portMap.find(daddr.AsString());
-    if (it != portMap.end())
-        return it->second;
-
-    unsigned id = DetectSourceAddress(socMap, addr, port);
-    if (id) {
-        PTRACE(2, "H46019M\tUnMUX Packet received from " << daddr.AsString() << " permenant assigned MUX " << id);
-        portMap.insert(pair<PString,unsigned>(daddr.AsString(),id));
-    }
-    return id;
-}
-
-
-unsigned ResolveSession(const muxSocketMap & socMap, unsigned muxID, PBoolean rtp, const PIPSocket::Address & addr, WORD port, unsigned & correctMUX)
+unsigned ResolveSession(H46019MultiplexRoutes & routes, unsigned muxID, PBoolean rtp, const PIPSocket::Address & addr, WORD port, unsigned & correctMUX)
 {
     if (PNatMethod_H46019::IsMultiplexed()) {   // Check the send/receive multiplex is around the wrong way
       H46019UDPSocket * mapSocket = NULL;
-      unsigned eraseID = 0;
-      for (std::map<unsigned, PUDPSocket*>::const_iterator i = socMap.begin(); i != socMap.end(); ++i) {
-          if (((H46019UDPSocket *)i->second)->GetSendMultiplexID() == muxID) {
-              mapSocket = (H46019UDPSocket *)i->second;
-              eraseID = i->first;
-              correctMUX = eraseID;
-              break;
-          }
-      }
+      unsigned eraseID = routes.FindBySendID(muxID, mapSocket);
       if (eraseID > 0) {
+           correctMUX = eraseID;
            mapSocket->SetMultiplexID(muxID,true);
            PNatMethod_H46019::RegisterSocket(rtp,muxID, mapSocket);
            PNatMethod_H46019::UnregisterSocket(rtp, eraseID);
            return muxID;
       }
     }
-    return DetectSourceAddress(socMap, addr, port);
-}
-
-void CloseAllSessions(const muxSocketMap & socMap)
-{
-    if (PNatMethod_H46019::IsMultiplexed()) {   // Check the send/receive multiplex is around the wrong way
-        for (std::map<unsigned, PUDPSocket*>::const_iterator i = socMap.begin(); i != socMap.end(); ++i) {
-            i->second->Close();
-        }
-    }
+    return routes.FindByPeer(addr, port);
 }
 
 void PNatMethod_H46019::StartMultiplexListener()
@@ -852,7 +801,8 @@ void PNatMethod_H46019::ReadThread(PThread &, H323_INT)
     if (!muxShutdown && socket && socket->ReadFrom(buffer.GetPointer(), len, addr, port)) {
         int actRead = socket->GetLastReadCount();
         int muxHeader = buffer.GetMultiHeaderSize();
-        std::map<unsigned, PUDPSocket*>::const_iterator it;
+        H46019MultiplexRoutes * routes = NULL;
+        unsigned routeID = 0;
         switch (socketRead) {
             case H46019MultiplexSocket::e_rtp:
             {
@@ -864,57 +814,52 @@ void PNatMethod_H46019::ReadThread(PThread &, H323_INT)
                     }
                     // We have received a valid RTP UnMuxed Packet.
                     muxHeader = 0;  // Read from the first byte
-                    multiplexID = ResolveMuxIDFromSourceAddress(rtpSocketMap, rtpPortMap, addr, port);
+                    multiplexID = rtpRoutes.FindBySource(addr, port);
                     } else {
                         multiplexID = buffer.GetMultiplexID();
                     }
 
-                    it = rtpSocketMap.find(multiplexID);
-                    if (it == rtpSocketMap.end()) {
-                        unsigned badMUXid = multiplexID;
-                        unsigned rightMUXid = 0;
-                        unsigned detected = ResolveSession(rtpSocketMap, badMUXid, true, addr, port, rightMUXid);
-                        if (!detected) {
-                            PTRACE(2, "H46019M\tReceived RTP packet with unknown MUX ID " << badMUXid << " " << addr << ":" << port);
-                            continue;
-                        }
-                        it = rtpSocketMap.find(detected);
-                        if (it == rtpSocketMap.end()) continue;
-
-                        if (rightMUXid == 0) {
-                            PTRACE(2, "H46019M\tERROR: Receive UnMultiplex Packet " << " " << addr << ":" << port);
-                            ((H46019UDPSocket *)it->second)->WriteMultiplexBuffer(buffer.GetPointer(), actRead, addr, port);
-                            continue;
-                        }
-                        PTRACE(2, "H46019M\tERROR: Recover Receive Multiplex Session " << rightMUXid  << " incorrectly sent as " << badMUXid);
+                    if (rtpRoutes.Deliver(multiplexID, buffer.GetPointer()+muxHeader, actRead-muxHeader, addr, port))
+                        continue;
+
+                    unsigned badMUXid = multiplexID;
+                    unsigned rightMUXid = 0;
+                    unsigned detected = ResolveSession(rtpRoutes, badMUXid, true, addr, port, rightMUXid);
+                    if (!detected) {
+                        PTRACE(2, "H46019M\tReceived RTP packet with unknown MUX ID " << badMUXid << " " << addr << ":" << port);
+                        continue;
+                    }
+
+                    if (rightMUXid == 0) {
+                        PTRACE(2, "H46019M\tERROR: Receive UnMultiplex Packet " << " " << addr << ":" << port);
+                        rtpRoutes.Deliver(detected, buffer.GetPointer(), actRead, addr, port);
+                        continue;
                     }
+                    PTRACE(2, "H46019M\tERROR: Recover Receive Multiplex Session " << rightMUXid  << " incorrectly sent as " << badMUXid);
+                    routes = &rtpRoutes;
+                    routeID = detected;
                     break;
                 }
 
                 case H46019MultiplexSocket::e_rtcp:
-                    it = rtcpSocketMap.find(buffer.GetMultiplexID());
-                    if (it == rtcpSocketMap.end()) {
-                        PTRACE(2, "H46019M\tReceived RTCP packet with unknown MUX ID "
-                                << buffer.GetMultiplexID() << " " << addr << ":" << port);
-                        continue;
-                    }
+                    routes = &rtcpRoutes;
+                    routeID = buffer.GetMultiplexID();
                 break;
                 default:
                     PTRACE(2, "H46019M\tUnknown Muxed RTP packet received from " << addr << ":" << port);
                     continue;
              }
 
-             ((H46019UDPSocket *)it->second)->WriteMultiplexBuffer(buffer.GetPointer()+muxHeader, actRead-muxHeader, addr, port);
+             if (!routes->Deliver(routeID, buffer.GetPointer()+muxHeader, actRead-muxHeader, addr, port)) {
+                 PTRACE(2, "H46019M\tReceived " << (routes == &rtpRoutes ? "RTP" : "RTCP") << " packet with unknown MUX ID "
+                         << routeID << " " << addr << ":" << port);
+             }
              len = bufferLen;
          } else {
              if (muxShutdown) continue;
 
               switch (socket->GetErrorNumber(PChannel::LastReadError)) {
                 case ECONNRESET :
-/*                PTRACE(2, "H46019M\tUDP Port Reset! Closing all Sockets");
-                  if (socketRead == H46019MultiplexSocket::e_rtp)
-                             CloseAllSessions(rtpSocketMap);
-                   continue; */
                 case ECONNREFUSED :
                   PTRACE(2, "H46019M\tUDP Port on remote not ready.");
                   continue;
@@ -938,24 +883,16 @@ void PNatMethod_H46019::ReadThread(PThread &, H323_INT)
 void PNatMethod_H46019::RegisterSocket(bool rtp, unsigned id, PUDPSocket * socket)
 {
     if (rtp)
-       rtpSocketMap.insert(pair<unsigned, PUDPSocket*>(id,socket));
+       rtpRoutes.Add(id, (H46019UDPSocket *)socket);
     else
-       rtcpSocketMap.insert(pair<unsigned, PUDPSocket*>(id,socket));
+       rtcpRoutes.Add(id, (H46019UDPSocket *)socket);
 }
 
 void PNatMethod_H46019::UnregisterSocket(bool rtp, unsigned id)
 {
-    if (rtp) {
-        std::map<unsigned, PUDPSocket*>::iterator it = rtpSocketMap.find(id);
-        if (it != rtpSocketMap.end())
-             rtpSocketMap.erase(it);
-    } else {
-        std::map<unsigned, PUDPSocket*>::iterator it = rtcpSocketMap.find(id);
-        if (it != rtcpSocketMap.end())
-             rtcpSocketMap.erase(it);
-    }
+    PINDEX remaining = rtp ? rtpRoutes.Remove(id) : rtcpRoutes.Remove(id);
 
-    if (rtp && rtpSocketMap.size() == 0) {
+    if (rtp && remaining == 0) {
         muxShutdown = true;
         if (muxSockets.rtp) {
             muxSockets.rtp->Close();
@@ -1048,12 +985,232 @@ PBoolean H46019MultiplexSocket::Close()
 
 /////////////////////////////////////////////////////////////////////////////////////////////
 
+#ifdef H323_H46019M
+
+H46019MultiplexRoutes::H46019MultiplexRoutes()
+{
+}
+
+void H46019MultiplexRoutes::Add(unsigned id, H46019UDPSocket * socket)
+{
+    Shard & shard = GetShard(id);
+    PWriteWaitAndSignal m(shard.mutex);
+    shard.sockets.insert(std::pair<unsigned, H46019UDPSocket *>(id, socket));
+}
+
+PINDEX H46019MultiplexRoutes::Remove(unsigned id)
+{
+    {
+        Shard & shard = GetShard(id);
+        PWriteWaitAndSignal m(shard.mutex);
+        shard.sockets.erase(id);
+    }
+
+    {
+        PWriteWaitAndSignal m(sourceMutex);
+        std::map<PString, unsigned>::iterator it = sources.begin();
+        while (it != sources.end()) {
+            if (it->second == id)
+                sources.erase(it++);
+            else
+                ++it;
+        }
+    }
+
+    return GetSize();
+}
+
+void H46019MultiplexRoutes::RemoveAll()
+{
+    for (PINDEX i = 0; i < H46019_MUX_ROUTE_SHARDS; ++i) {
+        PWriteWaitAndSignal m(shards[i].mutex);
+        shards[i].sockets.clear();
+    }
+
+    PWriteWaitAndSignal m(sourceMutex);
+    sources.clear();
+}
+
+PBoolean H46019MultiplexRoutes::Deliver(unsigned id, const void * buf, PINDEX len, const PIPSocket::Address & addr, WORD port)
+{
+    Shard & shard = GetShard(id);
+    PReadWaitAndSignal m(shard.mutex);
+
+    std::map<unsigned, H46019UDPSocket *>::const_iterator it = shard.sockets.find(id);
+    if (it == shard.sockets.end())
+        return false;
+
+    it->second->WriteMultiplexBuffer(buf, len, addr, port);
+    return true;
+}
+
+unsigned H46019MultiplexRoutes::FindBySource(const PIPSocket::Address & addr, WORD port)
+{
+    PIPSocketAddressAndPort daddr;
+    daddr.SetAddress(addr, port);
+    PString source = daddr.AsString();
+
+    {
+        PReadWaitAndSignal m(sourceMutex);
+        std::map<PString, unsigned>::const_iterator it = sources.find(source);
+        if (it != sources.end())
+            return it->second;
+    }
+
+    unsigned id = FindByPeer(addr, port);
+    if (id) {
+        PTRACE(2, "H46019M\tUnMUX Packet received from " << source << " permenant assigned MUX " << id);
+        PWriteWaitAndSignal m(sourceMutex);
+        sources.insert(std::pair<PString, unsigned>(source, id));
+    }
+    return id;
+}
+
+unsigned H46019MultiplexRoutes::FindByPeer(const PIPSocket::Address & addr, WORD port)
+{
+    PIPSocketAddressAndPort daddr;
+    daddr.SetAddress(addr, port);
+    PString source = daddr.AsString();
+
+    for (PINDEX i = 0; i < H46019_MUX_ROUTE_SHARDS; ++i) {
+        PReadWaitAndSignal m(shards[i].mutex);
+        for (std::map<unsigned, H46019UDPSocket *>::const_iterator it = shards[i].sockets.begin(); it != shards[i].sockets.end(); ++it) {
+            PIPSocketAddressAndPort raddr;
+            if (it->second)
+                it->second->GetPeerAddress(raddr);
+            if (raddr.AsString() == source)
+                return it->first;
+        }
+    }
+    return 0;
+}
+
+unsigned H46019MultiplexRoutes::FindBySendID(unsigned sendID, H46019UDPSocket * & socket)
+{
+    for (PINDEX i = 0; i < H46019_MUX_ROUTE_SHARDS; ++i) {
+        PReadWaitAndSignal m(shards[i].mutex);
+        for (std::map<unsigned, H46019UDPSocket *>::const_iterator it = shards[i].sockets.begin(); it != shards[i].sockets.end(); ++it) {
+            if (it->second->GetSendMultiplexID() == sendID) {
+                socket = it->second;
+                return it->first;
+            }
+        }
+    }
+    return 0;
+}
+
+PINDEX H46019MultiplexRoutes::GetSize() const
+{
+    PINDEX count = 0;
+    for (PINDEX i = 0; i < H46019_MUX_ROUTE_SHARDS; ++i) {
+        PReadWaitAndSignal m(shards[i].mutex);
+        count += (PINDEX)shards[i].sockets.size();
+    }
+    return count;
+}
+
+#define H46019_MUX_QUEUE_SIZE   64    // Power of two
+
+H46019MultiQueue::H46019MultiQueue()
+  : slots(H46019_MUX_QUEUE_SIZE), head(0), tail(0)
+{
+}
+
+PBoolean H46019MultiQueue::Push(const void * buf, PINDEX len, const PIPSocket::Address & addr, WORD port)
+{
+#ifdef H323_STD_ATOMIC
+    unsigned current = tail.load(std::memory_order_relaxed);
+    if (current - head.load(std::memory_order_acquire) >= H46019_MUX_QUEUE_SIZE)
+        return false;
+#else
+    indexMutex.Wait();
+    unsigned current = tail;
+    PBoolean full = (current - head >= H46019_MUX_QUEUE_SIZE);
+    indexMutex.Signal();
+    if (full)
+        return false;
+#endif
+
+    // The slot buffer only grows, so it is allocated once for a stream
+    H46019MultiPacket & packet = slots[current & (H46019_MUX_QUEUE_SIZE-1)];
+    if (!packet.frame.SetMinSize(len))
+        return false;
+    memcpy(packet.frame.GetPointer(), buf, len);
+    packet.length   = len;
+    packet.fromAddr = addr;
+    packet.fromPort = port;
+
+#ifdef H323_STD_ATOMIC
+    tail.store(current+1, std::memory_order_release);
+#else
+    indexMutex.Wait();
+    tail = current+1;
+    indexMutex.Signal();
+#endif
+    return true;
+}
+
+PBoolean H46019MultiQueue::Pop(void * buf, PINDEX & len, PIPSocket::Address & addr, WORD & port)
+{
+#ifdef H323_STD_ATOMIC
+    unsigned current = head.load(std::memory_order_relaxed);
+    if (current == tail.load(std::memory_order_acquire))
+        return false;
+#else
+    indexMutex.Wait();
+    unsigned current = head;
+    PBoolean empty = (current == tail);
+    indexMutex.Signal();
+    if (empty)
+        return false;
+#endif
+
+    const H46019MultiPacket & packet = slots[current & (H46019_MUX_QUEUE_SIZE-1)];
+    addr = packet.fromAddr;
+    port = packet.fromPort;
+    len  = PMIN(len, packet.length);
+    memcpy(buf, packet.frame.GetPointer(), len);
+
+#ifdef H323_STD_ATOMIC
+    head.store(current+1, std::memory_order_release);
+#else
+    indexMutex.Wait();
+    head = current+1;
+    indexMutex.Signal();
+#endif
+    return true;
+}
+
+void H46019MultiQueue::Clear()
+{
+#ifdef H323_STD_ATOMIC
+    head.store(tail.load(std::memory_order_acquire), std::memory_order_release);
+#else
+    PWaitAndSignal m(indexMutex);
+    head = tail;
+#endif
+}
+
+PBoolean H46019MultiQueue::IsEmpty() const
+{
+#ifdef H323_STD_ATOMIC
+    return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+#else
+    PWaitAndSignal m(indexMutex);
+    return head == tail;
+#endif
+}
+
+#endif
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+
 H46019UDPSocket::H46019UDPSocket(H46018Handler & _handler, H323Connection::SessionInformation * info, bool _rtpSocket)
 : m_Handler(_handler), m_Session(info->GetSessionID()), m_Token(info->GetCallToken()),
   m_CallId(info->GetCallIdentifer()), m_CUI(info->GetCUI()),
   keepport(0), keeppayload(0), keepTTL(0), keepseqno(0), keepStartTime(NULL), initialKeep(NULL),
 #ifdef H323_H46019M
-  m_recvMultiplexID(info->GetRecvMultiplexID()), m_sendMultiplexID(0), m_multiBuffer(0), m_shutDown(false),
+  m_recvMultiplexID(info->GetRecvMultiplexID()), m_sendMultiplexID(0), m_shutDown(false),
 #endif
 #if defined(H323_H46024A) || defined(H323_H46024B)
   m_CUIrem(PString()), m_locAddr(PIPSocket::GetDefaultIpAny()),  m_locPort(0),
@@ -1123,6 +1280,7 @@ PBoolean H46019UDPSocket::Close()
 {
 #ifdef H323_H46019M
     m_shutDown = true;
+    m_multiReady.Signal();
 #endif
     return H323UDPSocket::Close();
 }
@@ -1341,16 +1499,11 @@ PBoolean H46019UDPSocket::WriteMultiplexBuffer(const void * buf, PINDEX len, con
         return true;
     }
 
-    H46019MultiPacket packet;
-        packet.fromAddr = addr;
-        packet.fromPort = port;
-        packet.frame.SetSize(len);
-        memcpy(packet.frame.GetPointer(), buf, len);
-
-    m_multiMutex.Wait();
-      m_multQueue.push(packet);
-    m_multiMutex.Signal();
-    m_multiBuffer++;
+    if (!m_multQueue.Push(buf, len, addr, port)) {
+        PTRACE(4, "H46019\t" << (rtpSocket ? "RTP" : "RTCP") << " Session " << m_Session << " multiplex queue full, packet dropped.");
+        return false;
+    }
+    m_multiReady.Signal();
 
     if (!rtpSocket && len > 0) {
         RTP_ControlFrame frame(len);
@@ -1369,34 +1522,14 @@ PBoolean H46019UDPSocket::WriteMultiplexBuffer(const void * buf, PINDEX len, con
 
 PBoolean H46019UDPSocket::ReadMultiplexBuffer(void * buf, PINDEX & len, Address & addr, WORD & port)
 {
-    if (m_multiBuffer == 0 || m_multQueue.size() == 0)
-        return false;
-
-    m_multiMutex.Wait();
-    H46019MultiPacket & packet = m_multQueue.front();
-
-    addr = packet.fromAddr;
-    port = packet.fromPort;
-    len = packet.frame.GetSize();
-    memcpy(buf, packet.frame.GetPointer(), len);
-
-    m_multQueue.pop();
-    m_multiMutex.Signal();
-
-    m_multiBuffer--;
-    return true;
+    PWaitAndSignal m(m_multiMutex);
+    return m_multQueue.Pop(buf, len, addr, port);
 }
 
 void H46019UDPSocket::ClearMultiplexBuffer()
 {
-    if (m_multiBuffer > 0) {
-        m_multiMutex.Wait();
-        while (!m_multQueue.empty()) {
-            m_multQueue.pop();
-        }
-        m_multiMutex.Signal();
-    }
-    m_multiBuffer = 0;
+    PWaitAndSignal m(m_multiMutex);
+    m_multQueue.Clear();
 }
 
 PBoolean H46019UDPSocket::DoPseudoRead(int & selectStatus)
@@ -1404,15 +1537,16 @@ PBoolean H46019UDPSocket::DoPseudoRead(int & selectStatus)
    if (m_recvMultiplexID == 0)
        return false;
 
+   // Sleep until the multiplex read thread queues a frame or the socket is closed
    if (rtpSocket) {
-	   while (!m_shutDown && m_multiBuffer == 0)
-          selectBlock.Delay(3);
+       while (!m_shutDown && m_multQueue.IsEmpty())
+          m_multiReady.Wait();
    }
 
    if (m_shutDown)
        selectStatus += PSocket::Interrupted;
    else
-       selectStatus += ((m_multiBuffer > 0) ? (rtpSocket ? -1 : -2) : 0);
+       selectStatus += (!m_multQueue.IsEmpty() ? (rtpSocket ? -1 : -2) : 0);
 
    return rtpSocket;
 }
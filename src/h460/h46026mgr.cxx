@@ -41,6 +41,7 @@
 
 #include <h323pdu.h>
 #include "h460/h46026mgr.h"
+#include <algorithm>
 
 //-------------------------------------------
 #define MAX_AUDIO_FRAMES     3
@@ -49,11 +50,22 @@
 #define REC_FRAME_TIME       (1.0/REC_FRAME_RATE) * 1000
 #define MAX_STACK_DESCRETION  REC_FRAME_TIME * 2
 #define FAST_UPDATE_INTERVAL  REC_FRAME_TIME * 3
-#define MAX_VIDEO_KBPS       384000.0
-
-
-#define PACKETDELAY(sz,mbps) \
-      int((double(sz) / (mbps *0.5)) * 1000.0);
+#define DEFAULT_PIPE_BPS     1536000.0    // Same pacing as the former fixed packet delay at 384k
+#define MIN_PIPE_BPS         64000.0
+#define PACING_BURST_TIME    50           // Milliseconds of data the token bucket can hold
+#define MIN_PACING_BURST     10000        // Never less than one tunnelled packet
+#define RATE_WINDOW          1000         // Send rate measurement window (ms)
+#define WRITE_BLOCKED_TIME   5            // Socket write taking longer than this with data waiting means the link is full (ms)
+#define CONGESTION_BACKOFF   0.85         // Pacing rate multiplier for each congested window
+#define MAX_FREE_BUFFERS     64
+
+// Deficit round robin quantum in bytes for each priority
+static const PINDEX FlowQuantum[socketOrder::Priority_Count] = {
+    1500,       // Critical(Audio)
+    1500,       // Discretion(Video)
+    1500,       // High(Signal)
+    300         // Low(RTCP)
+};
 
 //-------------------------------------------
 
@@ -89,6 +101,56 @@ static void BuildRTPFrame(Q931 & q931, H225_H323_UserInformation & uuie, unsigne
     SetInfoUUIE(q931,uuie);
 }
 
+static PINDEX PERLengthSize(PINDEX len)
+{
+    return len < 128 ? 1 : 2;
+}
+
+static BYTE * PutPERLength(BYTE * ptr, PINDEX len)
+{
+    if (len < 128)
+        *ptr++ = (BYTE)len;
+    else {
+        *ptr++ = (BYTE)(0x80 | (len >> 8));
+        *ptr++ = (BYTE)len;
+    }
+    return ptr;
+}
+
+static PBoolean GetPERLength(const BYTE * & ptr, const BYTE * end, PINDEX & len)
+{
+    if (ptr >= end)
+        return false;
+
+    if ((*ptr & 0x80) == 0) {
+        len = *ptr++;
+        return true;
+    }
+
+    // Fragmented lengths (16k and over) are never used by the envelope
+    if ((*ptr & 0xc0) != 0x80 || ptr+1 >= end)
+        return false;
+
+    len = ((ptr[0] & 0x3f) << 8) | ptr[1];
+    ptr += 2;
+    return true;
+}
+
+static PINDEX FindUserUserIE(const PBYTEArray & data)
+{
+    PINDEX offset = 5;
+    while (offset < data.GetSize()) {
+        BYTE discriminator = data[offset];
+        if ((discriminator & 0x80) != 0)
+            offset++;
+        else if (discriminator == Q931::UserUserIE)
+            return offset;
+        else
+            offset += 2 + data[offset+1];
+    }
+    return P_MAX_INDEX;
+}
+
 static PBoolean ReadRTPFrame(const Q931 & q931, H46026_UDPFrame & data)
 {
     H225_H323_UserInformation uuie;
@@ -254,6 +316,23 @@ PINDEX H46026UDPBuffer::GetPacketCount()
 
 //-------------------------------------------
 
+H46026SocketFlow::H46026SocketFlow()
+: bytes(0), deficit(0), active(false), newRound(true)
+{
+}
+
+H46026QueueStatistics::H46026QueueStatistics()
+: packetsSent(0), bytesSent(0), packetsDropped(0), totalDelay(0), maximumDelay(0), packetsQueued(0), bytesQueued(0)
+{
+}
+
+unsigned H46026QueueStatistics::GetAverageDelay() const
+{
+    return packetsSent > 0 ? (unsigned)(totalDelay / packetsSent) : 0;
+}
+
+//-------------------------------------------
+
 H46026_MediaFrame::H46026_MediaFrame()
 :PBYTEArray(12)
 {
@@ -288,7 +367,9 @@ void H46026_MediaFrame::PrintInfo(ostream & strm) const
 //-------------------------------------------
 
 H46026ChannelManager::H46026ChannelManager()
-:  m_mbps(MAX_VIDEO_KBPS), m_socketPacketReady(false), m_currentPacketTime(0), m_pktCounter(0)
+:  m_mbps(DEFAULT_PIPE_BPS), m_socketPacketReady(false), m_pktCounter(0), m_envelopeValid(false),
+   m_pacingRate(DEFAULT_PIPE_BPS), m_tokens(0), m_lastRefill(0),
+   m_sendRate(0), m_sentBytes(0), m_rateWindowStart(0), m_lastHandout(0), m_backlogged(false), m_congested(false)
 {
 
     // Initialise the Information PDU RTP Message structure.
@@ -314,6 +395,7 @@ H46026ChannelManager::H46026ChannelManager()
     m_uuie.m_h323_uu_pdu.m_h323_message_body.SetTag(H225_H323_UU_PDU_h323_message_body::e_empty);
     m_uuie.m_h323_uu_pdu.m_h245Tunneling = TRUE;
 
+    BuildEnvelope();
 }
 
 H46026ChannelManager::~H46026ChannelManager()
@@ -321,8 +403,166 @@ H46026ChannelManager::~H46026ChannelManager()
     PWaitAndSignal m(m_queueMutex);
 
     ClearBufferEntries(m_rtpBuffer, 0);
-    while (!m_socketQueue.empty())
-        m_socketQueue.pop();
+    m_flows.clear();
+    m_criticalFlows.clear();
+    m_sharedFlows.clear();
+    m_freeBuffers.clear();
+}
+
+void H46026ChannelManager::BuildEnvelope()
+{
+    // Encode the envelope with two payloads of different sizes. Everything other
+    // than the payload and the lengths covering it is the same for every packet.
+    static const PINDEX SampleSize[2] = { 200, 300 };
+    PBYTEArray sample[2];
+    PINDEX perStart = 0;
+
+    for (PINDEX i = 0; i < 2; ++i) {
+        PBYTEArray payload(SampleSize[i]);
+        memset(payload.GetPointer(), 0xa5, SampleSize[i]);
+
+        PASN_OctetString & val = m_uuie.m_h323_uu_pdu.m_genericData[0].m_parameters[0].m_content;
+        val.SetValue(payload);
+
+        Q931 q931;
+        q931.BuildInformation(0, true);
+        q931.SetCallState(Q931::CallState_CallInitiated);
+        SetInfoUUIE(q931, m_uuie);
+        q931.Encode(sample[i]);
+
+        PINDEX uuie = FindUserUserIE(sample[i]);
+        if (uuie == P_MAX_INDEX || uuie+4 > sample[i].GetSize()) {
+            PTRACE(2,"H46026\tMedia envelope has no User-User IE, fast path disabled");
+            return;
+        }
+        if (i > 0 && (uuie+4 != perStart || memcmp((const BYTE *)sample[0], (const BYTE *)sample[1], uuie) != 0)) {
+            PTRACE(2,"H46026\tMedia envelope header not constant, fast path disabled");
+            return;
+        }
+        perStart = uuie+4;
+
+        // The payload must be the last thing in the message
+        PINDEX perLen = sample[i].GetSize() - perStart;
+        PINDEX ieLen = (sample[i][uuie+1] << 8) | sample[i][uuie+2];
+        PINDEX lenPos = sample[i].GetSize() - SampleSize[i] - 2;
+        if (ieLen != perLen+1 || lenPos < perStart ||
+            memcmp((const BYTE *)sample[i] + lenPos + 2, (const BYTE *)payload, SampleSize[i]) != 0 ||
+            sample[i][lenPos] != (BYTE)(0x80 | (SampleSize[i] >> 8)) || sample[i][lenPos+1] != (BYTE)SampleSize[i]) {
+            PTRACE(2,"H46026\tMedia envelope payload not found, fast path disabled");
+            return;
+        }
+    }
+
+    // Find the genericData open type length, the one length before the payload
+    // length that matches the bytes following it in both samples.
+    PINDEX lenPos0 = sample[0].GetSize() - SampleSize[0] - 2;
+    PINDEX lenPos1 = sample[1].GetSize() - SampleSize[1] - 2;
+    for (PINDEX pos = perStart; pos+2 <= lenPos0; ++pos) {
+        PINDEX len0 = sample[0].GetSize() - pos - 2;
+        PINDEX len1 = sample[1].GetSize() - pos - 2;
+        if (sample[0][pos] != (BYTE)(0x80 | (len0 >> 8)) || sample[0][pos+1] != (BYTE)len0 ||
+            sample[1][pos] != (BYTE)(0x80 | (len1 >> 8)) || sample[1][pos+1] != (BYTE)len1)
+            continue;
+
+        PINDEX innerLen = lenPos0 - pos - 2;
+        if (lenPos1 - pos - 2 != innerLen ||
+            memcmp((const BYTE *)sample[0] + perStart, (const BYTE *)sample[1] + perStart, pos - perStart) != 0 ||
+            memcmp((const BYTE *)sample[0] + pos + 2, (const BYTE *)sample[1] + pos + 2, innerLen) != 0)
+            continue;
+
+        m_envelopeHeader = PBYTEArray((const BYTE *)sample[0], perStart-4);
+        m_envelopePrefix = PBYTEArray((const BYTE *)sample[0] + perStart, pos - perStart);
+        m_envelopeInner = PBYTEArray((const BYTE *)sample[0] + pos + 2, innerLen);
+        m_envelopeValid = true;
+        PTRACE(4,"H46026\tMedia envelope pre-encoded. Header " << m_envelopeHeader.GetSize()
+               << " Prefix " << m_envelopePrefix.GetSize() << " Inner " << m_envelopeInner.GetSize());
+        return;
+    }
+
+    PTRACE(2,"H46026\tMedia envelope length not found, fast path disabled");
+}
+
+PBoolean H46026ChannelManager::EncodeEnvelope(unsigned crv, const H46026_UDPFrame & data, PBYTEArray & output)
+{
+    PPER_Stream strm;
+    data.Encode(strm);
+    strm.CompleteEncoding();
+
+    PINDEX payloadLen = strm.GetSize();
+    PINDEX innerLen = m_envelopeInner.GetSize() + PERLengthSize(payloadLen) + payloadLen;
+    if (innerLen >= 16384)
+        return false;
+
+    PINDEX perLen = m_envelopePrefix.GetSize() + PERLengthSize(innerLen) + innerLen;
+    PINDEX headerLen = m_envelopeHeader.GetSize();
+    if (!output.SetSize(headerLen + 4 + perLen))
+        return false;
+
+    BYTE * ptr = output.GetPointer();
+    memcpy(ptr, (const BYTE *)m_envelopeHeader, headerLen);
+    ptr[2] = (BYTE)((m_envelopeHeader[2] & 0x80) | ((crv >> 8) & 0x7f));
+    ptr[3] = (BYTE)crv;
+    ptr += headerLen;
+
+    *ptr++ = Q931::UserUserIE;
+    *ptr++ = (BYTE)((perLen+1) >> 8);
+    *ptr++ = (BYTE)(perLen+1);
+    *ptr++ = 5;  // ITU protocol block
+
+    memcpy(ptr, (const BYTE *)m_envelopePrefix, m_envelopePrefix.GetSize());
+    ptr = PutPERLength(ptr + m_envelopePrefix.GetSize(), innerLen);
+    memcpy(ptr, (const BYTE *)m_envelopeInner, m_envelopeInner.GetSize());
+    ptr = PutPERLength(ptr + m_envelopeInner.GetSize(), payloadLen);
+    memcpy(ptr, (const BYTE *)strm, payloadLen);
+
+    return true;
+}
+
+PBoolean H46026ChannelManager::SocketMediaIn(const BYTE * data, PINDEX len)
+{
+    if (!m_envelopeValid)
+        return false;
+
+    // Everything but the call reference must match what we send
+    PINDEX headerLen = m_envelopeHeader.GetSize();
+    const BYTE * header = m_envelopeHeader;
+    if (len < headerLen + 4 || data[0] != header[0] || data[1] != header[1] ||
+        memcmp(data+4, header+4, headerLen-4) != 0)
+        return false;
+
+    const BYTE * end = data + len;
+    const BYTE * ptr = data + headerLen;
+    if (ptr[0] != Q931::UserUserIE || ptr[3] != 5 || ((ptr[1] << 8) | ptr[2]) != end - ptr - 3)
+        return false;
+    ptr += 4;
+
+    PINDEX prefixLen = m_envelopePrefix.GetSize();
+    if (end - ptr < prefixLen || memcmp(ptr, (const BYTE *)m_envelopePrefix, prefixLen) != 0)
+        return false;
+    ptr += prefixLen;
+
+    PINDEX innerLen;
+    if (!GetPERLength(ptr, end, innerLen) || innerLen != end - ptr)
+        return false;
+
+    PINDEX innerSize = m_envelopeInner.GetSize();
+    if (end - ptr < innerSize || memcmp(ptr, (const BYTE *)m_envelopeInner, innerSize) != 0)
+        return false;
+    ptr += innerSize;
+
+    PINDEX payloadLen;
+    if (!GetPERLength(ptr, end, payloadLen) || payloadLen != end - ptr)
+        return false;
+
+    H46026_UDPFrame frameData;
+    PPER_Stream strm(ptr, payloadLen);
+    if (!frameData.Decode(strm)) {
+        PTRACE(2,"H46026\tERROR Decoding Media Frame");
+        return false;
+    }
+
+    MediaFrameIn(((data[2] & 0x7f) << 8) | data[3], frameData);
+    return true;
 }
 
  void H46026ChannelManager::RTPFrameIn(unsigned crv, PINDEX sessionId, PBoolean rtp, const PBYTEArray & data)
@@ -332,7 +572,9 @@ H46026ChannelManager::~H46026ChannelManager()
 
  void H46026ChannelManager::SetPipeBandwidth(unsigned bps)
  {
-     m_mbps = double(bps);
+     PWaitAndSignal m(m_queueMutex);
+     m_mbps = PMAX(double(bps), MIN_PIPE_BPS);
+     m_pacingRate = m_mbps;
  }
 
 void H46026ChannelManager::BufferRelease(unsigned crv)
@@ -348,7 +590,6 @@ PBoolean H46026ChannelManager::SignalMsgOut(const Q931 & pdu)
     prior.crv = pdu.GetCallReference();
     prior.priority = socketOrder::Priority_High;
     prior.packTime = PTimer::Tick().GetMilliSeconds();
-    prior.delay = PACKETDELAY(pdu.GetIE(Q931::UserUserIE).GetSize(), m_mbps);
     return WriteQueue(pdu, prior);
 }
 
@@ -361,7 +602,7 @@ PBoolean H46026ChannelManager::SignalMsgOut(const BYTE * data, PINDEX len)
     prior.crv = 0;
     prior.priority = socketOrder::Priority_High;
     prior.packTime = PTimer::Tick().GetMilliSeconds();
-    prior.delay = PACKETDELAY(len, m_mbps);
+    prior.size = len;
     return WriteQueue(msg, prior);
 }
 
@@ -380,10 +621,6 @@ H46026UDPBuffer * H46026ChannelManager::GetRTPBuffer(unsigned crv, int sessionId
 
 PBoolean H46026ChannelManager::PackageFrame(PBoolean rtp, unsigned crv, PacketTypes id, PINDEX sessionId, H46026_UDPFrame & data)
 {
-    // Build Packet
-    Q931 mediaPDU;
-    BuildRTPFrame(mediaPDU, m_uuie, crv, data);
-
     // Set metadata
     socketOrder::MessageHeader prior;
     prior.crv = crv;
@@ -405,12 +642,11 @@ PBoolean H46026ChannelManager::PackageFrame(PBoolean rtp, unsigned crv, PacketTy
         prior.priority = socketOrder::Priority_Low;
     prior.id = NextPacketCounter();
     prior.packTime = PTimer::Tick().GetMilliSeconds();
-    prior.delay = PACKETDELAY(mediaPDU.GetIE(Q931::UserUserIE).GetSize(), m_mbps);
 
     if (PTrace::CanTrace(6)) {
         PStringStream info;
-        info <<  "Build #" << prior.id << (rtp ? "\nMedia" : " Control") << ":" << H46026MediaTypeAsString(id) << "  Delay:" << prior.delay
-            << "ms  Priority:" << H46026PriorityAsString(prior.priority) << "\n" << H46026MediaFrameAnalysis(data);
+        info <<  "Build #" << prior.id << (rtp ? "\nMedia" : " Control") << ":" << H46026MediaTypeAsString(id)
+            << "  Priority:" << H46026PriorityAsString(prior.priority) << "\n" << H46026MediaFrameAnalysis(data);
         if (PTrace::CanTrace(7)) {
             if (rtp) info  << data;
             else info << "\n" << data;
@@ -420,6 +656,20 @@ PBoolean H46026ChannelManager::PackageFrame(PBoolean rtp, unsigned crv, PacketTy
         }
     }
 
+    // Patch the frame into the pre-encoded envelope
+    if (m_envelopeValid) {
+        PBYTEArray frame;
+        GetFreeBuffer(frame);
+        if (EncodeEnvelope(crv, data, frame)) {
+            prior.size = frame.GetSize();
+            return WriteQueue(frame, prior);
+        }
+    }
+
+    // Build Packet
+    Q931 mediaPDU;
+    BuildRTPFrame(mediaPDU, m_uuie, crv, data);
+
     // Write to the output Queue
     return WriteQueue(mediaPDU, prior);
 }
@@ -474,34 +724,145 @@ PBoolean H46026ChannelManager::RTPFrameOut(unsigned crv, PacketTypes id, PINDEX
 
 PBoolean H46026ChannelManager::ProcessQueue()
 {
-    PWaitAndSignal m(m_queueMutex);
+    std::vector< std::pair<unsigned, PINDEX> > fastUpdate;
 
-    if (m_socketQueue.size() == 0) {
-        m_socketPacketReady = false;
-        return true;
-    }
+    m_queueMutex.Wait();
 
     PInt64 nowTime = PTimer::Tick().GetMilliSeconds();
-    PInt64 stackTime = nowTime - m_socketQueue.top().second.packTime;
+    H46026QueueStatistics & stats = m_statistics[socketOrder::Priority_Discretion-1];
+
+    // Video that has waited too long is dropped for that call only
+    H46026FlowMap::iterator f = m_flows.lower_bound(H46026FlowKey(socketOrder::Priority_Discretion, 0));
+    for (; f != m_flows.end() && f->first.first == socketOrder::Priority_Discretion; ++f) {
+        H46026SocketFlow & flow = f->second;
+        if (flow.packets.empty())
+            continue;
+
+        PInt64 stackTime = nowTime - flow.packets.front().header.packTime;
+        if (stackTime <= MAX_STACK_DESCRETION)
+            continue;
+
+        PTRACE(5,"H46026\tPossible pipe blockage detected on call " << f->first.second << ". Delay " << stackTime << " Dropping video frames...");
+        while (!flow.packets.empty()) {
+            std::pair<unsigned, PINDEX> session(f->first.second, flow.packets.front().header.sessionId);
+            if (std::find(fastUpdate.begin(), fastUpdate.end(), session) == fastUpdate.end())
+                fastUpdate.push_back(session);
+            stats.packetsDropped++;
+            stats.packetsQueued--;
+            stats.bytesQueued -= flow.packets.front().header.size;
+            RecycleBuffer(flow.packets.front().data);
+            flow.packets.pop_front();
+        }
+        flow.bytes = 0;
+    }
+
+    m_socketPacketReady = (!m_criticalFlows.empty() || !m_sharedFlows.empty());
 
-    PBoolean dropPacket = ((m_socketQueue.top().second.priority == socketOrder::Priority_Discretion) &&
-            (stackTime > MAX_STACK_DESCRETION));
+    m_queueMutex.Signal();
+
+    for (size_t i = 0; i < fastUpdate.size(); ++i)
+        FastUpdatePictureRequired(fastUpdate[i].first, fastUpdate[i].second);
+
+    return true;
+}
+
+PBoolean H46026ChannelManager::NextPacket(H46026FlowList & active, H46026QueuedPacket & packet)
+{
+    while (!active.empty()) {
+        H46026FlowKey key = active.front();
+        H46026FlowMap::iterator f = m_flows.find(key);
+        if (f == m_flows.end()) {
+            active.pop_front();
+            continue;
+        }
+
+        H46026SocketFlow & flow = f->second;
+        if (flow.packets.empty()) {
+            active.pop_front();
+            m_flows.erase(f);
+            continue;
+        }
+
+        if (flow.newRound) {
+            flow.deficit += FlowQuantum[key.first-1];
+            flow.newRound = false;
+        }
+
+        if (flow.packets.front().header.size > flow.deficit) {
+            // Not enough credit, wait for the next round
+            flow.newRound = true;
+            active.pop_front();
+            active.push_back(key);
+            continue;
+        }
 
-    if (dropPacket) {
+        packet = flow.packets.front();
+        flow.packets.pop_front();
+        flow.deficit -= packet.header.size;
+        flow.bytes -= packet.header.size;
 
-        PTRACE(5,"H46026\tPossible pipe blockage detected. Delay " << stackTime << " Dropping video frames...");
-        unsigned crv = m_socketQueue.top().second.crv;
-        PINDEX sessionId = m_socketQueue.top().second.sessionId;
-        while (m_socketQueue.size()>0 && m_socketQueue.top().second.priority == socketOrder::Priority_Discretion) {
-            m_socketQueue.pop();
+        if (flow.packets.empty()) {
+            active.pop_front();
+            m_flows.erase(f);
         }
-        FastUpdatePictureRequired(crv, sessionId);
-        // TODO: Flow Control based on the Time in the queue (stackTime) - SH
+        return true;
     }
+    return false;
+}
 
-    m_socketPacketReady = (!m_socketQueue.empty());
+void H46026ChannelManager::GetFreeBuffer(PBYTEArray & data)
+{
+    PWaitAndSignal m(m_queueMutex);
+    if (!m_freeBuffers.empty()) {
+        data = m_freeBuffers.back();
+        m_freeBuffers.pop_back();
+    }
+}
 
-    return true;
+void H46026ChannelManager::RecycleBuffer(const PBYTEArray & data)
+{
+    if (m_freeBuffers.size() < MAX_FREE_BUFFERS)
+        m_freeBuffers.push_back(data);
+}
+
+void H46026ChannelManager::RefillTokens(PInt64 now)
+{
+    double burst = PMAX(m_pacingRate / 8000.0 * PACING_BURST_TIME, (double)MIN_PACING_BURST);
+
+    if (m_lastRefill == 0)
+        m_tokens = burst;
+    else
+        m_tokens += double(now - m_lastRefill) * m_pacingRate / 8000.0;
+
+    if (m_tokens > burst)
+        m_tokens = burst;
+    m_lastRefill = now;
+}
+
+void H46026ChannelManager::UpdateSendRate(PInt64 now)
+{
+    if (m_rateWindowStart == 0) {
+        m_rateWindowStart = now;
+        return;
+    }
+
+    PInt64 elapsed = now - m_rateWindowStart;
+    if (elapsed < RATE_WINDOW)
+        return;
+
+    m_sendRate = double(m_sentBytes) * 8000.0 / double(elapsed);
+
+    if (m_congested) {
+        // Back off from where we were, the send rate of a window is only as high as the media offered
+        m_pacingRate = PMAX(m_pacingRate * CONGESTION_BACKOFF, MIN_PIPE_BPS);
+        PTRACE(4,"H46026\tSocket congested. Send rate " << (unsigned)m_sendRate << " bps, pacing at " << (unsigned)m_pacingRate << " bps");
+    } else if (m_pacingRate < m_mbps)
+        m_pacingRate = PMIN(m_mbps, m_pacingRate + m_mbps * 0.05);
+
+    m_sentBytes = 0;
+    m_rateWindowStart = now;
+    m_backlogged = false;
+    m_congested = false;
 }
 
 unsigned H46026ChannelManager::NextPacketCounter()
@@ -515,12 +876,18 @@ unsigned H46026ChannelManager::NextPacketCounter()
 
 PBoolean H46026ChannelManager::SocketIn(const BYTE * data, PINDEX len)
 {
+    if (SocketMediaIn(data, len))
+        return true;
+
     PBYTEArray buffer(data,len);
     return SocketIn(buffer);
 }
 
 PBoolean H46026ChannelManager::SocketIn(const PBYTEArray & data)
 {
+    if (SocketMediaIn(data, data.GetSize()))
+        return true;
+
     Q931 q931pdu;
     if (!q931pdu.Decode(data)) {
         PTRACE(1, "H46026\tERROR DECODING Q.931!");
@@ -534,28 +901,33 @@ PBoolean H46026ChannelManager::SocketIn(const Q931 & q931)
     PString callId = PString();
     H46026_UDPFrame frameData;
 
-    if ((q931.GetMessageType() == Q931::InformationMsg) && ReadRTPFrame(q931, frameData)) {
-        if (PTrace::CanTrace(6) && frameData.m_dataFrame) {
-            PStringStream info;
-            info << "Received Media:" << H46026MediaSessionId(frameData.m_sessionId)
-                << "\n" << H46026MediaFrameAnalysis(frameData);
-            if (PTrace::CanTrace(7)) {
-                info << "\n" << frameData;
-                PTRACE(7, "H46026\t" << info);
-            } else {
-                PTRACE(6, "H46026\t" << info);
-            }
-        }
-        for (PINDEX i=0; i < frameData.m_frame.GetSize(); ++i) {
-            PASN_OctetString & data = frameData.m_frame[i];
-            RTPFrameIn(q931.GetCallReference(), frameData.m_sessionId.GetValue(), frameData.m_dataFrame, data.GetValue());
-        }
-    } else
+    if ((q931.GetMessageType() == Q931::InformationMsg) && ReadRTPFrame(q931, frameData))
+        MediaFrameIn(q931.GetCallReference(), frameData);
+    else
         SignalMsgIn(q931);
 
     return true;
 }
 
+void H46026ChannelManager::MediaFrameIn(unsigned crv, H46026_UDPFrame & frameData)
+{
+    if (PTrace::CanTrace(6) && frameData.m_dataFrame) {
+        PStringStream info;
+        info << "Received Media:" << H46026MediaSessionId(frameData.m_sessionId)
+            << "\n" << H46026MediaFrameAnalysis(frameData);
+        if (PTrace::CanTrace(7)) {
+            info << "\n" << frameData;
+            PTRACE(7, "H46026\t" << info);
+        } else {
+            PTRACE(6, "H46026\t" << info);
+        }
+    }
+    for (PINDEX i=0; i < frameData.m_frame.GetSize(); ++i) {
+        PASN_OctetString & data = frameData.m_frame[i];
+        RTPFrameIn(crv, frameData.m_sessionId.GetValue(), frameData.m_dataFrame, data.GetValue());
+    }
+}
+
 void H46026ChannelManager::SignalMsgIn(const Q931 & pdu)
 {
     SignalMsgIn(pdu.GetCallReference(), pdu);
@@ -571,39 +943,127 @@ PBoolean H46026ChannelManager::SocketOut(BYTE * data, PINDEX & len)
     if (!m_socketPacketReady)
         return false;
 
+    PWaitAndSignal m(m_queueMutex);
+
     PInt64 nowTime = PTimer::Tick().GetMilliSeconds();
-    if (m_currentPacketTime > nowTime)
+    RefillTokens(nowTime);
+    if (m_tokens <= 0) {
+        m_backlogged = true;
         return false;
+    }
 
-    PBoolean gotPacket = false;
-    m_queueMutex.Wait();
-        if (!m_socketQueue.empty()) {
-            PTRACE(6,"H46026\tSending #" << m_socketQueue.top().second.id << " delay " << m_socketQueue.top().second.delay << "ms");
-            m_currentPacketTime = nowTime + m_socketQueue.top().second.delay;
-            len = m_socketQueue.top().first.GetSize();
-            memcpy(data, (const BYTE *)m_socketQueue.top().first, len);
-            m_socketQueue.pop();
-            gotPacket = true;
-        } else {
-            m_currentPacketTime = nowTime;
-        }
-    m_queueMutex.Signal();
+    // Audio always goes first, everything else shares the rest
+    H46026QueuedPacket packet;
+    if (!NextPacket(m_criticalFlows, packet) && !NextPacket(m_sharedFlows, packet)) {
+        m_socketPacketReady = false;
+        return false;
+    }
+
+    const socketOrder::MessageHeader & header = packet.header;
+    unsigned delay = (unsigned)(nowTime - header.packTime);
+
+    H46026QueueStatistics & stats = m_statistics[header.priority-1];
+    stats.packetsSent++;
+    stats.bytesSent += header.size;
+    stats.packetsQueued--;
+    stats.bytesQueued -= header.size;
+    stats.totalDelay += delay;
+    if (delay > stats.maximumDelay)
+        stats.maximumDelay = delay;
+
+    PTRACE(6,"H46026\tSending #" << header.id << " " << H46026PriorityAsString(header.priority) << " queued " << delay << "ms");
+
+    m_tokens -= header.size;
+    m_lastHandout = nowTime;
+
+    len = header.size;
+    memcpy(data, (const BYTE *)packet.data, len);
+    RecycleBuffer(packet.data);
+
+    m_socketPacketReady = (!m_criticalFlows.empty() || !m_sharedFlows.empty());
+    return true;
+}
+
+void H46026ChannelManager::SocketWritten(PINDEX len)
+{
+    PWaitAndSignal m(m_queueMutex);
+
+    /* A slow write on its own may just be the scheduler, it only means the
+       link is full if data was left waiting for it this window.
+     */
+    PInt64 nowTime = PTimer::Tick().GetMilliSeconds();
+    if (!m_criticalFlows.empty() || !m_sharedFlows.empty())
+        m_backlogged = true;
+    if (m_backlogged && m_lastHandout > 0 && (nowTime - m_lastHandout) > WRITE_BLOCKED_TIME)
+        m_congested = true;
 
-    return gotPacket;
+    UpdateSendRate(nowTime);
+    m_sentBytes += len;
 }
 
-PBoolean H46026ChannelManager::WriteQueue(const Q931 & msg, const socketOrder::MessageHeader & prior)
+H46026QueueStatistics H46026ChannelManager::GetQueueStatistics(int priority)
+{
+    PWaitAndSignal m(m_queueMutex);
+
+    if (priority < socketOrder::Priority_Critical || priority > socketOrder::Priority_Count)
+        return H46026QueueStatistics();
+
+    return m_statistics[priority-1];
+}
+
+unsigned H46026ChannelManager::GetSendRate()
+{
+    PWaitAndSignal m(m_queueMutex);
+    return (unsigned)m_sendRate;
+}
+
+unsigned H46026ChannelManager::GetPacingRate()
+{
+    PWaitAndSignal m(m_queueMutex);
+    return (unsigned)m_pacingRate;
+}
+
+PBoolean H46026ChannelManager::WriteQueue(const Q931 & msg, socketOrder::MessageHeader & prior)
 {
     PTRACE(6,"H46026\tPack #" << prior.id << " Type:" << msg.GetMessageTypeName());
+
+    // Encode straight into a buffer left over from an earlier packet
     PBYTEArray data;
-    msg.Encode(data);
+    GetFreeBuffer(data);
+
+    if (!msg.Encode(data)) {
+        PTRACE(2,"H46026\tError encoding #" << prior.id);
+        return false;
+    }
+
+    prior.size = data.GetSize();
     return WriteQueue(data, prior);
 }
 
 PBoolean H46026ChannelManager::WriteQueue(const PBYTEArray & data, const socketOrder::MessageHeader & prior)
 {
     m_queueMutex.Wait();
-     m_socketQueue.push(pair<PBYTEArray, socketOrder::MessageHeader>(data, prior) );
+
+    H46026FlowKey key(prior.priority, prior.crv);
+    H46026SocketFlow & flow = m_flows[key];
+
+    flow.packets.push_back(H46026QueuedPacket());
+    flow.packets.back().data = data;
+    flow.packets.back().header = prior;
+    flow.bytes += prior.size;
+
+    H46026QueueStatistics & stats = m_statistics[prior.priority-1];
+    stats.packetsQueued++;
+    stats.bytesQueued += prior.size;
+
+    if (!flow.active) {
+        flow.active = true;
+        if (prior.priority == socketOrder::Priority_Critical)
+            m_criticalFlows.push_back(key);
+        else
+            m_sharedFlows.push_back(key);
+    }
+
     m_queueMutex.Signal();
 
     return ProcessQueue();
@@ -355,8 +355,16 @@ PBoolean H46017Transport::HandleH46017Socket()
       if (!IsOpen())
           return false;
 
+      PBYTEArray rawData;
+      PBoolean readOK = ReadPDU(rawData);
+#ifdef H323_H46026
+      // Tunnelled media does not need the Q.931 and H.225 decoded
+      if (readOK && !closeTransport && m_h46026tunnel && m_socketMgr->SocketMediaIn(rawData, rawData.GetSize()))
+          continue;
+#endif
+
       H323SignalPDU rpdu;
-      if (!rpdu.Read(*this)) {
+      if (!readOK || !rpdu.ProcessReadData(*this, rawData)) {
             PTRACE(3, "H46017\tSocket Read Failure");
             if (GetErrorNumber(PChannel::LastReadError) == 0) {
               PTRACE(3, "H46017\tRemote SHUT DOWN or Intermediary Shutdown!");
@@ -650,7 +658,8 @@ void H46017Transport::SocketWrite(PThread &, H323_INT)
             packetLength = sz + 4;
             tpkt[2] = (BYTE)(packetLength >> 8);
             tpkt[3] = (BYTE)packetLength;
-            Write((const BYTE *)tpkt, packetLength);
+            if (Write((const BYTE *)tpkt, packetLength))
+                m_socketMgr->SocketWritten(packetLength);
         } else {
             PThread::Sleep(2);
         }
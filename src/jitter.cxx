@@ -44,6 +44,10 @@
 #include <ptclib/sockagg.h>
 #endif
 
+#ifdef H323_RTP_REACTOR
+#include "rtpreactor.h"
+#endif
+
 /*Number of consecutive attempts to add a packet to the jitter buffer while
   it is full before the system clears the jitter buffer and starts over
   again. */
@@ -61,6 +65,14 @@ jitter */
 jitter buffer target */
 #define DECREASE_JITTER_MIN_PACKETS 50
 
+#ifdef H323_RING_JITTER
+/* Set in RTP_RingJitterBuffer::newestInfo once a frame has been read */
+#define RING_NEWEST_VALID   ((PUInt64)1 << 48)
+
+/* RTP_RingJitterBuffer::playSequence until the first frame is played */
+#define RING_NOT_PLAYING    0x10000
+#endif
+
 
 
 #ifdef H323_JITTER_ANALYSER
@@ -145,6 +157,27 @@ class RTP_AggregatedHandle : public PAggregatedHandle
 };
 #endif
 
+#ifdef H323_RTP_REACTOR
+class RTP_JitterReactorHandle : public RTP_ReactorHandle
+{
+  PCLASSINFO(RTP_JitterReactorHandle, RTP_ReactorHandle);
+  public:
+    RTP_JitterReactorHandle(RTP_JitterBuffer & _jitterBuffer)
+      : RTP_ReactorHandle(_jitterBuffer.session),
+        jitterBuffer(_jitterBuffer)
+    { }
+
+    PBoolean OnDataReady()
+    { return jitterBuffer.OnReactorData(); }
+
+    void OnRemoved()
+    { jitterBuffer.shuttingDown = TRUE; }
+
+  protected:
+    RTP_JitterBuffer & jitterBuffer;
+};
+#endif
+
 #define new PNEW
 
 /////////////////////////////////////////////////////////////////////////////
@@ -218,27 +251,17 @@ RTP_JitterBuffer::RTP_JitterBuffer(RTP_Session & sess,
 #ifdef H323_RTP_AGGREGATE
   aggregratedHandle = NULL;
 #endif
+
+#ifdef H323_RTP_REACTOR
+  reactorHandle = NULL;
+  reactorMarkerWarning = FALSE;
+#endif
 }
 
 
 RTP_JitterBuffer::~RTP_JitterBuffer()
 {
-  shuttingDown = TRUE;
-
-#ifdef H323_RTP_AGGREGATE
-  if (jitterThread == NULL) {
-    aggregratedHandle->Remove();
-    delete aggregratedHandle;  
-    aggregratedHandle = NULL;
-  } else 
-#endif
-  {
-    PTRACE(3, "RTP\tRemoving jitter buffer " << this << ' ' << jitterThread->GetThreadName());
-    //PAssert(jitterThread->WaitForTermination(10000), "Jitter buffer thread did not terminate");
-	jitterThread->WaitForTermination(3000);
-    delete jitterThread;
-    jitterThread = NULL;
-  }
+  StopReading();
 
   bufferMutex.Wait();
 
@@ -268,6 +291,31 @@ RTP_JitterBuffer::~RTP_JitterBuffer()
 }
 
 
+void RTP_JitterBuffer::StopReading()
+{
+  shuttingDown = TRUE;
+
+#ifdef H323_RTP_REACTOR
+  DetachReactor();
+#endif
+
+#ifdef H323_RTP_AGGREGATE
+  if (aggregratedHandle != NULL) {
+    aggregratedHandle->Remove();
+    delete aggregratedHandle;  
+    aggregratedHandle = NULL;
+  } else 
+#endif
+  if (jitterThread != NULL) {
+    PTRACE(3, "RTP\tRemoving jitter buffer " << this << ' ' << jitterThread->GetThreadName());
+    //PAssert(jitterThread->WaitForTermination(10000), "Jitter buffer thread did not terminate");
+	jitterThread->WaitForTermination(3000);
+    delete jitterThread;
+    jitterThread = NULL;
+  }
+}
+
+
 void RTP_JitterBuffer::SetDelay(unsigned minJitterDelay, unsigned maxJitterDelay)
 {
   if (shuttingDown && jitterThread != NULL) {
@@ -286,31 +334,49 @@ void RTP_JitterBuffer::SetDelay(unsigned minJitterDelay, unsigned maxJitterDelay
     Entry * frame = new Entry;
     frame->prev = NULL;
     frame->next = freeFrames;
-    freeFrames->prev = frame;
+    if (freeFrames != NULL)
+      freeFrames->prev = frame;
     freeFrames = frame;
     bufferSize++;
   }
 
-  if (jitterThread != NULL) {
-    if (jitterThread->IsTerminated()) {
-      packetsTooLate = 0;
-      bufferOverruns = 0;
-      consecutiveBufferOverruns = 0;
-      consecutiveMarkerBits = 0;
-      consecutiveEarlyPacketStartTime = 0;
+  PBoolean restart = jitterThread != NULL && jitterThread->IsTerminated();
+#ifdef H323_RTP_REACTOR
+  // The reactor has dropped the handle after the session was closed
+  PBoolean restartReactor = reactorHandle != NULL && shuttingDown;
+  restart = restart || restartReactor;
+#endif
 
-      shuttingDown = FALSE;
-      preBuffering = TRUE;
+  if (restart) {
+    packetsTooLate = 0;
+    bufferOverruns = 0;
+    consecutiveBufferOverruns = 0;
+    consecutiveMarkerBits = 0;
+    consecutiveEarlyPacketStartTime = 0;
 
-      PTRACE(2, "RTP\tJitter buffer restarted:"
-                " size=" << bufferSize <<
-                " delay=" << minJitterTime << '-' << maxJitterTime << '/' << currentJitterTime <<
-                " (" << (currentJitterTime/8) << "ms)");
+    shuttingDown = FALSE;
+    preBuffering = TRUE;
+
+    PTRACE(2, "RTP\tJitter buffer restarted:"
+              " size=" << bufferSize <<
+              " delay=" << minJitterTime << '-' << maxJitterTime << '/' << currentJitterTime <<
+              " (" << (currentJitterTime/8) << "ms)");
+    if (jitterThread != NULL)
       jitterThread->Restart();
-    }
   }
 
   bufferMutex.Signal();
+
+#ifdef H323_RTP_REACTOR
+  // Done outside bufferMutex, the reactor threads take it while dispatching
+  if (restartReactor) {
+    reactorMarkerWarning = FALSE;
+    if (!session.GetReactor()->AddHandle(reactorHandle)) {
+      PTRACE(1, "RTP\tJitter buffer could not be restarted on reactor");
+      shuttingDown = TRUE;
+    }
+  }
+#endif
 }
 
 void RTP_JitterBuffer::Resume(
@@ -328,6 +394,21 @@ void RTP_JitterBuffer::Resume(
   }
 #endif
 
+#ifdef H323_RTP_REACTOR
+  // if there is an endpoint reactor, let it read the sockets instead of a thread
+  if (reactorHandle == NULL && session.GetReactor() != NULL && session.IsReactorCapable()) {
+    reactorHandle = new RTP_JitterReactorHandle(*this);
+    reactorMarkerWarning = FALSE;
+    if (session.GetReactor()->AddHandle(reactorHandle)) {
+      PTRACE(3, "RTP\tJitter buffer " << this << " reading from reactor");
+      return;
+    }
+    PTRACE(2, "RTP\tJitter buffer could not use reactor, starting thread");
+    delete reactorHandle;
+    reactorHandle = NULL;
+  }
+#endif
+
   if (!jitterThread)
     jitterThread = PThread::Create(PCREATE_NOTIFIER(JitterThreadMain), 0, PThread::NoAutoDeleteThread, PThread::HighestPriority, "RTP Jitter:%x",  jitterStackSize);
   else
@@ -427,6 +508,13 @@ PBoolean RTP_JitterBuffer::OnRead(RTP_JitterBuffer::Entry * & currentReadFrame,
     return FALSE;
   }
 
+  QueueReadFrame(currentReadFrame, markerWarning);
+  return TRUE;
+}
+
+
+void RTP_JitterBuffer::PrepareReadFrame(Entry * currentReadFrame, PBoolean & markerWarning)
+{
   currentReadFrame->tick = PTimer::Tick();
 
   if (consecutiveMarkerBits < maxConsecutiveMarkerBits) {
@@ -450,6 +538,13 @@ PBoolean RTP_JitterBuffer::OnRead(RTP_JitterBuffer::Entry * & currentReadFrame,
 #ifdef H323_JITTER_ANALYSER
   analyser->In(currentReadFrame->GetTimestamp(), currentDepth, preBuffering ? "PreBuf" : "");
 #endif
+}
+
+
+// Note: returns with bufferMutex locked, as OnRead() always has
+void RTP_JitterBuffer::QueueReadFrame(Entry * currentReadFrame, PBoolean & markerWarning)
+{
+  PrepareReadFrame(currentReadFrame, markerWarning);
 
   // Queue the frame for playing by the thread at other end of jitter buffer
   bufferMutex.Wait();
@@ -486,10 +581,135 @@ PBoolean RTP_JitterBuffer::OnRead(RTP_JitterBuffer::Entry * & currentReadFrame,
   }
 
   currentDepth++;
+}
+
+
+#ifdef H323_RTP_REACTOR
+PBoolean RTP_JitterBuffer::OnReactorData()
+{
+  // A batched read may leave more packets than the one the reactor saw
+  do {
+    if (shuttingDown)
+      return FALSE;
+
+    Entry * currentReadFrame;
+    bufferMutex.Wait();
+    PreRead(currentReadFrame, reactorMarkerWarning);  // Releases bufferMutex
+
+    RTP_Session::SendReceiveStatus status = session.ReadReadyData(*currentReadFrame);
+    if (status == RTP_Session::e_ProcessPacket) {
+      QueueReadFrame(currentReadFrame, reactorMarkerWarning);
+      bufferMutex.Signal();
+      continue;
+    }
+
+    // Nothing to queue, put the frame back into the free list
+    bufferMutex.Wait();
+    currentReadFrame->next = freeFrames;
+    if (freeFrames != NULL)
+      freeFrames->prev = currentReadFrame;
+    freeFrames = currentReadFrame;
+    bufferMutex.Signal();
+
+    if (status == RTP_Session::e_AbortTransport) {
+      shuttingDown = TRUE; // Flag to stop the reading side thread
+      PTRACE(3, "RTP\tJitter RTP reactor read ended");
+      return FALSE;
+    }
+  } while (session.HasReadyData());
 
   return TRUE;
 }
 
+
+void RTP_JitterBuffer::DetachReactor()
+{
+  if (reactorHandle == NULL)
+    return;
+
+  session.GetReactor()->RemoveHandle(reactorHandle);
+  delete reactorHandle;
+  reactorHandle = NULL;
+}
+#endif
+
+
+void RTP_JitterBuffer::AnalyseWriteFrame()
+{
+  // Calculate the jitter contribution of this frame
+  // - don't count if start of a talk burst
+  if (currentWriteFrame->GetMarker()) {
+    lastWriteTimestamp = 0;
+    lastWriteTick = 0;
+  }
+
+  if (lastWriteTimestamp != 0 && lastWriteTick !=0) {
+    int thisJitter = 0;
+
+    if (currentWriteFrame->GetTimestamp() < lastWriteTimestamp) {
+      //Not too sure how to handle this situation...
+      thisJitter = 0;
+    }
+    else if (currentWriteFrame->tick < lastWriteTick) {
+      //Not too sure how to handle this situation either!
+      thisJitter = 0;
+    }
+    else {  
+      thisJitter = (currentWriteFrame->tick -
+                   lastWriteTick).GetInterval()*8 +
+                   lastWriteTimestamp -
+                   currentWriteFrame->GetTimestamp();
+    }
+
+    if (thisJitter < 0) thisJitter *=(-1);
+    thisJitter *=2; //currentJitterTime needs to be at least TWICE the maximum jitter
+
+    if (thisJitter > (int) currentJitterTime * LOWER_JITTER_MAX_PCNT / 100) {
+      targetJitterTime = currentJitterTime;
+      PTRACE(3, "RTP\tJitter buffer target realigned to current jitter buffer");
+      consecutiveEarlyPacketStartTime = PTimer::Tick();
+      jitterCalcPacketCount = 0;
+      jitterCalc = 0;
+    }
+    else {
+      if (thisJitter > (int) jitterCalc)
+        jitterCalc = thisJitter;
+      jitterCalcPacketCount++;
+
+      //If it's bigger than the target we're currently trying to set, adapt that target.
+      //Note: this will never make targetJitterTime larger than currentJitterTime due to
+      //previous if condition
+      if (thisJitter > (int) targetJitterTime * LOWER_JITTER_MAX_PCNT / 100) {
+        targetJitterTime = thisJitter * 100 / LOWER_JITTER_MAX_PCNT;
+        PTRACE(3, "RTP\tJitter buffer target size increased to "
+                   << targetJitterTime << " (" << (targetJitterTime/8) << "ms)");
+      }
+
+    }
+  }
+
+  lastWriteTimestamp = currentWriteFrame->GetTimestamp();
+  lastWriteTick = currentWriteFrame->tick;
+}
+
+
+void RTP_JitterBuffer::CheckTargetJitter()
+{
+  if ((PTimer::Tick() - consecutiveEarlyPacketStartTime).GetInterval() > DECREASE_JITTER_PERIOD &&
+       jitterCalcPacketCount >= DECREASE_JITTER_MIN_PACKETS){
+    jitterCalc = jitterCalc * 100 / LOWER_JITTER_MAX_PCNT;
+    if (jitterCalc < targetJitterTime / 2) jitterCalc = targetJitterTime / 2;
+    if (jitterCalc < minJitterTime) jitterCalc = minJitterTime;
+    targetJitterTime = jitterCalc;
+    PTRACE(3, "RTP\tJitter buffer target size decreased to "
+               << targetJitterTime << " (" << (targetJitterTime/8) << "ms)");
+    jitterCalc = 0;
+    jitterCalcPacketCount = 0;
+    consecutiveEarlyPacketStartTime = PTimer::Tick();
+  }
+}
+
+
 void RTP_JitterBuffer::ResetFirstWrite()
 {
 	doneFirstWrite = FALSE;
@@ -619,60 +839,7 @@ PBoolean RTP_JitterBuffer::ReadData(DWORD timestamp, RTP_DataFrame & frame)
   oldestFrame = currentWriteFrame->next;
   currentWriteFrame->next = NULL;
  
-  // Calculate the jitter contribution of this frame
-  // - don't count if start of a talk burst
-  if (currentWriteFrame->GetMarker()) {
-    lastWriteTimestamp = 0;
-    lastWriteTick = 0;
-  }
-
-  if (lastWriteTimestamp != 0 && lastWriteTick !=0) {
-    int thisJitter = 0;
-
-    if (currentWriteFrame->GetTimestamp() < lastWriteTimestamp) {
-      //Not too sure how to handle this situation...
-      thisJitter = 0;
-    }
-    else if (currentWriteFrame->tick < lastWriteTick) {
-      //Not too sure how to handle this situation either!
-      thisJitter = 0;
-    }
-    else {  
-      thisJitter = (currentWriteFrame->tick -
-                   lastWriteTick).GetInterval()*8 +
-                   lastWriteTimestamp -
-                   currentWriteFrame->GetTimestamp();
-    }
-
-    if (thisJitter < 0) thisJitter *=(-1);
-    thisJitter *=2; //currentJitterTime needs to be at least TWICE the maximum jitter
-
-    if (thisJitter > (int) currentJitterTime * LOWER_JITTER_MAX_PCNT / 100) {
-      targetJitterTime = currentJitterTime;
-      PTRACE(3, "RTP\tJitter buffer target realigned to current jitter buffer");
-      consecutiveEarlyPacketStartTime = PTimer::Tick();
-      jitterCalcPacketCount = 0;
-      jitterCalc = 0;
-    }
-    else {
-      if (thisJitter > (int) jitterCalc)
-        jitterCalc = thisJitter;
-      jitterCalcPacketCount++;
-
-      //If it's bigger than the target we're currently trying to set, adapt that target.
-      //Note: this will never make targetJitterTime larger than currentJitterTime due to
-      //previous if condition
-      if (thisJitter > (int) targetJitterTime * LOWER_JITTER_MAX_PCNT / 100) {
-        targetJitterTime = thisJitter * 100 / LOWER_JITTER_MAX_PCNT;
-        PTRACE(3, "RTP\tJitter buffer target size increased to "
-                   << targetJitterTime << " (" << (targetJitterTime/8) << "ms)");
-      }
-
-    }
-  }
-
-  lastWriteTimestamp = currentWriteFrame->GetTimestamp();
-  lastWriteTick = currentWriteFrame->tick;
+  AnalyseWriteFrame();
 
 
   if (oldestFrame == NULL)
@@ -759,18 +926,7 @@ PBoolean RTP_JitterBuffer::ReadData(DWORD timestamp, RTP_DataFrame & frame)
     }
   }
 
-  if ((PTimer::Tick() - consecutiveEarlyPacketStartTime).GetInterval() > DECREASE_JITTER_PERIOD &&
-       jitterCalcPacketCount >= DECREASE_JITTER_MIN_PACKETS){
-    jitterCalc = jitterCalc * 100 / LOWER_JITTER_MAX_PCNT;
-    if (jitterCalc < targetJitterTime / 2) jitterCalc = targetJitterTime / 2;
-    if (jitterCalc < minJitterTime) jitterCalc = minJitterTime;
-    targetJitterTime = jitterCalc;
-    PTRACE(3, "RTP\tJitter buffer target size decreased to "
-               << targetJitterTime << " (" << (targetJitterTime/8) << "ms)");
-    jitterCalc = 0;
-    jitterCalcPacketCount = 0;
-    consecutiveEarlyPacketStartTime = PTimer::Tick();
-  }
+  CheckTargetJitter();
 
   /* If using immediate jitter reduction (rather than waiting for silence opportunities)
   then trash oldest frames as necessary to reduce the size of the jitter buffer */
@@ -816,6 +972,521 @@ PBoolean RTP_JitterBuffer::ReadData(DWORD timestamp, RTP_DataFrame & frame)
 
 /////////////////////////////////////////////////////////////////////////////////
 
+#ifdef H323_RING_JITTER
+
+RTP_RingJitterBuffer::RTP_RingJitterBuffer(RTP_Session & sess,
+                                           unsigned minJitterDelay,
+                                           unsigned maxJitterDelay,
+                                           PINDEX stackSize)
+  : RTP_JitterBuffer(sess, minJitterDelay, maxJitterDelay, stackSize),
+    freeHead(0), freeTail(0), newestInfo(0), playSequence(RING_NOT_PLAYING),
+    resyncRequested(false), spareFrame(NULL), headFrame(NULL)
+{
+  // The ring is indexed by the low bits of the sequence number, it must be
+  // less than half the sequence number space for the wrap around compares.
+  ringSize = 16;
+  while (ringSize < bufferSize && ringSize < 0x4000)
+    ringSize <<= 1;
+  ringMask = ringSize-1;
+
+  ring = new std::atomic<Entry *>[ringSize];
+  for (PINDEX i = 0; i < ringSize; i++)
+    ring[i].store(NULL);
+
+  // A full ring plus the frames being read, played and discarded
+  PINDEX frameCount = ringSize+3;
+  freeSize = ringSize*2;
+  freeQueue = new Entry *[freeSize];
+
+  // Take over the frames allocated by RTP_JitterBuffer, adding what is missing
+  for (PINDEX i = 0; i < frameCount; i++) {
+    Entry * frame = freeFrames;
+    if (frame != NULL)
+      freeFrames = frame->next;
+    else
+      frame = new Entry;
+    freeQueue[i] = frame;
+  }
+  if (freeFrames != NULL)
+    freeFrames->prev = NULL;
+  freeTail.store(frameCount);
+
+  PTRACE(3, "RTP\tJitter buffer ring created: size=" << ringSize << " obj=" << this);
+}
+
+
+RTP_RingJitterBuffer::~RTP_RingJitterBuffer()
+{
+  // The reading side must be finished before its frames are taken away
+  StopReading();
+
+  for (PINDEX i = 0; i < ringSize; i++)
+    delete ring[i].exchange(NULL);
+  delete [] ring;
+
+  for (unsigned i = freeHead; i != freeTail; i++)
+    delete freeQueue[i & (freeSize-1)];
+  delete [] freeQueue;
+
+  delete spareFrame;
+  delete headFrame;
+}
+
+
+void RTP_RingJitterBuffer::SetDelay(unsigned minJitterDelay, unsigned maxJitterDelay)
+{
+  RTP_JitterBuffer::SetDelay(minJitterDelay, maxJitterDelay);
+
+  PTRACE_IF(2, bufferSize > ringSize,
+            "RTP\tJitter buffer ring of " << ringSize << " frames is smaller than delay of " << maxJitterTime);
+}
+
+
+PBoolean RTP_RingJitterBuffer::Init(Entry * & currentReadFrame, PBoolean & markerWarning)
+{
+  currentReadFrame = NULL;
+  markerWarning = FALSE;
+  return TRUE;
+}
+
+
+void RTP_RingJitterBuffer::DeInit(Entry * & currentReadFrame, PBoolean & /*markerWarning*/)
+{
+  // Keep the frame for a restart, or for the destructor to delete
+  if (spareFrame == NULL)
+    spareFrame = currentReadFrame;
+  else
+    delete currentReadFrame;
+  currentReadFrame = NULL;
+}
+
+
+PBoolean RTP_RingJitterBuffer::PreRead(Entry * & currentReadFrame, PBoolean & /*markerWarning*/)
+{
+  // The frame swapped out of the ring by the previous read is reused
+  if (currentReadFrame == NULL)
+    currentReadFrame = TakeFreeFrame();
+  return TRUE;
+}
+
+
+PBoolean RTP_RingJitterBuffer::OnRead(Entry * & currentReadFrame, PBoolean & markerWarning, PBoolean loop)
+{
+  // Keep reading from the RTP transport frames
+  if (!session.ReadData(*currentReadFrame, loop)) {
+    shuttingDown = TRUE; // Flag to stop the reading side thread
+    PTRACE(3, "RTP\tJitter RTP receive thread ended");
+    return FALSE;
+  }
+
+  PublishFrame(currentReadFrame, markerWarning);
+  return TRUE;
+}
+
+
+#ifdef H323_RTP_REACTOR
+PBoolean RTP_RingJitterBuffer::OnReactorData()
+{
+  // A batched read may leave more packets than the one the reactor saw
+  do {
+    if (shuttingDown)
+      return FALSE;
+
+    Entry * currentReadFrame = TakeFreeFrame();
+    RTP_Session::SendReceiveStatus status = session.ReadReadyData(*currentReadFrame);
+    if (status == RTP_Session::e_ProcessPacket)
+      PublishFrame(currentReadFrame, reactorMarkerWarning);
+    spareFrame = currentReadFrame;
+
+    if (status == RTP_Session::e_AbortTransport) {
+      shuttingDown = TRUE; // Flag to stop the reading side thread
+      PTRACE(3, "RTP\tJitter RTP reactor read ended");
+      return FALSE;
+    }
+  } while (session.HasReadyData());
+
+  return TRUE;
+}
+#endif
+
+
+RTP_JitterBuffer::Entry * RTP_RingJitterBuffer::TakeFreeFrame()
+{
+  Entry * frame = spareFrame;
+  if (frame != NULL) {
+    spareFrame = NULL;
+    return frame;
+  }
+
+  unsigned head = freeHead.load(std::memory_order_relaxed);
+  if (head != freeTail.load(std::memory_order_acquire)) {
+    frame = freeQueue[head & (freeSize-1)];
+    freeHead.store(head+1, std::memory_order_release);
+    return frame;
+  }
+
+  // Cannot happen with the frames allocated in the constructor
+  PTRACE(2, "RTP\tJitter buffer ring has no free frames");
+  return new Entry;
+}
+
+
+// Note: the reading side continues with the frame that was in the slot
+void RTP_RingJitterBuffer::PublishFrame(Entry * & currentReadFrame, PBoolean & markerWarning)
+{
+  PrepareReadFrame(currentReadFrame, markerWarning);
+
+  WORD sequence = currentReadFrame->GetSequenceNumber();
+  PBoolean restarted = FALSE;
+
+  unsigned playing = playSequence.load(std::memory_order_acquire);
+  if (playing < RING_NOT_PLAYING) {
+    short offset = (short)(sequence - (WORD)playing);
+    if (offset < 0) {
+      if (offset > -(short)ringSize) {
+        // Its turn has passed already, read the next one into this frame
+        packetsTooLate++;
+        return;
+      }
+
+      PTRACE(3, "RTP\tJitter buffer sequence number jumped from " << playing << " to " << sequence);
+      resyncRequested = true;
+      restarted = TRUE;
+    }
+  }
+
+  // Update the newest frame before the frame can be seen in the ring
+  PUInt64 newest = newestInfo.load(std::memory_order_relaxed);
+  if (restarted || newest == 0 || (short)(sequence - (WORD)(newest >> 32)) > 0)
+    newestInfo.store(RING_NEWEST_VALID | ((PUInt64)sequence << 32) | currentReadFrame->GetTimestamp(),
+                     std::memory_order_release);
+
+  Entry * previous = ring[sequence & ringMask].exchange(currentReadFrame, std::memory_order_acq_rel);
+  currentReadFrame = previous;
+
+  if (previous == NULL) {
+    PTRACE_IF(2, consecutiveBufferOverruns > 1,
+              "RTP\tJitter buffer full, threw away "
+              << consecutiveBufferOverruns << " oldest frames");
+    consecutiveBufferOverruns = 0;
+    return;
+  }
+
+  // Duplicate packet replaced the original
+  if (previous->GetSequenceNumber() == sequence)
+    return;
+
+  playing = playSequence.load(std::memory_order_acquire);
+  if (playing < RING_NOT_PLAYING && (short)(previous->GetSequenceNumber() - (WORD)playing) < 0) {
+    packetsTooLate++;
+    return;
+  }
+
+  // The ring has wrapped onto a frame not played yet
+  bufferOverruns++;
+  consecutiveBufferOverruns++;
+  if (consecutiveBufferOverruns > MAX_BUFFER_OVERRUNS) {
+    resyncRequested = true;
+    consecutiveBufferOverruns = 0;
+  }
+  else {
+    PTRACE_IF(2, consecutiveBufferOverruns == 1,
+              "RTP\tJitter buffer full, throwing away oldest frame ("
+              << previous->GetTimestamp() << ')');
+  }
+}
+
+
+RTP_JitterBuffer::Entry * RTP_RingJitterBuffer::TakeSlot(WORD sequence)
+{
+  std::atomic<Entry *> & slot = ring[sequence & ringMask];
+  if (slot.load(std::memory_order_relaxed) == NULL)
+    return NULL;
+
+  Entry * frame = slot.exchange(NULL, std::memory_order_acq_rel);
+  if (frame == NULL)
+    return NULL;
+
+  short offset = (short)(frame->GetSequenceNumber() - sequence);
+  if (offset == 0)
+    return frame;
+
+  if (offset < 0)
+    ReleaseFrame(frame);  // Left over from a previous lap of the ring
+  else
+    ReturnSlot(frame);    // Belongs to a later lap, so the wanted one is lost
+  return NULL;
+}
+
+
+void RTP_RingJitterBuffer::ReturnSlot(Entry * frame)
+{
+  // If the reading side has filled the slot since, the newer frame wins
+  Entry * expected = NULL;
+  if (!ring[frame->GetSequenceNumber() & ringMask].compare_exchange_strong(expected, frame, std::memory_order_acq_rel))
+    ReleaseFrame(frame);
+}
+
+
+void RTP_RingJitterBuffer::ReleaseFrame(Entry * frame)
+{
+  unsigned tail = freeTail.load(std::memory_order_relaxed);
+  if (tail - freeHead.load(std::memory_order_acquire) >= (unsigned)freeSize) {
+    delete frame;  // Only frames allocated by TakeFreeFrame() can overflow
+    return;
+  }
+
+  freeQueue[tail & (freeSize-1)] = frame;
+  freeTail.store(tail+1, std::memory_order_release);
+}
+
+
+PBoolean RTP_RingJitterBuffer::FindOldest(DWORD & newestTimestamp)
+{
+  PUInt64 newest = newestInfo.load(std::memory_order_acquire);
+  if (newest == 0) {
+    currentDepth = 0;
+    return FALSE;
+  }
+
+  WORD newestSequence = (WORD)(newest >> 32);
+  newestTimestamp = (DWORD)newest;
+
+  // Look from the next frame to be played, but no further back than the ring
+  WORD sequence = (WORD)(newestSequence - ringSize + 1);
+  unsigned playing = playSequence.load(std::memory_order_relaxed);
+  if (playing < RING_NOT_PLAYING && (short)(sequence - (WORD)playing) < 0)
+    sequence = (WORD)playing;
+
+  // A frame older than the one already held may have arrived out of order
+  WORD last = headFrame != NULL ? headFrame->GetSequenceNumber() : (WORD)(newestSequence + 1);
+  while ((short)(last - sequence) > 0) {
+    Entry * frame = TakeSlot(sequence);
+    if (frame != NULL) {
+      if (headFrame != NULL)
+        ReturnSlot(headFrame);
+      headFrame = frame;
+      break;
+    }
+    sequence++;
+  }
+
+  if (headFrame == NULL) {
+    currentDepth = 0;
+    return FALSE;
+  }
+
+  if ((int)(newestTimestamp - headFrame->GetTimestamp()) < 0)
+    newestTimestamp = headFrame->GetTimestamp();
+  currentDepth = (WORD)(newestSequence - headFrame->GetSequenceNumber()) + 1;
+  return TRUE;
+}
+
+
+PBoolean RTP_RingJitterBuffer::NextWriteFrame(DWORD & newestTimestamp)
+{
+  //Throw away the frame being written and move up the oldest one
+  ReleaseFrame(currentWriteFrame);
+  currentWriteFrame = headFrame;
+  headFrame = NULL;
+  playSequence.store((WORD)(currentWriteFrame->GetSequenceNumber()+1), std::memory_order_release);
+
+  return FindOldest(newestTimestamp);
+}
+
+
+void RTP_RingJitterBuffer::Flush()
+{
+  for (PINDEX i = 0; i < ringSize; i++) {
+    Entry * frame = ring[i].exchange(NULL, std::memory_order_acq_rel);
+    if (frame != NULL)
+      ReleaseFrame(frame);
+  }
+
+  if (headFrame != NULL) {
+    ReleaseFrame(headFrame);
+    headFrame = NULL;
+  }
+
+  playSequence.store(RING_NOT_PLAYING, std::memory_order_release);
+  preBuffering = TRUE;
+}
+
+
+PBoolean RTP_RingJitterBuffer::ReadData(DWORD timestamp, RTP_DataFrame & frame)
+{
+  if (shuttingDown)
+    return FALSE;
+
+  // Give the frame just written to codec back to the reading side
+  if (currentWriteFrame != NULL) {
+    ReleaseFrame(currentWriteFrame);
+    currentWriteFrame = NULL;
+  }
+
+  // Default response is an empty frame, ie silence
+  frame.SetPayloadSize(0);
+
+  if (resyncRequested.exchange(false)) {
+    PTRACE(2, "RTP\tJitter buffer continuously full, throwing away entire buffer.");
+    Flush();
+  }
+
+  DWORD newestTimestamp;
+  if (!FindOldest(newestTimestamp)) {
+    /*No data to play! We ran the buffer down to empty, restart buffer by
+      setting flag that will fill it again before returning any data.
+     */
+    preBuffering = TRUE;
+    currentJitterTime = targetJitterTime;
+
+#ifdef H323_JITTER_ANALYSER
+    analyser->Out(0, currentDepth, "Empty");
+#endif
+    return TRUE;
+  }
+
+  DWORD oldestTimestamp = headFrame->GetTimestamp();
+
+  /* If there is an opportunity (due to silence in the buffer) to implement a desired 
+  reduction in the size of the jitter buffer, effect it */
+
+  if (targetJitterTime < currentJitterTime &&
+      (newestTimestamp - oldestTimestamp) < currentJitterTime) {
+    currentJitterTime = ( targetJitterTime > (newestTimestamp - oldestTimestamp)) ?
+                          targetJitterTime : (newestTimestamp - oldestTimestamp);
+
+    PTRACE(3, "RTP\tJitter buffer size decreased to "
+           << currentJitterTime << " (" << (currentJitterTime/8) << "ms)");
+  }
+
+  if (preBuffering) {
+    // Reset jitter baseline
+    lastWriteTimestamp = 0;
+    lastWriteTick = 0;
+
+    // If oldest frame has not been in the buffer long enough, don't return anything yet
+    if ((PTimer::Tick() - headFrame->tick).GetInterval() * 8
+         < currentJitterTime / 2) {
+#ifdef H323_JITTER_ANALYSER
+      analyser->Out(oldestTimestamp, currentDepth, "PreBuf");
+#endif
+      return TRUE;
+    }
+
+    preBuffering = FALSE;
+  }
+
+  //Handle short silence bursts in the middle of the buffer
+  // - if we think we're getting marker bit information, use that
+  PBoolean shortSilence = FALSE;
+  if (consecutiveMarkerBits < maxConsecutiveMarkerBits) {
+      if (headFrame->GetMarker() &&
+          (PTimer::Tick() - headFrame->tick).GetInterval()* 8 < currentJitterTime / 2)
+        shortSilence = TRUE;
+  }
+  else if (timestamp < oldestTimestamp && timestamp > (newestTimestamp - currentJitterTime))
+    shortSilence = TRUE;
+
+  if (shortSilence) {
+    // It is not yet time for something in the buffer
+#ifdef H323_JITTER_ANALYSER
+    analyser->Out(oldestTimestamp, currentDepth, "Wait");
+#endif
+    lastWriteTimestamp = 0;
+    lastWriteTick = 0;
+    return TRUE;
+  }
+
+  // Take the oldest frame from the ring, put into parking space
+  currentDepth--;
+#ifdef H323_JITTER_ANALYSER
+  analyser->Out(oldestTimestamp, currentDepth, timestamp >= oldestTimestamp ? "" : "Late");
+#endif
+  currentWriteFrame = headFrame;
+  headFrame = NULL;
+  playSequence.store((WORD)(currentWriteFrame->GetSequenceNumber()+1), std::memory_order_release);
+
+  AnalyseWriteFrame();
+
+  if (FindOldest(newestTimestamp)) {
+    // If exceeded current jitter buffer time delay:
+    if ((newestTimestamp - currentWriteFrame->GetTimestamp()) > currentJitterTime) {
+      PTRACE(4, "RTP\tJitter buffer length exceeded");
+      consecutiveEarlyPacketStartTime = PTimer::Tick();
+      jitterCalcPacketCount = 0;
+      jitterCalc = 0;
+      lastWriteTimestamp = 0;
+      lastWriteTick = 0;
+
+      // If we haven't yet written a frame, we get one free overrun
+      if (!doneFirstWrite) {
+        PTRACE(4, "RTP\tJitter buffer length exceed was prior to first write. Not increasing buffer size");
+        while ((newestTimestamp - currentWriteFrame->GetTimestamp()) > currentJitterTime) {
+          if (!NextWriteFrame(newestTimestamp))
+            break;
+        }
+
+        doneFirstWrite = TRUE;
+        frame = *currentWriteFrame;
+        return TRUE;
+      }
+
+      // See if exceeded maximum jitter buffer time delay, waste them if so
+      while ((newestTimestamp - currentWriteFrame->GetTimestamp()) > maxJitterTime) {
+        PTRACE(4, "RTP\tJitter buffer oldest packet ("
+               << headFrame->GetTimestamp() << " < "
+               << (newestTimestamp - maxJitterTime)
+               << ") too late, throwing away");
+
+        currentJitterTime = maxJitterTime;
+
+        if (!NextWriteFrame(newestTimestamp))
+          break;
+      }
+
+      // Now change the jitter time to cope with the new size
+      // unless already set to maxJitterTime
+      if (newestTimestamp - currentWriteFrame->GetTimestamp() > currentJitterTime) 
+        currentJitterTime = newestTimestamp - currentWriteFrame->GetTimestamp();
+
+      targetJitterTime = currentJitterTime;
+      PTRACE(3, "RTP\tJitter buffer size increased to "
+             << currentJitterTime << " (" << (currentJitterTime/8) << "ms)");
+    }
+  }
+
+  CheckTargetJitter();
+
+  /* If using immediate jitter reduction (rather than waiting for silence opportunities)
+  then trash oldest frames as necessary to reduce the size of the jitter buffer. The
+  newest frames cannot be taken back from the reading side. */
+  if (targetJitterTime < currentJitterTime &&
+      doJitterReductionImmediately &&
+      headFrame != NULL) {
+    while ((newestTimestamp - currentWriteFrame->GetTimestamp()) > targetJitterTime) {
+      // Reset jitter calculation baseline
+      lastWriteTimestamp = 0;
+      lastWriteTick = 0;
+
+      if (!NextWriteFrame(newestTimestamp))
+        break;
+    }
+
+    currentJitterTime = targetJitterTime;
+    PTRACE(3, "RTP\tJitter buffer size decreased to "
+        << currentJitterTime << " (" << (currentJitterTime/8) << "ms)");
+  }
+
+  doneFirstWrite = TRUE;
+  frame = *currentWriteFrame;
+  return TRUE;
+}
+
+#endif // H323_RING_JITTER
+
+/////////////////////////////////////////////////////////////////////////////////
+
 
 #ifdef H323_JITTER_ANALYSER
 
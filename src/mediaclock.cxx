@@ -0,0 +1,367 @@
+/*
+ * mediaclock.cxx
+ *
+ * Shared media clock for transmit channels
+ *
+ * H323Plus Library
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is H323Plus Library.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Id$
+ *
+ */
+
+#include <ptlib.h>
+
+#ifdef __GNUC__
+#pragma implementation "mediaclock.h"
+#endif
+
+#include "openh323buildopts.h"
+
+#include "mediaclock.h"
+
+#ifdef H323_MEDIA_CLOCK
+
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+
+/* Missed ticks run back to back before the oldest are skipped */
+#define CLOCK_MAX_CATCH_UP  3
+
+#define new PNEW
+
+static PInt64 MonotonicNow()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (PInt64)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+H323MediaClockHandle::H323MediaClockHandle(unsigned p)
+  : period(PMAX(p, 1000)),
+    id(0),
+    nextDeadline(0),
+    pendingTicks(0),
+    scheduled(FALSE),
+    stopped(FALSE),
+    removed(FALSE),
+    runningThread(NULL),
+    tickCount(0),
+    skippedTicks(0),
+    totalLateness(0),
+    maximumLateness(0)
+{
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+H323MediaClock::H323MediaClock(unsigned workerCount, PINDEX stackSize)
+  : timerFd(-1),
+    wakeFd(-1),
+    running(TRUE),
+    clockThread(NULL),
+    available(0, P_MAX_INDEX),
+    nextId(0)
+{
+  timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+  wakeFd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+  if (timerFd < 0 || wakeFd < 0) {
+    PTRACE(1, "MediaClock\tCould not create timer: " << strerror(errno));
+    return;
+  }
+
+  if (workerCount == 0)
+    workerCount = 1;
+
+  clockThread = PThread::Create(PCREATE_NOTIFIER(ClockMain), 0, PThread::NoAutoDeleteThread, PThread::HighestPriority, "Media Clock", stackSize);
+  for (unsigned i = 0; i < workerCount; i++)
+    workers.push_back(PThread::Create(PCREATE_NOTIFIER(WorkerMain), 0, PThread::NoAutoDeleteThread, PThread::HighPriority, "Media Worker:%x", stackSize));
+
+  PTRACE(3, "MediaClock\tCreated with " << workerCount << " worker threads");
+}
+
+
+H323MediaClock::~H323MediaClock()
+{
+  mutex.Wait();
+  running = FALSE;
+  mutex.Signal();
+
+  if (clockThread != NULL) {
+    Wake();
+    clockThread->WaitForTermination();
+    delete clockThread;
+    clockThread = NULL;
+  }
+
+  std::vector<PThread *>::iterator it;
+  for (it = workers.begin(); it != workers.end(); ++it)
+    available.Signal();
+  // With no handles left a worker only has to see running is FALSE
+  for (it = workers.begin(); it != workers.end(); ++it) {
+    (*it)->WaitForTermination();
+    delete *it;
+  }
+  workers.clear();
+
+  PTRACE_IF(2, !handles.empty(), "MediaClock\tDestroyed with " << handles.size() << " handles still attached");
+
+  if (wakeFd >= 0)
+    ::close(wakeFd);
+  if (timerFd >= 0)
+    ::close(timerFd);
+}
+
+
+void H323MediaClock::Wake()
+{
+  uint64_t one = 1;
+  if (::write(wakeFd, &one, sizeof(one)) < 0) {
+    PTRACE(2, "MediaClock\tWake up failed: " << strerror(errno));
+  }
+}
+
+
+PBoolean H323MediaClock::AddHandle(H323MediaClockHandle * handle)
+{
+  if (handle == NULL || clockThread == NULL)
+    return FALSE;
+
+  {
+    PWaitAndSignal m(mutex);
+
+    if (++nextId == 0)
+      ++nextId;
+    handle->id = nextId;
+    handle->nextDeadline = MonotonicNow() + (PInt64)handle->period*1000;
+
+    handles[handle->id] = handle;
+    schedule.insert(Schedule::value_type(handle->nextDeadline, handle->id));
+  }
+
+  // Timer may be set for a later deadline
+  Wake();
+
+  PTRACE(4, "MediaClock\tAdded id=" << handle->id << " period=" << handle->period << "us");
+  return TRUE;
+}
+
+
+PBoolean H323MediaClock::RemoveHandle(H323MediaClockHandle * handle)
+{
+  if (handle == NULL)
+    return FALSE;
+
+  mutex.Wait();
+
+  HandleMap::iterator it = handles.find(handle->id);
+  if (it == handles.end() || it->second != handle) {
+    mutex.Signal();
+    return FALSE;
+  }
+
+  // Any schedule entry is dropped when it falls due
+  handles.erase(it);
+  handle->removed = TRUE;
+
+  PBoolean wait = handle->runningThread != NULL && handle->runningThread != PThread::Current();
+  mutex.Signal();
+
+  // Let the worker finish the tick it is in
+  if (wait)
+    handle->finished.Wait();
+
+  PTRACE(4, "MediaClock\tRemoved id=" << handle->id << " ticks=" << handle->tickCount
+         << " skipped=" << handle->skippedTicks << " lateness avg=" << handle->GetAverageLateness()
+         << "us max=" << handle->maximumLateness << "us");
+  return TRUE;
+}
+
+
+PINDEX H323MediaClock::GetHandleCount() const
+{
+  PWaitAndSignal m(mutex);
+  return (PINDEX)handles.size();
+}
+
+
+void H323MediaClock::OnDeadline(H323MediaClockHandle & handle, PInt64 now)
+{
+  PInt64 period = (PInt64)handle.period*1000;
+
+  // Suspended or badly overloaded, move the schedule on rather than
+  // running a burst of ticks to catch up.
+  PInt64 behind = (now - handle.nextDeadline)/period;
+  if (behind > CLOCK_MAX_CATCH_UP) {
+    handle.skippedTicks += (DWORD)(behind - CLOCK_MAX_CATCH_UP);
+    handle.nextDeadline += (behind - CLOCK_MAX_CATCH_UP)*period;
+  }
+
+  while (handle.nextDeadline <= now) {
+    if (handle.pendingTicks < CLOCK_MAX_CATCH_UP)
+      handle.pendingTicks++;
+    else
+      handle.skippedTicks++;
+    handle.nextDeadline += period;
+  }
+
+  schedule.insert(Schedule::value_type(handle.nextDeadline, handle.id));
+
+  if (!handle.scheduled && handle.pendingTicks > 0) {
+    handle.scheduled = TRUE;
+    runQueue.push_back(handle.id);
+    available.Signal();
+  }
+}
+
+
+void H323MediaClock::ClockMain(PThread &, H323_INT)
+{
+  PTRACE(3, "MediaClock\tClock thread started");
+
+  for (;;) {
+    struct itimerspec timer;
+    memset(&timer, 0, sizeof(timer));
+
+    {
+      PWaitAndSignal m(mutex);
+      if (!running)
+        break;
+
+      PInt64 now = MonotonicNow();
+      while (!schedule.empty() && schedule.begin()->first <= now) {
+        unsigned id = schedule.begin()->second;
+        schedule.erase(schedule.begin());
+
+        HandleMap::iterator it = handles.find(id);
+        if (it != handles.end() && !it->second->stopped)
+          OnDeadline(*it->second, now);
+      }
+
+      if (!schedule.empty()) {
+        PInt64 deadline = schedule.begin()->first;
+        timer.it_value.tv_sec = (time_t)(deadline/1000000000);
+        timer.it_value.tv_nsec = (long)(deadline%1000000000);
+      }
+    }
+
+    // An absolute deadline, so the time spent above does not add up
+    if (timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &timer, NULL) < 0) {
+      PTRACE(1, "MediaClock\tCould not set timer: " << strerror(errno));
+      break;
+    }
+
+    struct pollfd fds[2];
+    fds[0].fd = timerFd;
+    fds[0].events = POLLIN;
+    fds[1].fd = wakeFd;
+    fds[1].events = POLLIN;
+    if (::poll(fds, 2, -1) < 0 && errno != EINTR) {
+      PTRACE(1, "MediaClock\tpoll failed: " << strerror(errno));
+      break;
+    }
+
+    uint64_t value;
+    while (::read(timerFd, &value, sizeof(value)) > 0)
+      ;
+    while (::read(wakeFd, &value, sizeof(value)) > 0)
+      ;
+  }
+
+  PTRACE(3, "MediaClock\tClock thread finished");
+}
+
+
+void H323MediaClock::WorkerMain(PThread &, H323_INT)
+{
+  PTRACE(3, "MediaClock\tWorker thread started");
+
+  for (;;) {
+    available.Wait();
+
+    H323MediaClockHandle * handle;
+    {
+      PWaitAndSignal m(mutex);
+      if (!running)
+        break;
+      if (runQueue.empty())
+        continue;
+
+      HandleMap::iterator it = handles.find(runQueue.front());
+      runQueue.pop_front();
+      if (it == handles.end())
+        continue;
+
+      handle = it->second;
+      handle->runningThread = PThread::Current();
+    }
+
+    RunHandle(*handle);
+  }
+
+  PTRACE(3, "MediaClock\tWorker thread finished");
+}
+
+
+void H323MediaClock::RunHandle(H323MediaClockHandle & handle)
+{
+  mutex.Wait();
+
+  while (handle.pendingTicks > 0 && !handle.stopped && !handle.removed) {
+    // Deadline of the oldest tick still to be run
+    PInt64 due = handle.nextDeadline - (PInt64)handle.pendingTicks*handle.period*1000;
+    handle.pendingTicks--;
+
+    PInt64 lateness = (MonotonicNow() - due)/1000;
+    if (lateness < 0)
+      lateness = 0;
+    handle.totalLateness += lateness;
+    if (lateness > handle.maximumLateness)
+      handle.maximumLateness = (unsigned)lateness;
+    handle.tickCount++;
+
+    mutex.Signal();
+    PBoolean ok = handle.OnTick();
+    mutex.Wait();
+
+    if (!ok && !handle.removed) {
+      handle.stopped = TRUE;
+      handle.pendingTicks = 0;
+
+      mutex.Signal();
+      handle.OnStopped();
+      mutex.Wait();
+    }
+  }
+
+  handle.runningThread = NULL;
+  handle.scheduled = FALSE;
+
+  if (handle.removed)
+    handle.finished.Signal();
+
+  mutex.Signal();
+}
+
+#endif // H323_MEDIA_CLOCK
+
+/////////////////////////////////////////////////////////////////////////////
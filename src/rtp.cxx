@@ -59,6 +59,12 @@
 #include <ptclib/sockagg.h>
 #endif
 
+#ifdef H323_RTP_BATCHIO
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <vector>
+#endif
+
 #define new PNEW
 
 
@@ -68,6 +74,9 @@ const unsigned SecondsFrom1900to1970 = (70*365+17)*24*60*60U;
 
 #define MIN_HEADER_SIZE 12
 
+/* Upper limit on the number of packets per batched read or write */
+#define MAX_BATCH_SIZE 64
+
 
 /////////////////////////////////////////////////////////////////////////////
 
@@ -531,6 +540,12 @@ RTP_Session::RTP_Session(
 #ifdef H323_RTP_AGGREGATE
     ,aggregator(NULL)
 #endif
+#ifdef H323_RTP_REACTOR
+    ,reactor(NULL)
+#endif
+#ifdef H323_RING_JITTER
+    ,ringJitterBuffer(FALSE)
+#endif
 {
   if (sessionID <= 0) {
       PTRACE(2,"RTP\tWARNING: Session ID <= 0 Invalid SessionID.");
@@ -635,6 +650,11 @@ void RTP_Session::SetJitterBufferSize(unsigned minJitterDelay,
   else {
     SetIgnoreOutOfOrderPackets(FALSE);
 #ifdef H323_AUDIO_CODECS
+#ifdef H323_RING_JITTER
+    if (ringJitterBuffer)
+      jitter = new RTP_RingJitterBuffer(*this, minJitterDelay, maxJitterDelay, stackSize);
+    else
+#endif
     jitter = new RTP_JitterBuffer(*this, minJitterDelay, maxJitterDelay, stackSize);
     jitter->Resume(
 #ifdef H323_RTP_AGGREGATE
@@ -1414,6 +1434,12 @@ RTP_UDP::RTP_UDP(
     dataSocket(NULL), controlSocket(NULL),
     appliedQOS(false), enableGQOS(false),
     remoteIsNAT(_remoteIsNAT), successiveWrongAddresses(0), mediaIsTunneled(_mediaTunneled)
+#ifdef H323_RTP_BATCHIO
+    , rxBatchSize(1), rxFrames(NULL), rxMessages(NULL), rxCount(0), rxNext(0),
+    rxBatchCalls(0), rxBatchPackets(0), rxBatchMaximum(0),
+    txBatchSize(1), txFrames(NULL), txMessages(NULL), txCount(0),
+    txBatchCalls(0), txBatchPackets(0), txBatchMaximum(0)
+#endif
 {
 
 }
@@ -1424,10 +1450,28 @@ RTP_UDP::~RTP_UDP()
   Close(TRUE);
   Close(FALSE);
 
+#ifdef H323_RTP_REACTOR
+  // The sockets must leave the reactor before they are closed
+  if (jitter != NULL)
+    jitter->DetachReactor();
+#endif
+
   delete dataSocket;
   dataSocket = NULL;
   delete controlSocket;
   controlSocket = NULL;
+
+#ifdef H323_RTP_BATCHIO
+  PTRACE_IF(3, rxBatchCalls != 0 || txBatchCalls != 0,
+            "RTP_UDP\tSession " << sessionID << " batch statistics:"
+            " rx=" << rxBatchPackets << '/' << rxBatchCalls << " max=" << rxBatchMaximum <<
+            " tx=" << txBatchPackets << '/' << txBatchCalls << " max=" << txBatchMaximum);
+
+  delete [] rxFrames;
+  delete rxMessages;
+  delete [] txFrames;
+  delete txMessages;
+#endif
 }
 
 
@@ -1583,6 +1627,10 @@ PBoolean RTP_UDP::Open(PIPSocket::Address _localAddress,
          << localAddress << ':' << localDataPort << '-' << localControlPort
          << " ssrc=" << syncSourceOut);
 
+#ifdef H323_RTP_BATCHIO
+  AllocateBatchBuffers();
+#endif
+
   return TRUE;
 }
 
@@ -1614,6 +1662,9 @@ void RTP_UDP::Close(PBoolean reading)
   }
   else {
     PTRACE(3, "RTP_UDP\tSession " << sessionID << ", Shutting down write.");
+#ifdef H323_RTP_BATCHIO
+    FlushData();
+#endif
     shutdownWrite = TRUE;
   }
 }
@@ -1684,6 +1735,12 @@ PBoolean RTP_UDP::ReadData(RTP_DataFrame & frame, PBoolean loop)
 #endif
     int selectStatus = 0;
 
+#ifdef H323_RTP_BATCHIO
+    // Data packets left over from the last batched read
+    if (rxNext < rxCount)
+      selectStatus = -1;
+    else
+#endif
     if (!PseudoRead(selectStatus))
        selectStatus = PSocket::Select(*dataSocket, *controlSocket, reportTimer);
 #ifdef H323_RTP_AGGREGATE
@@ -1743,97 +1800,172 @@ PBoolean RTP_UDP::ReadData(RTP_DataFrame & frame, PBoolean loop)
 }
 
 
+PBoolean RTP_UDP::UsesPlainSockets() const
+{
+  // Multiplexed and tunneled media do not arrive on our own sockets
+  if (mediaIsTunneled || dataSocket == NULL || controlSocket == NULL)
+    return FALSE;
+
+  return strcmp(dataSocket->GetClass(), H323UDPSocket::Class()) == 0 &&
+         strcmp(controlSocket->GetClass(), H323UDPSocket::Class()) == 0;
+}
+
+
+#ifdef H323_RTP_REACTOR
+PBoolean RTP_UDP::IsReactorCapable() const
+{
+  return UsesPlainSockets();
+}
+
+
+RTP_Session::SendReceiveStatus RTP_UDP::ReadReadyData(RTP_DataFrame & frame)
+{
+  if (shutdownRead) {
+    PTRACE(3, "RTP_UDP\tSession " << sessionID << ", Read shutdown.");
+    shutdownRead = FALSE;
+    return e_AbortTransport;
+  }
+
+  return ReadDataPDU(frame);
+}
+
+
+RTP_Session::SendReceiveStatus RTP_UDP::ReadReadyControl()
+{
+  if (shutdownRead) {
+    PTRACE(3, "RTP_UDP\tSession " << sessionID << ", Read shutdown.");
+    shutdownRead = FALSE;
+    return e_AbortTransport;
+  }
+
+  return ReadControlPDU();
+}
+
+
+PBoolean RTP_UDP::HasReadyData() const
+{
+#ifdef H323_RTP_BATCHIO
+  return rxNext < rxCount;
+#else
+  return FALSE;
+#endif
+}
+#endif
+
+
 RTP_Session::SendReceiveStatus RTP_UDP::ReadDataOrControlPDU(PUDPSocket & socket,
                                                              PBYTEArray & frame,
                                                              PBoolean fromDataChannel)
+{
+  PIPSocket::Address addr;
+  WORD port;
+
+  if (socket.ReadFrom(frame.GetPointer(), frame.GetSize(), addr, port))
+    return OnReadDataOrControlPDU(socket, frame, fromDataChannel, addr, port);
+
+  return OnReadError(socket.GetErrorNumber(), fromDataChannel, socket.GetErrorText(PChannel::LastReadError));
+}
+
+
+RTP_Session::SendReceiveStatus RTP_UDP::OnReadDataOrControlPDU(PUDPSocket & socket,
+                                                               PBYTEArray & frame,
+                                                               PBoolean fromDataChannel,
+                                                               const PIPSocket::Address & addr,
+                                                               WORD port)
 {
 #if PTRACING
   const char * channelName = fromDataChannel ? "Data" : "Control";
 #endif
-  PIPSocket::Address addr;
-  WORD port;
 
-  if (socket.ReadFrom(frame.GetPointer(), frame.GetSize(), addr, port)) {
-    if (!mediaIsTunneled && ignoreOtherSources) {
+  if (!mediaIsTunneled && ignoreOtherSources) {
 
-      // If remote address never set from higher levels, then try and figure
-      // it out from the first packet received.
-      if (remoteAddress.IsAny() || !remoteAddress.IsValid()) {
-        remoteAddress = addr;
-        PTRACE(4, "RTP\tSet remote address from first " << channelName
-               << " PDU from " << addr << ':' << port);
-      }
-      if (fromDataChannel) {
-        if (remoteDataPort == 0)
-          remoteDataPort = port;
-      }
-      else {
-        if (remoteControlPort == 0)
-          remoteControlPort = port;
-      }
+    // If remote address never set from higher levels, then try and figure
+    // it out from the first packet received.
+    if (remoteAddress.IsAny() || !remoteAddress.IsValid()) {
+      remoteAddress = addr;
+      PTRACE(4, "RTP\tSet remote address from first " << channelName
+             << " PDU from " << addr << ':' << port);
+    }
+    if (fromDataChannel) {
+      if (remoteDataPort == 0)
+        remoteDataPort = port;
+    }
+    else {
+      if (remoteControlPort == 0)
+        remoteControlPort = port;
+    }
 
-      if (remoteTransmitAddress.IsAny() || !remoteTransmitAddress.IsValid())
-             remoteTransmitAddress = addr;
+    if (remoteTransmitAddress.IsAny() || !remoteTransmitAddress.IsValid())
+           remoteTransmitAddress = addr;
 
-      else if (remoteTransmitAddress != addr) {
+    else if (remoteTransmitAddress != addr) {
 #ifdef H323_H46024A
 #if PTLIB_VER >= 2130
-          if (((H323UDPSocket&)socket).IsAlternateAddress(addr,port)) {
+        if (((H323UDPSocket&)socket).IsAlternateAddress(addr,port)) {
 #else
-          if (socket.IsAlternateAddress(addr,port)) {
+        if (socket.IsAlternateAddress(addr,port)) {
 #endif
-                remoteTransmitAddress = addr;
-                remoteAddress = addr;
-                appliedQOS = false;
-                if (fromDataChannel) {
-                    remoteDataPort = port;
-                    // Fixes to makes sure sync,stats and jitter don't get screwed up
-                    syncSourceIn = ((RTP_DataFrame &)frame).GetSyncSource();
-                    expectedSequenceNumber = ((RTP_DataFrame &)frame).GetSequenceNumber();
+              remoteTransmitAddress = addr;
+              remoteAddress = addr;
+              appliedQOS = false;
+              if (fromDataChannel) {
+                  remoteDataPort = port;
+                  // Fixes to makes sure sync,stats and jitter don't get screwed up
+                  syncSourceIn = ((RTP_DataFrame &)frame).GetSyncSource();
+                  expectedSequenceNumber = ((RTP_DataFrame &)frame).GetSequenceNumber();
 #ifdef H323_AUDIO_CODECS
-                    if (jitter != NULL)  jitter->ResetFirstWrite();
+                  if (jitter != NULL)  jitter->ResetFirstWrite();
 #endif
-                } else
-                    remoteControlPort = port;
-          } else
+              } else
+                  remoteControlPort = port;
+        } else
 #endif
-          {
-            successiveWrongAddresses++;
-            if (successiveWrongAddresses < 5) {
-                PTRACE(1, "RTP_UDP\tSession " << sessionID << ", "
-                       << channelName << " PDU from incorrect host, "
-                          " is " << addr << " should be " << remoteTransmitAddress);
-                return RTP_Session::e_IgnorePacket;
-            }
+        {
+          successiveWrongAddresses++;
+          if (successiveWrongAddresses < 5) {
+              PTRACE(1, "RTP_UDP\tSession " << sessionID << ", "
+                     << channelName << " PDU from incorrect host, "
+                        " is " << addr << " should be " << remoteTransmitAddress);
+              return RTP_Session::e_IgnorePacket;
+          }
 
-            PTRACE(1, "RTP_UDP\tSession " << sessionID << ", "
-                       << channelName << " PDU from incorrect host limit switching to " << addr);
-
-            remoteTransmitAddress = addr;
-            remoteAddress = addr;
-            appliedQOS = false;
-               if (fromDataChannel) {
-                    remoteDataPort = port;
-                    // Fixes to makes sure sync,stats and jitter don't get screwed up
-                    syncSourceIn = ((RTP_DataFrame &)frame).GetSyncSource();
-                    expectedSequenceNumber = ((RTP_DataFrame &)frame).GetSequenceNumber();
+          PTRACE(1, "RTP_UDP\tSession " << sessionID << ", "
+                     << channelName << " PDU from incorrect host limit switching to " << addr);
+
+          remoteTransmitAddress = addr;
+          remoteAddress = addr;
+          appliedQOS = false;
+             if (fromDataChannel) {
+                  remoteDataPort = port;
+                  // Fixes to makes sure sync,stats and jitter don't get screwed up
+                  syncSourceIn = ((RTP_DataFrame &)frame).GetSyncSource();
+                  expectedSequenceNumber = ((RTP_DataFrame &)frame).GetSequenceNumber();
 #ifdef H323_AUDIO_CODECS
-                    if (jitter != NULL)  jitter->ResetFirstWrite();
+                  if (jitter != NULL)  jitter->ResetFirstWrite();
 #endif
-               } else
-                 remoteControlPort = port;
-          }
-      }
+             } else
+               remoteControlPort = port;
+        }
     }
-    successiveWrongAddresses=0;
+  }
+  successiveWrongAddresses=0;
 
-    if (!remoteAddress.IsAny() && remoteAddress.IsValid() && !appliedQOS)
-      ApplyQOS(remoteAddress);
+  if (!remoteAddress.IsAny() && remoteAddress.IsValid() && !appliedQOS)
+    ApplyQOS(remoteAddress);
 
-    return RTP_Session::e_ProcessPacket;
-  }
+  return RTP_Session::e_ProcessPacket;
+}
+
+
+RTP_Session::SendReceiveStatus RTP_UDP::OnReadError(int errorNumber,
+                                                    PBoolean fromDataChannel,
+                                                    const PString & PTRACE_PARAM(errorText))
+{
+#if PTRACING
+  const char * channelName = fromDataChannel ? "Data" : "Control";
+#endif
 
-  switch (socket.GetErrorNumber()) {
+  switch (errorNumber) {
     case ECONNRESET :
     case ECONNREFUSED :
       PTRACE(2, "RTP_UDP\tSession " << sessionID << ", "
@@ -1851,8 +1983,7 @@ RTP_Session::SendReceiveStatus RTP_UDP::ReadDataOrControlPDU(PUDPSocket & socket
 
     default:
       PTRACE(1, "RTP_UDP\t" << channelName << " read error ("
-             << socket.GetErrorNumber(PChannel::LastReadError) << "): "
-             << socket.GetErrorText(PChannel::LastReadError));
+             << errorNumber << "): " << errorText);
       return RTP_Session::e_AbortTransport;
   }
 }
@@ -1860,12 +1991,23 @@ RTP_Session::SendReceiveStatus RTP_UDP::ReadDataOrControlPDU(PUDPSocket & socket
 
 RTP_Session::SendReceiveStatus RTP_UDP::ReadDataPDU(RTP_DataFrame & frame)
 {
-  SendReceiveStatus status = ReadDataOrControlPDU(*dataSocket, frame, TRUE);
+  SendReceiveStatus status;
+  PINDEX pduSize;
+
+#ifdef H323_RTP_BATCHIO
+  if (rxFrames != NULL)
+    status = ReadBatchedDataPDU(frame, pduSize);
+  else
+#endif
+  {
+    status = ReadDataOrControlPDU(*dataSocket, frame, TRUE);
+    pduSize = dataSocket->GetLastReadCount();
+  }
+
   if (status != e_ProcessPacket)
     return status;
 
   // Check received PDU is big enough
-  PINDEX pduSize = dataSocket->GetLastReadCount();
   if (pduSize < RTP_DataFrame::MinHeaderSize || pduSize < frame.GetHeaderSize()) {
     PTRACE(2, "RTP_UDP\tSession " << sessionID
            << ", Received data packet too small: " << pduSize << " bytes");
@@ -1928,6 +2070,11 @@ PBoolean RTP_UDP::WriteData(RTP_DataFrame & frame)
     return true;
   }
 
+#ifdef H323_RTP_BATCHIO
+  if (txFrames != NULL)
+    return WriteBatchedData(frame);
+#endif
+
   while (dataSocket && !dataSocket->WriteTo(frame.GetPointer(),
             frame.GetHeaderSize()+frame.GetPayloadSize(), remoteAddress, remoteDataPort)) {
 
@@ -1977,5 +2124,263 @@ PBoolean RTP_UDP::WriteControl(RTP_ControlFrame & frame)
   return true;
 }
 
+#ifdef H323_RTP_BATCHIO
+
+class RTP_BatchMessages
+{
+  public:
+    RTP_BatchMessages(RTP_DataFrame * frames, PINDEX size)
+      : messages(size), vectors(size), addresses(size)
+    {
+      for (PINDEX i = 0; i < size; i++) {
+        memset(&messages[i], 0, sizeof(struct mmsghdr));
+        vectors[i].iov_base = frames[i].GetPointer();
+        vectors[i].iov_len  = frames[i].GetSize();
+        messages[i].msg_hdr.msg_iov     = &vectors[i];
+        messages[i].msg_hdr.msg_iovlen  = 1;
+        messages[i].msg_hdr.msg_name    = &addresses[i];
+        messages[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+      }
+    }
+
+    std::vector<struct mmsghdr>          messages;
+    std::vector<struct iovec>            vectors;
+    std::vector<struct sockaddr_storage> addresses;
+};
+
+
+static PBoolean GetSockAddr(const struct sockaddr_storage & sa, PIPSocket::Address & addr, WORD & port)
+{
+  if (sa.ss_family == AF_INET) {
+    const struct sockaddr_in & sin = (const struct sockaddr_in &)sa;
+    addr = PIPSocket::Address(sin.sin_addr);
+    port = ntohs(sin.sin_port);
+    return TRUE;
+  }
+
+#if P_HAS_IPV6
+  if (sa.ss_family == AF_INET6) {
+    const struct sockaddr_in6 & sin6 = (const struct sockaddr_in6 &)sa;
+    addr = PIPSocket::Address(sin6.sin6_addr);
+    port = ntohs(sin6.sin6_port);
+    return TRUE;
+  }
+#endif
+
+  return FALSE;
+}
+
+
+static socklen_t SetSockAddr(const PIPSocket::Address & addr, WORD port, struct sockaddr_storage & sa)
+{
+  memset(&sa, 0, sizeof(sa));
+
+#if P_HAS_IPV6
+  if (addr.GetVersion() == 6) {
+    struct sockaddr_in6 & sin6 = (struct sockaddr_in6 &)sa;
+    sin6.sin6_family = AF_INET6;
+    sin6.sin6_addr   = addr;
+    sin6.sin6_port   = htons(port);
+    return sizeof(struct sockaddr_in6);
+  }
+#endif
+
+  struct sockaddr_in & sin = (struct sockaddr_in &)sa;
+  sin.sin_family = AF_INET;
+  sin.sin_addr   = addr;
+  sin.sin_port   = htons(port);
+  return sizeof(struct sockaddr_in);
+}
+
+
+void RTP_UDP::SetReceiveBatchSize(PINDEX size)
+{
+  rxBatchSize = PMIN(PMAX(size, 1), MAX_BATCH_SIZE);
+  AllocateBatchBuffers();
+}
+
+
+void RTP_UDP::SetSendBatchSize(PINDEX size)
+{
+  FlushData();
+
+  PWaitAndSignal m(txBatchMutex);
+  txBatchSize = PMIN(PMAX(size, 1), MAX_BATCH_SIZE);
+  AllocateBatchBuffers();
+}
+
+
+void RTP_UDP::AllocateBatchBuffers()
+{
+  // The batched calls bypass the socket classes, so only use them when
+  // nothing (NAT traversal, multiplexing, tunneling) has replaced them.
+  PBoolean plain = UsesPlainSockets();
+
+  // Start again whenever the size changes, so the arrays always hold the
+  // number of messages the batch size reports.
+  PINDEX rxSize = plain ? rxBatchSize : 1;
+  PINDEX rxAllocated = rxMessages != NULL ? (PINDEX)rxMessages->messages.size() : 1;
+  if (rxSize != rxAllocated) {
+    PTRACE_IF(3, rxNext < rxCount, "RTP_UDP\tSession " << sessionID << ", discarding "
+              << rxCount - rxNext << " batched packets on resize");
+    delete [] rxFrames;
+    rxFrames = NULL;
+    delete rxMessages;
+    rxMessages = NULL;
+    rxCount = rxNext = 0;
+
+    if (rxSize > 1) {
+      rxFrames = new RTP_DataFrame[rxSize];
+      rxMessages = new RTP_BatchMessages(rxFrames, rxSize);
+    }
+  }
+
+  // The caller has flushed anything queued for sending
+  PINDEX txSize = plain ? txBatchSize : 1;
+  PINDEX txAllocated = txMessages != NULL ? (PINDEX)txMessages->messages.size() : 1;
+  if (txSize != txAllocated) {
+    delete [] txFrames;
+    txFrames = NULL;
+    delete txMessages;
+    txMessages = NULL;
+    txCount = 0;
+
+    if (txSize > 1) {
+      txFrames = new RTP_DataFrame[txSize];
+      txMessages = new RTP_BatchMessages(txFrames, txSize);
+    }
+  }
+
+  PTRACE_IF(2, dataSocket != NULL && !plain && (rxBatchSize > 1 || txBatchSize > 1),
+            "RTP_UDP\tSession " << sessionID << ", batched I/O not available on these sockets");
+}
+
+
+RTP_Session::SendReceiveStatus RTP_UDP::ReadBatchedDataPDU(RTP_DataFrame & frame, PINDEX & pduSize)
+{
+  if (rxNext >= rxCount) {
+    rxCount = rxNext = 0;
+
+    PINDEX size = (PINDEX)rxMessages->messages.size();
+    for (PINDEX i = 0; i < size; i++)
+      rxMessages->messages[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+
+    int count = recvmmsg(dataSocket->GetHandle(), &rxMessages->messages[0], size, MSG_DONTWAIT, NULL);
+    if (count < 0) {
+      int err = errno;
+      return OnReadError(err, TRUE, strerror(err));
+    }
+    if (count == 0)
+      return e_IgnorePacket;
+
+    rxCount = count;
+    rxBatchCalls++;
+    rxBatchPackets += count;
+    if ((DWORD)count > rxBatchMaximum)
+      rxBatchMaximum = count;
+  }
+
+  PINDEX i = rxNext++;
+  const struct mmsghdr & message = rxMessages->messages[i];
+
+  if ((message.msg_hdr.msg_flags & MSG_TRUNC) != 0)
+    return OnReadError(EMSGSIZE, TRUE, strerror(EMSGSIZE));
+
+  PIPSocket::Address addr;
+  WORD port;
+  if (!GetSockAddr(rxMessages->addresses[i], addr, port))
+    return e_IgnorePacket;
+
+  pduSize = message.msg_len;
+  if (!frame.SetMinSize(pduSize))
+    return e_IgnorePacket;
+  memcpy(frame.GetPointer(), rxFrames[i].GetPointer(), pduSize);
+
+  return OnReadDataOrControlPDU(*dataSocket, frame, TRUE, addr, port);
+}
+
+
+PBoolean RTP_UDP::WriteBatchedData(RTP_DataFrame & frame)
+{
+  PINDEX size = frame.GetHeaderSize()+frame.GetPayloadSize();
+
+  {
+    PWaitAndSignal m(txBatchMutex);
+
+    if (txFrames == NULL)
+      return TRUE;
+
+    RTP_DataFrame & queued = txFrames[txCount];
+    if (!queued.SetMinSize(size))
+      return FALSE;
+    memcpy(queued.GetPointer(), frame.GetPointer(), size);
+
+    txMessages->vectors[txCount].iov_base = queued.GetPointer();
+    txMessages->vectors[txCount].iov_len  = size;
+    txCount++;
+
+    // Hold on to the packet until the end of the burst
+    if (txCount < (PINDEX)txMessages->messages.size() && !frame.GetMarker())
+      return TRUE;
+  }
+
+  return FlushData();
+}
+
+
+PBoolean RTP_UDP::FlushData()
+{
+  PWaitAndSignal m(txBatchMutex);
+
+  if (txCount == 0)
+    return TRUE;
+
+  if (dataSocket == NULL || txMessages == NULL) {
+    txCount = 0;
+    return TRUE;
+  }
+
+  // All queued packets go to the current remote data port
+  struct sockaddr_storage & destination = txMessages->addresses[0];
+  socklen_t destinationLength = SetSockAddr(remoteAddress, remoteDataPort, destination);
+  for (PINDEX i = 0; i < txCount; i++) {
+    txMessages->messages[i].msg_hdr.msg_name    = &destination;
+    txMessages->messages[i].msg_hdr.msg_namelen = destinationLength;
+  }
+
+  PINDEX sent = 0;
+  while (sent < txCount) {
+    int count = sendmmsg(dataSocket->GetHandle(), &txMessages->messages[sent], txCount - sent, 0);
+    if (count < 0) {
+      switch (errno) {
+        case EINTR :
+          continue;
+
+        case ECONNRESET :
+        case ECONNREFUSED :
+          PTRACE(2, "RTP_UDP\tSession " << sessionID << ", data port on remote not ready.");
+          continue;
+
+        default:
+          PTRACE(1, "RTP_UDP\tSession " << sessionID
+                 << ", Batched write error on data port (" << errno << "): " << strerror(errno));
+          txCount = 0;
+          return FALSE;
+      }
+    }
+
+    txBatchCalls++;
+    if ((DWORD)count > txBatchMaximum)
+      txBatchMaximum = count;
+    sent += count;
+  }
+
+  txBatchPackets += sent;
+  txCount = 0;
+  return TRUE;
+}
+
+#endif // H323_RTP_BATCHIO
+
 
 /////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,415 @@
+/*
+ * rtpreactor.cxx
+ *
+ * Shared RTP socket reactor
+ *
+ * H323Plus Library
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is H323Plus Library.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Id$
+ *
+ */
+
+#include <ptlib.h>
+
+#ifdef __GNUC__
+#pragma implementation "rtpreactor.h"
+#endif
+
+#include "openh323buildopts.h"
+
+#include "rtpreactor.h"
+
+#ifdef H323_RTP_REACTOR
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <errno.h>
+
+/* Maximum number of events handled per epoll_wait() */
+#define REACTOR_MAX_EVENTS  64
+
+/* Interval at which the handles are given a chance to send RTCP reports */
+#define REACTOR_TIMEOUT     1000 // milliseconds
+
+#define new PNEW
+
+/////////////////////////////////////////////////////////////////////////////
+
+RTP_ReactorHandle::RTP_ReactorHandle(RTP_Session & sess)
+  : session(sess), id(0)
+{
+}
+
+
+PBoolean RTP_ReactorHandle::OnControlReady()
+{
+  return session.ReadReadyControl() != RTP_Session::e_AbortTransport;
+}
+
+
+PBoolean RTP_ReactorHandle::OnTimeout()
+{
+  return session.SendReport();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+class RTP_Reactor::Worker : public PObject
+{
+  PCLASSINFO(RTP_Reactor::Worker, PObject);
+
+  public:
+    Worker(PINDEX stackSize);
+    ~Worker();
+
+    PBoolean Add(RTP_ReactorHandle * handle);
+    PBoolean Remove(RTP_ReactorHandle * handle);
+    PINDEX GetCount() const;
+
+    PDECLARE_NOTIFIER(PThread, RTP_Reactor::Worker, ThreadMain);
+
+  protected:
+    typedef std::map<unsigned, RTP_ReactorHandle *> HandleMap;
+
+    enum CallBacks {
+      e_DataReady,
+      e_ControlReady,
+      e_Timeout
+    };
+
+    void Detach(HandleMap::iterator it);
+    void CallBack(unsigned id, CallBacks callBack);
+
+    int        epollFd;
+    int        wakeFd;
+    PBoolean   running;
+    PThread  * thread;
+    HandleMap  handles;
+    unsigned   busyId;      // Handle whose call back is running, zero if none
+    unsigned   removing;    // Threads in Remove() waiting for busyId to change
+    PSemaphore idle;
+    mutable PMutex mutex;
+};
+
+
+RTP_Reactor::Worker::Worker(PINDEX stackSize)
+  : epollFd(-1), wakeFd(-1), running(TRUE), thread(NULL), busyId(0), removing(0), idle(0, UINT_MAX)
+{
+  epollFd = epoll_create1(EPOLL_CLOEXEC);
+  wakeFd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+  if (epollFd < 0 || wakeFd < 0) {
+    PTRACE(1, "RTP\tReactor could not create epoll instance: " << strerror(errno));
+    return;
+  }
+
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.u64 = 0;
+  epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &ev);
+
+  thread = PThread::Create(PCREATE_NOTIFIER(ThreadMain), 0, PThread::NoAutoDeleteThread, PThread::HighestPriority, "RTP Reactor:%x", stackSize);
+}
+
+
+RTP_Reactor::Worker::~Worker()
+{
+  if (thread != NULL) {
+    running = FALSE;
+    uint64_t one = 1;
+    if (::write(wakeFd, &one, sizeof(one)) < 0) {
+      PTRACE(2, "RTP\tReactor wake up failed: " << strerror(errno));
+    }
+    // Never delete the thread while it may still be in the loop
+    thread->WaitForTermination();
+    delete thread;
+    thread = NULL;
+  }
+
+  PTRACE_IF(2, !handles.empty(), "RTP\tReactor destroyed with " << handles.size() << " handles still attached");
+
+  if (wakeFd >= 0)
+    ::close(wakeFd);
+  if (epollFd >= 0)
+    ::close(epollFd);
+}
+
+
+PBoolean RTP_Reactor::Worker::Add(RTP_ReactorHandle * handle)
+{
+  if (thread == NULL)
+    return FALSE;
+
+  RTP_Session & session = handle->GetSession();
+  int dataFd = (int)session.GetDataSocketHandle();
+  int controlFd = (int)session.GetControlSocketHandle();
+  if (dataFd < 0 || controlFd < 0)
+    return FALSE;
+
+  PWaitAndSignal m(mutex);
+
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+
+  // Low bit of the key selects the control socket
+  ev.data.u64 = ((uint64_t)handle->GetId() << 1);
+  if (epoll_ctl(epollFd, EPOLL_CTL_ADD, dataFd, &ev) < 0) {
+    PTRACE(1, "RTP\tReactor could not add data socket " << dataFd << ": " << strerror(errno));
+    return FALSE;
+  }
+
+  ev.data.u64 = ((uint64_t)handle->GetId() << 1) | 1;
+  if (epoll_ctl(epollFd, EPOLL_CTL_ADD, controlFd, &ev) < 0) {
+    PTRACE(1, "RTP\tReactor could not add control socket " << controlFd << ": " << strerror(errno));
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, dataFd, NULL);
+    return FALSE;
+  }
+
+  handles[handle->GetId()] = handle;
+  return TRUE;
+}
+
+
+PBoolean RTP_Reactor::Worker::Remove(RTP_ReactorHandle * handle)
+{
+  mutex.Wait();
+
+  HandleMap::iterator it = handles.find(handle->GetId());
+  if (it == handles.end()) {
+    mutex.Signal();
+    return FALSE;
+  }
+
+  Detach(it);
+
+  /* Call backs run without the lock, so wait for one in progress on this
+     handle to finish. A handle removing itself from its own call back is
+     already finished with as far as the reactor is concerned.
+   */
+  if (PThread::Current() != thread) {
+    while (busyId == handle->GetId()) {
+      removing++;
+      mutex.Signal();
+      idle.Wait();
+      mutex.Wait();
+    }
+  }
+
+  mutex.Signal();
+  return TRUE;
+}
+
+
+PINDEX RTP_Reactor::Worker::GetCount() const
+{
+  PWaitAndSignal m(mutex);
+  return (PINDEX)handles.size();
+}
+
+
+void RTP_Reactor::Worker::Detach(HandleMap::iterator it)
+{
+  RTP_ReactorHandle * handle = it->second;
+  handles.erase(it);
+
+  RTP_Session & session = handle->GetSession();
+  int dataFd = (int)session.GetDataSocketHandle();
+  int controlFd = (int)session.GetControlSocketHandle();
+  if (dataFd >= 0)
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, dataFd, NULL);
+  if (controlFd >= 0)
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, controlFd, NULL);
+
+  handle->OnRemoved();
+}
+
+
+void RTP_Reactor::Worker::CallBack(unsigned id, CallBacks callBack)
+{
+  RTP_ReactorHandle * handle;
+  {
+    PWaitAndSignal m(mutex);
+
+    // Handle may have been removed since epoll_wait() returned
+    HandleMap::iterator it = handles.find(id);
+    if (it == handles.end())
+      return;
+
+    handle = it->second;
+    busyId = id;
+  }
+
+  // Not under the lock, the call back may take locks a thread in Remove() holds
+  PBoolean ok;
+  switch (callBack) {
+    case e_DataReady :
+      ok = handle->OnDataReady();
+      break;
+    case e_ControlReady :
+      ok = handle->OnControlReady();
+      break;
+    default :
+      ok = handle->OnTimeout();
+  }
+
+  PWaitAndSignal m(mutex);
+
+  busyId = 0;
+  while (removing > 0) {
+    removing--;
+    idle.Signal();
+  }
+
+  if (!ok) {
+    HandleMap::iterator it = handles.find(id);
+    if (it != handles.end())
+      Detach(it);
+  }
+}
+
+
+void RTP_Reactor::Worker::ThreadMain(PThread &, H323_INT)
+{
+  PTRACE(3, "RTP\tReactor thread started: " << this);
+
+  struct epoll_event events[REACTOR_MAX_EVENTS];
+  PTimeInterval lastTimeout = PTimer::Tick();
+
+  while (running) {
+    int count = epoll_wait(epollFd, events, REACTOR_MAX_EVENTS, REACTOR_TIMEOUT);
+    if (count < 0) {
+      if (errno == EINTR)
+        continue;
+      PTRACE(1, "RTP\tReactor epoll_wait failed: " << strerror(errno));
+      break;
+    }
+
+    for (int i = 0; i < count; i++) {
+      uint64_t key = events[i].data.u64;
+      if (key == 0) {
+        uint64_t value;
+        while (::read(wakeFd, &value, sizeof(value)) > 0)
+          ;
+        continue;
+      }
+
+      CallBack((unsigned)(key >> 1), (key & 1) != 0 ? e_ControlReady : e_DataReady);
+    }
+
+    PTimeInterval now = PTimer::Tick();
+    if ((now - lastTimeout).GetMilliSeconds() >= REACTOR_TIMEOUT) {
+      lastTimeout = now;
+
+      std::vector<unsigned> ids;
+      {
+        PWaitAndSignal m(mutex);
+        for (HandleMap::iterator it = handles.begin(); it != handles.end(); ++it)
+          ids.push_back(it->first);
+      }
+
+      for (std::vector<unsigned>::iterator it = ids.begin(); it != ids.end(); ++it)
+        CallBack(*it, e_Timeout);
+    }
+  }
+
+  PTRACE(3, "RTP\tReactor thread finished: " << this);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+RTP_Reactor::RTP_Reactor(unsigned threadCount, PINDEX stackSize)
+  : nextId(0)
+{
+  if (threadCount == 0)
+    threadCount = 1;
+
+  for (unsigned i = 0; i < threadCount; i++)
+    workers.push_back(new Worker(stackSize));
+
+  PTRACE(3, "RTP\tReactor created with " << threadCount << " threads");
+}
+
+
+RTP_Reactor::~RTP_Reactor()
+{
+  for (std::vector<Worker *>::iterator it = workers.begin(); it != workers.end(); ++it)
+    delete *it;
+  workers.clear();
+}
+
+
+PBoolean RTP_Reactor::AddHandle(RTP_ReactorHandle * handle)
+{
+  if (handle == NULL)
+    return FALSE;
+
+  Worker * worker = NULL;
+  {
+    PWaitAndSignal m(workersMutex);
+
+    // Id zero is reserved for the wake up event
+    if (++nextId == 0)
+      ++nextId;
+    handle->id = nextId;
+
+    PINDEX lowest = P_MAX_INDEX;
+    for (std::vector<Worker *>::iterator it = workers.begin(); it != workers.end(); ++it) {
+      PINDEX count = (*it)->GetCount();
+      if (count < lowest) {
+        lowest = count;
+        worker = *it;
+      }
+    }
+  }
+
+  if (worker == NULL || !worker->Add(handle))
+    return FALSE;
+
+  PTRACE(4, "RTP\tReactor added session " << handle->GetSession().GetSessionID() << " id=" << handle->id);
+  return TRUE;
+}
+
+
+PBoolean RTP_Reactor::RemoveHandle(RTP_ReactorHandle * handle)
+{
+  if (handle == NULL)
+    return FALSE;
+
+  for (std::vector<Worker *>::iterator it = workers.begin(); it != workers.end(); ++it) {
+    if ((*it)->Remove(handle)) {
+      PTRACE(4, "RTP\tReactor removed session " << handle->GetSession().GetSessionID() << " id=" << handle->id);
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+
+PINDEX RTP_Reactor::GetHandleCount() const
+{
+  PINDEX count = 0;
+  for (std::vector<Worker *>::const_iterator it = workers.begin(); it != workers.end(); ++it)
+    count += (*it)->GetCount();
+  return count;
+}
+
+#endif // H323_RTP_REACTOR
+
+/////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,513 @@
+/*
+ * signalreactor.cxx
+ *
+ * Shared H.225/H.245 signalling reactor
+ *
+ * H323Plus Library
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is H323Plus Library.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Id$
+ *
+ */
+
+#include <ptlib.h>
+
+#ifdef __GNUC__
+#pragma implementation "signalreactor.h"
+#endif
+
+#include "openh323buildopts.h"
+
+#include "signalreactor.h"
+
+#ifdef H323_SIGNAL_REACTOR
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+/* Maximum number of events handled per epoll_wait() */
+#define REACTOR_MAX_EVENTS   64
+
+/* Interval at which read timeouts and keep alives are checked */
+#define REACTOR_TICK         1000 // milliseconds
+
+/* Stop reading a channel when this many PDUs are waiting for a worker,
+   and start again when half of them have been processed */
+#define REACTOR_MAX_PENDING  32
+
+/* Events a worker processes for one handle before giving the others a turn */
+#define REACTOR_WORKER_BATCH 8
+
+#define new PNEW
+
+/////////////////////////////////////////////////////////////////////////////
+
+H323SignalReactorHandle::H323SignalReactorHandle(H323TransportTCP & t, const PTimeInterval & keepAlive)
+  : transport(t),
+    keepAliveInterval(keepAlive),
+    id(0),
+    fd(-1),
+    scheduled(FALSE),
+    paused(FALSE),
+    stopped(FALSE),
+    removed(FALSE),
+    runningThread(NULL)
+{
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+H323SignalReactor::H323SignalReactor(unsigned workerCount, PINDEX stackSize)
+  : epollFd(-1),
+    wakeFd(-1),
+    running(TRUE),
+    ioThread(NULL),
+    available(0, P_MAX_INDEX),
+    nextId(0)
+{
+  epollFd = epoll_create1(EPOLL_CLOEXEC);
+  wakeFd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+  if (epollFd < 0 || wakeFd < 0) {
+    PTRACE(1, "H225\tReactor could not create epoll instance: " << strerror(errno));
+    return;
+  }
+
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.u64 = 0;
+  epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &ev);
+
+  if (workerCount == 0)
+    workerCount = 1;
+
+  ioThread = PThread::Create(PCREATE_NOTIFIER(IOMain), 0, PThread::NoAutoDeleteThread, PThread::HighPriority, "H225 Reactor", stackSize);
+  for (unsigned i = 0; i < workerCount; i++)
+    workers.push_back(PThread::Create(PCREATE_NOTIFIER(WorkerMain), 0, PThread::NoAutoDeleteThread, PThread::NormalPriority, "H225 Worker:%x", stackSize));
+
+  PTRACE(3, "H225\tReactor created with " << workerCount << " worker threads");
+}
+
+
+H323SignalReactor::~H323SignalReactor()
+{
+  mutex.Wait();
+  running = FALSE;
+  mutex.Signal();
+
+  if (ioThread != NULL) {
+    uint64_t one = 1;
+    if (::write(wakeFd, &one, sizeof(one)) < 0) {
+      PTRACE(2, "H225\tReactor wake up failed: " << strerror(errno));
+    }
+    // The handles are gone, so nothing can keep the threads from exiting
+    ioThread->WaitForTermination();
+    delete ioThread;
+    ioThread = NULL;
+  }
+
+  std::vector<PThread *>::iterator it;
+  for (it = workers.begin(); it != workers.end(); ++it)
+    available.Signal();
+  for (it = workers.begin(); it != workers.end(); ++it) {
+    (*it)->WaitForTermination();
+    delete *it;
+  }
+  workers.clear();
+
+  PTRACE_IF(2, !handles.empty(), "H225\tReactor destroyed with " << handles.size() << " handles still attached");
+
+  if (wakeFd >= 0)
+    ::close(wakeFd);
+  if (epollFd >= 0)
+    ::close(epollFd);
+}
+
+
+PBoolean H323SignalReactor::IsSupportedTransport(H323Transport & transport)
+{
+  // Derived transports have their own ReadPDU() so must keep their thread
+  if (strcmp(transport.GetClass(), H323TransportTCP::Class()) != 0)
+    return FALSE;
+
+  if (transport.IsTransportSecure())
+    return FALSE;
+
+  PChannel * channel = transport.GetBaseReadChannel();
+  return channel == NULL || PIsDescendant(channel, PTCPSocket);
+}
+
+
+PBoolean H323SignalReactor::AddHandle(H323SignalReactorHandle * handle)
+{
+  if (handle == NULL || ioThread == NULL)
+    return FALSE;
+
+  PWaitAndSignal m(mutex);
+
+  // Id zero is reserved for the wake up event
+  if (++nextId == 0)
+    ++nextId;
+  handle->id = nextId;
+  handle->lastRead = handle->lastKeepAlive = PTimer::Tick();
+
+  if (!Attach(*handle))
+    return FALSE;
+
+  handles[handle->id] = handle;
+
+  // The thread that set up the channel may have read more than the first PDU
+  ReadHandle(*handle);
+
+  PTRACE(4, "H225\tReactor added " << handle->transport << " id=" << handle->id);
+  return TRUE;
+}
+
+
+PBoolean H323SignalReactor::RemoveHandle(H323SignalReactorHandle * handle)
+{
+  if (handle == NULL)
+    return FALSE;
+
+  mutex.Wait();
+
+  HandleMap::iterator it = handles.find(handle->id);
+  if (it == handles.end() || it->second != handle) {
+    mutex.Signal();
+    return FALSE;
+  }
+
+  handles.erase(it);
+  handle->removed = TRUE;
+  handle->events.clear();
+  Detach(*handle);
+
+  PBoolean wait = handle->runningThread != NULL && handle->runningThread != PThread::Current();
+  mutex.Signal();
+
+  // Let the worker finish the call back it is in
+  if (wait)
+    handle->finished.Wait();
+
+  PTRACE(4, "H225\tReactor removed id=" << handle->id);
+  return TRUE;
+}
+
+
+PINDEX H323SignalReactor::GetHandleCount() const
+{
+  PWaitAndSignal m(mutex);
+  return (PINDEX)handles.size();
+}
+
+
+PBoolean H323SignalReactor::Attach(H323SignalReactorHandle & handle)
+{
+  PChannel * channel = handle.transport.GetBaseReadChannel();
+  if (channel == NULL || !channel->IsOpen())
+    return FALSE;
+
+  // Register our own descriptor so the registration cannot outlive the
+  // socket, or pick up another one reusing its number, when the transport
+  // closes without telling us.
+  int fd = fcntl(channel->GetHandle(), F_DUPFD_CLOEXEC, 0);
+  if (fd < 0) {
+    PTRACE(1, "H225\tReactor could not duplicate socket: " << strerror(errno));
+    return FALSE;
+  }
+
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.u64 = handle.id;
+  if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+    PTRACE(1, "H225\tReactor could not add socket " << fd << ": " << strerror(errno));
+    ::close(fd);
+    return FALSE;
+  }
+
+  handle.fd = fd;
+  handle.paused = FALSE;
+  return TRUE;
+}
+
+
+void H323SignalReactor::Detach(H323SignalReactorHandle & handle)
+{
+  if (handle.fd < 0)
+    return;
+
+  epoll_ctl(epollFd, EPOLL_CTL_DEL, handle.fd, NULL);
+  ::close(handle.fd);
+  handle.fd = -1;
+}
+
+
+void H323SignalReactor::SetReading(H323SignalReactorHandle & handle, PBoolean enable)
+{
+  if (handle.fd < 0 || handle.paused != enable)
+    return;
+
+  // Leaving the data in the socket lets TCP flow control slow the remote
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = enable ? EPOLLIN : 0;
+  ev.data.u64 = handle.id;
+  epoll_ctl(epollFd, EPOLL_CTL_MOD, handle.fd, &ev);
+  handle.paused = !enable;
+}
+
+
+void H323SignalReactor::ReadHandle(H323SignalReactorHandle & handle)
+{
+  while (handle.events.size() < REACTOR_MAX_PENDING) {
+    Event event;
+    PBoolean complete;
+    if (!handle.transport.PollPDU(event.pdu, complete)) {
+      event.kind = Event::ReadFailed;
+      event.error = handle.transport.GetErrorCode(PChannel::LastReadError);
+      event.osError = handle.transport.GetErrorNumber(PChannel::LastReadError);
+      QueueEvent(handle, event);
+
+      // Nothing more to read until the handle has decided what to do
+      Detach(handle);
+      return;
+    }
+
+    if (!complete)
+      return;
+
+    handle.lastRead = PTimer::Tick();
+    event.kind = Event::ReceivedPDU;
+    event.error = PChannel::NoError;
+    event.osError = 0;
+    QueueEvent(handle, event);
+  }
+
+  SetReading(handle, FALSE);
+}
+
+
+void H323SignalReactor::CheckTimers(H323SignalReactorHandle & handle, const PTimeInterval & now)
+{
+  if (handle.stopped || handle.paused)
+    return;
+
+  Event event;
+  event.error = PChannel::NoError;
+  event.osError = 0;
+
+  // Transport closed under us, or a reconnect that failed
+  if (handle.fd < 0 || !handle.transport.IsOpen()) {
+    if (!handle.scheduled) {
+      Detach(handle);
+      event.kind = Event::ReadFailed;
+      event.error = PChannel::NotOpen;
+      event.osError = EBADF;
+      QueueEvent(handle, event);
+    }
+    return;
+  }
+
+  // Behave as a blocking read on the transport would have
+  PTimeInterval timeout = handle.transport.GetReadTimeout();
+  if (timeout != PMaxTimeInterval && now - handle.lastRead >= timeout) {
+    handle.lastRead = now;
+    event.kind = Event::ReadFailed;
+    event.error = PChannel::Timeout;
+    event.osError = ETIMEDOUT;
+    QueueEvent(handle, event);
+  }
+
+  if (handle.keepAliveInterval > 0 && now - handle.lastKeepAlive >= handle.keepAliveInterval) {
+    handle.lastKeepAlive = now;
+    event.kind = Event::SendKeepAlive;
+    event.error = PChannel::NoError;
+    event.osError = 0;
+    QueueEvent(handle, event);
+  }
+}
+
+
+void H323SignalReactor::QueueEvent(H323SignalReactorHandle & handle, const Event & event)
+{
+  if (handle.stopped || handle.removed)
+    return;
+
+  handle.events.push_back(event);
+
+  if (!handle.scheduled) {
+    handle.scheduled = TRUE;
+    runQueue.push_back(handle.id);
+    available.Signal();
+  }
+}
+
+
+void H323SignalReactor::IOMain(PThread &, H323_INT)
+{
+  PTRACE(3, "H225\tReactor I/O thread started");
+
+  struct epoll_event events[REACTOR_MAX_EVENTS];
+  PTimeInterval lastTick = PTimer::Tick();
+
+  for (;;) {
+    int count = epoll_wait(epollFd, events, REACTOR_MAX_EVENTS, REACTOR_TICK);
+    if (count < 0 && errno != EINTR) {
+      PTRACE(1, "H225\tReactor epoll_wait failed: " << strerror(errno));
+      break;
+    }
+
+    PWaitAndSignal m(mutex);
+
+    if (!running)
+      break;
+
+    for (int i = 0; i < count; i++) {
+      uint64_t key = events[i].data.u64;
+      if (key == 0) {
+        uint64_t value;
+        while (::read(wakeFd, &value, sizeof(value)) > 0)
+          ;
+        continue;
+      }
+
+      // Handle may have been removed since epoll_wait() returned
+      HandleMap::iterator it = handles.find((unsigned)key);
+      if (it != handles.end() && it->second->fd >= 0 && !it->second->paused)
+        ReadHandle(*it->second);
+    }
+
+    PTimeInterval now = PTimer::Tick();
+    if ((now - lastTick).GetMilliSeconds() >= REACTOR_TICK) {
+      lastTick = now;
+      for (HandleMap::iterator it = handles.begin(); it != handles.end(); ++it)
+        CheckTimers(*it->second, now);
+    }
+  }
+
+  PTRACE(3, "H225\tReactor I/O thread finished");
+}
+
+
+void H323SignalReactor::WorkerMain(PThread &, H323_INT)
+{
+  PTRACE(3, "H225\tReactor worker thread started");
+
+  for (;;) {
+    available.Wait();
+
+    H323SignalReactorHandle * handle;
+    {
+      PWaitAndSignal m(mutex);
+      if (!running)
+        break;
+      if (runQueue.empty())
+        continue;
+
+      HandleMap::iterator it = handles.find(runQueue.front());
+      runQueue.pop_front();
+      if (it == handles.end())
+        continue;
+
+      handle = it->second;
+      handle->runningThread = PThread::Current();
+    }
+
+    RunHandle(*handle);
+  }
+
+  PTRACE(3, "H225\tReactor worker thread finished");
+}
+
+
+void H323SignalReactor::RunHandle(H323SignalReactorHandle & handle)
+{
+  mutex.Wait();
+
+  for (PINDEX count = 0; count < REACTOR_WORKER_BATCH && !handle.events.empty(); count++) {
+    Event event = handle.events.front();
+    handle.events.pop_front();
+
+    if (handle.paused && handle.events.size() <= REACTOR_MAX_PENDING/2)
+      SetReading(handle, TRUE);
+
+    mutex.Signal();
+    PBoolean ok = Dispatch(handle, event);
+    mutex.Wait();
+
+    if (handle.removed)
+      break;
+
+    if (!ok) {
+      handle.stopped = TRUE;
+      handle.events.clear();
+      Detach(handle);
+
+      mutex.Signal();
+      handle.OnStopped();
+      mutex.Wait();
+      break;
+    }
+
+    // Carrying on after a read error means the transport was reconnected
+    if (event.kind == Event::ReadFailed && event.error != PChannel::Timeout && handle.fd < 0)
+      Attach(handle);
+  }
+
+  handle.runningThread = NULL;
+
+  if (handle.removed)
+    handle.finished.Signal();
+  else if (!handle.events.empty()) {
+    // Back of the queue so one busy channel cannot hold up the others
+    runQueue.push_back(handle.id);
+    available.Signal();
+  }
+  else
+    handle.scheduled = FALSE;
+
+  mutex.Signal();
+}
+
+
+PBoolean H323SignalReactor::Dispatch(H323SignalReactorHandle & handle, Event & event)
+{
+  switch (event.kind) {
+    case Event::SendKeepAlive :
+    {
+      // Send empty RFC1006 TPKT
+      static const BYTE tpkt[4] = { 3, 0, 0, 4 };
+      PTRACE(5, "H225\tSending KeepAlive TPKT packet");
+      handle.transport.Write(tpkt, sizeof(tpkt));
+      return TRUE;
+    }
+
+    case Event::ReadFailed :
+      handle.transport.SetErrorValues(event.error, event.osError, PChannel::LastReadError);
+      return handle.OnReceivedPDU(FALSE, event.pdu);
+
+    default :
+      return handle.OnReceivedPDU(TRUE, event.pdu);
+  }
+}
+
+#endif // H323_SIGNAL_REACTOR
+
+/////////////////////////////////////////////////////////////////////////////
@@ -42,6 +42,10 @@
 #include "h323ep.h"
 #include "gkclient.h"
 
+#ifdef H323_SIGNAL_REACTOR
+#include "signalreactor.h"
+#endif
+
 #ifdef P_STUN
 #include <ptclib/pstun.h>
  #ifdef _MSC_VER
@@ -55,9 +59,17 @@
 #include <openssl/err.h>
 #endif
 
+#ifndef _WIN32
+#include <sys/uio.h>
+#include <errno.h>
+#endif
+
 // TCP KeepAlive
 static int KeepAliveInterval = 19;
 
+// Initial size of the TPKT read buffer, grows to fit larger PDUs
+#define TPKT_READ_BUFFER_SIZE 2048
+
 class H225TransportThread : public PThread
 {
   PCLASSINFO(H225TransportThread, PThread)
@@ -101,6 +113,9 @@ class H245TransportThread : public PThread
 #ifdef H323_SIGNAL_AGGREGATE
     PBoolean useAggregator;
 #endif
+#ifdef H323_SIGNAL_REACTOR
+    PBoolean useReactor;
+#endif
 
     PDECLARE_NOTIFIER(PTimer, H245TransportThread, KeepAlive);
     PTimer    m_keepAlive;
@@ -183,12 +198,19 @@ H245TransportThread::H245TransportThread(H323EndPoint & endpoint,
     connection(c),
     transport(t)
 {
+#ifdef H323_SIGNAL_REACTOR
+  // The reactor sends the keep alives once it has the channel
+  useReactor = endpoint.GetSignalReactor() != NULL && H323SignalReactor::IsSupportedTransport(transport);
+#endif
 #ifdef H323_SIGNAL_AGGREGATE
   useAggregator = endpoint.GetSignallingAggregator() != NULL;
   if (!useAggregator)
 #endif
   {
     transport.AttachThread(this);
+#ifdef H323_SIGNAL_REACTOR
+    if (!useReactor)
+#endif
     if (endpoint.EnableH245KeepAlive()) {
       m_keepAlive.SetNotifier(PCREATE_NOTIFIER(KeepAlive));
       m_keepAlive.RunContinuous(KeepAliveInterval * 1000);
@@ -219,6 +241,22 @@ void H245TransportThread::Main()
     }
 #endif
 
+#ifdef H323_SIGNAL_REACTOR
+    // This thread stays attached to the transport and ends here, so it is
+    // cleaned up with the transport as usual.
+    if (useReactor) {
+      H323EndPoint & endpoint = connection.GetEndPoint();
+      PTimeInterval keepAlive = endpoint.EnableH245KeepAlive() ? KeepAliveInterval * 1000 : 0;
+      if (connection.ReactControlChannel(&transport, keepAlive))
+        return;
+
+      if (endpoint.EnableH245KeepAlive()) {
+        m_keepAlive.SetNotifier(PCREATE_NOTIFIER(KeepAlive));
+        m_keepAlive.RunContinuous(KeepAliveInterval * 1000);
+      }
+    }
+#endif
+
     connection.HandleControlChannel();
   }
 }
@@ -1168,6 +1206,16 @@ PBoolean H323Transport::HandleFirstSignallingChannelPDU(PThread * thread)
 #ifdef H323_H46018
     keepAlive = connection->IsH46019Enabled();
 #endif
+
+#ifdef H323_SIGNAL_REACTOR
+    // Hand the channel to the reactor and let this thread end
+    if (connection->ReactSignalChannel(this, (keepAlive || endpoint.EnableH225KeepAlive()) ? KeepAliveInterval * 1000 : 0)) {
+      SetReadTimeout(PMaxTimeInterval);
+      connection->Unlock();
+      return TRUE;
+    }
+#endif
+
     ((H225TransportThread *)thread)->ConnectionEstablished(keepAlive);
     AttachThread(thread);
     thread->SetNoAutoDelete();
@@ -1536,6 +1584,7 @@ H323TransportTCP::H323TransportTCP(H323EndPoint & end,
 #endif
 {
   h245listener = NULL;
+  readBufferStart = readBufferEnd = 0;
 
   // construct listener socket if required
   if (listen) {
@@ -1722,7 +1771,7 @@ PBoolean H323TransportTCP::ExtractPDU(const PBYTEArray & pdu, PINDEX & pduLen)
   // dwarf PDUs are errors
   if (dataLen < 4) {
     PTRACE(1, "H323TCP\tDwarf PDU received (length " << dataLen << ")");
-    return FALSE;
+    return SetErrorValues(Miscellaneous, 0x41000000);
   }
 
   // wait for data to arrive
@@ -1759,61 +1808,204 @@ PBoolean H323TransportTCP::ReadBlock(void * buf, PINDEX len)
 }
 #endif
 
-PBoolean H323TransportTCP::ReadPDU(PBYTEArray & pdu)
+PBoolean H323TransportTCP::TakeBufferedPDU(PBYTEArray & pdu, PBoolean & ok)
 {
-  // Make sure is a RFC1006 TPKT
-  switch (ReadChar()) {
-    case -1 :
-      return FALSE;
+  ok = TRUE;
 
-    case 3 :  // Only support version 3
-      break;
+  PINDEX pduLen = readBufferEnd - readBufferStart;
+  if (pduLen == 0)
+    return FALSE;
+
+  // Look at the buffered data in place
+  PBYTEArray buffered(readBuffer.GetPointer()+readBufferStart, pduLen, FALSE);
+  ok = ExtractPDU(buffered, pduLen);
+  if (!ok) {
+    // Lost PDU alignment, the bad bytes must not be looked at again
+    readBufferStart = readBufferEnd = 0;
+    return FALSE;
+  }
+  if (pduLen == 0)
+    return FALSE;
+
+  PINDEX dataLen = pduLen - 4;
+  pdu.SetSize(dataLen);
+  if (dataLen > 0)
+    memcpy(pdu.GetPointer(), readBuffer.GetPointer()+readBufferStart+4, dataLen);
+  lastReadCount = dataLen;
 
-    default :  // Unknown version number
-      return SetErrorValues(Miscellaneous, 0x41000000);
+  readBufferStart += pduLen;
+  if (readBufferStart == readBufferEnd) {
+    readBufferStart = readBufferEnd = 0;
+
+    // Do not hang on to the space used by an unusually large PDU
+    if (readBuffer.GetSize() > 4*TPKT_READ_BUFFER_SIZE)
+      readBuffer.SetSize(TPKT_READ_BUFFER_SIZE);
   }
 
-  // Save timeout
+  return TRUE;
+}
+
+
+void H323TransportTCP::PrepareReadBuffer()
+{
+  // Move any partial PDU to the front of the buffer
+  if (readBufferStart > 0) {
+    memmove(readBuffer.GetPointer(), readBuffer.GetPointer()+readBufferStart, readBufferEnd - readBufferStart);
+    readBufferEnd -= readBufferStart;
+    readBufferStart = 0;
+  }
+
+  // Make sure the whole PDU will fit once the length is known
+  PINDEX bufferSize = TPKT_READ_BUFFER_SIZE;
+  if (readBufferEnd >= 4) {
+    PINDEX packetLength = (readBuffer[2] << 8)|readBuffer[3];
+    if (packetLength > bufferSize)
+      bufferSize = packetLength;
+  }
+  if (readBuffer.GetSize() < bufferSize)
+    readBuffer.SetSize(bufferSize);
+}
+
+
+PBoolean H323TransportTCP::ReadPDU(PBYTEArray & pdu)
+{
   PTimeInterval oldTimeout = GetReadTimeout();
+  PBoolean timeoutChanged = FALSE;
+  PBoolean ok;
 
-  // Should get all of PDU in 5 seconds or something is seriously wrong,
-  SetReadTimeout(5000);
-
-  // Get TPKT length
-  BYTE header[3];
-  PBoolean ok = ReadBlock(header, sizeof(header));
-  if (ok) {
-    PINDEX packetLength = ((header[1] << 8)|header[2]);
-    if (packetLength < 4) {
-      PTRACE(1, "H323TCP\tDwarf PDU received (length " << packetLength << ")");
-      ok = FALSE;
-    } else {
-      packetLength -= 4;
-      ok = ReadBlock(pdu.GetPointer(packetLength), packetLength);
+  for (;;) {
+    if (TakeBufferedPDU(pdu, ok) || !ok)
+      break;
+
+    PrepareReadBuffer();
+
+    // Should get all of PDU in 5 seconds once it has started,
+    // or something is seriously wrong
+    if (readBufferEnd > 0 && !timeoutChanged) {
+      SetReadTimeout(5000);
+      timeoutChanged = TRUE;
+    }
+
+    ok = Read(readBuffer.GetPointer()+readBufferEnd, readBuffer.GetSize()-readBufferEnd) && GetLastReadCount() > 0;
+    if (!ok) {
+      // Lost PDU alignment, discard any partial PDU
+      readBufferStart = readBufferEnd = 0;
+      break;
     }
+
+    readBufferEnd += GetLastReadCount();
   }
 
-  SetReadTimeout(oldTimeout);
+  if (timeoutChanged)
+    SetReadTimeout(oldTimeout);
 
   return ok;
 }
 
 
+#ifdef H323_SIGNAL_REACTOR
+PBoolean H323TransportTCP::PollPDU(PBYTEArray & pdu, PBoolean & complete)
+{
+  complete = FALSE;
+
+  for (;;) {
+    PBoolean ok;
+    if (TakeBufferedPDU(pdu, ok)) {
+      complete = TRUE;
+      return TRUE;
+    }
+    if (!ok)
+      return FALSE;
+
+    PChannel * channel = GetBaseReadChannel();
+    if (channel == NULL || !channel->IsOpen())
+      return SetErrorValues(NotOpen, EBADF, LastReadError);
+
+    PrepareReadBuffer();
+
+    ssize_t count = ::recv(channel->GetHandle(), readBuffer.GetPointer()+readBufferEnd,
+                           readBuffer.GetSize()-readBufferEnd, MSG_DONTWAIT);
+    if (count > 0) {
+      readBufferEnd += count;
+      continue;
+    }
+
+    if (count < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return TRUE;
+    }
+
+    // Closed by the remote or failed, discard any partial PDU
+    readBufferStart = readBufferEnd = 0;
+    if (count == 0)
+      return SetErrorValues(NotOpen, 0, LastReadError);
+    return ConvertOSError(-1, LastReadError);
+  }
+}
+#endif
+
+
 PBoolean H323TransportTCP::WritePDU(const PBYTEArray & pdu)
 {
-  // We copy the data into a new buffer so we can do a single write call. This
-  // is necessary as we have disabled the Nagle TCP delay algorithm to improve
+  // The header and the PDU go out in a single write call. This is
+  // necessary as we have disabled the Nagle TCP delay algorithm to improve
   // network performance.
 
   int packetLength = pdu.GetSize() + 4;
 
   // Send RFC1006 TPKT length
+  BYTE header[4];
+  header[0] = 3;
+  header[1] = 0;
+  header[2] = (BYTE)(packetLength >> 8);
+  header[3] = (BYTE)packetLength;
+
+  return WriteTPKT(header, pdu);
+}
+
+
+PBoolean H323TransportTCP::WriteTPKT(const BYTE * header, const PBYTEArray & pdu)
+{
+  PINDEX pduSize = pdu.GetSize();
+
+#ifndef _WIN32
+  // Plain sockets can take the header and the PDU without copying them
+  PChannel * channel = GetWriteChannel();
+  if (!IsTransportSecure() && channel != NULL && PIsDescendant(channel, PTCPSocket)) {
+    struct iovec vectors[2];
+    vectors[0].iov_base = (void *)header;
+    vectors[0].iov_len  = 4;
+    vectors[1].iov_base = (void *)(const BYTE *)pdu;
+    vectors[1].iov_len  = pduSize;
+
+    ssize_t sent = ::writev(channel->GetHandle(), vectors, 2);
+    if (sent == (ssize_t)(pduSize+4)) {
+      lastWriteCount = sent;
+      return TRUE;
+    }
+
+    if (sent < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        return ConvertOSError(-1, LastWriteError);
+      sent = 0;
+    }
+
+    // Socket buffer is full, let the channel wait and write the rest
+    if (sent < 4 && !Write(header+sent, 4-sent))
+      return FALSE;
+
+    PINDEX offset = sent > 4 ? (PINDEX)(sent-4) : 0;
+    return Write((const BYTE *)pdu+offset, pduSize-offset);
+  }
+#endif
+
+  // Otherwise copy into a new buffer so we can do a single write call
+  PINDEX packetLength = pduSize + 4;
   PBYTEArray tpkt(packetLength);
-  tpkt[0] = 3;
-  tpkt[1] = 0;
-  tpkt[2] = (BYTE)(packetLength >> 8);
-  tpkt[3] = (BYTE)packetLength;
-  memcpy(tpkt.GetPointer()+4, (const BYTE *)pdu, pdu.GetSize());
+  memcpy(tpkt.GetPointer(), header, 4);
+  memcpy(tpkt.GetPointer()+4, (const BYTE *)pdu, pduSize);
 
   return Write((const BYTE *)tpkt, packetLength);
 }